@@ -4,19 +4,30 @@
 
 include Config.mk
 
-OBJS		:=	src/config.o \
+OBJS		:=	src/audio/devicesink.o \
+			src/audio/nullsink.o \
+			src/audio/wavsink.o \
+			src/audiotelemetry.o \
+			src/bootgraph.o \
+			src/config.o \
 			src/control/control.o \
 			src/control/mister.o \
 			src/control/rotaryencoder.o \
 			src/control/simplebuttons.o \
 			src/control/simpleencoder.o \
+			src/coreexecutor.o \
+			src/coreload.o \
+			src/crossfader.o \
+			src/jobsystem.o \
 			src/kernel.o \
+			src/latencycontroller.o \
 			src/lcd/drivers/hd44780.o \
 			src/lcd/drivers/hd44780fourbit.o \
 			src/lcd/drivers/hd44780i2c.o \
 			src/lcd/drivers/sh1106.o \
 			src/lcd/drivers/ssd1306.o \
 			src/lcd/ui.o \
+			src/limiter.o \
 			src/main.o \
 			src/midimonitor.o \
 			src/midiparser.o \
@@ -25,15 +36,29 @@ OBJS		:=	src/config.o \
 			src/net/ftpdaemon.o \
 			src/net/ftpworker.o \
 			src/net/udpmidi.o \
+			src/pcmconverter.o \
 			src/pisound.o \
 			src/power.o \
+			src/renderworker.o \
+			src/resampler.o \
 			src/rommanager.o \
 			src/soundfontmanager.o \
+			src/synth/effectspipeline.o \
+			src/synth/effectsunit.o \
 			src/synth/mt32synth.o \
+			src/synth/polyphonygovernor.o \
+			src/synth/samplecache.o \
+			src/synth/sampledecoder.o \
+			src/synth/soundfontcache.o \
+			src/synth/soundfontcompiler.o \
+			src/synth/soundfontimage.o \
+			src/synth/soundfontloader.o \
 			src/synth/soundfontsynth.o \
+			src/synth/synthbase.o \
 			src/zoneallocator.o
 
 EXTRACLEAN	+=	src/*.d src/*.o \
+			src/audio/*.d src/audio/*.o \
 			src/control/*.d src/control/*.o \
 			src/lcd/*.d src/lcd/*.o \
 			src/lcd/drivers/*.d src/lcd/drivers/*.o \
@@ -48,10 +73,23 @@ INCLUDE		+=	-I $(INIHHOME)
 EXTRACLEAN	+=	$(INIHHOME)/ini.d \
 			$(INIHHOME)/ini.o
 
+#
+# stb_vorbis (SF3 sample decoding)
+#
+OBJS		+=	$(STBHOME)/stb_vorbis.o
+INCLUDE		+=	-I $(STBHOME)
+EXTRACLEAN	+=	$(STBHOME)/stb_vorbis.d \
+			$(STBHOME)/stb_vorbis.o
+
 include $(CIRCLEHOME)/Rules.mk
 
 CFLAGS		+=	-Werror -Wextra -Wno-unused-parameter
 
+# Only decoding from memory is needed; the warnings stb_vorbis raises under our settings are silenced individually, so
+# anything new still fails the build
+$(STBHOME)/stb_vorbis.o: CFLAGS += -Wno-sign-compare -Wno-type-limits -Wno-unused-variable -Wno-unused-but-set-variable \
+			-Wno-maybe-uninitialized -D STB_VORBIS_NO_PUSHDATA_API -D STB_VORBIS_NO_STDIO
+
 CFLAGS		+=	-I "$(NEWLIBDIR)/include" \
 			-I $(STDDEF_INCPATH) \
 			-I $(CIRCLESTDLIBHOME)/include \
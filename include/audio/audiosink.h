@@ -0,0 +1,70 @@
+//
+// audiosink.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef _audiosink_h
+#define _audiosink_h
+
+#include <circle/types.h>
+
+#include "pcmconverter.h"
+
+// Destination for rendered audio; consumes interleaved stereo frames from a queue
+class CAudioSink
+{
+public:
+	CAudioSink(unsigned int nSampleRate, size_t nChunkFrames)
+		: m_nSampleRate(nSampleRate),
+		  m_nChunkFrames(nChunkFrames)
+	{
+	}
+
+	virtual ~CAudioSink() = default;
+
+	// Queue will be at least as large as requested, but may be larger
+	virtual bool Initialize(size_t nMinQueueSizeFrames) = 0;
+	virtual bool Start() = 0;
+	virtual void Cancel() = 0;
+
+	virtual PCMConverter::TFormat GetFormat() const = 0;
+	virtual size_t GetQueueSizeFrames() const = 0;
+	virtual size_t GetQueueFramesAvail() const = 0;
+
+	// Whether the queue drains in real time, i.e. render deadlines and underruns are meaningful
+	virtual bool IsRealTime() const = 0;
+
+	// Blocks until some queued frames may have been consumed
+	virtual void WaitForSpace() {}
+
+	// Returns the number of frames accepted
+	virtual size_t Write(const void* pData, size_t nFrames) = 0;
+
+	unsigned int GetSampleRate() const { return m_nSampleRate; }
+
+	// Frames consumed from the queue at a time
+	size_t GetChunkFrames() const { return m_nChunkFrames; }
+
+protected:
+	unsigned int m_nSampleRate;
+	size_t m_nChunkFrames;
+};
+
+#endif
@@ -0,0 +1,67 @@
+//
+// devicesink.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef _devicesink_h
+#define _devicesink_h
+
+#include <circle/i2cmaster.h>
+#include <circle/interrupt.h>
+#include <circle/sound/soundbasedevice.h>
+#include <circle/types.h>
+
+#include "audio/audiosink.h"
+#include "config.h"
+
+// Audio sink backed by one of Circle's DMA-driven sound devices
+class CSoundDeviceSink : public CAudioSink
+{
+public:
+	CSoundDeviceSink(CInterruptSystem* pInterrupt, CConfig::TAudioOutputDevice Device, unsigned int nSampleRate, unsigned int nChunkSize, bool bI2SSlave = false, CI2CMaster* pI2CMaster = nullptr);
+	virtual ~CSoundDeviceSink() override;
+
+	// CAudioSink
+	virtual bool Initialize(size_t nMinQueueSizeFrames) override;
+	virtual bool Start() override;
+	virtual void Cancel() override;
+
+	virtual PCMConverter::TFormat GetFormat() const override;
+	virtual size_t GetQueueSizeFrames() const override { return m_pSound->GetQueueSizeFrames(); }
+	virtual size_t GetQueueFramesAvail() const override { return m_pSound->GetQueueFramesAvail(); }
+
+	virtual bool IsRealTime() const override { return true; }
+	virtual void WaitForSpace() override;
+
+	virtual size_t Write(const void* pData, size_t nFrames) override;
+
+private:
+	static unsigned int GetChunkSize(CConfig::TAudioOutputDevice Device, unsigned int nChunkSize);
+	static void NeedDataHandler(void* pParam);
+
+	CInterruptSystem* m_pInterrupt;
+	CConfig::TAudioOutputDevice m_Device;
+	bool m_bI2SSlave;
+	CI2CMaster* m_pI2CMaster;
+
+	CSoundBaseDevice* m_pSound;
+};
+
+#endif
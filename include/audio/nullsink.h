@@ -0,0 +1,55 @@
+//
+// nullsink.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef _nullsink_h
+#define _nullsink_h
+
+#include <circle/types.h>
+
+#include "audio/audiosink.h"
+
+// Discards all audio immediately; the audio task renders as fast as possible, for measuring throughput
+class CNullSink : public CAudioSink
+{
+public:
+	CNullSink(unsigned int nSampleRate, size_t nChunkFrames);
+
+	// CAudioSink
+	virtual bool Initialize(size_t nMinQueueSizeFrames) override;
+	virtual bool Start() override;
+	virtual void Cancel() override;
+
+	virtual PCMConverter::TFormat GetFormat() const override { return PCMConverter::TFormat::S24_Packed; }
+	virtual size_t GetQueueSizeFrames() const override { return m_nQueueSizeFrames; }
+	virtual size_t GetQueueFramesAvail() const override { return m_bRunning ? m_nQueueSizeFrames : 0; }
+
+	virtual bool IsRealTime() const override { return false; }
+	virtual void WaitForSpace() override;
+
+	virtual size_t Write(const void* pData, size_t nFrames) override { return nFrames; }
+
+private:
+	size_t m_nQueueSizeFrames;
+	volatile bool m_bRunning;
+};
+
+#endif
@@ -0,0 +1,81 @@
+//
+// wavsink.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef _wavsink_h
+#define _wavsink_h
+
+#include <circle/string.h>
+#include <circle/types.h>
+#include <fatfs/ff.h>
+
+#include <atomic>
+
+#include "audio/audiosink.h"
+
+// Streams audio to a 24-bit stereo WAV file as fast as it can be written. The audio task only copies frames into a
+// ring buffer; the file is written by a task on core 0, as FatFs and the storage drivers may only be used there.
+class CWAVSink : public CAudioSink
+{
+public:
+	CWAVSink(unsigned int nSampleRate, size_t nChunkFrames, const char* pPath);
+	virtual ~CWAVSink() override;
+
+	// CAudioSink
+	virtual bool Initialize(size_t nMinQueueSizeFrames) override;
+	virtual bool Start() override;
+	virtual void Cancel() override;
+
+	virtual PCMConverter::TFormat GetFormat() const override { return PCMConverter::TFormat::S24_Packed; }
+	virtual size_t GetQueueSizeFrames() const override { return m_nBufferFrames; }
+	virtual size_t GetQueueFramesAvail() const override;
+
+	virtual bool IsRealTime() const override { return false; }
+	virtual void WaitForSpace() override;
+
+	virtual size_t Write(const void* pData, size_t nFrames) override;
+
+private:
+	class CWriterTask;
+
+	// Writer task (core 0); returns false if there was nothing to write
+	bool Flush();
+	bool WriteHeader();
+
+	CString m_Path;
+	FIL m_File;
+	bool m_bFileOpen;
+	volatile bool m_bRunning;
+	volatile bool m_bStopWriter;
+	volatile bool m_bWriterRunning;
+
+	// Frames are written by the audio task and flushed to the file by the writer task; both counts only ever increase
+	u8* m_pBuffer;
+	size_t m_nBufferFrames;
+	std::atomic<size_t> m_nWrittenFrames;
+	std::atomic<size_t> m_nFlushedFrames;
+
+	u32 m_nDataBytes;
+	u32 m_nUnsyncedFrames;
+	bool m_bWriteFailed;
+};
+
+#endif
@@ -0,0 +1,85 @@
+//
+// audiotelemetry.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef _audiotelemetry_h
+#define _audiotelemetry_h
+
+#include <circle/types.h>
+
+#include <atomic>
+
+#include "synth/synth.h"
+
+// Collects per-block timing statistics on the audio core, and makes consistent snapshots of them available to other cores.
+class CAudioTelemetry
+{
+public:
+	// Bucket N counts blocks that took [2^N, 2^(N+1)) microseconds to render; the last bucket is open-ended
+	static constexpr size_t HistogramBuckets = 16;
+	static constexpr size_t SynthCount = static_cast<size_t>(TSynth::SoundFont) + 1;
+
+	// Pass as deadline for blocks written to a sink that doesn't drain in real time
+	static constexpr unsigned int NoDeadline = static_cast<unsigned int>(-1);
+
+	struct TStats
+	{
+		u32 nBlocks;
+
+		// Time taken to render a block
+		u32 nLastRenderMicros;
+		u32 nWorstRenderMicros;
+
+		// Time remaining before the sound queue would have run dry once the block was rendered
+		u32 nLastSlackMicros;
+		u32 nWorstSlackMicros;
+
+		// Blocks that took longer to render than the audio remaining in the queue
+		u32 nDeadlineMisses;
+
+		u32 RenderHistogram[HistogramBuckets];
+
+		// Portion of the render time spent in the master bus limiter
+		u32 nLastLimiterMicros;
+		u32 nWorstLimiterMicros;
+
+		// Per-synth counts of the sound queue having run dry, and of audio being dropped by the sound device
+		u32 Underruns[SynthCount];
+		u32 ShortWrites[SynthCount];
+	};
+
+	CAudioTelemetry();
+
+	// Audio core only
+	void EnableCycleCounter();
+	static u32 GetCycleCount();
+	u32 RecordBlock(TSynth Synth, u32 nRenderCycles, u32 nLimiterCycles, unsigned int nDeadlineMicros, bool bUnderrun, bool bShortWrite);
+
+	// Any core
+	void GetStats(TStats& OutStats) const;
+
+private:
+	// Sequence lock; odd while the audio core is updating the statistics
+	std::atomic<u32> m_nSequence;
+	TStats m_Stats;
+};
+
+#endif
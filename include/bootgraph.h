@@ -0,0 +1,91 @@
+//
+// bootgraph.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef _bootgraph_h
+#define _bootgraph_h
+
+#include <circle/types.h>
+
+#include <atomic>
+
+class CJobSystem;
+
+// Runs boot stages as a dependency graph across all CPU cores. Stages that touch devices or storage must stay on core 0
+// (where Circle's drivers, interrupts and scheduler live); the rest are picked up by whichever core is free first.
+class CBootGraph
+{
+public:
+	using TFunction = void (*)(void* pParam);
+	using TStageMask = u32;
+
+	static constexpr size_t MaxStages = 16;
+
+	CBootGraph();
+
+	// Core 0, before Run(); returns a mask identifying the stage, to be used as a dependency of later stages
+	TStageMask AddStage(const char* pName, TFunction pFunction, void* pParam, TStageMask Dependencies = 0, bool bAnyCore = false);
+
+	// Any core, once all stages have been added; returns once every stage has completed. Runs jobs from pJobSystem, if
+	// given, while there's no stage to run (e.g. SF3 samples being decoded by a stage on core 0)
+	void Run(unsigned nCore, CJobSystem* pJobSystem = nullptr);
+
+	// Core 0, once all stages have been added; runs every stage in a new task, yielding to other tasks in between
+	void RunInBackground();
+	bool IsDone() const;
+
+	// Core 0, after Run(); logs when each stage ran, and the chain of stages that determined the total boot time
+	void LogTimings() const;
+
+private:
+	enum class TState : u8
+	{
+		Pending,
+		Running,
+		Done,
+	};
+
+	struct TStage
+	{
+		const char* pName;
+		TFunction pFunction;
+		void* pParam;
+		TStageMask Dependencies;
+		bool bAnyCore;
+
+		std::atomic<TState> State;
+		unsigned nCore;
+		unsigned nStartTicks;
+		unsigned nEndTicks;
+	};
+
+	class CBackgroundTask;
+
+	bool RunNextStage(unsigned nCore);
+
+	TStage m_Stages[MaxStages];
+	size_t m_nStages;
+	unsigned m_nStartTicks;
+
+	std::atomic<TStageMask> m_DoneMask;
+};
+
+#endif
@@ -42,13 +42,27 @@ public:
 	#define ENUM_AUDIOOUTPUTDEVICE(ENUM) \
 		ENUM(PWM, pwm)                   \
 		ENUM(HDMI, hdmi)                 \
-		ENUM(I2S, i2s)
+		ENUM(I2S, i2s)                   \
+		ENUM(Null, null)                 \
+		ENUM(WAV, wav)
+
+	#define ENUM_MT32EMUSECONDINPUT(ENUM) \
+		ENUM(USBCable, usb_cable)         \
+		ENUM(UDP, udp)                    \
+		ENUM(Serial, serial)
+
+	#define ENUM_MT32EMUSECONDOUTPUT(ENUM) \
+		ENUM(Mix, mix)                     \
+		ENUM(Split, split)
 
 	#define ENUM_CONTROLSCHEME(ENUM)        \
 		ENUM(None, none)                    \
 		ENUM(SimpleButtons, simple_buttons) \
 		ENUM(SimpleEncoder, simple_encoder)
 
+	// Bit N set for MIDI channel N+1
+	using TMIDIChannelMask         = u16;
+
 	using TEncoderType             = CRotaryEncoder::TEncoderType;
 
 	using TMT32EmuResamplerQuality = CMT32Synth::TResamplerQuality;
@@ -72,6 +86,8 @@ public:
 
 	CONFIG_ENUM(TSystemDefaultSynth, ENUM_SYSTEMDEFAULTSYNTH);
 	CONFIG_ENUM(TAudioOutputDevice, ENUM_AUDIOOUTPUTDEVICE);
+	CONFIG_ENUM(TMT32EmuSecondInput, ENUM_MT32EMUSECONDINPUT);
+	CONFIG_ENUM(TMT32EmuSecondOutput, ENUM_MT32EMUSECONDOUTPUT);
 	CONFIG_ENUM(TControlScheme, ENUM_CONTROLSCHEME);
 	CONFIG_ENUM(TLCDType, ENUM_LCDTYPE);
 	CONFIG_ENUM(TNetworkMode, ENUM_NETWORKMODE);
@@ -91,11 +107,14 @@ public:
 	static bool ParseOption(const char* pString, float* pOutFloat);
 	static bool ParseOption(const char *pString, CString* pOut);
 	static bool ParseOption(const char *pString, CIPAddress* pOut);
+	static bool ParseOption(const char* pString, TMIDIChannelMask* pOut);
 	static bool ParseOption(const char* pString, TSystemDefaultSynth* pOut);
 	static bool ParseOption(const char* pString, TAudioOutputDevice* pOut);
 	static bool ParseOption(const char* pString, TMT32EmuResamplerQuality* pOut);
 	static bool ParseOption(const char* pString, TMT32EmuMIDIChannels* pOut);
 	static bool ParseOption(const char* pString, TMT32EmuROMSet* pOut);
+	static bool ParseOption(const char* pString, TMT32EmuSecondInput* pOut);
+	static bool ParseOption(const char* pString, TMT32EmuSecondOutput* pOut);
 	static bool ParseOption(const char* pString, TLCDType* pOut);
 	static bool ParseOption(const char* pString, TControlScheme* pOut);
 	static bool ParseOption(const char* pString, TEncoderType* pOut);
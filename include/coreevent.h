@@ -0,0 +1,70 @@
+//
+// coreevent.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef _coreevent_h
+#define _coreevent_h
+
+// Core-to-core wake-up primitives. Built for the host (MT32_PI_HOST; see tools/hosttests) they stand in for threads,
+// so that lock-free code built on them can be tested without Circle.
+#ifdef MT32_PI_HOST
+#include <thread>
+#else
+#include <circle/multicore.h>
+#include <circle/sysconfig.h>
+#include <circle/timer.h>
+#endif
+
+#include <atomic>
+#include <stdint.h>
+
+namespace Utility
+{
+#ifndef MT32_PI_HOST
+	// Time each core has spent sleeping in WaitForCoreEvent(), in microseconds; see CCoreLoad
+	inline std::atomic<uint32_t> CoreIdleMicros[CORES];
+#endif
+
+	// Puts the calling core into a low-power state until an event is signalled by another core (or an interrupt)
+	inline void WaitForCoreEvent()
+	{
+#ifdef MT32_PI_HOST
+		// Callers always re-check their condition, so just give other threads a chance to run
+		std::this_thread::yield();
+#else
+		const unsigned int nStartTicks = CTimer::GetClockTicks();
+		asm volatile ("wfe" ::: "memory");
+		CoreIdleMicros[CMultiCoreSupport::ThisCore()].fetch_add(CTimer::GetClockTicks() - nStartTicks, std::memory_order_relaxed);
+#endif
+	}
+
+	// Wakes any cores sleeping in WaitForCoreEvent(); prior memory writes are visible to them on wake-up
+	inline void SignalCoreEvent()
+	{
+#ifdef MT32_PI_HOST
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+#else
+		asm volatile ("dsb sy\n\tsev" ::: "memory");
+#endif
+	}
+}
+
+#endif
@@ -0,0 +1,76 @@
+//
+// coreexecutor.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef _coreexecutor_h
+#define _coreexecutor_h
+
+#include <circle/types.h>
+
+#include <atomic>
+
+// Minimal fork/join primitive for bare metal: runs one function at a time on a dedicated CPU core on behalf of other cores.
+// Stands in for threads where a library expects to be able to create them (e.g. FluidSynth's mixer).
+class CCoreExecutor
+{
+public:
+	using TFunction = void (*)(void* pParam);
+
+	CCoreExecutor();
+
+	// Any core; Launch() fails if a previous function hasn't been joined yet, or if the executor core is busy with other
+	// work (unless asked to wait for it), so that the caller can do the work itself rather than wait behind it
+	bool Launch(TFunction pFunction, void* pParam, bool bWaitWhileBusy = false);
+	void Join();
+
+	// Executor core; services launches until bRunning becomes false
+	void Run(const volatile bool& bRunning);
+
+	// Executor core; runs the launched function if there is one, for cores that also have other work
+	bool RunPending();
+
+	// Executor core; brackets other work, during which launches fail. BeginOtherWork() fails if a launch is under way.
+	bool BeginOtherWork();
+	void EndOtherWork();
+
+private:
+	static constexpr size_t CacheLineSize = 64;
+
+	enum TState : u32
+	{
+		Idle,
+		Claimed,
+		Pending,
+		Busy,
+	};
+
+	// Written by the launching core while it holds the claim
+	TFunction m_pFunction;
+	void* m_pParam;
+
+	// Idle -> Claimed -> Pending -> Idle for a launch (the function runs while Pending), Idle -> Busy -> Idle for other work
+	alignas(CacheLineSize) std::atomic<u32> m_State;
+
+	// Set by a launcher waiting for other work to finish, so that EndOtherWork() only signals when it needs to
+	std::atomic<bool> m_bLaunchWaiting;
+};
+
+#endif
@@ -0,0 +1,48 @@
+//
+// coreload.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef _coreload_h
+#define _coreload_h
+
+#include <circle/multicore.h>
+#include <circle/types.h>
+
+// Per-core utilization. Cores count as idle while sleeping in Utility::WaitForCoreEvent(), and busy otherwise.
+class CCoreLoad
+{
+public:
+	CCoreLoad();
+
+	// Calling core; generates a wake-up event roughly every nPeriodMicros (rounded down to a power of two timer ticks)
+	// so that loops polling timers can sleep between polls
+	static void EnablePeriodicWakeup(unsigned int nPeriodMicros);
+
+	// One core only; percentage of time each core was busy since the previous call
+	void GetUtilization(u8 (&OutPercent)[CORES]);
+
+private:
+	unsigned int m_nLastTicks;
+	u32 m_nLastIdleMicros[CORES];
+};
+
+#endif
@@ -0,0 +1,72 @@
+//
+// crossfader.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef _crossfader_h
+#define _crossfader_h
+
+#include <circle/types.h>
+
+#include <atomic>
+
+#include "synth/synth.h"
+
+// Click-free transitions between synths: each synth's output is scaled by a gain that ramps towards a target.
+// Targets are set from the main core; gains are advanced on the audio core as each synth's output is mixed.
+// Slots are normally indexed by synth, but can also be indexed directly (e.g. for engines within one synth).
+class CCrossfader
+{
+public:
+	static constexpr size_t SlotCount = 2;
+
+	CCrossfader();
+
+	void Initialize(unsigned int nSampleRate, unsigned int nFadeMillis);
+	unsigned int GetFadeMillis() const { return m_nFadeMillis; }
+
+	// Main core; Reset() jumps straight to the target and must only be used while the slot isn't being rendered
+	void SetAudible(size_t nSlot, bool bAudible);
+	void Reset(size_t nSlot, bool bAudible);
+	bool IsSettled(size_t nSlot) const;
+
+	// Audio core; a slot needs rendering while it is audible or fading out
+	bool IsAudible(size_t nSlot) const;
+	void Apply(size_t nSlot, float* pBuffer, size_t nFrames);
+	void Mix(size_t nSlot, const float* pInBuffer, float* pOutBuffer, size_t nFrames);
+
+	void SetAudible(TSynth Synth, bool bAudible) { SetAudible(static_cast<size_t>(Synth), bAudible); }
+	void Reset(TSynth Synth, bool bAudible) { Reset(static_cast<size_t>(Synth), bAudible); }
+	bool IsSettled(TSynth Synth) const { return IsSettled(static_cast<size_t>(Synth)); }
+	bool IsAudible(TSynth Synth) const { return IsAudible(static_cast<size_t>(Synth)); }
+	void Apply(TSynth Synth, float* pBuffer, size_t nFrames) { Apply(static_cast<size_t>(Synth), pBuffer, nFrames); }
+	void Mix(TSynth Synth, const float* pInBuffer, float* pOutBuffer, size_t nFrames) { Mix(static_cast<size_t>(Synth), pInBuffer, pOutBuffer, nFrames); }
+
+private:
+	void Process(size_t nSlot, const float* pInBuffer, float* pOutBuffer, size_t nFrames, bool bAccumulate);
+
+	unsigned int m_nFadeMillis;
+	float m_nStep;
+
+	std::atomic<bool> m_bTargets[SlotCount];
+	std::atomic<float> m_nGains[SlotCount];
+};
+
+#endif
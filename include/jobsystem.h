@@ -0,0 +1,100 @@
+//
+// jobsystem.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef _jobsystem_h
+#define _jobsystem_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#include "workstealingdeque.h"
+
+// Small job system for spare CPU time on cores that aren't otherwise busy. Each core has a work-stealing deque per
+// priority; cores run their own jobs first, then steal from the others. Jobs must be short, as a core only looks for
+// more urgent work between jobs. Only depends on atomics and core events, so it can be tested on a host with threads
+// standing in for cores (see tools/hosttests).
+class CJobSystem
+{
+public:
+	using TFunction = void (*)(void* pParam);
+
+	enum class TPriority : uint8_t
+	{
+		Critical,
+		Background,
+	};
+
+	// Fork/join counter; counts jobs submitted against it that haven't finished yet
+	class CCounter
+	{
+	public:
+		CCounter() : m_nPending(0) {}
+
+		bool IsDone() const { return m_nPending.load(std::memory_order_acquire) == 0; }
+
+	private:
+		friend class CJobSystem;
+		std::atomic<uint32_t> m_nPending;
+	};
+
+	// Owned by the submitter; must stay alive until the job has finished
+	struct TJob
+	{
+		TFunction pFunction;
+		void* pParam;
+		CCounter* pCounter;
+	};
+
+	static constexpr size_t MaxCores = 4;
+	static constexpr size_t QueueSize = 64;
+
+	CJobSystem();
+	~CJobSystem();
+
+	// Calling core only; if its queue is full, the job is run immediately instead
+	void Submit(unsigned nCore, TJob& Job, TPriority Priority = TPriority::Background);
+
+	// Runs one job of at least the given priority, if any; more urgent jobs are always taken first
+	bool RunOne(unsigned nCore, TPriority LowestPriority = TPriority::Background);
+
+	// Returns once all jobs counted by Counter have finished, running other jobs in the meantime
+	void Wait(unsigned nCore, const CCounter& Counter, TPriority LowestPriority = TPriority::Background);
+
+	// Worker loop; sleeps while there's nothing to do
+	void Run(unsigned nCore, const volatile bool& bRunning, TPriority LowestPriority = TPriority::Background);
+
+	static CJobSystem* Get() { return s_pThis; }
+
+private:
+	static constexpr size_t PriorityCount = static_cast<size_t>(TPriority::Background) + 1;
+
+	static void Execute(TJob* pJob);
+
+	CWorkStealingDeque<TJob*, QueueSize> m_Queues[MaxCores][PriorityCount];
+
+	static CJobSystem* s_pThis;
+};
+
+#endif
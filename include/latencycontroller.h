@@ -0,0 +1,53 @@
+//
+// latencycontroller.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef _latencycontroller_h
+#define _latencycontroller_h
+
+#include <circle/types.h>
+
+// Adjusts the number of frames kept in the sound queue based on how long each block takes to render
+// relative to the time left before the queue runs dry.
+class CLatencyController
+{
+public:
+	CLatencyController(unsigned int nSampleRate, size_t nMinFrames, size_t nMaxFrames, unsigned int nSafetyMarginMicros);
+
+	size_t GetTargetFrames() const { return m_nTargetFrames; }
+	void Update(size_t nQueuedFrames, size_t nRenderedFrames, unsigned int nRenderMicros);
+
+private:
+	unsigned int FramesToMicros(size_t nFrames) const;
+
+	// Amount of consistent headroom required before reducing latency
+	static constexpr unsigned int ShrinkHoldMillis = 1000;
+
+	unsigned int m_nSampleRate;
+	size_t m_nMinFrames;
+	size_t m_nMaxFrames;
+	unsigned int m_nSafetyMarginMicros;
+
+	size_t m_nTargetFrames;
+	size_t m_nHeadroomFrames;
+};
+
+#endif
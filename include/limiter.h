@@ -0,0 +1,70 @@
+//
+// limiter.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef _limiter_h
+#define _limiter_h
+
+#include <circle/types.h>
+
+// Master bus look-ahead peak limiter with a soft-knee clipper as a safety net; operates on interleaved stereo
+class CLimiter
+{
+public:
+	CLimiter(unsigned int nSampleRate, float nThresholdDB);
+	~CLimiter();
+
+	bool Initialize(size_t nMaxFrames);
+
+	// Processes in-place; output is delayed by the look-ahead time
+	void Process(float* pBuffer, size_t nFrames);
+
+	size_t GetLatencyFrames() const { return m_nLookAheadFrames; }
+
+private:
+	void ComputeGains(size_t nFrames);
+	void ApplyGains(float* pBuffer, size_t nFrames);
+
+	static constexpr float LookAheadMillis = 1.0f;
+	static constexpr float ReleaseMillis   = 100.0f;
+
+	float m_nThreshold;
+	float m_nReleaseCoefficient;
+	size_t m_nLookAheadFrames;
+	size_t m_nMaxFrames;
+
+	// Input delayed by the look-ahead time, followed by the current block
+	float* m_pDelayBuffer;
+
+	// Per-frame peak levels and gains for the current block
+	float* m_pPeaks;
+	float* m_pGains;
+
+	// Envelope follower state
+	float m_nEnvelope;
+	size_t m_nHoldFrames;
+
+	// Moving average of the last look-ahead frames' worth of gains
+	float* m_pGainHistory;
+	size_t m_nGainHistoryIndex;
+};
+
+#endif
@@ -30,11 +30,13 @@ class CMIDIParser
 public:
 	CMIDIParser();
 
-	void ParseMIDIBytes(const u8* pData, size_t nSize, bool bIgnoreNoteOns = false);
+	// The timestamp is the time the bytes were received (CTimer::GetClockTicks()); each message is given that of its
+	// last byte
+	void ParseMIDIBytes(const u8* pData, size_t nSize, unsigned int nTimestamp, bool bIgnoreNoteOns = false);
 
 protected:
-	virtual void OnShortMessage(u32 nMessage) = 0;
-	virtual void OnSysExMessage(const u8* pData, size_t nSize) = 0;
+	virtual void OnShortMessage(u32 nMessage, unsigned int nTimestamp) = 0;
+	virtual void OnSysExMessage(const u8* pData, size_t nSize, unsigned int nTimestamp) = 0;
 
 	virtual void OnUnexpectedStatus();
 	virtual void OnSysExOverflow();
@@ -58,6 +60,7 @@ private:
 	TState m_State;
 	u8 m_MessageBuffer[SysExBufferSize];
 	size_t m_nMessageLength;
+	unsigned int m_nTimestamp;
 };
 
 #endif
@@ -35,7 +35,6 @@
 #include <circle/multicore.h>
 #include <circle/net/netsubsystem.h>
 #include <circle/sched/scheduler.h>
-#include <circle/sound/soundbasedevice.h>
 #include <circle/spimaster.h>
 #include <circle/timer.h>
 #include <circle/types.h>
@@ -47,10 +46,20 @@
 #include <wlan/bcm4343.h>
 #include <wlan/hostap/wpa_supplicant/wpasupplicant.h>
 
+#include <atomic>
+
+
+#include "audio/audiosink.h"
+#include "audiotelemetry.h"
+#include "bootgraph.h"
 #include "config.h"
 #include "control/control.h"
 #include "control/mister.h"
+#include "coreexecutor.h"
+#include "coreload.h"
+#include "crossfader.h"
 #include "event.h"
+#include "jobsystem.h"
 #include "lcd/ui.h"
 #include "midiparser.h"
 #include "net/applemidi.h"
@@ -58,6 +67,7 @@
 #include "net/udpmidi.h"
 #include "pisound.h"
 #include "power.h"
+#include "renderworker.h"
 #include "ringbuffer.h"
 #include "synth/mt32romset.h"
 #include "synth/mt32synth.h"
@@ -76,6 +86,9 @@ public:
 
 	virtual void Run(unsigned nCore) override;
 
+	// Audio performance statistics; safe to call from any core
+	void GetAudioStats(CAudioTelemetry::TStats& OutStats) const { m_AudioTelemetry.GetStats(OutStats); }
+
 private:
 	enum class TLCDLogType
 	{
@@ -87,6 +100,34 @@ private:
 	};
 
 	static constexpr size_t MIDIRxBufferSize = 2048;
+	static constexpr size_t MIDIRxBatchSize = 256;
+
+	// A received MIDI byte and the time it arrived (CTimer::GetClockTicks())
+	struct TMIDIRxByte
+	{
+		unsigned int nTimestamp;
+		u8 nData;
+	};
+
+	using TMIDIRxBuffer = CRingBuffer<TMIDIRxByte, MIDIRxBufferSize>;
+
+	// Input for the second mt32emu instance; everything it receives goes to that instance only
+	class CSecondMT32Port : public CMIDIParser, public CUDPMIDIHandler
+	{
+	public:
+		CSecondMT32Port(CMT32Pi* pMT32Pi) : m_pMT32Pi(pMT32Pi) {}
+
+		// CUDPMIDIHandler
+		virtual void OnUDPMIDIDataReceived(const u8* pData, size_t nSize) override { ParseMIDIBytes(pData, nSize, CTimer::GetClockTicks()); };
+
+	protected:
+		// CMIDIParser
+		virtual void OnShortMessage(u32 nMessage, unsigned int nTimestamp) override;
+		virtual void OnSysExMessage(const u8* pData, size_t nSize, unsigned int nTimestamp) override;
+
+	private:
+		CMT32Pi* m_pMT32Pi;
+	};
 
 	// CPower
 	virtual void OnEnterPowerSavingMode() override;
@@ -95,35 +136,55 @@ private:
 	virtual void OnUnderVoltageDetected() override;
 
 	// CMIDIParser
-	virtual void OnShortMessage(u32 nMessage) override;
-	virtual void OnSysExMessage(const u8* pData, size_t nSize) override;
+	virtual void OnShortMessage(u32 nMessage, unsigned int nTimestamp) override;
+	virtual void OnSysExMessage(const u8* pData, size_t nSize, unsigned int nTimestamp) override;
 	virtual void OnUnexpectedStatus() override;
 	virtual void OnSysExOverflow() override;
 
-	// CAppleMIDIHandler
-	virtual void OnAppleMIDIDataReceived(const u8* pData, size_t nSize) override { ParseMIDIBytes(pData, nSize); };
+	// CAppleMIDIHandler; network MIDI is parsed by the network tasks as soon as it's received
+	virtual void OnAppleMIDIDataReceived(const u8* pData, size_t nSize) override { ParseMIDIBytes(pData, nSize, CTimer::GetClockTicks()); };
 	virtual void OnAppleMIDIConnect(const CIPAddress* pIPAddress, const char* pName) override;
 	virtual void OnAppleMIDIDisconnect(const CIPAddress* pIPAddress, const char* pName) override;
 
 	// CUDPMIDIHandler
-	virtual void OnUDPMIDIDataReceived(const u8* pData, size_t nSize) override { ParseMIDIBytes(pData, nSize); };
+	virtual void OnUDPMIDIDataReceived(const u8* pData, size_t nSize) override { ParseMIDIBytes(pData, nSize, CTimer::GetClockTicks()); };
 
-	// Initialization
+	// Initialization; boot stages are run by m_BootGraph
+	void InitUSB();
 	bool InitNetwork();
+	void InitPisound();
+	void InitAudio();
+	void InitControls();
+	unsigned int GetRenderRate(int nConfigRenderRate) const;
 	bool InitMT32Synth();
+	CMT32Synth* LoadMT32ROMs(TMT32ROMSet PreferredROMSet);
+	bool OpenMT32Synth(CMT32Synth* pMT32Synth);
 	bool InitSoundFontSynth();
+	void InitSecondMT32Synth();
+	void InitDeferredUSB();
+	void InitDeferredSynths();
 
 	// Tasks for specific CPU cores
 	void MainTask();
 	void UITask();
 	void AudioTask();
+	void AuxRenderTask();
 
 	void UpdateUSB(bool bStartup = false);
 	void UpdateNetwork();
-	void UpdateMIDI();
+	bool UpdateMIDI();
+	bool UpdateSecondMT32MIDI();
+	void UpdateAudioStats();
 	void PurgeMIDIBuffers();
+	void AllSoundOff();
+	void ReleaseNotes(CSynthBase* pSynth);
 	size_t ReceiveSerialMIDI(u8* pOutData, size_t nSize);
+	static void ParseSerialMIDI(CMIDIParser& Parser, const u8* pData, size_t nSize, unsigned int nBaudRate, unsigned int& nLastReadTime, bool bIgnoreNoteOns = false);
+	static void ParseMIDIRxBytes(CMIDIParser& Parser, const TMIDIRxByte* pBytes, size_t nCount, bool bIgnoreNoteOns = false);
+	static bool EnqueueMIDIRxBytes(TMIDIRxBuffer& Buffer, const u8* pData, size_t nSize);
 	bool ParseCustomSysEx(const u8* pData, size_t nSize);
+	void SendSoundFontCacheStatus(size_t nIndex, bool bResident);
+	void SendMIDI(const u8* pData, size_t nSize);
 
 	void ProcessEventQueue();
 	void ProcessButtonEvent(const TButtonEvent& Event);
@@ -133,6 +194,8 @@ private:
 	void SwitchMT32ROMSet(TMT32ROMSet ROMSet);
 	void NextMT32ROMSet();
 	void SwitchSoundFont(size_t nIndex);
+	void CompleteSoundFontSwitch();
+	void UpdateSoundFontSwitch(unsigned int nTicks);
 	void DeferSwitchSoundFont(size_t nIndex);
 	void SetMasterVolume(s32 nVolume);
 
@@ -162,6 +225,7 @@ private:
 	bool m_bNetworkReady;
 	CAppleMIDIParticipant* m_pAppleMIDIParticipant;
 	CUDPMIDIReceiver* m_pUDPMIDIReceiver;
+	CUDPMIDIReceiver* m_pSecondMT32UDPReceiver;
 	CFTPDaemon* m_pFTPDaemon;
 
 	CBcmRandomNumberGenerator m_Random;
@@ -184,6 +248,18 @@ private:
 	size_t m_nDeferredSoundFontSwitchIndex;
 	unsigned m_nDeferredSoundFontSwitchTime;
 
+	// SoundFont switch waiting for FluidSynth to fade out before it can load (multi-core mode); advanced by the main task
+	// so that MIDI keeps flowing meanwhile
+	enum class TSoundFontSwitchState
+	{
+		Idle,
+		FadingOutToLoad,
+	};
+
+	TSoundFontSwitchState m_SoundFontSwitchState;
+	size_t m_nSoundFontSwitchIndex;
+	unsigned int m_nSoundFontSwitchFadeTime;
+
 	// Serial GPIO MIDI
 	bool m_bSerialMIDIAvailable;
 	bool m_bSerialMIDIEnabled;
@@ -196,13 +272,29 @@ private:
 	bool m_bActiveSenseFlag;
 	unsigned m_nActiveSenseTime;
 
+	// Boot stages; the deferred ones run in the background once audio has started
+	CBootGraph m_BootGraph;
+	CBootGraph m_DeferredBootGraph;
+	volatile bool m_bInitialized;
+	bool m_bBootComplete;
 	volatile bool m_bRunning;
 	volatile bool m_bUITaskDone;
+
+	// Counted by the scheduler on core 0, so that the main task can tell whether other tasks still want to run
+	unsigned int m_nTaskSwitches;
+
 	bool m_bLEDOn;
 	unsigned m_nLEDOnTime;
 
 	// Audio output
-	CSoundBaseDevice* m_pSound;
+	CAudioSink* m_pAudioSink;
+	CAudioTelemetry m_AudioTelemetry;
+	unsigned m_nAudioStatsUpdateTime;
+	CCoreLoad m_CoreLoad;
+	unsigned m_nCoreLoadReportTime;
+	u32 m_nAudioProblemCount;
+	size_t m_nPolyphonyCap;
+	bool m_bEffectsSendsWarned;
 
 	// Extra devices
 	CPisound* m_pPisound;
@@ -210,11 +302,39 @@ private:
 	// Synthesizers
 	u8 m_nMasterVolume;
 	CSynthBase* m_pCurrentSynth;
-	CMT32Synth* m_pMT32Synth;
-	CSoundFontSynth* m_pSoundFontSynth;
+	// Published by core 0 with release ordering once fully constructed; other cores must load with acquire
+	std::atomic<CMT32Synth*> m_pMT32Synth;
+	std::atomic<CSoundFontSynth*> m_pSoundFontSynth;
+
+	// Synth switches fade between engines; the outgoing one is stopped once it has faded out
+	CCrossfader m_Crossfader;
+	CSynthBase* m_pFadingSynth;
+	bool m_bSoundFontOnAuxCore;
+
+	// Layered mode; channels in the mask are played by mt32emu, the rest by FluidSynth rendering on core 3
+	bool m_bLayered;
+	u16 m_nLayerMT32Channels;
+	CRenderWorker* m_pLayerWorker;
+
+	// Optional second mt32emu instance with its own ROM set and input, rendering on core 3 and mixed or panned at the output
+	CMT32Synth* m_pSecondMT32Synth;
+	CRenderWorker* m_pSecondMT32Worker;
+	CSecondMT32Port m_SecondMT32Port;
+	bool m_bSecondMT32Serial;
+
+	// Otherwise, core 3 can render a share of FluidSynth's voices, or its effects
+	CCoreExecutor m_AuxCore;
+
+	// Spare cycles on cores 1 and 3 (and any core waiting on a job, or for boot to finish) are shared out as jobs
+	CJobSystem m_JobSystem;
+
+	// MIDI receive buffers, filled by interrupt handlers
+	TMIDIRxBuffer m_MIDIRxBuffer;
+	TMIDIRxBuffer m_SecondMT32RxBuffer;
 
-	// MIDI receive buffer
-	CRingBuffer<u8, MIDIRxBufferSize> m_MIDIRxBuffer;
+	// When serial MIDI was last read, for estimating when each byte arrived
+	unsigned int m_nSerialMIDIReadTime;
+	unsigned int m_nUSBSerialMIDIReadTime;
 
 	// Event handling
 	TEventQueue m_EventQueue;
@@ -223,6 +343,7 @@ private:
 	static void USBMIDIDeviceRemovedHandler(CDevice* pDevice, void* pContext);
 	static void USBMIDIPacketHandler(unsigned nCable, u8* pPacket, unsigned nLength);
 	static void IRQMIDIReceiveHandler(const u8* pData, size_t nSize);
+	static void TaskSwitchHandler(CTask* pTask);
 
 	static void PanicHandler();
 
@@ -36,7 +36,9 @@ public:
 class CUDPMIDIReceiver : protected CTask
 {
 public:
-	CUDPMIDIReceiver(CUDPMIDIHandler* pHandler);
+	static constexpr u16 DefaultPort = 1999;
+
+	CUDPMIDIReceiver(CUDPMIDIHandler* pHandler, u16 nPort = DefaultPort);
 	virtual ~CUDPMIDIReceiver() override;
 
 	bool Initialize();
@@ -45,6 +47,7 @@ public:
 
 private:
 	// UDP sockets
+	u16 m_nPort;
 	CSocket* m_pMIDISocket;
 
 	// Socket receive buffer
@@ -0,0 +1,54 @@
+//
+// pcmconverter.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef _pcmconverter_h
+#define _pcmconverter_h
+
+#include <circle/types.h>
+
+namespace PCMConverter
+{
+	enum class TFormat
+	{
+		// Signed 24-bit samples in the low bits of 32-bit words (I2S)
+		S24_32,
+
+		// Packed little-endian signed 24-bit samples (PWM/HDMI)
+		S24_Packed,
+	};
+
+	// Converts interleaved stereo floats to PCM; input is saturated to the output range
+	using TConvertFunc = void (*)(const float* pInBuffer, void* pOutBuffer, size_t nFrames);
+
+	// Number of bytes that a converter may write past the end of its output
+	constexpr size_t OutputPadding = 4;
+
+	constexpr size_t GetBytesPerSample(TFormat Format)
+	{
+		return Format == TFormat::S24_32 ? sizeof(s32) : sizeof(s8) * 3;
+	}
+
+	// Returns a converter specialized for the given output format and channel order
+	TConvertFunc GetConvertFunc(TFormat Format, bool bReversedStereo);
+}
+
+#endif
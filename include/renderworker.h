@@ -0,0 +1,70 @@
+//
+// renderworker.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef _renderworker_h
+#define _renderworker_h
+
+#include <circle/types.h>
+
+#include <atomic>
+
+#include "resampler.h"
+#include "synth/synthbase.h"
+
+// Renders a synth on a dedicated CPU core in lockstep with the audio core, so that two synths can render each block in parallel.
+// The audio core calls Start() to hand over a block, does its own work, then calls Wait() to collect the result.
+class CRenderWorker
+{
+public:
+	CRenderWorker(CSynthBase* pSynth, unsigned int nOutputRate);
+	~CRenderWorker();
+
+	bool Initialize(size_t nMaxFrames);
+
+	// Audio core only
+	void Start(size_t nFrames);
+	const float* Wait();
+	u32 GetRenderMicros() const { return m_nRenderMicros; }
+
+	// Worker core; services blocks until bRunning becomes false
+	void Run(const volatile bool& bRunning);
+
+private:
+	static constexpr size_t CacheLineSize = 64;
+
+	CSynthBase* m_pSynth;
+	CResampler m_Resampler;
+	float* m_pBuffer;
+
+	// Written by the audio core before a block is requested
+	size_t m_nFrames;
+
+	// Written by the worker core before a block is completed
+	u32 m_nRenderMicros;
+
+	// Block sequence numbers; a block is pending while they differ
+	alignas(CacheLineSize) std::atomic<u32> m_nRequested;
+	alignas(CacheLineSize) std::atomic<u32> m_nCompleted;
+	std::atomic<bool> m_bStopped;
+};
+
+#endif
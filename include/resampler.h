@@ -0,0 +1,77 @@
+//
+// resampler.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef _resampler_h
+#define _resampler_h
+
+#include <circle/types.h>
+
+// Rational-ratio polyphase FIR resampler for interleaved stereo float audio.
+// The caller renders GetInputFrames() frames into GetInputBuffer(), then calls Process() to produce output.
+class CResampler
+{
+public:
+	CResampler(unsigned int nInputRate, unsigned int nOutputRate);
+	~CResampler();
+
+	bool Initialize(size_t nMaxOutputFrames);
+	void Reset();
+
+	// True if the rates are identical; no resampling is required
+	bool IsBypassed() const { return m_nInterpolation == m_nDecimation; }
+	unsigned int GetInputRate() const { return m_nInputRate; }
+
+	size_t GetInputFrames(size_t nOutputFrames) const;
+	float* GetInputBuffer() const { return m_pBuffer + HistoryFrames * nChannels; }
+	void Process(float* pOutBuffer, size_t nOutputFrames);
+
+	static bool IsRatioSupported(unsigned int nInputRate, unsigned int nOutputRate);
+
+	// Largest reduced interpolation factor supported (number of filter phases)
+	static constexpr unsigned int MaxPhases = 512;
+
+private:
+	static constexpr u8 nChannels = 2;
+
+	// Taps per phase; also the number of previous input frames retained between blocks
+	static constexpr size_t Taps = 16;
+	static constexpr size_t HistoryFrames = Taps;
+
+	unsigned int m_nInputRate;
+	unsigned int m_nOutputRate;
+
+	// Output rate = input rate * L / M
+	unsigned int m_nInterpolation;
+	unsigned int m_nDecimation;
+
+	// Position of the next output frame relative to the first new input frame, in units of 1/L input frames
+	int m_nTime;
+
+	// Per-phase coefficients in reverse order, duplicated for both channels so that they line up with interleaved frames
+	float* m_pCoefficients;
+
+	// History frames followed by new input frames
+	float* m_pBuffer;
+	size_t m_nMaxInputFrames;
+};
+
+#endif
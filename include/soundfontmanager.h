@@ -47,6 +47,7 @@ private:
 	{
 		CString Name;
 		CString Path;
+		bool bCompressed;
 	};
 
 	static constexpr size_t MaxSoundFontNameLength = 256;
@@ -0,0 +1,83 @@
+//
+// spscqueue.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef _spscqueue_h
+#define _spscqueue_h
+
+#include <stddef.h>
+
+#include <atomic>
+
+// Wait-free single-producer/single-consumer queue for passing data between two CPU cores.
+// Enqueue() must only ever be called from one core, and Dequeue() from one (other) core.
+// Only depends on the standard headers, so it can be benchmarked on a host (see tools/hosttests).
+template <class T, size_t N>
+class CSPSCQueue
+{
+public:
+	CSPSCQueue()
+		: m_nInPtr(0),
+		  m_nOutPtr(0),
+		  m_Data{}
+	{
+	}
+
+	bool Enqueue(const T& Item)
+	{
+		const size_t nInPtr = m_nInPtr.load(std::memory_order_relaxed);
+		const size_t nNextInPtr = (nInPtr + 1) & BufferMask;
+
+		// Full
+		if (nNextInPtr == m_nOutPtr.load(std::memory_order_acquire))
+			return false;
+
+		m_Data[nInPtr] = Item;
+		m_nInPtr.store(nNextInPtr, std::memory_order_release);
+		return true;
+	}
+
+	bool Dequeue(T& OutItem)
+	{
+		const size_t nOutPtr = m_nOutPtr.load(std::memory_order_relaxed);
+
+		// Empty
+		if (nOutPtr == m_nInPtr.load(std::memory_order_acquire))
+			return false;
+
+		OutItem = m_Data[nOutPtr];
+		m_nOutPtr.store((nOutPtr + 1) & BufferMask, std::memory_order_release);
+		return true;
+	}
+
+private:
+	static_assert(N && (N & (N - 1)) == 0, "Queue size must be a power of 2");
+
+	static constexpr size_t BufferMask = N - 1;
+	static constexpr size_t CacheLineSize = 64;
+
+	// Keep producer and consumer indices on separate cache lines to avoid false sharing
+	alignas(CacheLineSize) std::atomic<size_t> m_nInPtr;
+	alignas(CacheLineSize) std::atomic<size_t> m_nOutPtr;
+	alignas(CacheLineSize) T m_Data[N];
+};
+
+#endif
@@ -0,0 +1,93 @@
+//
+// effectspipeline.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef _effectspipeline_h
+#define _effectspipeline_h
+
+#include <circle/types.h>
+
+#include <atomic>
+
+#include <fluidsynth.h>
+
+#include "coreexecutor.h"
+#include "synth/effectsunit.h"
+
+// Renders FluidSynth with its reverb and chorus processed on a separate core.
+// The voices of FluidSynth block N are rendered on the calling core while the effects for block N-1 are processed on the
+// effects core, so output is delayed by one FluidSynth block (64 frames). The synth must have its effects bypassed
+// (fluid_synth_set_fx_bypass()), so that it mixes the sends without processing them.
+class CEffectsPipeline
+{
+public:
+	CEffectsPipeline(unsigned int nSampleRate, CCoreExecutor* pEffectsCore);
+
+	bool Initialize();
+	void SetParameters(const CEffectsUnit::TParameters& Parameters);
+	void Reset();
+
+	// Produces nFrames of interleaved stereo output
+	void Render(fluid_synth_t* pSynth, float* pOutBuffer, size_t nFrames);
+
+	// Any core; true if the synth has produced a while of dry output with effects active, but nothing on the sends
+	bool AreSendsSilent() const;
+
+	static constexpr size_t BlockFrames = CEffectsUnit::BlockFrames;
+
+private:
+	enum TSend
+	{
+		ReverbLeft,
+		ReverbRight,
+		ChorusLeft,
+		ChorusRight,
+		SendCount
+	};
+
+	// Returns the slot of the block that was completed
+	size_t RenderBlock(fluid_synth_t* pSynth);
+	static void EffectsJob(void* pParam);
+
+	CCoreExecutor* m_pEffectsCore;
+	CEffectsUnit m_EffectsUnit;
+
+	// Double-buffered dry output and effects sends; one slot is being rendered while the other's effects are processed
+	float m_DryBuffers[2][2][BlockFrames];
+	float m_SendBuffers[2][SendCount][BlockFrames];
+	float m_ReverbSend[BlockFrames];
+	float m_ChorusSend[BlockFrames];
+	size_t m_nSlot;
+	bool m_bInFlight;
+
+	// Output of the effects core
+	float m_EffectsBuffer[2][BlockFrames];
+
+	// Blocks with dry output but silent sends, until the sends have been seen to carry a signal
+	std::atomic<u32> m_nSilentSendBlocks;
+	std::atomic<bool> m_bSendsVerified;
+
+	// Completed frames of the last block that didn't fit in the caller's buffer
+	float m_CarryBuffer[BlockFrames * 2];
+	size_t m_nCarryFrames;
+};
+
+#endif
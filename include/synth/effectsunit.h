@@ -0,0 +1,75 @@
+//
+// effectsunit.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef _effectsunit_h
+#define _effectsunit_h
+
+#include <circle/types.h>
+
+struct _fluid_revmodel_t;
+struct _fluid_chorus_t;
+
+// Reverb and chorus for FluidSynth's effects send buses, so that effects can be processed separately from the voices.
+// These are FluidSynth's own reverb and chorus units, created through the additions in our FluidSynth patch, so the
+// result sounds the same as when the synth processes its effects itself.
+class CEffectsUnit
+{
+public:
+	struct TParameters
+	{
+		bool bReverbActive;
+		float nReverbRoomSize;
+		float nReverbDamping;
+		float nReverbWidth;
+		float nReverbLevel;
+
+		bool bChorusActive;
+		int nChorusVoices;
+		float nChorusLevel;
+		float nChorusSpeed;
+		float nChorusDepth;
+	};
+
+	// FluidSynth's block size (FLUID_BUFSIZE)
+	static constexpr size_t BlockFrames = 64;
+
+	CEffectsUnit(unsigned int nSampleRate);
+	~CEffectsUnit();
+
+	bool Initialize();
+	void SetParameters(const TParameters& Parameters);
+	void Reset();
+
+	bool IsActive() const { return m_Parameters.bReverbActive || m_Parameters.bChorusActive; }
+
+	// Processes one block of mono sends and writes the stereo effects output
+	void Process(const float* pReverbSend, const float* pChorusSend, float* pOutLeft, float* pOutRight);
+
+private:
+	unsigned int m_nSampleRate;
+	TParameters m_Parameters;
+
+	_fluid_revmodel_t* m_pReverb;
+	_fluid_chorus_t* m_pChorus;
+};
+
+#endif
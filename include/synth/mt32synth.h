@@ -54,18 +54,17 @@ public:
 
 	// CSynthBase
 	virtual bool Initialize() override;
-	virtual void HandleMIDIShortMessage(u32 nMessage) override;
-	virtual void HandleMIDISysExMessage(const u8* pData, size_t nSize) override;
-	virtual bool IsActive() override { return m_pSynth->isActive(); }
-	virtual void AllSoundOff() override;
-	virtual void SetMasterVolume(u8 nVolume) override;
+
+	// Initialize() in two halves: loading ROMs needs storage (core 0), opening the synth is pure computation (any core)
+	bool LoadROMs(TMT32ROMSet PreferredROMSet);
+	bool Open();
 	virtual size_t Render(s16* pBuffer, size_t nFrames) override;
 	virtual size_t Render(float* pBuffer, size_t nFrames) override;
 	virtual void ReportStatus() const override;
 	virtual void UpdateLCD(CLCD& LCD, unsigned int nTicks) override;
 
 	void SetMIDIChannels(TMIDIChannels Channels);
-	void SetReversedStereo(bool bEnabled) { m_pSynth->setReversedStereoEnabled(bEnabled); }
+	void SetReversedStereo(bool bEnabled) { SetControl(TControl::ReversedStereo, bEnabled); }
 	bool SwitchROMSet(TMT32ROMSet ROMSet);
 	bool NextROMSet();
 	TMT32ROMSet GetROMSet() const;
@@ -81,6 +80,10 @@ private:
 	static constexpr size_t LCDTextBufferSize = 20 + 1;
 
 	void GetPartLevels(unsigned int nTicks, float PartLevels[9], float PartPeaks[9]);
+	void ProcessCommands(size_t nFrames);
+	virtual void ApplyControl(TControl Control, u8 nValue) override;
+	template <class T>
+	size_t RenderSamples(T* pOutBuffer, size_t nFrames);
 
 	// MT32Emu::ReportHandler
 	virtual bool onMIDIQueueOverflow() override;
@@ -0,0 +1,64 @@
+//
+// polyphonygovernor.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef _polyphonygovernor_h
+#define _polyphonygovernor_h
+
+#include <circle/types.h>
+
+#include <atomic>
+
+// Lowers the voice limit when rendering gets close to taking longer than real time, and gradually
+// restores it once the load drops. Updated from the audio core; state can be read from any core.
+class CPolyphonyGovernor
+{
+public:
+	CPolyphonyGovernor();
+
+	void Reset(size_t nMaxPolyphony);
+
+	// Returns the new voice cap, given the fraction of real time taken to render the last block
+	size_t Update(float nLoad, size_t nActiveVoices, size_t nFrames, unsigned int nSampleRate);
+	void AddSteals(size_t nSteals) { m_nSteals += nSteals; }
+
+	size_t GetMaxPolyphony() const { return m_nMaxPolyphony.load(std::memory_order_relaxed); }
+	size_t GetVoiceCap() const { return m_nVoiceCap.load(std::memory_order_relaxed); }
+	u32 GetStealsPerSecond() const { return m_nStealsPerSecond.load(std::memory_order_relaxed); }
+
+	static constexpr size_t MinPolyphony = 16;
+
+private:
+	// Hysteresis band; the cap is lowered above the high mark, and raised after a period below the low mark
+	static constexpr float HighLoad       = 0.80f;
+	static constexpr float LowLoad        = 0.60f;
+	static constexpr u32 RecoveryMillis   = 500;
+
+	std::atomic<size_t> m_nMaxPolyphony;
+	std::atomic<size_t> m_nVoiceCap;
+	std::atomic<u32> m_nStealsPerSecond;
+
+	size_t m_nRecoveryFrames;
+	size_t m_nSteals;
+	size_t m_nStealWindowFrames;
+};
+
+#endif
@@ -0,0 +1,210 @@
+//
+// samplecache.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef _samplecache_h
+#define _samplecache_h
+
+#include <circle/sched/synchronizationevent.h>
+#include <circle/sched/task.h>
+#include <circle/types.h>
+
+#include <atomic>
+
+#include <fluidsynth.h>
+
+#include "jobsystem.h"
+
+// With FluidSynth's dynamic sample loading, only the samples of presets in use are kept in memory. Presets are paged in
+// by a background task on core 0 before the program change that selects them reaches the audio core, so FluidSynth never
+// touches storage while rendering. The audio core carries on rendering during a page-in: the task only changes
+// FluidSynth's state between blocks, and leaves the engine to the audio core whenever it waits for storage. Recently used
+// presets stay pinned until the memory budget is exceeded, when the least recently used ones are released. When a
+// program change selects a preset that is already resident, the start of its samples is read into the shared L2 cache by
+// a background job, ahead of the first note. Main core only, unless stated otherwise.
+class CSampleCache : protected CTask
+{
+public:
+	enum class TCheckResult
+	{
+		// The message can go to the audio core
+		Ready,
+
+		// A program change selects a preset that is now being paged in; hold it back until IsPagingIn() returns false
+		PagingIn,
+
+		// A program change selects a preset that isn't resident while another one is being paged in; check it again later
+		Busy,
+	};
+
+	struct TStats
+	{
+		u32 nHits;
+		u32 nMisses;
+		u32 nTotalStallMillis;
+		u32 nWorstStallMillis;
+		u32 nUnavailable;
+		size_t nResidentBytes;
+		size_t nBudgetBytes;
+		u32 nPrefetches;
+		u32 nAveragePrefetchMicros;
+		u32 nWorstPrefetchMicros;
+		u32 nLatePrefetches;
+	};
+
+	CSampleCache(size_t nBudgetBytes);
+	~CSampleCache();
+
+	void Initialize();
+
+	// A new engine has been installed; call with rendering suspended, after WaitForPageIn()
+	void Reset(fluid_synth_t* pSynth);
+
+	// Tracks bank/program state, prefetches resident presets, and starts paging in presets that aren't
+	TCheckResult CheckMessage(u32 nMessage, u16 nPercussionMask);
+
+	bool IsPagingIn() const { return m_bPagingIn; }
+
+	// Also waits for prefetches in flight
+	void WaitForPageIn();
+
+	// All channels return to bank 0, program 0 (e.g. GM/GS/XG reset)
+	void ResetPrograms();
+
+	void GetStats(TStats& OutStats) const;
+
+	// Audio core; held while rendering, so that a page-in only changes FluidSynth's state between blocks
+	void LockEngine();
+	void UnlockEngine() { m_bEngineLocked.clear(std::memory_order_release); }
+
+	// Called from FluidSynth's file/memory callbacks
+	static bool IsPaging();
+	static void BeginStorageAccess();
+	static void EndStorageAccess();
+	static void OnSampleAlloc(void* pData, size_t nSize);
+	static void OnLoadRefused() { s_nRefusedLoads.fetch_add(1, std::memory_order_relaxed); }
+
+	virtual void Run() override;
+
+private:
+	struct TPreset
+	{
+		u16 nBank;
+		u8 nProgram;
+	};
+
+	struct TEntry
+	{
+		TPreset Preset;
+		bool bUsed;
+		bool bPermanent;
+		u32 nLastUsed;
+	};
+
+	// Sample data allocated while an entry was being paged in
+	struct TRange
+	{
+		const u8* pData;
+		size_t nSize;
+		u16 nEntry;
+	};
+
+	// One in-flight prefetch per channel; the ranges are copied so that the job never reads state owned by this core
+	struct TPrefetch
+	{
+		CSampleCache* pCache;
+		CJobSystem::TJob Job;
+		CJobSystem::CCounter Counter;
+		unsigned int nSubmitTicks;
+		size_t nRanges;
+		TRange Ranges[128];
+	};
+
+	static constexpr size_t MaxEntries = 256;
+	static constexpr size_t MaxRanges = 4096;
+	static constexpr u16 PendingEntry = MaxEntries;
+	static constexpr u16 DrumBank = 128;
+
+	// Smaller allocations made while paging are FluidSynth's bookkeeping rather than sample data
+	static constexpr size_t MinSampleBytes = 256;
+
+	// Enough for the attack of each sample without a single job flushing the whole L2 cache
+	static constexpr size_t PrefetchBytesPerSample = 2048;
+	static constexpr size_t CacheLineSize = 64;
+
+	static bool IsPagingInBackground();
+	void LockEngineFromTask();
+
+	bool FindPreset(u16 nBank, u8 nProgram) const;
+	bool ResolvePreset(u8 nChannel, u8 nProgram, bool bDrum, TPreset& OutPreset) const;
+	TEntry* FindEntry(const TPreset& Preset);
+	bool Pin(const TPreset& Preset, bool bPermanent);
+	void Unpin(TEntry& Entry);
+	bool IsSelected(const TPreset& Preset) const;
+	void EvictToBudget(const TEntry* pKeep);
+	void AssignRanges(u16 nEntry);
+	void FreeRanges(u16 nEntry);
+
+	void Prefetch(u8 nChannel, const TEntry& Entry);
+	void WaitForPrefetches();
+	static void PrefetchJob(void* pParam);
+
+	size_t m_nBudgetBytes;
+
+	fluid_synth_t* m_pSynth;
+	fluid_sfont_t* m_pSoundFont;
+	int m_nSoundFontID;
+
+	// Bank select state, and the preset each channel will have selected once queued messages have been processed
+	u8 m_BankSelect[16];
+	TPreset m_Selected[16];
+
+	TEntry m_Entries[MaxEntries];
+	u32 m_nUseCounter;
+
+	// Background page-in
+	CSynchronizationEvent m_Event;
+	volatile bool m_bPagingIn;
+	TPreset m_PendingPreset;
+	std::atomic_flag m_bEngineLocked = ATOMIC_FLAG_INIT;
+
+	TRange m_Ranges[MaxRanges];
+	size_t m_nNextRange;
+	TPrefetch m_Prefetches[16];
+
+	u32 m_nHits;
+	u32 m_nMisses;
+	u32 m_nTotalStallMillis;
+	u32 m_nWorstStallMillis;
+
+	// Updated by prefetch jobs on other cores
+	std::atomic<u32> m_nPrefetches;
+	std::atomic<u32> m_nTotalPrefetchMicros;
+	std::atomic<u32> m_nWorstPrefetchMicros;
+	u32 m_nLatePrefetches;
+
+	// The cache being paged in, and the task doing it (the cache's own task, or the main task while resetting)
+	static CSampleCache* s_pPagingCache;
+	static CTask* s_pPagingTask;
+	static std::atomic<u32> s_nRefusedLoads;
+};
+
+#endif
@@ -0,0 +1,78 @@
+//
+// sampledecoder.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef _sampledecoder_h
+#define _sampledecoder_h
+
+#include <circle/types.h>
+
+#include <atomic>
+
+#include "jobsystem.h"
+#include "synth/soundfontcompiler.h"
+
+// Decodes the Ogg Vorbis samples of an SF3 SoundFont into their place in an image built by CSoundFontCompiler. Each
+// sample is a job, so the decoding is spread across whichever cores are taking jobs, while the main task carries on
+// between checks. Each core decodes with its own scratch memory, which is allocated up front. Main core only.
+class CSampleDecoder
+{
+public:
+	struct TCoreStats
+	{
+		u32 nSamples;
+		u64 nFrames;
+		u64 nMicros;
+	};
+
+	CSampleDecoder();
+	~CSampleDecoder();
+
+	bool Initialize();
+
+	// Returns the number of samples that couldn't be decoded; they're marked invalid and left silent
+	u32 Decode(const CSoundFontCompiler& Compiler, u8* pImage);
+
+	const TCoreStats& GetCoreStats(unsigned nCore) const { return m_CoreStats[nCore]; }
+
+private:
+	struct TSampleJob
+	{
+		CSampleDecoder* pDecoder;
+		CSoundFontCompiler::TCompressedSample Sample;
+		CJobSystem::TJob Job;
+	};
+
+	static void DecodeJob(void* pParam);
+	bool DecodeSample(const CSoundFontCompiler::TCompressedSample& Sample, unsigned nCore);
+
+	// Per-core working memory for the Vorbis decoder
+	u8* m_pScratch[CJobSystem::MaxCores];
+	TCoreStats m_CoreStats[CJobSystem::MaxCores];
+
+	CJobSystem::CCounter m_Counter;
+	std::atomic<u32> m_nStarted;
+	std::atomic<u32> m_nFinished;
+	std::atomic<u32> m_nFailed;
+};
+
+#endif
@@ -0,0 +1,79 @@
+//
+// soundfontcache.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef _soundfontcache_h
+#define _soundfontcache_h
+
+#include <circle/string.h>
+#include <circle/types.h>
+
+#include <fluidsynth.h>
+
+// Keeps FluidSynth instances for recently used SoundFonts alive after switching away from them, so that switching back
+// is just a matter of swapping engines. The least recently used ones are deleted once the memory budget is exceeded.
+// Instances are never rendered while in the cache. Main core only.
+class CSoundFontCache
+{
+public:
+	CSoundFontCache();
+	~CSoundFontCache();
+
+	void SetBudget(size_t nBudgetBytes);
+	bool IsEnabled() const { return m_nBudgetBytes > 0; }
+
+	// Ownership passes to the cache; deleted straight away if it doesn't fit
+	void Add(fluid_synth_t* pSynth, const char* pSoundFontPath, size_t nBytes);
+
+	// Ownership passes to the caller; returns nullptr if not resident
+	fluid_synth_t* Take(const char* pSoundFontPath, size_t& nOutBytes);
+
+	bool Contains(const char* pSoundFontPath) const;
+	void Clear();
+
+	size_t GetCount() const { return m_nCount; }
+	size_t GetResidentBytes() const { return m_nResidentBytes; }
+	size_t GetBudget() const { return m_nBudgetBytes; }
+
+	static constexpr size_t MaxEntries = 8;
+
+private:
+	struct TEntry
+	{
+		fluid_synth_t* pSynth;
+		CString Path;
+		size_t nBytes;
+		u32 nLastUsed;
+	};
+
+	int Find(const char* pSoundFontPath) const;
+	void Remove(size_t nEntry);
+	void EvictLeastRecentlyUsed();
+
+	size_t m_nBudgetBytes;
+	size_t m_nResidentBytes;
+	u32 m_nUseCounter;
+
+	size_t m_nCount;
+	TEntry m_Entries[MaxEntries];
+};
+
+#endif
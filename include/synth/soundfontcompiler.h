@@ -0,0 +1,216 @@
+//
+// soundfontcompiler.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef _soundfontcompiler_h
+#define _soundfontcompiler_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "synth/soundfontimageformat.h"
+
+// Compiles a SoundFont held in memory into a precompiled image (see soundfontimageformat.h). Used by the sfcompile tool,
+// and by mt32-pi itself to decode SF3 SoundFonts straight into an image, so it only depends on the standard headers.
+//
+// Nothing is allocated: Parse() checks the SoundFont and works out the size of the image, and Build() then writes the
+// image into a buffer of that size. The samples of an SF3 are laid out one after the other, and the Ogg Vorbis streams
+// of compressed samples are left for the caller to decode into their place.
+class CSoundFontCompiler
+{
+public:
+	// A compressed sample's stream, and where its decoded frames go
+	struct TCompressedSample
+	{
+		const uint8_t* pData;
+		size_t nSize;
+		int16_t* pFrames;
+		uint32_t nFrames;
+		TSoundFontImageSample* pSample;
+	};
+
+	CSoundFontCompiler();
+
+	bool Parse(const uint8_t* pSoundFont, size_t nSize);
+	const char* GetError() const { return m_pError; }
+
+	size_t GetImageSize() const { return m_nImageSize; }
+	uint32_t GetSampleCount() const { return m_nSamples; }
+	uint32_t GetCompressedSampleCount() const { return m_nCompressedSamples; }
+	size_t GetCompressedBytes() const { return m_nCompressedBytes; }
+
+	// The SoundFont's file name is used if it doesn't have a name of its own
+	void Build(uint8_t* pImage, const char* pFallbackName) const;
+
+	// After Build(); false if the sample isn't compressed, or is unusable
+	bool GetCompressedSample(uint8_t* pImage, uint32_t nSample, TCompressedSample& OutSample) const;
+
+	// Frame count of an Ogg Vorbis stream, from the granule position of its last page; 0 if there isn't one
+	static uint32_t GetVorbisFrameCount(const uint8_t* pData, size_t nSize);
+
+	static constexpr uint16_t SampleTypeVorbis = 0x10;
+	static constexpr uint16_t SampleTypeROM    = 0x8000;
+
+	// Zero frames after each sample when samples are laid out by the compiler, as in an SF2 (SF 2.04 section 7.10)
+	static constexpr uint32_t SamplePaddingFrames = 46;
+
+private:
+	// Hydra records (SF 2.04 section 7)
+	struct TPresetHeader
+	{
+		char Name[20];
+		uint16_t nProgram;
+		uint16_t nBank;
+		uint16_t nBagIndex;
+		uint32_t nLibrary;
+		uint32_t nGenre;
+		uint32_t nMorphology;
+	} __attribute__((packed));
+
+	struct TInstrumentHeader
+	{
+		char Name[20];
+		uint16_t nBagIndex;
+	} __attribute__((packed));
+
+	struct TBag
+	{
+		uint16_t nGeneratorIndex;
+		uint16_t nModulatorIndex;
+	} __attribute__((packed));
+
+	struct TModulator
+	{
+		uint16_t nSource;
+		uint16_t nDestination;
+		int16_t nAmount;
+		uint16_t nAmountSource;
+		uint16_t nTransform;
+	} __attribute__((packed));
+
+	struct TGenerator
+	{
+		uint16_t nType;
+		int16_t nAmount;
+	} __attribute__((packed));
+
+	struct TSampleHeader
+	{
+		char Name[20];
+		uint32_t nStart;
+		uint32_t nEnd;
+		uint32_t nLoopStart;
+		uint32_t nLoopEnd;
+		uint32_t nSampleRate;
+		uint8_t nOriginalPitch;
+		int8_t nPitchCorrection;
+		uint16_t nSampleLink;
+		uint16_t nSampleType;
+	} __attribute__((packed));
+
+	struct TChunk
+	{
+		const uint8_t* pData;
+		uint32_t nSize;
+	};
+
+	// Every hydra table ends with a terminal record, which is kept so that bag ranges can be found
+	template <class T>
+	struct THydraTable
+	{
+		const T* pRecords;
+		uint32_t nCount;
+	};
+
+	// Where the preset/instrument tables are written to; with null tables, entries are only counted
+	struct TOutput
+	{
+		TSoundFontImagePreset* pPresets;
+		TSoundFontImageZone* pPresetZones;
+		TSoundFontImageInstrument* pInstruments;
+		TSoundFontImageZone* pInstrumentZones;
+		TSoundFontImageGenerator* pGenerators;
+		TSoundFontImageModulator* pModulators;
+		uint32_t nPresetZones;
+		uint32_t nInstrumentZones;
+		uint32_t nGenerators;
+		uint32_t nModulators;
+	};
+
+	// A sample's frames and its place in the image's sample data
+	struct TSampleLayout
+	{
+		const uint8_t* pData;
+		size_t nSize;
+		uint32_t nFrames;
+		bool bCompressed;
+	};
+
+	bool Error(const char* pMessage);
+
+	static bool FindChunk(const TChunk& List, uint32_t nID, TChunk& OutChunk);
+	static bool FindList(const TChunk& RIFF, uint32_t nType, TChunk& OutList);
+	template <class T>
+	bool ReadHydraTable(const char* pID, THydraTable<T>& OutTable) const;
+	template <class T>
+	static bool CheckBags(const THydraTable<T>& Headers, const THydraTable<TBag>& Bags, uint32_t nGenerators, uint32_t nModulators);
+
+	bool GetSampleLayout(uint32_t nSample, TSampleLayout& OutLayout) const;
+	void AddModulators(const THydraTable<TModulator>& Modulators, uint32_t nFirst, uint32_t nEnd, TSoundFontImageZone& Zone, TOutput& Output) const;
+	uint32_t AddZones(const THydraTable<TBag>& Bags, const THydraTable<TGenerator>& Generators, const THydraTable<TModulator>& Modulators,
+	                  uint32_t nFirstBag, uint32_t nEndBag, bool bPresetLevel, uint32_t nTargets, TSoundFontImageZone* pZones,
+	                  uint32_t& nZones, TOutput& Output) const;
+	void AddPresetsAndInstruments(TOutput& Output) const;
+
+	const char* m_pError;
+
+	// The SoundFont
+	size_t m_nSourceSize;
+	TChunk m_PDTA;
+	TChunk m_SDTA;
+	TChunk m_Samples;
+	TChunk m_Samples24;
+	TChunk m_Name;
+	bool m_bPacked;
+
+	THydraTable<TPresetHeader> m_PresetHeaders;
+	THydraTable<TBag> m_PresetBags;
+	THydraTable<TModulator> m_PresetModulators;
+	THydraTable<TGenerator> m_PresetGenerators;
+	THydraTable<TInstrumentHeader> m_InstrumentHeaders;
+	THydraTable<TBag> m_InstrumentBags;
+	THydraTable<TModulator> m_InstrumentModulators;
+	THydraTable<TGenerator> m_InstrumentGenerators;
+	THydraTable<TSampleHeader> m_SampleHeaders;
+
+	// Sizes of the image's tables
+	uint32_t m_nPresets;
+	uint32_t m_nInstruments;
+	uint32_t m_nSamples;
+	uint32_t m_nCompressedSamples;
+	size_t m_nCompressedBytes;
+	TOutput m_Counts;
+	size_t m_nSampleDataSize;
+	size_t m_nSampleData24Size;
+	size_t m_nImageSize;
+};
+
+#endif
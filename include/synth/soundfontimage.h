@@ -0,0 +1,127 @@
+//
+// soundfontimage.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef _soundfontimage_h
+#define _soundfontimage_h
+
+#include <circle/types.h>
+#include <fatfs/ff.h>
+
+#include <fluidsynth.h>
+
+#include "synth/soundfontimageformat.h"
+
+// Loads precompiled SoundFont images (see soundfontimageformat.h) as a FluidSynth SoundFont loader. The image is read
+// with a few large sequential reads, and after one relocation/validation pass, its tables are used in place; only the
+// FluidSynth sample, modulator and preset objects that refer to them are created. If there's no image for a SoundFont,
+// or the SoundFont has changed since it was compiled, FluidSynth's own loader parses the SF2 as usual.
+//
+// SF3 SoundFonts (which FluidSynth can't load without libsndfile) are always handled here: they're compiled into an
+// image in memory, and their Ogg Vorbis samples are decoded by other cores (see CSampleDecoder). The result can be saved
+// as the SoundFont's image, so that later loads don't have to decode it again.
+class CSoundFontImage
+{
+public:
+	// Ownership passes to the synth it's added to
+	static fluid_sfloader_t* CreateLoader(bool bCompressedOnly, bool bSaveDecodedImages);
+
+	static bool IsCompressed(const char* pSoundFontPath);
+
+private:
+	struct TLoaderOptions
+	{
+		bool bCompressedOnly;
+		bool bSaveDecodedImages;
+	};
+
+	struct TPresetRef
+	{
+		const CSoundFontImage* pImage;
+		const TSoundFontImagePreset* pPreset;
+		char Name[21];
+	};
+
+	CSoundFontImage();
+	~CSoundFontImage();
+
+	bool Load(const char* pImagePath, const char* pSoundFontPath);
+	bool Decode(const char* pSoundFontPath);
+	bool Save(const char* pImagePath) const;
+	bool Relocate();
+	bool CreateObjects(fluid_sfont_t* pSoundFont);
+
+	template <class T>
+	bool GetTable(const TSoundFontImageTable& Table, T*& pOutTable) const;
+	static bool CheckRange(u32 nFirst, u32 nCount, u32 nTableSize) { return nFirst <= nTableSize && nCount <= nTableSize - nFirst; }
+	bool CheckZones(const TSoundFontImageZone* pZones, u32 nFirst, u32 nCount, u32 nTargets) const;
+
+	int NoteOn(const TSoundFontImagePreset& Preset, fluid_synth_t* pSynth, int nChannel, int nKey, int nVelocity) const;
+	fluid_sample_t* GetSample(u32 nIndex) const;
+	fluid_mod_t* GetModulator(u32 nIndex) const;
+	void AddModulators(fluid_voice_t* pVoice, const TSoundFontImageZone* pGlobalZone, const TSoundFontImageZone& Zone, int nMode) const;
+
+	// Updates the header's timestamp if the sample data had to be checked
+	static bool IsSourceCurrent(const char* pSoundFontPath, TSoundFontImageHeader& Header);
+	static u32 GetSourceTimestamp(const char* pSoundFontPath);
+	static void SaveSourceTimestamp(const char* pImagePath, u32 nTimestamp);
+	static bool ReadChunks(FIL& File, u8* pBuffer, size_t nSize);
+
+	// FluidSynth callbacks
+	static fluid_sfont_t* LoaderLoad(fluid_sfloader_t* pLoader, const char* pFileName);
+	static void LoaderFree(fluid_sfloader_t* pLoader);
+	static const char* SoundFontGetName(fluid_sfont_t* pSoundFont);
+	static fluid_preset_t* SoundFontGetPreset(fluid_sfont_t* pSoundFont, int nBank, int nProgram);
+	static void SoundFontIterationStart(fluid_sfont_t* pSoundFont);
+	static fluid_preset_t* SoundFontIterationNext(fluid_sfont_t* pSoundFont);
+	static int SoundFontFree(fluid_sfont_t* pSoundFont);
+	static const char* PresetGetName(fluid_preset_t* pPreset);
+	static int PresetGetBank(fluid_preset_t* pPreset);
+	static int PresetGetNumber(fluid_preset_t* pPreset);
+	static int PresetNoteOn(fluid_preset_t* pPreset, fluid_synth_t* pSynth, int nChannel, int nKey, int nVelocity);
+	static void PresetFree(fluid_preset_t* pPreset);
+
+	// The whole image, as read from storage
+	u8* m_pImage;
+	TSoundFontImageHeader* m_pHeader;
+
+	// Relocated tables
+	const TSoundFontImagePreset* m_pPresets;
+	const TSoundFontImageZone* m_pPresetZones;
+	const TSoundFontImageInstrument* m_pInstruments;
+	const TSoundFontImageZone* m_pInstrumentZones;
+	const TSoundFontImageGenerator* m_pGenerators;
+	const TSoundFontImageModulator* m_pModulators;
+	const TSoundFontImageSample* m_pSamples;
+	s16* m_pSampleData;
+	char* m_pSampleData24;
+
+	// FluidSynth objects referring to the tables; samples and modulators are pools of opaque objects
+	u8* m_pSampleObjects;
+	size_t m_nSampleObjectSize;
+	u8* m_pModulatorObjects;
+	size_t m_nModulatorObjectSize;
+	TPresetRef* m_pPresetRefs;
+	fluid_preset_t** m_pPresetObjects;
+	size_t m_nIterationIndex;
+};
+
+#endif
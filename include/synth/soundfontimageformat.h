@@ -0,0 +1,185 @@
+//
+// soundfontimageformat.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef _soundfontimageformat_h
+#define _soundfontimageformat_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Precompiled SoundFont image, produced from an SF2 file by tools/sfcompile, or from an SF3 file by mt32-pi itself
+// after decoding its samples (see CSoundFontCompiler), and stored next to it with SoundFontImageExtension appended. The
+// SF2's presets, instruments, zones, generators, modulators and sample headers are flattened into tables that can be
+// used in place, followed by its sample data. References between tables are indices, and tables are located by offsets
+// from the start of the image, so the image can be read into memory in one go and used wherever it lands. Little-endian
+// throughout.
+//
+// Shared with the offline compiler, so this only depends on the standard headers.
+
+constexpr char SoundFontImageExtension[] = ".mtsf";
+constexpr uint32_t SoundFontImageMagic   = 0x4653544D; // 'MTSF'
+constexpr uint32_t SoundFontImageVersion = 2;
+
+// Tables and sample data start on multiples of this
+constexpr size_t SoundFontImageAlignment = 16;
+
+struct TSoundFontImageTable
+{
+	uint32_t nOffset;
+	uint32_t nCount;
+};
+
+struct TSoundFontImageHeader
+{
+	uint32_t nMagic;
+	uint32_t nVersion;
+	uint32_t nImageSize;
+
+	// For telling whether the SF2 has changed since the image was compiled. The sample data is only checked when the
+	// SF2's FAT timestamp (date << 16 | time) differs from the one recorded by mt32-pi the last time it was checked; 0 if
+	// it never has been (e.g. compiled by sfcompile, which can't know it).
+	uint32_t nSourceSize;
+	uint32_t nSourceHydraCRC;
+	uint32_t nSourceSampleCRC;
+	uint32_t nSourceTimestamp;
+
+	char Name[64];
+
+	TSoundFontImageTable Presets;
+	TSoundFontImageTable PresetZones;
+	TSoundFontImageTable Instruments;
+	TSoundFontImageTable InstrumentZones;
+	TSoundFontImageTable Generators;
+	TSoundFontImageTable Modulators;
+	TSoundFontImageTable Samples;
+
+	// 16-bit sample frames, and the optional low bytes of 24-bit samples (nCount is in bytes for both)
+	TSoundFontImageTable SampleData;
+	TSoundFontImageTable SampleData24;
+};
+
+// Sorted by bank, then program
+struct TSoundFontImagePreset
+{
+	char Name[20];
+	uint16_t nBank;
+	uint16_t nProgram;
+	uint32_t nFirstZone;
+	uint32_t nZones;
+};
+
+struct TSoundFontImageInstrument
+{
+	char Name[20];
+	uint32_t nFirstZone;
+	uint32_t nZones;
+};
+
+// Global zones come first and have no target; otherwise the target is an instrument (preset zones) or a sample
+// (instrument zones). Range generators are folded into the key/velocity ranges, and generators that aren't allowed at
+// preset level have already been dropped.
+struct TSoundFontImageZone
+{
+	int32_t nTarget;
+	uint8_t nKeyLow;
+	uint8_t nKeyHigh;
+	uint8_t nVelocityLow;
+	uint8_t nVelocityHigh;
+	uint32_t nFirstGenerator;
+	uint16_t nGenerators;
+	uint16_t nModulators;
+	uint32_t nFirstModulator;
+};
+
+struct TSoundFontImageGenerator
+{
+	uint16_t nType;
+	int16_t nAmount;
+};
+
+// As in the SF2 file; invalid modulators have been dropped, and unsupported ones have an amount of 0
+struct TSoundFontImageModulator
+{
+	uint16_t nSource;
+	uint16_t nDestination;
+	int16_t nAmount;
+	uint16_t nAmountSource;
+};
+
+// Sample positions are in frames from the start of the sample data, with loop points already sanitized
+struct TSoundFontImageSample
+{
+	char Name[20];
+	uint32_t nStart;
+	uint32_t nEnd;
+	uint32_t nLoopStart;
+	uint32_t nLoopEnd;
+	uint32_t nSampleRate;
+	uint8_t nOriginalPitch;
+	int8_t nPitchCorrection;
+	uint16_t nFlags;
+};
+
+constexpr uint16_t SoundFontImageSampleValid = 1 << 0;
+
+// Layouts must be identical for the compiler's host and the Pi
+static_assert(sizeof(TSoundFontImageHeader) == 164, "Unexpected padding");
+static_assert(sizeof(TSoundFontImagePreset) == 32, "Unexpected padding");
+static_assert(sizeof(TSoundFontImageInstrument) == 28, "Unexpected padding");
+static_assert(sizeof(TSoundFontImageZone) == 20, "Unexpected padding");
+static_assert(sizeof(TSoundFontImageGenerator) == 4, "Unexpected padding");
+static_assert(sizeof(TSoundFontImageModulator) == 8, "Unexpected padding");
+static_assert(sizeof(TSoundFontImageSample) == 44, "Unexpected padding");
+
+// CRC-32 (IEEE 802.3) of the SF2's 'pdta' and 'sdta' lists (type and contents); table-driven, as the sample data can
+// run to hundreds of megabytes. Pass the previous result to continue a CRC over several buffers.
+struct TSoundFontImageCRCTable
+{
+	constexpr TSoundFontImageCRCTable()
+		: Entries{}
+	{
+		for (uint32_t i = 0; i < 256; ++i)
+		{
+			uint32_t nCRC = i;
+			for (int j = 0; j < 8; ++j)
+				nCRC = (nCRC >> 1) ^ (0xEDB88320 & -(nCRC & 1));
+			Entries[i] = nCRC;
+		}
+	}
+
+	uint32_t Entries[256];
+};
+
+inline constexpr TSoundFontImageCRCTable SoundFontImageCRCTable;
+
+inline uint32_t SoundFontImageCRC(const void* pData, size_t nSize, uint32_t nCRC = 0)
+{
+	const uint8_t* pBytes = static_cast<const uint8_t*>(pData);
+
+	nCRC = ~nCRC;
+	while (nSize--)
+		nCRC = SoundFontImageCRCTable.Entries[(nCRC ^ *pBytes++) & 0xFF] ^ (nCRC >> 8);
+
+	return ~nCRC;
+}
+
+#endif
@@ -0,0 +1,85 @@
+//
+// soundfontloader.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef _soundfontloader_h
+#define _soundfontloader_h
+
+#include <circle/sched/synchronizationevent.h>
+#include <circle/sched/task.h>
+#include <circle/string.h>
+#include <circle/types.h>
+
+#include <fluidsynth.h>
+
+#include "lcd/ui.h"
+
+// Loads a SoundFont into a FluidSynth instance as a background task on core 0, so that MIDI processing, networking and
+// audio carry on meanwhile. File I/O stays on core 0 (where the storage drivers live); large reads yield between chunks.
+class CSoundFontLoader : protected CTask
+{
+public:
+	enum class TState
+	{
+		Idle,
+		Loading,
+		Loaded,
+		Failed,
+	};
+
+	CSoundFontLoader();
+
+	void Initialize();
+
+	// Main task; the synth belongs to the loader until the load has finished
+	bool Load(fluid_synth_t* pSynth, const char* pSoundFontPath, CUserInterface* pUI);
+	TState GetState() const { return m_State; }
+	fluid_synth_t* Finish();
+
+	// Called by FluidSynth's file callbacks after each chunk is read
+	static void OnRead(size_t nBytes);
+
+	// Called while compressed samples are being decoded by other cores
+	static void OnDecode(size_t nDone, size_t nTotal);
+
+	virtual void Run() override;
+
+private:
+	void UpdateProgress(size_t nBytes);
+	void UpdateDecodeProgress(size_t nDone, size_t nTotal);
+
+	CSynchronizationEvent m_Event;
+	volatile TState m_State;
+
+	fluid_synth_t* m_pSynth;
+	CString m_SoundFontPath;
+	CUserInterface* m_pUI;
+
+	size_t m_nFileSize;
+	size_t m_nBytesRead;
+	u8 m_nProgress;
+	u8 m_nDecodeProgress;
+
+	// The loader currently running a load, if any
+	static CSoundFontLoader* s_pActiveLoader;
+};
+
+#endif
@@ -27,34 +27,104 @@
 
 #include <fluidsynth.h>
 
+#include "coreexecutor.h"
+#include "crossfader.h"
+#include "jobsystem.h"
 #include "soundfontmanager.h"
+#include "synth/effectspipeline.h"
 #include "synth/fxprofile.h"
+#include "synth/polyphonygovernor.h"
+#include "synth/samplecache.h"
+#include "synth/soundfontcache.h"
+#include "synth/soundfontloader.h"
 #include "synth/synthbase.h"
 
 class CSoundFontSynth : public CSynthBase
 {
 public:
-	CSoundFontSynth(unsigned nSampleRate);
+	CSoundFontSynth(unsigned nSampleRate, CCoreExecutor* pMixerThreadCore = nullptr, CCoreExecutor* pEffectsCore = nullptr);
 	virtual ~CSoundFontSynth() override;
 
 	// CSynthBase
 	virtual bool Initialize() override;
-	virtual void HandleMIDIShortMessage(u32 nMessage) override;
-	virtual void HandleMIDISysExMessage(const u8* pData, size_t nSize) override;
-	virtual bool IsActive() override;
-	virtual void AllSoundOff() override;
+	virtual void HandleMIDIShortMessage(u32 nMessage, unsigned int nTimestamp) override;
+	virtual void HandleMIDISysExMessage(const u8* pData, size_t nSize, unsigned int nTimestamp) override;
 	virtual void SetMasterVolume(u8 nVolume) override;
 	virtual size_t Render(s16* pOutBuffer, size_t nFrames) override;
 	virtual size_t Render(float* pOutBuffer, size_t nFrames) override;
 	virtual void ReportStatus() const override;
 	virtual void UpdateLCD(CLCD& LCD, unsigned int nTicks) override;
 
+	// SoundFonts load in the background; the current one keeps playing until CompleteSoundFontSwitch() is called, unless
+	// the switch isn't seamless (a second rendering core), in which case it's unloaded first and restored if loading fails.
+	// With bCrossfade, the outgoing engine's notes are released and it keeps rendering alongside the new one while it
+	// fades out; UpdateCrossfade() retires it once it has.
 	bool SwitchSoundFont(size_t nIndex);
+	CSoundFontLoader::TState GetSoundFontLoadState() const;
+	bool CompleteSoundFontSwitch(bool bCrossfade);
+	void UpdateCrossfade();
+	bool IsSwitchSeamless() const { return m_pMixerThreadCore == nullptr; }
 	size_t GetSoundFontIndex() const { return m_nCurrentSoundFontIndex; }
 	CSoundFontManager& GetSoundFontManager() { return m_SoundFontManager; }
 
+	// SoundFonts kept loaded after switching away from them
+	bool IsSoundFontResident(size_t nIndex) const;
+	const CSoundFontCache& GetSoundFontCache() const { return m_SoundFontCache; }
+
+	// Audio core only; fraction of real time taken to render the last block, applied on the next render
+	void SetRenderLoad(float nLoad) { m_nRenderLoad = nLoad; }
+	const CPolyphonyGovernor& GetPolyphonyGovernor() const { return m_PolyphonyGovernor; }
+
+	// Main core; returns false if samples aren't loaded on demand
+	bool GetSampleCacheStats(CSampleCache::TStats& OutStats) const;
+
+	// True if effects are processed on another core, but FluidSynth isn't producing anything for them to process
+	bool AreEffectsSendsSilent() const;
+
+	// Main core; passes on MIDI held back while samples were paged in, and returns true while a page-in is in progress
+	bool UpdatePaging();
+
 private:
+	// A message for a channel whose newly selected preset is being paged in, or one that affects every channel; SysEx
+	// payloads are stored in order in their own buffer
+	struct THeldMessage
+	{
+		u32 nMessage;
+		unsigned int nTimestamp;
+		bool bChecked;
+		size_t nSysExSize;
+	};
+
+	static constexpr size_t NoSoundFontIndex = static_cast<size_t>(-1);
+	static constexpr size_t MaxHeldMessages = 256;
+	static constexpr size_t MaxHeldSysExBytes = 4096;
+	static constexpr size_t OutgoingSlot = 0;
+	static constexpr size_t OutgoingBlockFrames = 256;
+
 	bool Reinitialize(const char* pSoundFontPath, const TFXProfile* pFXProfile);
+	fluid_synth_t* CreateSynth(const TFXProfile* pFXProfile) const;
+	void InstallSynth(fluid_synth_t* pSynth, const TFXProfile* pFXProfile, bool bCrossfade = false);
+	void MixOutgoingSynth(float* pOutBuffer, size_t nFrames);
+	void RetireOutgoingSynth();
+	void RetireSynth(fluid_synth_t* pSynth, size_t nSoundFontIndex, size_t nBytes);
+	static void DeleteSynthJob(void* pParam);
+	bool LoadInBackground(const char* pSoundFontPath);
+	void RestoreSoundFont();
+	void ProcessCommand(const TCommand& Command);
+	virtual void ApplyControl(TControl Control, u8 nValue) override;
+	void PlayMIDIShortMessage(u32 nMessage);
+	void ForwardMIDISysExMessage(const u8* pData, size_t nSize, unsigned int nTimestamp);
+	bool CheckPaging(u32 nMessage, unsigned int nTimestamp, bool bChecked);
+	bool CheckPagingSysEx(const u8* pData, size_t nSize, unsigned int nTimestamp);
+	void MakeRoomForHeldMessage(size_t nSysExSize);
+	void HoldMessage(u32 nMessage, unsigned int nTimestamp, bool bChecked, const u8* pSysExData = nullptr, size_t nSysExSize = 0);
+	void ReleaseHeldMessages();
+	void FlushHeldMessages();
+	template <class T, int (*WriteFunc)(fluid_synth_t*, int, void*, int, int, void*, int, int)>
+	size_t RenderWithCommands(T* pOutBuffer, size_t nFrames);
+	void GovernPolyphony(size_t nFrames);
+	void ShedVoices(size_t nVoiceCap);
+	void ApplyVoiceCap(size_t nVoiceCap);
 	void ResetMIDIMonitor();
 #ifndef NDEBUG
 	void DumpFXSettings() const;
@@ -63,17 +133,65 @@ private:
 	bool ParseRolandSysEx(const u8* pData, size_t nSize);
 	bool ParseYamahaSysEx(const u8* pData, size_t nSize);
 
+	CCoreExecutor* m_pMixerThreadCore;
+	CCoreExecutor* m_pEffectsCore;
 	fluid_settings_t* m_pSettings;
 	fluid_synth_t* m_pSynth;
 
+	// Reverb and chorus processed on another core, if enabled
+	CEffectsPipeline* m_pEffectsPipeline;
+
+	// Samples loaded per preset as they are selected, if enabled, and MIDI held back while they're paged in
+	CSampleCache* m_pSampleCache;
+	THeldMessage m_HeldMessages[MaxHeldMessages];
+	size_t m_nHeldMessages;
+	u16 m_nHeldChannels;
+	bool m_bHoldingAll;
+	u8 m_HeldSysEx[MaxHeldSysExBytes];
+	size_t m_nHeldSysExBytes;
+
+	// Background SoundFont loading
+	CSoundFontLoader* m_pLoader;
+	size_t m_nLoadingSoundFontIndex;
+	size_t m_nLoadingSoundFontBytes;
+	TFXProfile m_LoadingFXProfile;
+
+	// Resident SoundFonts; a switch to one of these just swaps engines
+	CSoundFontCache m_SoundFontCache;
+	fluid_synth_t* m_pResidentSynth;
+
+	// The previous engine keeps rendering its release tails while it fades out after a switch; it's only touched by the
+	// audio core between BeginRender() and EndRender()
+	fluid_synth_t* m_pOutgoingSynth;
+	size_t m_nOutgoingSoundFontIndex;
+	size_t m_nOutgoingSoundFontBytes;
+	size_t m_nOutgoingDelayFrames;
+	unsigned int m_nOutgoingFadeStartTime;
+	CCrossfader m_EngineCrossfader;
+	float m_OutgoingBuffer[OutgoingBlockFrames * 2];
+
+	// Engines that aren't kept resident are deleted by a background job, one at a time
+	fluid_synth_t* m_pDeletingSynth;
+	CJobSystem::TJob m_DeleteJob;
+	CJobSystem::CCounter m_DeleteCounter;
+
 	u8 m_nVolume;
 	float m_nInitialGain;
 
 	u16 m_nPercussionMask;
 	size_t m_nCurrentSoundFontIndex;
+	size_t m_nCurrentSoundFontBytes;
 
 	CSoundFontManager m_SoundFontManager;
 
+	// Polyphony governor
+	bool m_bPolyphonyGovernorEnabled;
+	CPolyphonyGovernor m_PolyphonyGovernor;
+	float m_nRenderLoad;
+	size_t m_nEnginePolyphony;
+	fluid_voice_t** m_pVoiceList;
+	size_t m_nVoiceListSize;
+
 	static void FluidSynthLogCallback(int nLevel, const char* pMessage, void* pUser);
 };
 
@@ -23,41 +23,139 @@
 #ifndef _synthbase_h
 #define _synthbase_h
 
-#include <circle/spinlock.h>
 #include <circle/types.h>
 
+#include <atomic>
+
 #include "lcd/lcd.h"
 #include "lcd/ui.h"
 #include "midimonitor.h"
+#include "spscqueue.h"
 
 class CSynthBase
 {
 public:
 	CSynthBase(unsigned int nSampleRate)
-		: m_Lock(TASK_LEVEL),
-		  m_nSampleRate(nSampleRate),
-		  m_pUI(nullptr)
+		: m_nSampleRate(nSampleRate),
+		  m_pUI(nullptr),
+		  m_bActive(false),
+		  m_bRendering(false),
+		  m_bSuspended(false),
+		  m_nRenderTime(0),
+		  m_nLastRenderTime(0),
+		  m_SysExBuffer{0},
+		  m_nSysExBytesWritten(0),
+		  m_nSysExBytesReleased(0),
+		  m_nSysExBytesToRelease(0),
+
+		  m_nEnqueuedCommands(0),
+		  m_nAllSoundOffCommand(0),
+		  m_bAllSoundOffPending(false)
 	{
+		for (std::atomic<s16>& Control : m_PendingControls)
+			Control.store(NoControlValue, std::memory_order_relaxed);
 	}
 
 	virtual ~CSynthBase() = default;
 
 	virtual bool Initialize() = 0;
-	virtual void HandleMIDIShortMessage(u32 nMessage) { m_MIDIMonitor.OnShortMessage(nMessage); };
-	virtual void HandleMIDISysExMessage(const u8* pData, size_t nSize) = 0;
-	virtual bool IsActive() = 0;
-	virtual void AllSoundOff() { m_MIDIMonitor.AllNotesOff(); };
-	virtual void SetMasterVolume(u8 nVolume) = 0;
+	virtual void HandleMIDIShortMessage(u32 nMessage, unsigned int nTimestamp);
+	virtual void HandleMIDISysExMessage(const u8* pData, size_t nSize, unsigned int nTimestamp);
+	bool IsActive() const { return m_bActive.load(std::memory_order_relaxed); }
+	virtual void AllSoundOff();
+	virtual void SetMasterVolume(u8 nVolume);
 	virtual size_t Render(s16* pOutBuffer, size_t nFrames) = 0;
 	virtual size_t Render(float* pOutBuffer, size_t nFrames) = 0;
 	virtual void ReportStatus() const = 0;
 	virtual void UpdateLCD(CLCD& LCD, unsigned int nTicks) = 0;
 	void SetUserInterface(CUserInterface* pUI) { m_pUI = pUI; }
 
-	CSpinLock m_Lock;
 	unsigned int m_nSampleRate;
 	CMIDIMonitor m_MIDIMonitor;
 	CUserInterface* m_pUI;
+
+protected:
+	enum class TCommandType : u8
+	{
+		ShortMessage,
+		SysExMessage,
+		AllSoundOff,
+	};
+
+	// Settings that only need their latest value applied; they're passed outside the command queue, so they never take
+	// up space in it, even while the synth isn't being rendered
+	enum class TControl : u8
+	{
+		MasterVolume,
+		ReversedStereo,
+		MIDIChannels,
+		Count
+	};
+
+	// Command sent from the main core to the audio core, stamped with its receive time (1MHz clock ticks)
+	struct TCommand
+	{
+		TCommandType Type;
+		unsigned int nTimestamp;
+
+		union
+		{
+			u32 nMessage;
+
+			struct
+			{
+				const u8* pData;
+				size_t nSize;
+				size_t nBufferSize;
+			} SysEx;
+		};
+	};
+
+	static constexpr size_t CommandQueueSize = 512;
+	static constexpr size_t SysExBufferSize = 16384;
+
+	// Producer side (main core)
+	bool EnqueueCommand(TCommandType Type);
+	void SetControl(TControl Control, u8 nValue);
+	void SuspendRendering();
+	void ResumeRendering();
+
+	// Consumer side (audio core)
+	bool BeginRender();
+	void EndRender(bool bActive);
+	void ApplyControls();
+	virtual void ApplyControl(TControl Control, u8 nValue) {}
+	bool DequeueCommand(TCommand& OutCommand);
+	size_t GetFrameOffset(unsigned int nTimestamp, size_t nFrames) const;
+
+private:
+	static constexpr s16 NoControlValue = -1;
+
+	bool Enqueue(const TCommand& Command);
+
+	CSPSCQueue<TCommand, CommandQueueSize> m_CommandQueue;
+	std::atomic<s16> m_PendingControls[static_cast<size_t>(TControl::Count)];
+
+	// Published by the audio core after each block
+	std::atomic<bool> m_bActive;
+
+	// Cold-path handshake for reconfiguring the synth engine from the main core
+	std::atomic<bool> m_bRendering;
+	std::atomic<bool> m_bSuspended;
+
+	unsigned int m_nRenderTime;
+	unsigned int m_nLastRenderTime;
+
+	// SysEx payloads referenced by queued commands; released in FIFO order by the audio core
+	u8 m_SysExBuffer[SysExBufferSize];
+	size_t m_nSysExBytesWritten;
+	std::atomic<size_t> m_nSysExBytesReleased;
+	size_t m_nSysExBytesToRelease;
+
+	// An All Sound Off that is still queued, with nothing queued after it, makes another one redundant
+	u32 m_nEnqueuedCommands;
+	u32 m_nAllSoundOffCommand;
+	std::atomic<bool> m_bAllSoundOffPending;
 };
 
 #endif
@@ -23,9 +23,15 @@
 #ifndef _utility_h
 #define _utility_h
 
+#include <circle/multicore.h>
 #include <circle/string.h>
+#include <circle/timer.h>
 #include <circle/util.h>
 
+#include <atomic>
+
+#include "coreevent.h"
+
 // Macro to extract the string representation of an enum
 #define CONFIG_ENUM_VALUE(VALUE, STRING) VALUE,
 
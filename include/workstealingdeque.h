@@ -0,0 +1,123 @@
+//
+// workstealingdeque.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef _workstealingdeque_h
+#define _workstealingdeque_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+// Lock-free fixed-size work-stealing deque (Chase-Lev, with the memory orderings from Lê et al., PPoPP 2013).
+// Push() and Pop() must only ever be called by the owning core (LIFO end); any core may Steal() (FIFO end).
+// Slots are accessed atomically as a thief may read one while it's being reused, so T should be a pointer or integer.
+// Only depends on the standard headers, so it can be tested on a host (see tools/hosttests).
+template <class T, size_t N>
+class CWorkStealingDeque
+{
+public:
+	CWorkStealingDeque()
+		: m_nTop(0),
+		  m_nBottom(0),
+		  m_Data{}
+	{
+	}
+
+	bool Push(const T& Item)
+	{
+		const uint32_t nBottom = m_nBottom.load(std::memory_order_relaxed);
+		const uint32_t nTop = m_nTop.load(std::memory_order_acquire);
+
+		// Full
+		if (nBottom - nTop >= N)
+			return false;
+
+		m_Data[nBottom & BufferMask].store(Item, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		m_nBottom.store(nBottom + 1, std::memory_order_relaxed);
+		return true;
+	}
+
+	bool Pop(T& OutItem)
+	{
+		const uint32_t nBottom = m_nBottom.load(std::memory_order_relaxed) - 1;
+		m_nBottom.store(nBottom, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		uint32_t nTop = m_nTop.load(std::memory_order_relaxed);
+
+		// Empty
+		if (static_cast<int32_t>(nBottom - nTop) < 0)
+		{
+			m_nBottom.store(nBottom + 1, std::memory_order_relaxed);
+			return false;
+		}
+
+		OutItem = m_Data[nBottom & BufferMask].load(std::memory_order_relaxed);
+
+		// Last item; race any thieves for it
+		bool bSuccess = true;
+		if (nTop == nBottom)
+		{
+			bSuccess = m_nTop.compare_exchange_strong(nTop, nTop + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+			m_nBottom.store(nBottom + 1, std::memory_order_relaxed);
+		}
+
+		return bSuccess;
+	}
+
+	bool Steal(T& OutItem)
+	{
+		uint32_t nTop = m_nTop.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		const uint32_t nBottom = m_nBottom.load(std::memory_order_acquire);
+
+		// Empty
+		if (static_cast<int32_t>(nBottom - nTop) <= 0)
+			return false;
+
+		OutItem = m_Data[nTop & BufferMask].load(std::memory_order_relaxed);
+
+		// Lost a race with the owner or another thief
+		return m_nTop.compare_exchange_strong(nTop, nTop + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+	}
+
+	bool IsEmpty() const
+	{
+		return static_cast<int32_t>(m_nBottom.load(std::memory_order_acquire) - m_nTop.load(std::memory_order_acquire)) <= 0;
+	}
+
+private:
+	static_assert(N && (N & (N - 1)) == 0, "Deque size must be a power of 2");
+	static_assert(sizeof(T) <= sizeof(void*), "Slots must be lock-free");
+
+	static constexpr size_t BufferMask = N - 1;
+	static constexpr size_t CacheLineSize = 64;
+
+	// Thieves contend on the top index; keep it away from the owner's bottom index
+	alignas(CacheLineSize) std::atomic<uint32_t> m_nTop;
+	alignas(CacheLineSize) std::atomic<uint32_t> m_nBottom;
+	alignas(CacheLineSize) std::atomic<T> m_Data[N];
+};
+
+#endif
@@ -30,13 +30,18 @@ enum TZoneTag : u32
 {
 	Free = 0,
 	Uncategorized = 1,
-	FluidSynth
+	FluidSynth,
+	FluidSynthSamples,
+
+	TagCount
 };
 
 class CZoneAllocator
 {
 public:
 	CZoneAllocator();
+	// Sub-zone within memory owned by the caller (e.g. a block allocated from the main zone)
+	CZoneAllocator(void* pHeap, size_t nHeapSize);
 	~CZoneAllocator();
 
 	// Allocator interface
@@ -45,6 +50,9 @@ public:
 	void* Realloc(void* pPtr, size_t nSize, TZoneTag Tag);
 	void Free(void* pPtr);
 	size_t GetAllocCount() const { return m_nAllocCount; }
+	size_t GetTagBytes(TZoneTag Tag) const { return m_nTagBytes[Tag]; }
+	size_t GetAllocSize(const void* pPtr) const;
+	bool Contains(const void* pPtr) const { return pPtr >= m_pHeap && pPtr < static_cast<u8*>(m_pHeap) + m_nHeapSize; }
 
 	void FreeTag(u32 nTag);
 	void Clear();
@@ -77,11 +85,15 @@ private:
 
 	void* m_pHeap;
 	size_t m_nHeapSize;
+	bool m_bSubZone;
 	TBlock m_MainBlock;
 	TBlock* m_pCurrentBlock;
 
 	size_t m_nAllocCount;
 
+	// Bytes in use per tag, including block headers
+	size_t m_nTagBytes[TZoneTag::TagCount];
+
 	static CZoneAllocator* s_pThis;
 };
 
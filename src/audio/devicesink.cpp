@@ -0,0 +1,133 @@
+//
+// devicesink.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <circle/logger.h>
+#include <circle/sound/hdmisoundbasedevice.h>
+#include <circle/sound/i2ssoundbasedevice.h>
+#include <circle/sound/pwmsoundbasedevice.h>
+
+#include "audio/devicesink.h"
+#include "utility.h"
+
+LOGMODULE("devicesink");
+
+constexpr u8 nChannels = 2;
+
+CSoundDeviceSink::CSoundDeviceSink(CInterruptSystem* pInterrupt, CConfig::TAudioOutputDevice Device, unsigned int nSampleRate, unsigned int nChunkSize, bool bI2SSlave, CI2CMaster* pI2CMaster)
+	: CAudioSink(nSampleRate, GetChunkSize(Device, nChunkSize) / nChannels),
+	  m_pInterrupt(pInterrupt),
+	  m_Device(Device),
+	  m_bI2SSlave(bI2SSlave),
+	  m_pI2CMaster(pI2CMaster),
+	  m_pSound(nullptr)
+{
+}
+
+CSoundDeviceSink::~CSoundDeviceSink()
+{
+	if (m_pSound)
+		delete m_pSound;
+}
+
+bool CSoundDeviceSink::Initialize(size_t nMinQueueSizeFrames)
+{
+	// Chunk size is in samples; the queue holds one chunk's worth of frames (two DMA chunks) by default
+	const unsigned int nChunkSize = m_nChunkFrames * nChannels;
+	const unsigned int nQueueSize = Utility::Max<unsigned int>(nChunkSize, nMinQueueSizeFrames);
+	TSoundFormat Format = TSoundFormat::SoundFormatSigned24;
+
+	switch (m_Device)
+	{
+		case CConfig::TAudioOutputDevice::PWM:
+			m_pSound = new CPWMSoundBaseDevice(m_pInterrupt, m_nSampleRate, nChunkSize);
+			break;
+
+		case CConfig::TAudioOutputDevice::HDMI:
+			m_pSound = new CHDMISoundBaseDevice(m_pInterrupt, m_nSampleRate, nChunkSize);
+			break;
+
+		case CConfig::TAudioOutputDevice::I2S:
+			// Circle's "fast path" for I2S 24-bit really expects 32-bit samples
+			m_pSound = new CI2SSoundBaseDevice(m_pInterrupt, m_nSampleRate, nChunkSize, m_bI2SSlave, m_pI2CMaster);
+			Format = TSoundFormat::SoundFormatSigned24_32;
+			break;
+
+		default:
+			LOGERR("Not a sound device");
+			return false;
+	}
+
+	m_pSound->SetWriteFormat(Format);
+	if (!m_pSound->AllocateQueueFrames(nQueueSize))
+	{
+		LOGERR("Failed to allocate sound queue");
+		return false;
+	}
+
+	// Wake the audio task whenever the DMA engine has consumed data
+	m_pSound->RegisterNeedDataCallback(NeedDataHandler, this);
+
+	return true;
+}
+
+bool CSoundDeviceSink::Start()
+{
+	return m_pSound->Start();
+}
+
+void CSoundDeviceSink::Cancel()
+{
+	m_pSound->Cancel();
+}
+
+PCMConverter::TFormat CSoundDeviceSink::GetFormat() const
+{
+	return m_Device == CConfig::TAudioOutputDevice::I2S ? PCMConverter::TFormat::S24_32 : PCMConverter::TFormat::S24_Packed;
+}
+
+void CSoundDeviceSink::WaitForSpace()
+{
+	// Sleep until the sound device interrupt signals that more space is available
+	Utility::WaitForCoreEvent();
+}
+
+size_t CSoundDeviceSink::Write(const void* pData, size_t nFrames)
+{
+	const size_t nBytesPerFrame = PCMConverter::GetBytesPerSample(GetFormat()) * nChannels;
+	const int nResult = m_pSound->Write(pData, nFrames * nBytesPerFrame);
+	return nResult > 0 ? nResult / nBytesPerFrame : 0;
+}
+
+unsigned int CSoundDeviceSink::GetChunkSize(CConfig::TAudioOutputDevice Device, unsigned int nChunkSize)
+{
+	// Chunk size must be a multiple of 384
+	if (Device == CConfig::TAudioOutputDevice::HDMI)
+		return Utility::RoundToNearestMultiple(nChunkSize, static_cast<unsigned int>(IEC958_SUBFRAMES_PER_BLOCK));
+
+	return nChunkSize;
+}
+
+void CSoundDeviceSink::NeedDataHandler(void* pParam)
+{
+	// Called from the DMA completion interrupt once there is room in the sound queue
+	Utility::SignalCoreEvent();
+}
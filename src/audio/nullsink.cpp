@@ -0,0 +1,55 @@
+//
+// nullsink.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "audio/nullsink.h"
+#include "utility.h"
+
+CNullSink::CNullSink(unsigned int nSampleRate, size_t nChunkFrames)
+	: CAudioSink(nSampleRate, nChunkFrames),
+	  m_nQueueSizeFrames(0),
+	  m_bRunning(false)
+{
+}
+
+bool CNullSink::Initialize(size_t nMinQueueSizeFrames)
+{
+	m_nQueueSizeFrames = Utility::Max(nMinQueueSizeFrames, m_nChunkFrames * 2);
+	return true;
+}
+
+bool CNullSink::Start()
+{
+	m_bRunning = true;
+	Utility::SignalCoreEvent();
+	return true;
+}
+
+void CNullSink::Cancel()
+{
+	m_bRunning = false;
+}
+
+void CNullSink::WaitForSpace()
+{
+	// Only reached while cancelled
+	Utility::WaitForCoreEvent();
+}
@@ -0,0 +1,269 @@
+//
+// wavsink.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <circle/logger.h>
+#include <circle/sched/scheduler.h>
+#include <circle/sched/task.h>
+#include <circle/util.h>
+
+#include "audio/wavsink.h"
+#include "utility.h"
+
+LOGMODULE("wavsink");
+
+constexpr u8 nChannels = 2;
+constexpr u8 nBitsPerSample = 24;
+constexpr u8 nBytesPerFrame = nChannels * nBitsPerSample / 8;
+constexpr u32 HeaderSize = 44;
+
+// Enough to ride out slow writes (e.g. SD card garbage collection) without holding up the audio task
+constexpr unsigned int BufferMillis = 1000;
+
+// Largest single write; the writer task yields in between
+constexpr size_t MaxWriteFrames = 8192;
+
+// How long the writer task sleeps when there's nothing to write
+constexpr unsigned int IdleSleepMillis = 5;
+
+class CWAVSink::CWriterTask : public CTask
+{
+public:
+	CWriterTask(CWAVSink* pSink)
+		: m_pSink(pSink)
+	{
+	}
+
+	// The scheduler deletes us once this returns
+	virtual void Run() override
+	{
+		CScheduler* const pScheduler = CScheduler::Get();
+
+		while (!m_pSink->m_bStopWriter)
+		{
+			if (m_pSink->Flush())
+				pScheduler->Yield();
+			else
+				pScheduler->MsSleep(IdleSleepMillis);
+		}
+
+		// The sink may be destroyed as soon as this is cleared
+		m_pSink->m_bWriterRunning = false;
+	}
+
+private:
+	CWAVSink* m_pSink;
+};
+
+CWAVSink::CWAVSink(unsigned int nSampleRate, size_t nChunkFrames, const char* pPath)
+	: CAudioSink(nSampleRate, nChunkFrames),
+	  m_Path(pPath),
+	  m_File{},
+	  m_bFileOpen(false),
+	  m_bRunning(false),
+	  m_bStopWriter(false),
+	  m_bWriterRunning(false),
+
+	  m_pBuffer(nullptr),
+	  m_nBufferFrames(0),
+	  m_nWrittenFrames(0),
+	  m_nFlushedFrames(0),
+
+	  m_nDataBytes(0),
+	  m_nUnsyncedFrames(0),
+	  m_bWriteFailed(false)
+{
+}
+
+CWAVSink::~CWAVSink()
+{
+	// The writer task refers to the ring buffer; wait for it to finish its current write and exit
+	m_bStopWriter = true;
+	while (m_bWriterRunning)
+		CScheduler::Get()->Yield();
+
+	if (m_bFileOpen)
+	{
+		// Whatever it hadn't written yet
+		while (Flush())
+			;
+
+		WriteHeader();
+		f_close(&m_File);
+	}
+
+	delete[] m_pBuffer;
+}
+
+bool CWAVSink::Initialize(size_t nMinQueueSizeFrames)
+{
+	// Core 0 (the audio boot stage)
+	m_nBufferFrames = Utility::Max<size_t>(nMinQueueSizeFrames, m_nSampleRate * BufferMillis / 1000);
+	m_pBuffer = new u8[m_nBufferFrames * nBytesPerFrame];
+
+	if (f_open(&m_File, m_Path, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK)
+	{
+		LOGERR("Couldn't open '%s' for writing", static_cast<const char*>(m_Path));
+		return false;
+	}
+
+	m_bFileOpen = true;
+	if (!WriteHeader())
+		return false;
+
+	// Runs until we're destroyed
+	m_bWriterRunning = true;
+	new CWriterTask(this);
+
+	return true;
+}
+
+bool CWAVSink::Start()
+{
+	m_bRunning = true;
+	Utility::SignalCoreEvent();
+	return true;
+}
+
+void CWAVSink::Cancel()
+{
+	// Whatever has been queued is still written out, followed by an up-to-date header
+	m_bRunning = false;
+}
+
+size_t CWAVSink::GetQueueFramesAvail() const
+{
+	if (!m_bRunning)
+		return 0;
+
+	return m_nBufferFrames - (m_nWrittenFrames.load(std::memory_order_relaxed) - m_nFlushedFrames.load(std::memory_order_acquire));
+}
+
+void CWAVSink::WaitForSpace()
+{
+	// The writer task signals whenever it has made room
+	Utility::WaitForCoreEvent();
+}
+
+size_t CWAVSink::Write(const void* pData, size_t nFrames)
+{
+	// Audio task; only copies into the ring buffer
+	const size_t nWrittenFrames = m_nWrittenFrames.load(std::memory_order_relaxed);
+	const size_t nFreeFrames = m_nBufferFrames - (nWrittenFrames - m_nFlushedFrames.load(std::memory_order_acquire));
+	nFrames = Utility::Min(nFrames, nFreeFrames);
+
+	const size_t nOffset = nWrittenFrames % m_nBufferFrames;
+	const size_t nFirstFrames = Utility::Min(nFrames, m_nBufferFrames - nOffset);
+	const u8* const pBytes = static_cast<const u8*>(pData);
+
+	memcpy(m_pBuffer + nOffset * nBytesPerFrame, pBytes, nFirstFrames * nBytesPerFrame);
+	memcpy(m_pBuffer, pBytes + nFirstFrames * nBytesPerFrame, (nFrames - nFirstFrames) * nBytesPerFrame);
+
+	m_nWrittenFrames.store(nWrittenFrames + nFrames, std::memory_order_release);
+
+	return nFrames;
+}
+
+bool CWAVSink::Flush()
+{
+	const size_t nFlushedFrames = m_nFlushedFrames.load(std::memory_order_relaxed);
+	const size_t nQueuedFrames = m_nWrittenFrames.load(std::memory_order_acquire) - nFlushedFrames;
+
+	if (nQueuedFrames == 0)
+	{
+		// Caught up (e.g. audio has stopped); make sure the header describes everything written so far
+		if (m_nUnsyncedFrames)
+		{
+			WriteHeader();
+			m_nUnsyncedFrames = 0;
+		}
+
+		return false;
+	}
+
+	// Up to the end of the ring buffer; the rest is written next time around
+	const size_t nOffset = nFlushedFrames % m_nBufferFrames;
+	const size_t nFrames = Utility::Min(Utility::Min(nQueuedFrames, m_nBufferFrames - nOffset), MaxWriteFrames);
+
+	UINT nBytesWritten;
+	if (f_write(&m_File, m_pBuffer + nOffset * nBytesPerFrame, nFrames * nBytesPerFrame, &nBytesWritten) != FR_OK || nBytesWritten != nFrames * nBytesPerFrame)
+	{
+		// Drop the audio rather than stall the audio task
+		if (!m_bWriteFailed)
+			LOGERR("Failed to write to '%s'", static_cast<const char*>(m_Path));
+		m_bWriteFailed = true;
+	}
+	else
+	{
+		m_nDataBytes += nBytesWritten;
+		m_nUnsyncedFrames += nFrames;
+	}
+
+	m_nFlushedFrames.store(nFlushedFrames + nFrames, std::memory_order_release);
+	Utility::SignalCoreEvent();
+
+	// Keep the header up-to-date roughly once per second of audio so that the file is playable if power is cut
+	if (m_nUnsyncedFrames >= m_nSampleRate)
+	{
+		WriteHeader();
+		m_nUnsyncedFrames = 0;
+	}
+
+	return true;
+}
+
+bool CWAVSink::WriteHeader()
+{
+	const u32 nByteRate = m_nSampleRate * nBytesPerFrame;
+	const u32 nRIFFSize = HeaderSize - 8 + m_nDataBytes;
+
+	u8 Header[HeaderSize];
+	auto WriteU16 = [&](size_t nOffset, u16 nValue) { Header[nOffset] = nValue; Header[nOffset + 1] = nValue >> 8; };
+	auto WriteU32 = [&](size_t nOffset, u32 nValue) { WriteU16(nOffset, nValue); WriteU16(nOffset + 2, nValue >> 16); };
+
+	memcpy(Header, "RIFF", 4);
+	WriteU32(4, nRIFFSize);
+	memcpy(Header + 8, "WAVEfmt ", 8);
+	WriteU32(16, 16);
+	WriteU16(20, 1);
+	WriteU16(22, nChannels);
+	WriteU32(24, m_nSampleRate);
+	WriteU32(28, nByteRate);
+	WriteU16(32, nBytesPerFrame);
+	WriteU16(34, nBitsPerSample);
+	memcpy(Header + 36, "data", 4);
+	WriteU32(40, m_nDataBytes);
+
+	const FSIZE_t nPosition = f_tell(&m_File);
+	UINT nBytesWritten;
+
+	if (f_lseek(&m_File, 0) != FR_OK || f_write(&m_File, Header, HeaderSize, &nBytesWritten) != FR_OK || nBytesWritten != HeaderSize)
+	{
+		LOGERR("Failed to write WAV header");
+		return false;
+	}
+
+	// Resume writing at the end of the data (or just after the header if this is a new file)
+	if (f_lseek(&m_File, Utility::Max<FSIZE_t>(nPosition, HeaderSize)) != FR_OK)
+		return false;
+
+	return f_sync(&m_File) == FR_OK;
+}
@@ -0,0 +1,117 @@
+//
+// audiotelemetry.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <circle/cputhrottle.h>
+#include <circle/util.h>
+
+#include <cstdint>
+
+#include "audiotelemetry.h"
+#include "utility.h"
+
+CAudioTelemetry::CAudioTelemetry()
+	: m_nSequence(0),
+	  m_Stats{}
+{
+	m_Stats.nWorstSlackMicros = UINT32_MAX;
+}
+
+void CAudioTelemetry::EnableCycleCounter()
+{
+	// The cycle counter is per-core; enable it (PMCR.E) without the divide-by-64 prescaler (PMCR.D)
+#if AARCH == 64
+	u64 nPMCR;
+	asm volatile ("mrs %0, pmcr_el0" : "=r" (nPMCR));
+	nPMCR = (nPMCR | 1) & ~(1 << 3);
+	asm volatile ("msr pmcr_el0, %0" : : "r" (nPMCR));
+	asm volatile ("msr pmcntenset_el0, %0" : : "r" (1ul << 31));
+#else
+	u32 nPMCR;
+	asm volatile ("mrc p15, 0, %0, c9, c12, 0" : "=r" (nPMCR));
+	nPMCR = (nPMCR | 1) & ~(1 << 3);
+	asm volatile ("mcr p15, 0, %0, c9, c12, 0" : : "r" (nPMCR));
+	asm volatile ("mcr p15, 0, %0, c9, c12, 1" : : "r" (1u << 31));
+#endif
+}
+
+u32 CAudioTelemetry::GetCycleCount()
+{
+#if AARCH == 64
+	u64 nCycles;
+	asm volatile ("mrs %0, pmccntr_el0" : "=r" (nCycles));
+	return nCycles;
+#else
+	u32 nCycles;
+	asm volatile ("mrc p15, 0, %0, c9, c13, 0" : "=r" (nCycles));
+	return nCycles;
+#endif
+}
+
+u32 CAudioTelemetry::RecordBlock(TSynth Synth, u32 nRenderCycles, u32 nLimiterCycles, unsigned int nDeadlineMicros, bool bUnderrun, bool bShortWrite)
+{
+	// Clock rate can change with power saving/throttling, so convert using the current rate
+	const u32 nCyclesPerMicro = Utility::Max(CCPUThrottle::Get()->GetClockRate() / 1000000, 1u);
+	const u32 nRenderMicros = nRenderCycles / nCyclesPerMicro;
+	const u32 nLimiterMicros = nLimiterCycles / nCyclesPerMicro;
+	const u32 nSlackMicros = nDeadlineMicros > nRenderMicros ? nDeadlineMicros - nRenderMicros : 0;
+	const size_t nBucket = Utility::Min<size_t>(nRenderMicros ? 31 - __builtin_clz(nRenderMicros) : 0, HistogramBuckets - 1);
+	const size_t nSynth = static_cast<size_t>(Synth);
+
+	const u32 nSequence = m_nSequence.load(std::memory_order_relaxed);
+	m_nSequence.store(nSequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	++m_Stats.nBlocks;
+	m_Stats.nLastRenderMicros = nRenderMicros;
+	m_Stats.nWorstRenderMicros = Utility::Max(m_Stats.nWorstRenderMicros, nRenderMicros);
+	if (nDeadlineMicros != NoDeadline)
+	{
+		m_Stats.nLastSlackMicros = nSlackMicros;
+		m_Stats.nWorstSlackMicros = Utility::Min(m_Stats.nWorstSlackMicros, nSlackMicros);
+		if (nRenderMicros > nDeadlineMicros)
+			++m_Stats.nDeadlineMisses;
+	}
+	++m_Stats.RenderHistogram[nBucket];
+	m_Stats.nLastLimiterMicros = nLimiterMicros;
+	m_Stats.nWorstLimiterMicros = Utility::Max(m_Stats.nWorstLimiterMicros, nLimiterMicros);
+	if (bUnderrun)
+		++m_Stats.Underruns[nSynth];
+	if (bShortWrite)
+		++m_Stats.ShortWrites[nSynth];
+
+	m_nSequence.store(nSequence + 2, std::memory_order_release);
+
+	return nRenderMicros;
+}
+
+void CAudioTelemetry::GetStats(TStats& OutStats) const
+{
+	u32 nSequence;
+
+	// Retry if the audio core updated the statistics while we were copying them
+	do
+	{
+		nSequence = m_nSequence.load(std::memory_order_acquire);
+		memcpy(&OutStats, &m_Stats, sizeof(TStats));
+		std::atomic_thread_fence(std::memory_order_acquire);
+	} while ((nSequence & 1) || nSequence != m_nSequence.load(std::memory_order_relaxed));
+}
@@ -0,0 +1,188 @@
+//
+// bootgraph.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <circle/logger.h>
+#include <circle/sched/scheduler.h>
+#include <circle/sched/task.h>
+#include <circle/timer.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "bootgraph.h"
+#include "jobsystem.h"
+#include "utility.h"
+
+LOGMODULE("boot");
+
+class CBootGraph::CBackgroundTask : public CTask
+{
+public:
+	CBackgroundTask(CBootGraph* pGraph)
+		: m_pGraph(pGraph)
+	{
+	}
+
+	// The scheduler deletes us once this returns
+	virtual void Run() override
+	{
+		CScheduler* const pScheduler = CScheduler::Get();
+
+		while (!m_pGraph->IsDone())
+		{
+			m_pGraph->RunNextStage(0);
+			pScheduler->Yield();
+		}
+	}
+
+private:
+	CBootGraph* m_pGraph;
+};
+
+CBootGraph::CBootGraph()
+	: m_Stages{},
+	  m_nStages(0),
+	  m_nStartTicks(0),
+
+	  m_DoneMask(0)
+{
+}
+
+CBootGraph::TStageMask CBootGraph::AddStage(const char* pName, TFunction pFunction, void* pParam, TStageMask Dependencies, bool bAnyCore)
+{
+	assert(m_nStages < MaxStages);
+
+	// Timings are relative to when the graph was built
+	if (m_nStages == 0)
+		m_nStartTicks = CTimer::GetClockTicks();
+
+	TStage& Stage = m_Stages[m_nStages];
+	Stage.pName = pName;
+	Stage.pFunction = pFunction;
+	Stage.pParam = pParam;
+	Stage.Dependencies = Dependencies;
+	Stage.bAnyCore = bAnyCore;
+	Stage.State.store(TState::Pending, std::memory_order_relaxed);
+
+	return 1 << m_nStages++;
+}
+
+void CBootGraph::Run(unsigned nCore, CJobSystem* pJobSystem)
+{
+	while (!IsDone())
+	{
+		// Nothing runnable yet; a stage completing or a job being submitted elsewhere will wake us up
+		if (!RunNextStage(nCore) && !(pJobSystem && pJobSystem->RunOne(nCore)))
+			Utility::WaitForCoreEvent();
+	}
+}
+
+void CBootGraph::RunInBackground()
+{
+	new CBackgroundTask(this);
+}
+
+bool CBootGraph::IsDone() const
+{
+	const TStageMask AllStages = (1 << m_nStages) - 1;
+	return m_DoneMask.load(std::memory_order_acquire) == AllStages;
+}
+
+bool CBootGraph::RunNextStage(unsigned nCore)
+{
+	const TStageMask DoneMask = m_DoneMask.load(std::memory_order_acquire);
+
+	// Core 0 is the only core that can run pinned stages, so it prefers those and only helps out with any-core
+	// stages when it would otherwise sit idle
+	for (unsigned nPass = nCore == 0 ? 0 : 1; nPass < 2; ++nPass)
+	{
+		for (size_t i = 0; i < m_nStages; ++i)
+		{
+			TStage& Stage = m_Stages[i];
+
+			if (Stage.bAnyCore != (nPass == 1) || (Stage.Dependencies & DoneMask) != Stage.Dependencies)
+				continue;
+
+			// Claim the stage; another core may have got there first
+			TState Expected = TState::Pending;
+			if (!Stage.State.compare_exchange_strong(Expected, TState::Running, std::memory_order_acq_rel))
+				continue;
+
+			Stage.nCore = nCore;
+			Stage.nStartTicks = CTimer::GetClockTicks();
+			Stage.pFunction(Stage.pParam);
+			Stage.nEndTicks = CTimer::GetClockTicks();
+
+			Stage.State.store(TState::Done, std::memory_order_release);
+			m_DoneMask.fetch_or(1 << i, std::memory_order_acq_rel);
+			Utility::SignalCoreEvent();
+
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void CBootGraph::LogTimings() const
+{
+	size_t nLastStage = 0;
+
+	for (size_t i = 0; i < m_nStages; ++i)
+	{
+		const TStage& Stage = m_Stages[i];
+		const unsigned nStartMillis = Utility::TicksToMillis(Stage.nStartTicks - m_nStartTicks);
+		const unsigned nEndMillis = Utility::TicksToMillis(Stage.nEndTicks - m_nStartTicks);
+		LOGNOTE("%-12s core %d: %5d - %5dms (%dms)", Stage.pName, Stage.nCore, nStartMillis, nEndMillis, nEndMillis - nStartMillis);
+
+		if (Stage.nEndTicks - m_nStartTicks > m_Stages[nLastStage].nEndTicks - m_nStartTicks)
+			nLastStage = i;
+	}
+
+	// Walk back from the last stage to finish through whichever dependency finished last
+	char Buffer[256] = "";
+	size_t nStage = nLastStage;
+
+	while (true)
+	{
+		const TStage& Stage = m_Stages[nStage];
+
+		char Path[sizeof(Buffer)];
+		snprintf(Path, sizeof(Path), Buffer[0] ? "%s > %s" : "%s%s", Stage.pName, Buffer);
+		strcpy(Buffer, Path);
+
+		if (!Stage.Dependencies)
+			break;
+
+		size_t nCriticalDependency = nStage;
+		for (size_t i = 0; i < m_nStages; ++i)
+		{
+			if ((Stage.Dependencies & (1 << i)) && (nCriticalDependency == nStage || m_Stages[i].nEndTicks - m_nStartTicks > m_Stages[nCriticalDependency].nEndTicks - m_nStartTicks))
+				nCriticalDependency = i;
+		}
+
+		nStage = nCriticalDependency;
+	}
+
+	LOGNOTE("Critical path: %s (%dms)", Buffer, Utility::TicksToMillis(m_Stages[nLastStage].nEndTicks - m_nStartTicks));
+}
@@ -62,6 +62,8 @@ CONFIG_ENUM_STRINGS(TAudioOutputDevice, ENUM_AUDIOOUTPUTDEVICE);
 CONFIG_ENUM_STRINGS(TMT32EmuResamplerQuality, ENUM_RESAMPLERQUALITY);
 CONFIG_ENUM_STRINGS(TMT32EmuMIDIChannels, ENUM_MIDICHANNELS);
 CONFIG_ENUM_STRINGS(TMT32EmuROMSet, ENUM_MT32ROMSET);
+CONFIG_ENUM_STRINGS(TMT32EmuSecondInput, ENUM_MT32EMUSECONDINPUT);
+CONFIG_ENUM_STRINGS(TMT32EmuSecondOutput, ENUM_MT32EMUSECONDOUTPUT);
 CONFIG_ENUM_STRINGS(TLCDType, ENUM_LCDTYPE);
 CONFIG_ENUM_STRINGS(TControlScheme, ENUM_CONTROLSCHEME);
 CONFIG_ENUM_STRINGS(TEncoderType, ENUM_ENCODERTYPE);
@@ -178,6 +180,52 @@ bool CConfig::ParseOption(const char* pString, CString* pOut)
 	return true;
 }
 
+bool CConfig::ParseOption(const char* pString, TMIDIChannelMask* pOut)
+{
+	// Comma-separated list of channels and/or ranges of channels, e.g. "2-10" or "1-8,10"
+	TMIDIChannelMask nMask = 0;
+	const char* pCurrent = pString;
+
+	while (*pCurrent)
+	{
+		char* pEnd;
+		const long nFirst = strtol(pCurrent, &pEnd, 10);
+		long nLast = nFirst;
+
+		if (pEnd == pCurrent)
+			return false;
+
+		if (*pEnd == '-')
+		{
+			pCurrent = pEnd + 1;
+			nLast = strtol(pCurrent, &pEnd, 10);
+			if (pEnd == pCurrent)
+				return false;
+		}
+
+		if (nFirst < 1 || nLast > 16 || nFirst > nLast)
+			return false;
+
+		for (long nChannel = nFirst; nChannel <= nLast; ++nChannel)
+			nMask |= 1 << (nChannel - 1);
+
+		pCurrent = pEnd;
+		while (*pCurrent == ' ')
+			++pCurrent;
+
+		if (*pCurrent == ',')
+			++pCurrent;
+		else if (*pCurrent)
+			return false;
+
+		while (*pCurrent == ' ')
+			++pCurrent;
+	}
+
+	*pOut = nMask;
+	return true;
+}
+
 bool CConfig::ParseOption(const char* pString, CIPAddress* pOut)
 {
 	// Space for 4 period-separated groups of 3 digits plus null terminator
@@ -206,6 +254,8 @@ CONFIG_ENUM_PARSER(TAudioOutputDevice);
 CONFIG_ENUM_PARSER(TMT32EmuResamplerQuality);
 CONFIG_ENUM_PARSER(TMT32EmuMIDIChannels);
 CONFIG_ENUM_PARSER(TMT32EmuROMSet);
+CONFIG_ENUM_PARSER(TMT32EmuSecondInput);
+CONFIG_ENUM_PARSER(TMT32EmuSecondOutput);
 CONFIG_ENUM_PARSER(TLCDType);
 CONFIG_ENUM_PARSER(TControlScheme);
 CONFIG_ENUM_PARSER(TEncoderType);
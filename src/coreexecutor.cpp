@@ -0,0 +1,101 @@
+//
+// coreexecutor.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "coreexecutor.h"
+#include "utility.h"
+
+CCoreExecutor::CCoreExecutor()
+	: m_pFunction(nullptr),
+	  m_pParam(nullptr),
+
+	  m_State(TState::Idle),
+	  m_bLaunchWaiting(false)
+{
+}
+
+bool CCoreExecutor::Launch(TFunction pFunction, void* pParam, bool bWaitWhileBusy)
+{
+	u32 nState = TState::Idle;
+	while (!m_State.compare_exchange_weak(nState, TState::Claimed, std::memory_order_acquire, std::memory_order_relaxed))
+	{
+		if (nState == TState::Busy && bWaitWhileBusy)
+		{
+			// Either EndOtherWork() sees the flag and signals, or we see that it has already finished
+			m_bLaunchWaiting.store(true);
+			if (m_State.load() == TState::Busy)
+				Utility::WaitForCoreEvent();
+		}
+		else if (nState != TState::Idle)
+			return false;
+
+		nState = TState::Idle;
+	}
+
+	m_pFunction = pFunction;
+	m_pParam = pParam;
+	m_State.store(TState::Pending, std::memory_order_release);
+	Utility::SignalCoreEvent();
+
+	return true;
+}
+
+void CCoreExecutor::Join()
+{
+	while (m_State.load(std::memory_order_acquire) == TState::Pending)
+		Utility::WaitForCoreEvent();
+}
+
+void CCoreExecutor::Run(const volatile bool& bRunning)
+{
+	while (bRunning)
+	{
+		// A launch made since we last looked will have set the event register, so this returns immediately
+		if (!RunPending())
+			Utility::WaitForCoreEvent();
+	}
+}
+
+bool CCoreExecutor::RunPending()
+{
+	if (m_State.load(std::memory_order_acquire) != TState::Pending)
+		return false;
+
+	m_pFunction(m_pParam);
+
+	m_State.store(TState::Idle, std::memory_order_release);
+	Utility::SignalCoreEvent();
+
+	return true;
+}
+
+bool CCoreExecutor::BeginOtherWork()
+{
+	u32 nState = TState::Idle;
+	return m_State.compare_exchange_strong(nState, TState::Busy, std::memory_order_acquire, std::memory_order_relaxed);
+}
+
+void CCoreExecutor::EndOtherWork()
+{
+	m_State.store(TState::Idle);
+	if (m_bLaunchWaiting.exchange(false))
+		Utility::SignalCoreEvent();
+}
@@ -0,0 +1,82 @@
+//
+// coreload.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include <circle/timer.h>
+
+#include "coreload.h"
+#include "utility.h"
+
+// Generic timer event stream control bits (CNTKCTL)
+constexpr u32 EventStreamEnableBit = 1 << 2;
+constexpr u32 EventStreamBitShift = 4;
+constexpr u32 EventStreamBitMask = 0xF << EventStreamBitShift;
+
+CCoreLoad::CCoreLoad()
+	: m_nLastTicks(CTimer::GetClockTicks()),
+	  m_nLastIdleMicros{}
+{
+}
+
+void CCoreLoad::EnablePeriodicWakeup(unsigned int nPeriodMicros)
+{
+#if AARCH == 64
+	u64 nFrequency, nControl;
+	asm volatile ("mrs %0, cntfrq_el0" : "=r" (nFrequency));
+	asm volatile ("mrs %0, cntkctl_el1" : "=r" (nControl));
+#else
+	u32 nFrequency, nControl;
+	asm volatile ("mrc p15, 0, %0, c14, c0, 0" : "=r" (nFrequency));
+	asm volatile ("mrc p15, 0, %0, c14, c1, 0" : "=r" (nControl));
+#endif
+
+	// An event is generated each time the chosen counter bit goes from 0 to 1, i.e. every 2^(bit + 1) ticks
+	const u64 nPeriodTicks = static_cast<u64>(nFrequency) * nPeriodMicros / 1000000;
+	u32 nBit = 0;
+	while (nBit < 15 && (2ull << (nBit + 1)) <= nPeriodTicks)
+		++nBit;
+
+	nControl = (nControl & ~EventStreamBitMask) | (nBit << EventStreamBitShift) | EventStreamEnableBit;
+
+#if AARCH == 64
+	asm volatile ("msr cntkctl_el1, %0" : : "r" (nControl));
+#else
+	asm volatile ("mcr p15, 0, %0, c14, c1, 0" : : "r" (nControl));
+#endif
+	asm volatile ("isb" ::: "memory");
+}
+
+void CCoreLoad::GetUtilization(u8 (&OutPercent)[CORES])
+{
+	const unsigned int nTicks = CTimer::GetClockTicks();
+	const unsigned int nElapsedMicros = nTicks - m_nLastTicks;
+	m_nLastTicks = nTicks;
+
+	for (size_t i = 0; i < CORES; ++i)
+	{
+		const u32 nIdleTotalMicros = Utility::CoreIdleMicros[i].load(std::memory_order_relaxed);
+		const u32 nIdleMicros = Utility::Min(nIdleTotalMicros - m_nLastIdleMicros[i], nElapsedMicros);
+		m_nLastIdleMicros[i] = nIdleTotalMicros;
+
+		OutPercent[i] = nElapsedMicros ? static_cast<u64>(nElapsedMicros - nIdleMicros) * 100 / nElapsedMicros : 0;
+	}
+}
@@ -0,0 +1,121 @@
+//
+// crossfader.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <circle/util.h>
+
+#include "crossfader.h"
+#include "utility.h"
+
+constexpr u8 nChannels = 2;
+
+CCrossfader::CCrossfader()
+	: m_nFadeMillis(0),
+	  m_nStep(1.0f),
+
+	  m_bTargets{false, false},
+	  m_nGains{0.0f, 0.0f}
+{
+}
+
+void CCrossfader::Initialize(unsigned int nSampleRate, unsigned int nFadeMillis)
+{
+	const float nFadeFrames = static_cast<float>(nSampleRate) * nFadeMillis / 1000.0f;
+
+	m_nFadeMillis = nFadeMillis;
+	m_nStep = nFadeFrames > 1.0f ? 1.0f / nFadeFrames : 1.0f;
+}
+
+void CCrossfader::SetAudible(size_t nSlot, bool bAudible)
+{
+	m_bTargets[nSlot].store(bAudible, std::memory_order_relaxed);
+}
+
+void CCrossfader::Reset(size_t nSlot, bool bAudible)
+{
+	m_bTargets[nSlot].store(bAudible, std::memory_order_relaxed);
+	m_nGains[nSlot].store(bAudible ? 1.0f : 0.0f, std::memory_order_relaxed);
+}
+
+bool CCrossfader::IsSettled(size_t nSlot) const
+{
+	const float nTarget = m_bTargets[nSlot].load(std::memory_order_relaxed) ? 1.0f : 0.0f;
+	return m_nGains[nSlot].load(std::memory_order_relaxed) == nTarget;
+}
+
+bool CCrossfader::IsAudible(size_t nSlot) const
+{
+	return m_bTargets[nSlot].load(std::memory_order_relaxed) || m_nGains[nSlot].load(std::memory_order_relaxed) > 0.0f;
+}
+
+void CCrossfader::Apply(size_t nSlot, float* pBuffer, size_t nFrames)
+{
+	Process(nSlot, pBuffer, pBuffer, nFrames, false);
+}
+
+void CCrossfader::Mix(size_t nSlot, const float* pInBuffer, float* pOutBuffer, size_t nFrames)
+{
+	Process(nSlot, pInBuffer, pOutBuffer, nFrames, true);
+}
+
+void CCrossfader::Process(size_t nSlot, const float* pInBuffer, float* pOutBuffer, size_t nFrames, bool bAccumulate)
+{
+	const float nTarget = m_bTargets[nSlot].load(std::memory_order_relaxed) ? 1.0f : 0.0f;
+	float nGain = m_nGains[nSlot].load(std::memory_order_relaxed);
+
+	// Settled; avoid per-sample work
+	if (nGain == nTarget)
+	{
+		if (nGain == 0.0f)
+		{
+			if (!bAccumulate)
+				memset(pOutBuffer, 0, nFrames * nChannels * sizeof(float));
+		}
+		else if (bAccumulate)
+		{
+			for (size_t i = 0; i < nFrames * nChannels; ++i)
+				pOutBuffer[i] += pInBuffer[i];
+		}
+
+		return;
+	}
+
+	const float nStep = nTarget > nGain ? m_nStep : -m_nStep;
+
+	for (size_t i = 0; i < nFrames * nChannels; i += nChannels)
+	{
+		if (nGain != nTarget)
+			nGain = nStep > 0.0f ? Utility::Min(nGain + nStep, nTarget) : Utility::Max(nGain + nStep, nTarget);
+
+		if (bAccumulate)
+		{
+			pOutBuffer[i]     += pInBuffer[i] * nGain;
+			pOutBuffer[i + 1] += pInBuffer[i + 1] * nGain;
+		}
+		else
+		{
+			pOutBuffer[i]     = pInBuffer[i] * nGain;
+			pOutBuffer[i + 1] = pInBuffer[i + 1] * nGain;
+		}
+	}
+
+	m_nGains[nSlot].store(nGain, std::memory_order_relaxed);
+}
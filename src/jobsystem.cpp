@@ -0,0 +1,119 @@
+//
+// jobsystem.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include <assert.h>
+
+#include "coreevent.h"
+#include "jobsystem.h"
+
+CJobSystem* CJobSystem::s_pThis = nullptr;
+
+CJobSystem::CJobSystem()
+{
+	assert(s_pThis == nullptr);
+	s_pThis = this;
+}
+
+CJobSystem::~CJobSystem()
+{
+	s_pThis = nullptr;
+}
+
+void CJobSystem::Submit(unsigned nCore, TJob& Job, TPriority Priority)
+{
+	assert(nCore < MaxCores);
+
+	if (Job.pCounter)
+		Job.pCounter->m_nPending.fetch_add(1, std::memory_order_relaxed);
+
+	if (!m_Queues[nCore][static_cast<size_t>(Priority)].Push(&Job))
+	{
+		Execute(&Job);
+		return;
+	}
+
+	Utility::SignalCoreEvent();
+}
+
+bool CJobSystem::RunOne(unsigned nCore, TPriority LowestPriority)
+{
+	assert(nCore < MaxCores);
+
+	for (size_t nPriority = 0; nPriority <= static_cast<size_t>(LowestPriority); ++nPriority)
+	{
+		TJob* pJob;
+
+		// Own work first (most recently submitted, so most likely to be in cache)
+		if (m_Queues[nCore][nPriority].Pop(pJob))
+		{
+			Execute(pJob);
+			return true;
+		}
+
+		// Steal the oldest job from the next busy core along
+		for (size_t i = 1; i < MaxCores; ++i)
+		{
+			if (m_Queues[(nCore + i) % MaxCores][nPriority].Steal(pJob))
+			{
+				Execute(pJob);
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+void CJobSystem::Wait(unsigned nCore, const CCounter& Counter, TPriority LowestPriority)
+{
+	while (!Counter.IsDone())
+	{
+		// A job finishing elsewhere will wake us up
+		if (!RunOne(nCore, LowestPriority))
+			Utility::WaitForCoreEvent();
+	}
+}
+
+void CJobSystem::Run(unsigned nCore, const volatile bool& bRunning, TPriority LowestPriority)
+{
+	while (bRunning)
+	{
+		// A submission since we last looked will have set the event register, so this returns immediately
+		if (!RunOne(nCore, LowestPriority))
+			Utility::WaitForCoreEvent();
+	}
+}
+
+void CJobSystem::Execute(TJob* pJob)
+{
+	// Read before running; the submitter may reuse the job as soon as the counter reaches zero
+	CCounter* const pCounter = pJob->pCounter;
+
+	pJob->pFunction(pJob->pParam);
+
+	if (pCounter)
+	{
+		pCounter->m_nPending.fetch_sub(1, std::memory_order_acq_rel);
+		Utility::SignalCoreEvent();
+	}
+}
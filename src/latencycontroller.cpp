@@ -0,0 +1,71 @@
+//
+// latencycontroller.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "latencycontroller.h"
+#include "utility.h"
+
+CLatencyController::CLatencyController(unsigned int nSampleRate, size_t nMinFrames, size_t nMaxFrames, unsigned int nSafetyMarginMicros)
+	: m_nSampleRate(nSampleRate),
+	  m_nMinFrames(nMinFrames),
+	  m_nMaxFrames(Utility::Max(nMinFrames, nMaxFrames)),
+	  m_nSafetyMarginMicros(nSafetyMarginMicros),
+
+	  // Start from the safe end and work downwards
+	  m_nTargetFrames(m_nMaxFrames),
+	  m_nHeadroomFrames(0)
+{
+}
+
+void CLatencyController::Update(size_t nQueuedFrames, size_t nRenderedFrames, unsigned int nRenderMicros)
+{
+	// Time remaining before the queue would have run dry had nothing been written
+	const unsigned int nDeadlineMicros = FramesToMicros(nQueuedFrames);
+	const unsigned int nSlackMicros = nDeadlineMicros > nRenderMicros ? nDeadlineMicros - nRenderMicros : 0;
+
+	if (nSlackMicros < m_nSafetyMarginMicros)
+	{
+		// Getting too close to an underrun; back off quickly
+		m_nTargetFrames = Utility::Min(m_nTargetFrames + Utility::Max(m_nTargetFrames / 2, m_nMinFrames), m_nMaxFrames);
+		m_nHeadroomFrames = 0;
+		return;
+	}
+
+	// Only reduce latency if shrinking the queue by one step would still leave the safety margin intact
+	const size_t nStepFrames = Utility::Max<size_t>(m_nTargetFrames / 8, 1);
+	if (nSlackMicros < 2 * m_nSafetyMarginMicros + FramesToMicros(nStepFrames))
+	{
+		m_nHeadroomFrames = 0;
+		return;
+	}
+
+	m_nHeadroomFrames += nRenderedFrames;
+	if (m_nHeadroomFrames * 1000 < static_cast<size_t>(m_nSampleRate) * ShrinkHoldMillis)
+		return;
+
+	m_nTargetFrames = m_nTargetFrames > m_nMinFrames + nStepFrames ? m_nTargetFrames - nStepFrames : m_nMinFrames;
+	m_nHeadroomFrames = 0;
+}
+
+unsigned int CLatencyController::FramesToMicros(size_t nFrames) const
+{
+	return static_cast<u64>(nFrames) * 1000000 / m_nSampleRate;
+}
@@ -0,0 +1,204 @@
+//
+// limiter.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <circle/util.h>
+
+#include <assert.h>
+#include <cmath>
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+#include "limiter.h"
+#include "utility.h"
+
+constexpr u8 nChannels = 2;
+
+CLimiter::CLimiter(unsigned int nSampleRate, float nThresholdDB)
+	: m_nThreshold(powf(10.0f, Utility::Min(nThresholdDB, 0.0f) / 20.0f)),
+	  m_nReleaseCoefficient(expf(-1000.0f / (ReleaseMillis * nSampleRate))),
+	  m_nLookAheadFrames(Utility::Max<size_t>(nSampleRate * LookAheadMillis / 1000.0f, 1)),
+	  m_nMaxFrames(0),
+
+	  m_pDelayBuffer(nullptr),
+	  m_pPeaks(nullptr),
+	  m_pGains(nullptr),
+
+	  m_nEnvelope(0.0f),
+	  m_nHoldFrames(0),
+
+	  m_pGainHistory(nullptr),
+	  m_nGainHistoryIndex(0)
+{
+}
+
+CLimiter::~CLimiter()
+{
+	delete[] m_pDelayBuffer;
+	delete[] m_pPeaks;
+	delete[] m_pGains;
+	delete[] m_pGainHistory;
+}
+
+bool CLimiter::Initialize(size_t nMaxFrames)
+{
+	m_nMaxFrames = nMaxFrames;
+	m_pDelayBuffer = new float[(m_nLookAheadFrames + nMaxFrames) * nChannels];
+	m_pPeaks = new float[nMaxFrames];
+	m_pGains = new float[nMaxFrames];
+	m_pGainHistory = new float[m_nLookAheadFrames];
+
+	if (!m_pDelayBuffer || !m_pPeaks || !m_pGains || !m_pGainHistory)
+		return false;
+
+	memset(m_pDelayBuffer, 0, (m_nLookAheadFrames + nMaxFrames) * nChannels * sizeof(float));
+	for (size_t i = 0; i < m_nLookAheadFrames; ++i)
+		m_pGainHistory[i] = 1.0f;
+
+	return true;
+}
+
+void CLimiter::Process(float* pBuffer, size_t nFrames)
+{
+	assert(nFrames <= m_nMaxFrames);
+
+	const size_t nLookAheadSamples = m_nLookAheadFrames * nChannels;
+	const size_t nSamples = nFrames * nChannels;
+	float* const pInput = m_pDelayBuffer + nLookAheadSamples;
+
+	memcpy(pInput, pBuffer, nSamples * sizeof(float));
+
+	// Per-frame peak level; max(|L|, |R|)
+	size_t i = 0;
+#ifdef __ARM_NEON
+	for (; i + 2 <= nFrames; i += 2)
+	{
+		const float32x4_t Samples = vabsq_f32(vld1q_f32(pInput + i * nChannels));
+		vst1_f32(m_pPeaks + i, vpmax_f32(vget_low_f32(Samples), vget_high_f32(Samples)));
+	}
+#endif
+	for (; i < nFrames; ++i)
+		m_pPeaks[i] = Utility::Max(fabsf(pInput[i * nChannels]), fabsf(pInput[i * nChannels + 1]));
+
+	ComputeGains(nFrames);
+
+	// Output the delayed signal, then keep the tail for the next block
+	memcpy(pBuffer, m_pDelayBuffer, nSamples * sizeof(float));
+	memmove(m_pDelayBuffer, m_pDelayBuffer + nSamples, nLookAheadSamples * sizeof(float));
+
+	ApplyGains(pBuffer, nFrames);
+}
+
+void CLimiter::ComputeGains(size_t nFrames)
+{
+	const float nHistoryScale = 1.0f / m_nLookAheadFrames;
+
+	// Resynchronize the running sum each block to stop rounding errors from accumulating
+	float nGainSum = 0.0f;
+	for (size_t i = 0; i < m_nLookAheadFrames; ++i)
+		nGainSum += m_pGainHistory[i];
+
+	for (size_t i = 0; i < nFrames; ++i)
+	{
+		// Instant attack; hold for the look-ahead time so that the smoothed gain fully reaches the target, then release
+		const float nPeak = m_pPeaks[i];
+		if (nPeak >= m_nEnvelope)
+		{
+			m_nEnvelope = nPeak;
+			m_nHoldFrames = m_nLookAheadFrames;
+		}
+		else if (m_nHoldFrames)
+			--m_nHoldFrames;
+		else
+			m_nEnvelope = Utility::Max(nPeak, m_nEnvelope * m_nReleaseCoefficient);
+
+		const float nTargetGain = m_nEnvelope > m_nThreshold ? m_nThreshold / m_nEnvelope : 1.0f;
+
+		// Moving average over the look-ahead window ramps the gain down smoothly before the peak leaves the delay line
+		nGainSum += nTargetGain - m_pGainHistory[m_nGainHistoryIndex];
+		m_pGainHistory[m_nGainHistoryIndex] = nTargetGain;
+		if (++m_nGainHistoryIndex == m_nLookAheadFrames)
+			m_nGainHistoryIndex = 0;
+
+		m_pGains[i] = nGainSum * nHistoryScale;
+	}
+}
+
+void CLimiter::ApplyGains(float* pBuffer, size_t nFrames)
+{
+	// Soft-knee clipper above the threshold catches anything the limiter lets through; the curve
+	// k + (1 - k) * t / (1 + t) has unity slope at the knee and approaches full scale asymptotically
+	const float nKnee = m_nThreshold;
+	const float nKneeRange = 1.0f - nKnee;
+	const float nKneeScale = nKneeRange > 0.0f ? 1.0f / nKneeRange : 0.0f;
+
+	size_t i = 0;
+#ifdef __ARM_NEON
+	const float32x4_t Knee = vdupq_n_f32(nKnee);
+	const float32x4_t KneeRange = vdupq_n_f32(nKneeRange);
+	const float32x4_t KneeScale = vdupq_n_f32(nKneeScale);
+	const float32x4_t One = vdupq_n_f32(1.0f);
+	const uint32x4_t SignMask = vdupq_n_u32(0x80000000);
+
+	for (; i + 2 <= nFrames; i += 2)
+	{
+		float* const pSamples = pBuffer + i * nChannels;
+
+		// Duplicate each frame's gain across both channels
+		const float32x2_t Gains = vld1_f32(m_pGains + i);
+		const float32x4_t FrameGains = vcombine_f32(vdup_lane_f32(Gains, 0), vdup_lane_f32(Gains, 1));
+		const float32x4_t Samples = vmulq_f32(vld1q_f32(pSamples), FrameGains);
+
+		const float32x4_t Magnitude = vabsq_f32(Samples);
+		const float32x4_t Over = vmulq_f32(vmaxq_f32(vsubq_f32(Magnitude, Knee), vdupq_n_f32(0.0f)), KneeScale);
+
+		// Reciprocal estimate refined with one Newton-Raphson step is plenty for this purpose
+		const float32x4_t Denominator = vaddq_f32(One, Over);
+		float32x4_t Reciprocal = vrecpeq_f32(Denominator);
+		Reciprocal = vmulq_f32(Reciprocal, vrecpsq_f32(Denominator, Reciprocal));
+
+		const float32x4_t Clipped = vmlaq_f32(Knee, KneeRange, vmulq_f32(Over, Reciprocal));
+		const float32x4_t NewMagnitude = vbslq_f32(vcgtq_f32(Magnitude, Knee), Clipped, Magnitude);
+
+		// Restore sign
+		const uint32x4_t Sign = vandq_u32(vreinterpretq_u32_f32(Samples), SignMask);
+		vst1q_f32(pSamples, vreinterpretq_f32_u32(vorrq_u32(vreinterpretq_u32_f32(NewMagnitude), Sign)));
+	}
+#endif
+
+	for (; i < nFrames; ++i)
+	{
+		for (size_t j = 0; j < nChannels; ++j)
+		{
+			float& nSample = pBuffer[i * nChannels + j];
+			nSample *= m_pGains[i];
+
+			const float nMagnitude = fabsf(nSample);
+			if (nMagnitude > nKnee)
+			{
+				const float nOver = (nMagnitude - nKnee) * nKneeScale;
+				nSample = copysignf(nKnee + nKneeRange * nOver / (1.0f + nOver), nSample);
+			}
+		}
+	}
+}
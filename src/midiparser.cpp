@@ -29,12 +29,15 @@ LOGMODULE("midiparser");
 CMIDIParser::CMIDIParser()
 	: m_State(TState::StatusByte),
 	  m_MessageBuffer{0},
-	  m_nMessageLength(0)
+	  m_nMessageLength(0),
+	  m_nTimestamp(0)
 {
 }
 
-void CMIDIParser::ParseMIDIBytes(const u8* pData, size_t nSize, bool bIgnoreNoteOns)
+void CMIDIParser::ParseMIDIBytes(const u8* pData, size_t nSize, unsigned int nTimestamp, bool bIgnoreNoteOns)
 {
+	m_nTimestamp = nTimestamp;
+
 	// Process MIDI messages
 	// See: https://www.midi.org/specifications/item/table-1-summary-of-midi-message
 	for (size_t i = 0; i < nSize; ++i)
@@ -47,7 +50,7 @@ void CMIDIParser::ParseMIDIBytes(const u8* pData, size_t nSize, bool bIgnoreNote
 		{
 			// Ignore undefined System Real-Time
 			if (nByte != 0xF9 && nByte != 0xFD)
-				OnShortMessage(nByte);
+				OnShortMessage(nByte, m_nTimestamp);
 
 			continue;
 		}
@@ -99,7 +102,7 @@ void CMIDIParser::ParseMIDIBytes(const u8* pData, size_t nSize, bool bIgnoreNote
 				// End of SysEx
 				if (nByte == 0xF7)
 				{
-					OnSysExMessage(m_MessageBuffer, m_nMessageLength);
+					OnSysExMessage(m_MessageBuffer, m_nMessageLength, m_nTimestamp);
 					ResetState(true);
 				}
 
@@ -142,7 +145,7 @@ void CMIDIParser::ParseStatusByte(u8 nByte)
 
 			// Tune Request - single byte, handle immediately and clear running status
 			case 0xF6:
-				OnShortMessage(nByte);
+				OnShortMessage(nByte, m_nTimestamp);
 				m_MessageBuffer[0] = 0;
 				break;
 
@@ -179,7 +182,7 @@ bool CMIDIParser::CheckCompleteShortMessage(bool bIgnoreNoteOns)
 		const bool bIsNoteOn = (nStatus & 0xF0) == 0x90;
 
 		if (!(bIsNoteOn && bIgnoreNoteOns))
-			OnShortMessage(PrepareShortMessage());
+			OnShortMessage(PrepareShortMessage(), m_nTimestamp);
 
 		// Clear running status if System Common
 		ResetState(nStatus >= 0xF1 && nStatus <= 0xF7);
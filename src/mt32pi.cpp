@@ -22,16 +22,20 @@
 
 #include <circle/memory.h>
 #include <circle/serial.h>
-#include <circle/sound/hdmisoundbasedevice.h>
-#include <circle/sound/i2ssoundbasedevice.h>
-#include <circle/sound/pwmsoundbasedevice.h>
 
 #include <cstdarg>
 
+#include "audio/devicesink.h"
+#include "audio/nullsink.h"
+#include "audio/wavsink.h"
+#include "latencycontroller.h"
+#include "limiter.h"
 #include "lcd/drivers/hd44780.h"
 #include "lcd/drivers/ssd1306.h"
 #include "lcd/ui.h"
 #include "mt32pi.h"
+#include "pcmconverter.h"
+#include "resampler.h"
 
 #define MT32_PI_NAME "mt32-pi"
 LOGMODULE(MT32_PI_NAME);
@@ -44,8 +48,12 @@ constexpr u32 LCDUpdatePeriodMillis                = 16;
 constexpr u32 MisterUpdatePeriodMillis             = 50;
 constexpr u32 LEDTimeoutMillis                     = 50;
 constexpr u32 ActiveSenseTimeoutMillis             = 330;
+constexpr u32 AudioStatsUpdatePeriodMillis         = 1000;
+constexpr u32 CoreLoadReportPeriodMillis           = 10000;
+constexpr u32 CoreWakeupPeriodMicros               = 1000;
 
-constexpr float Sample24BitMax = (1 << 24 - 1) - 1;
+// Matches FluidSynth's internal block size
+constexpr size_t RenderBlockFrames = 64;
 
 enum class TCustomSysExCommand : u8
 {
@@ -83,6 +91,7 @@ CMT32Pi::CMT32Pi(CI2CMaster* pI2CMaster, CSPIMaster* pSPIMaster, CInterruptSyste
 	  m_bNetworkReady(false),
 	  m_pAppleMIDIParticipant(nullptr),
 	  m_pUDPMIDIReceiver(nullptr),
+	  m_pSecondMT32UDPReceiver(nullptr),
 	  m_pFTPDaemon(nullptr),
 
 	  m_pLCD(nullptr),
@@ -99,6 +108,10 @@ CMT32Pi::CMT32Pi(CI2CMaster* pI2CMaster, CSPIMaster* pSPIMaster, CInterruptSyste
 	  m_nDeferredSoundFontSwitchIndex(0),
 	  m_nDeferredSoundFontSwitchTime(0),
 
+	  m_SoundFontSwitchState(TSoundFontSwitchState::Idle),
+	  m_nSoundFontSwitchIndex(0),
+	  m_nSoundFontSwitchFadeTime(0),
+
 	  m_bSerialMIDIAvailable(false),
 	  m_bSerialMIDIEnabled(false),
 	  m_pUSBMIDIDevice(nullptr),
@@ -108,18 +121,43 @@ CMT32Pi::CMT32Pi(CI2CMaster* pI2CMaster, CSPIMaster* pSPIMaster, CInterruptSyste
 	  m_bActiveSenseFlag(false),
 	  m_nActiveSenseTime(0),
 
+	  m_bInitialized(false),
+	  m_bBootComplete(false),
 	  m_bRunning(true),
 	  m_bUITaskDone(false),
+
+	  m_nTaskSwitches(0),
+
 	  m_bLEDOn(false),
 	  m_nLEDOnTime(0),
 
-	  m_pSound(nullptr),
+	  m_pAudioSink(nullptr),
+	  m_nAudioStatsUpdateTime(0),
+	  m_nCoreLoadReportTime(0),
+	  m_nAudioProblemCount(0),
+	  m_nPolyphonyCap(0),
+	  m_bEffectsSendsWarned(false),
 	  m_pPisound(nullptr),
 
 	  m_nMasterVolume(100),
 	  m_pCurrentSynth(nullptr),
 	  m_pMT32Synth(nullptr),
-	  m_pSoundFontSynth(nullptr)
+	  m_pSoundFontSynth(nullptr),
+
+	  m_pFadingSynth(nullptr),
+	  m_bSoundFontOnAuxCore(false),
+
+	  m_bLayered(false),
+	  m_nLayerMT32Channels(0),
+	  m_pLayerWorker(nullptr),
+
+	  m_pSecondMT32Synth(nullptr),
+	  m_pSecondMT32Worker(nullptr),
+	  m_SecondMT32Port(this),
+	  m_bSecondMT32Serial(false),
+
+	  m_nSerialMIDIReadTime(0),
+	  m_nUSBSerialMIDIReadTime(0)
 {
 	s_pThis = this;
 }
@@ -178,103 +216,89 @@ bool CMT32Pi::Initialize(bool bSerialMIDIAvailable)
 		}
 	}
 
-#if !defined(__aarch64__) || !defined(LEAVE_QEMU_ON_HALT)
-	// The USB driver is not supported under 64-bit QEMU, so
-	// the initialization must be skipped in this case, or an
-	// exit happens here under 64-bit QEMU.
-	LCDLog(TLCDLogType::Startup, "Init USB");
-	if (m_pConfig->SystemUSB && m_pUSBHCI->Initialize())
-	{
-		m_bUSBAvailable = true;
+	// Bring up the default synth (both in layered mode), MIDI inputs and audio first; everything else is deferred
+	// until we're already playing. Stages that touch devices or storage stay on core 0; opening mt32emu is pure
+	// computation and can run anywhere
+	const bool bMT32First = m_pConfig->SystemLayered || m_pConfig->SystemDefaultSynth == CConfig::TSystemDefaultSynth::MT32;
+	const bool bSoundFontFirst = m_pConfig->SystemLayered || m_pConfig->SystemDefaultSynth == CConfig::TSystemDefaultSynth::SoundFont;
 
-		// Perform an initial Plug and Play update to initialize devices early
-		UpdateUSB(true);
+	CBootGraph::TStageMask MT32ROMs = 0;
+	if (bMT32First)
+	{
+		MT32ROMs = m_BootGraph.AddStage("MT-32 ROMs", [](void* p) {
+			CMT32Pi* pThis = static_cast<CMT32Pi*>(p);
+			pThis->LCDLog(TLCDLogType::Startup, "Init mt32emu");
+			pThis->m_pMT32Synth.store(pThis->LoadMT32ROMs(pThis->m_pConfig->MT32EmuROMSet), std::memory_order_release);
+		}, this);
+
+		m_BootGraph.AddStage("mt32emu", [](void* p) {
+			CMT32Pi* pThis = static_cast<CMT32Pi*>(p);
+
+			// May run on another core; the other cores' tasks don't look at the synth until initialization has finished
+			CMT32Synth* const pMT32Synth = pThis->m_pMT32Synth.load(std::memory_order_acquire);
+			if (!pMT32Synth)
+				return;
+
+			if (pThis->OpenMT32Synth(pMT32Synth))
+				pMT32Synth->SetUserInterface(&pThis->m_UserInterface);
+			else
+				pThis->m_pMT32Synth.store(nullptr, std::memory_order_release);
+		}, this, MT32ROMs, true);
 	}
-#endif
 
-	LCDLog(TLCDLogType::Startup, "Init Network");
-	InitNetwork();
+	// Layered mode already gives core 3 to FluidSynth
+	const bool bSecondMT32 = m_pConfig->MT32EmuSecondInstance && !m_pConfig->SystemLayered;
+	if (m_pConfig->MT32EmuSecondInstance && m_pConfig->SystemLayered)
+		LOGWARN("Second mt32emu instance unavailable in layered mode; disabled");
 
-	// Check for Blokas Pisound, but only when not using 4-bit HD44780 (GPIO pin conflict)
-	if (m_pConfig->LCDType != CConfig::TLCDType::HD44780FourBit)
+	CBootGraph::TStageMask SecondMT32ROMs = 0;
+	if (bSecondMT32)
 	{
-		m_pPisound = new CPisound(m_pSPIMaster, m_pGPIOManager, m_pConfig->AudioSampleRate);
-		if (m_pPisound->Initialize())
-		{
-			LOGWARN("Blokas Pisound detected");
-			m_pPisound->RegisterMIDIReceiveHandler(IRQMIDIReceiveHandler);
-			m_bSerialMIDIEnabled = false;
-		}
-		else
-		{
-			delete m_pPisound;
-			m_pPisound = nullptr;
-		}
+		SecondMT32ROMs = m_BootGraph.AddStage("MT-32 #2 ROMs", [](void* p) {
+			CMT32Pi* pThis = static_cast<CMT32Pi*>(p);
+			pThis->m_pSecondMT32Synth = pThis->LoadMT32ROMs(pThis->m_pConfig->MT32EmuSecondROMSet);
+		}, this);
+
+		m_BootGraph.AddStage("mt32emu #2", [](void* p) {
+			CMT32Pi* pThis = static_cast<CMT32Pi*>(p);
+			if (pThis->m_pSecondMT32Synth && !pThis->OpenMT32Synth(pThis->m_pSecondMT32Synth))
+				pThis->m_pSecondMT32Synth = nullptr;
+		}, this, SecondMT32ROMs, true);
 	}
 
-	// Queue size of just one chunk
-	unsigned int nQueueSize = m_pConfig->AudioChunkSize;
-	TSoundFormat Format = TSoundFormat::SoundFormatSigned24;
-
-	switch (m_pConfig->AudioOutputDevice)
+	// Knowing that ROMs were found is enough to decide whether layered mode or the second instance will claim core 3
+	if (bSoundFontFirst)
 	{
-		case CConfig::TAudioOutputDevice::PWM:
-			LCDLog(TLCDLogType::Startup, "Init audio (PWM)");
-			m_pSound = new CPWMSoundBaseDevice(m_pInterrupt, m_pConfig->AudioSampleRate, m_pConfig->AudioChunkSize);
-			break;
-
-		case CConfig::TAudioOutputDevice::HDMI:
-		{
-			LCDLog(TLCDLogType::Startup, "Init audio (HDMI)");
-
-			// Chunk size must be a multiple of 384
-			const unsigned int nChunkSize = Utility::RoundToNearestMultiple(m_pConfig->AudioChunkSize, IEC958_SUBFRAMES_PER_BLOCK);
-			nQueueSize = nChunkSize;
-
-			m_pSound = new CHDMISoundBaseDevice(m_pInterrupt, m_pConfig->AudioSampleRate, nChunkSize);
-			break;
-		}
-
-		case CConfig::TAudioOutputDevice::I2S:
-		{
-			LCDLog(TLCDLogType::Startup, "Init audio (I2S)");
-
-			// Pisound provides clock
-			const bool bSlave = m_pPisound != nullptr;
-
-			// Don't probe if using Pisound
-			CI2CMaster* const pI2CMaster = bSlave ? nullptr : m_pI2CMaster;
-
-			m_pSound = new CI2SSoundBaseDevice(m_pInterrupt, m_pConfig->AudioSampleRate, m_pConfig->AudioChunkSize, bSlave, pI2CMaster);
-			Format = TSoundFormat::SoundFormatSigned24_32;
-
-			break;
-		}
+		m_BootGraph.AddStage("FluidSynth", [](void* p) {
+			CMT32Pi* pThis = static_cast<CMT32Pi*>(p);
+			pThis->LCDLog(TLCDLogType::Startup, "Init FluidSynth");
+			pThis->InitSoundFontSynth();
+		}, this, MT32ROMs | SecondMT32ROMs);
 	}
 
-	m_pSound->SetWriteFormat(Format);
-	if (!m_pSound->AllocateQueueFrames(nQueueSize))
-		LOGPANIC("Failed to allocate sound queue");
+	CBootGraph::TStageMask Pisound = m_BootGraph.AddStage("Pisound", [](void* p) { static_cast<CMT32Pi*>(p)->InitPisound(); }, this);
+	m_BootGraph.AddStage("Audio", [](void* p) { static_cast<CMT32Pi*>(p)->InitAudio(); }, this, Pisound);
+	m_BootGraph.AddStage("Controls", [](void* p) { static_cast<CMT32Pi*>(p)->InitControls(); }, this);
 
-	LCDLog(TLCDLogType::Startup, "Init controls");
-	if (m_pConfig->ControlScheme == CConfig::TControlScheme::SimpleButtons)
-		m_pControl = new CControlSimpleButtons(m_EventQueue);
-	else if (m_pConfig->ControlScheme == CConfig::TControlScheme::SimpleEncoder)
-		m_pControl = new CControlSimpleEncoder(m_EventQueue, m_pConfig->ControlEncoderType, m_pConfig->ControlEncoderReversed);
+	// Start the other cores early so that they can help with boot; they wait for initialization to finish before
+	// starting their own tasks
+	if (!CMultiCoreSupport::Initialize())
+		return false;
 
-	if (m_pControl && !m_pControl->Initialize())
+	m_BootGraph.Run(0);
+	m_BootGraph.LogTimings();
+
+	// The only ROMs/SoundFonts may be on a USB disk; bring up USB and whatever else we can before giving up
+	bool bUSBInitialized = false;
+	if (!m_pMT32Synth && !m_pSoundFontSynth)
 	{
-		LOGWARN("Control init failed");
-		delete m_pControl;
-		m_pControl = nullptr;
+		LOGWARN("Default synth unavailable; initializing USB and remaining synths");
+		LCDLog(TLCDLogType::Startup, "Init USB");
+		InitUSB();
+		bUSBInitialized = true;
+		InitDeferredSynths();
 	}
 
-	LCDLog(TLCDLogType::Startup, "Init mt32emu");
-	InitMT32Synth();
-
-	LCDLog(TLCDLogType::Startup, "Init FluidSynth");
-	InitSoundFontSynth();
-
 	// Set initial synthesizer
 	if (m_pConfig->SystemDefaultSynth == CConfig::TSystemDefaultSynth::MT32)
 		m_pCurrentSynth = m_pMT32Synth;
@@ -297,6 +321,36 @@ bool CMT32Pi::Initialize(bool bSerialMIDIAvailable)
 		}
 	}
 
+	if (m_pConfig->SystemLayered)
+	{
+		if (m_pMT32Synth && m_pSoundFontSynth)
+		{
+			m_pLayerWorker = new CRenderWorker(m_pSoundFontSynth, m_pAudioSink->GetSampleRate());
+			if (m_pLayerWorker->Initialize(m_pAudioSink->GetQueueSizeFrames()))
+			{
+				m_bLayered = true;
+				m_nLayerMT32Channels = m_pConfig->SystemLayerMT32Channels;
+				LOGNOTE("Layered mode enabled (mt32emu channel mask: 0x%04x)", m_nLayerMT32Channels);
+			}
+			else
+			{
+				LOGERR("Failed to initialize layer renderer");
+				delete m_pLayerWorker;
+				m_pLayerWorker = nullptr;
+			}
+		}
+		else
+			LOGWARN("Layered mode requires both synths; disabled");
+	}
+
+	if (m_pSecondMT32Synth)
+		InitSecondMT32Synth();
+
+	// Start with the initial synth (or both in layered mode) fully audible
+	m_Crossfader.Initialize(m_pAudioSink->GetSampleRate(), Utility::Max(m_pConfig->SystemCrossfadeTime, 0));
+	m_Crossfader.Reset(TSynth::MT32, m_bLayered || m_pCurrentSynth == m_pMT32Synth);
+	m_Crossfader.Reset(TSynth::SoundFont, m_bLayered || m_pCurrentSynth == m_pSoundFontSynth);
+
 	if (m_pPisound)
 		LOGNOTE("Using Pisound MIDI interface");
 	else if (m_bSerialMIDIEnabled)
@@ -310,15 +364,42 @@ bool CMT32Pi::Initialize(bool bSerialMIDIAvailable)
 		m_pLCD->Clear();
 
 	// Start audio
-	m_pSound->Start();
+	m_pAudioSink->Start();
 
-	// Start other cores
-	if (!CMultiCoreSupport::Initialize())
-		return false;
+	// Release the other cores to start their tasks
+	m_bInitialized = true;
+	Utility::SignalCoreEvent();
+
+	// The system timer starts counting at power-on
+	LOGNOTE("Ready to play after %dms", Utility::TicksToMillis(CTimer::GetClockTicks()));
+
+	// Bring up the rest in the background; the main task reports when it's all done
+	CBootGraph::TStageMask USB = 0;
+	if (!bUSBInitialized)
+		USB = m_DeferredBootGraph.AddStage("USB", [](void* p) { static_cast<CMT32Pi*>(p)->InitDeferredUSB(); }, this);
+	m_DeferredBootGraph.AddStage("Network", [](void* p) { static_cast<CMT32Pi*>(p)->InitNetwork(); }, this);
+	m_DeferredBootGraph.AddStage("Other synth", [](void* p) { static_cast<CMT32Pi*>(p)->InitDeferredSynths(); }, this, USB);
+	m_DeferredBootGraph.RunInBackground();
 
 	return true;
 }
 
+void CMT32Pi::InitUSB()
+{
+#if !defined(__aarch64__) || !defined(LEAVE_QEMU_ON_HALT)
+	// The USB driver is not supported under 64-bit QEMU, so
+	// the initialization must be skipped in this case, or an
+	// exit happens here under 64-bit QEMU.
+	if (m_pConfig->SystemUSB && m_pUSBHCI->Initialize())
+	{
+		m_bUSBAvailable = true;
+
+		// Perform an initial Plug and Play update to initialize devices early
+		UpdateUSB(true);
+	}
+#endif
+}
+
 bool CMT32Pi::InitNetwork()
 {
 	assert(m_pNet == nullptr);
@@ -367,27 +448,150 @@ bool CMT32Pi::InitNetwork()
 	return m_pNet != nullptr;
 }
 
+void CMT32Pi::InitPisound()
+{
+	// Check for Blokas Pisound, but only when not using 4-bit HD44780 (GPIO pin conflict)
+	if (m_pConfig->LCDType != CConfig::TLCDType::HD44780FourBit)
+	{
+		m_pPisound = new CPisound(m_pSPIMaster, m_pGPIOManager, m_pConfig->AudioSampleRate);
+		if (m_pPisound->Initialize())
+		{
+			LOGWARN("Blokas Pisound detected");
+			m_pPisound->RegisterMIDIReceiveHandler(IRQMIDIReceiveHandler);
+			m_bSerialMIDIEnabled = false;
+		}
+		else
+		{
+			delete m_pPisound;
+			m_pPisound = nullptr;
+		}
+	}
+}
+
+void CMT32Pi::InitAudio()
+{
+	const unsigned int nSampleRate = m_pConfig->AudioSampleRate;
+	const unsigned int nChunkSize = m_pConfig->AudioChunkSize;
+
+	switch (m_pConfig->AudioOutputDevice)
+	{
+		case CConfig::TAudioOutputDevice::PWM:
+			LCDLog(TLCDLogType::Startup, "Init audio (PWM)");
+			m_pAudioSink = new CSoundDeviceSink(m_pInterrupt, CConfig::TAudioOutputDevice::PWM, nSampleRate, nChunkSize);
+			break;
+
+		case CConfig::TAudioOutputDevice::HDMI:
+			LCDLog(TLCDLogType::Startup, "Init audio (HDMI)");
+			m_pAudioSink = new CSoundDeviceSink(m_pInterrupt, CConfig::TAudioOutputDevice::HDMI, nSampleRate, nChunkSize);
+			break;
+
+		case CConfig::TAudioOutputDevice::I2S:
+		{
+			LCDLog(TLCDLogType::Startup, "Init audio (I2S)");
+
+			// Pisound provides clock
+			const bool bSlave = m_pPisound != nullptr;
+
+			// Don't probe if using Pisound
+			CI2CMaster* const pI2CMaster = bSlave ? nullptr : m_pI2CMaster;
+
+			m_pAudioSink = new CSoundDeviceSink(m_pInterrupt, CConfig::TAudioOutputDevice::I2S, nSampleRate, nChunkSize, bSlave, pI2CMaster);
+			break;
+		}
+
+		case CConfig::TAudioOutputDevice::Null:
+			LCDLog(TLCDLogType::Startup, "Init audio (null)");
+			m_pAudioSink = new CNullSink(nSampleRate, nChunkSize / 2);
+			break;
+
+		case CConfig::TAudioOutputDevice::WAV:
+			LCDLog(TLCDLogType::Startup, "Init audio (WAV)");
+			m_pAudioSink = new CWAVSink(nSampleRate, nChunkSize / 2, m_pConfig->AudioWAVPath);
+			break;
+	}
+
+	// Leave room for the latency controller to grow the queue
+	const size_t nMinQueueSizeFrames = m_pConfig->AudioAdaptiveLatency ? m_pConfig->AudioLatencyMax : 0;
+	if (!m_pAudioSink->Initialize(nMinQueueSizeFrames))
+		LOGPANIC("Failed to initialize audio output");
+}
+
+void CMT32Pi::InitControls()
+{
+	LCDLog(TLCDLogType::Startup, "Init controls");
+	if (m_pConfig->ControlScheme == CConfig::TControlScheme::SimpleButtons)
+		m_pControl = new CControlSimpleButtons(m_EventQueue);
+	else if (m_pConfig->ControlScheme == CConfig::TControlScheme::SimpleEncoder)
+		m_pControl = new CControlSimpleEncoder(m_EventQueue, m_pConfig->ControlEncoderType, m_pConfig->ControlEncoderReversed);
+
+	if (m_pControl && !m_pControl->Initialize())
+	{
+		LOGWARN("Control init failed");
+		delete m_pControl;
+		m_pControl = nullptr;
+	}
+}
+
+unsigned int CMT32Pi::GetRenderRate(int nConfigRenderRate) const
+{
+	const unsigned int nOutputRate = m_pConfig->AudioSampleRate;
+	if (nConfigRenderRate <= 0)
+		return nOutputRate;
+
+	if (!CResampler::IsRatioSupported(nConfigRenderRate, nOutputRate))
+	{
+		LOGWARN("Can't resample from %dHz to %dHz; rendering at output rate", nConfigRenderRate, nOutputRate);
+		return nOutputRate;
+	}
+
+	return nConfigRenderRate;
+}
+
 bool CMT32Pi::InitMT32Synth()
 {
 	assert(m_pMT32Synth == nullptr);
 
-	m_pMT32Synth = new CMT32Synth(m_pConfig->AudioSampleRate, m_pConfig->MT32EmuGain, m_pConfig->MT32EmuReverbGain, m_pConfig->MT32EmuResamplerQuality);
-	if (!m_pMT32Synth->Initialize())
+	// Other tasks may already be running, so only publish the synth once it's ready
+	CMT32Synth* pMT32Synth = LoadMT32ROMs(m_pConfig->MT32EmuROMSet);
+	if (!pMT32Synth || !OpenMT32Synth(pMT32Synth))
+		return false;
+
+	pMT32Synth->SetUserInterface(&m_UserInterface);
+	pMT32Synth->SetMasterVolume(m_nMasterVolume);
+	m_pMT32Synth.store(pMT32Synth, std::memory_order_release);
+
+	return true;
+}
+
+CMT32Synth* CMT32Pi::LoadMT32ROMs(TMT32ROMSet PreferredROMSet)
+{
+	CMT32Synth* pMT32Synth = new CMT32Synth(GetRenderRate(m_pConfig->MT32EmuRenderRate), m_pConfig->MT32EmuGain, m_pConfig->MT32EmuReverbGain, m_pConfig->MT32EmuResamplerQuality);
+	if (!pMT32Synth->LoadROMs(PreferredROMSet))
 	{
 		LOGWARN("mt32emu init failed; no ROMs present?");
-		delete m_pMT32Synth;
-		m_pMT32Synth = nullptr;
+		delete pMT32Synth;
+		return nullptr;
+	}
+
+	return pMT32Synth;
+}
+
+bool CMT32Pi::OpenMT32Synth(CMT32Synth* pMT32Synth)
+{
+	// May run on any core; must not touch devices or storage
+	if (!pMT32Synth->Open())
+	{
+		LOGWARN("mt32emu failed to open");
+		delete pMT32Synth;
 		return false;
 	}
 
 	// Set initial MT-32 channel assignment from config
 	if (m_pConfig->MT32EmuMIDIChannels == CMT32Synth::TMIDIChannels::Alternate)
-		m_pMT32Synth->SetMIDIChannels(m_pConfig->MT32EmuMIDIChannels);
+		pMT32Synth->SetMIDIChannels(m_pConfig->MT32EmuMIDIChannels);
 
 	// Set MT-32 reversed stereo option from config
-	m_pMT32Synth->SetReversedStereo(m_pConfig->MT32EmuReversedStereo);
-
-	m_pMT32Synth->SetUserInterface(&m_UserInterface);
+	pMT32Synth->SetReversedStereo(m_pConfig->MT32EmuReversedStereo);
 
 	return true;
 }
@@ -396,32 +600,107 @@ bool CMT32Pi::InitSoundFontSynth()
 {
 	assert(m_pSoundFontSynth == nullptr);
 
-	m_pSoundFontSynth = new CSoundFontSynth(m_pConfig->AudioSampleRate);
-	if (!m_pSoundFontSynth->Initialize())
+	// Core 3 has one job; in order of precedence: layered mode or the second mt32emu instance, FluidSynth voices, FluidSynth effects
+	const bool bAuxCoreFree = !(m_pConfig->SystemLayered && m_pMT32Synth) && !m_pSecondMT32Synth;
+	const bool bMultiCore = bAuxCoreFree && m_pConfig->FluidSynthCPUCores > 1;
+	const bool bEffectsCore = bAuxCoreFree && !bMultiCore && m_pConfig->FluidSynthEffectsCore;
+	m_bSoundFontOnAuxCore = bMultiCore || bEffectsCore;
+
+	// Other tasks may already be running, so only publish the synth once it's ready
+	CSoundFontSynth* pSoundFontSynth = new CSoundFontSynth(GetRenderRate(m_pConfig->FluidSynthRenderRate), bMultiCore ? &m_AuxCore : nullptr, bEffectsCore ? &m_AuxCore : nullptr);
+	if (!pSoundFontSynth->Initialize())
 	{
 		LOGWARN("FluidSynth init failed; no SoundFonts present?");
-		delete m_pSoundFontSynth;
-		m_pSoundFontSynth = nullptr;
+		delete pSoundFontSynth;
 		return false;
 	}
 
-	m_pSoundFontSynth->SetUserInterface(&m_UserInterface);
+	pSoundFontSynth->SetUserInterface(&m_UserInterface);
+	pSoundFontSynth->SetMasterVolume(m_nMasterVolume);
+	m_pSoundFontSynth.store(pSoundFontSynth, std::memory_order_release);
 
 	return true;
 }
 
+void CMT32Pi::InitSecondMT32Synth()
+{
+	m_pSecondMT32Worker = new CRenderWorker(m_pSecondMT32Synth, m_pAudioSink->GetSampleRate());
+	if (!m_pSecondMT32Worker->Initialize(m_pAudioSink->GetQueueSizeFrames()))
+	{
+		LOGERR("Failed to initialize second mt32emu renderer");
+		delete m_pSecondMT32Worker;
+		m_pSecondMT32Worker = nullptr;
+		delete m_pSecondMT32Synth;
+		m_pSecondMT32Synth = nullptr;
+		return;
+	}
+
+	m_pSecondMT32Synth->SetMasterVolume(m_nMasterVolume);
+
+	// Take the GPIO serial port away from the main synth
+	if (m_pConfig->MT32EmuSecondInput == CConfig::TMT32EmuSecondInput::Serial)
+	{
+		if (m_bSerialMIDIAvailable)
+		{
+			m_bSecondMT32Serial = true;
+			m_bSerialMIDIAvailable = false;
+			m_bSerialMIDIEnabled = false;
+		}
+		else
+			LOGWARN("Serial port unavailable; second mt32emu instance has no input");
+	}
+
+	LOGNOTE("Second mt32emu instance enabled");
+}
+
+void CMT32Pi::InitDeferredUSB()
+{
+	InitUSB();
+
+	// Synths brought up before USB only saw the SD card
+	if (m_pUSBMassStorageDevice)
+	{
+		if (m_pMT32Synth)
+			m_pMT32Synth.load()->GetROMManager().ScanROMs();
+		if (m_pSecondMT32Synth)
+			m_pSecondMT32Synth->GetROMManager().ScanROMs();
+		if (m_pSoundFontSynth)
+			m_pSoundFontSynth.load()->GetSoundFontManager().ScanSoundFonts();
+	}
+}
+
+void CMT32Pi::InitDeferredSynths()
+{
+	if (!m_pMT32Synth)
+		InitMT32Synth();
+	if (!m_pSoundFontSynth)
+		InitSoundFontSynth();
+}
+
 void CMT32Pi::MainTask()
 {
 	CScheduler* const pScheduler = CScheduler::Get();
 
 	LOGNOTE("Main task on Core 0 starting up");
 
+	pScheduler->RegisterTaskSwitchHandler(TaskSwitchHandler);
+
 	Awaken();
 
 	while (m_bRunning)
 	{
 		// Process MIDI data
-		UpdateMIDI();
+		bool bMIDIReceived = UpdateMIDI();
+		if (m_pSecondMT32Synth)
+			bMIDIReceived |= UpdateSecondMT32MIDI();
+
+		// Report once everything deferred at boot has come up
+		if (!m_bBootComplete && m_DeferredBootGraph.IsDone())
+		{
+			LOGNOTE("Fully ready after %dms", Utility::TicksToMillis(CTimer::GetClockTicks()));
+			m_DeferredBootGraph.LogTimings();
+			m_bBootComplete = true;
+		}
 
 		// Process network packets
 		UpdateNetwork();
@@ -445,13 +724,13 @@ void CMT32Pi::MainTask()
 		// Check for active sensing timeout
 		if (m_bActiveSenseFlag && (nTicks > m_nActiveSenseTime) && (nTicks - m_nActiveSenseTime) >= MSEC2HZ(ActiveSenseTimeoutMillis))
 		{
-			m_pCurrentSynth->AllSoundOff();
+			AllSoundOff();
 			m_bActiveSenseFlag = false;
 			LOGNOTE("Active sense timeout - turning notes off");
 		}
 
 		// Update power management
-		if (m_pCurrentSynth->IsActive())
+		if (m_pCurrentSynth->IsActive() || (m_bLayered && (m_pMT32Synth.load()->IsActive() || m_pSoundFontSynth.load()->IsActive())) || (m_pSecondMT32Synth && m_pSecondMT32Synth->IsActive()))
 			Awaken();
 
 #ifdef MONITOR_TEMPERATURE
@@ -464,10 +743,53 @@ void CMT32Pi::MainTask()
 		}
 #endif
 
+		// Report audio problems
+		if (nTicks - m_nAudioStatsUpdateTime >= MSEC2HZ(AudioStatsUpdatePeriodMillis))
+		{
+			UpdateAudioStats();
+			m_nAudioStatsUpdateTime = nTicks;
+		}
+
+		// Report per-core load
+		if (m_pConfig->SystemVerbose && nTicks - m_nCoreLoadReportTime >= MSEC2HZ(CoreLoadReportPeriodMillis))
+		{
+			u8 Utilization[CORES];
+			m_CoreLoad.GetUtilization(Utilization);
+			LOGNOTE("Core load: %d%% %d%% %d%% %d%%", Utilization[0], Utilization[1], Utilization[2], Utilization[3]);
+
+			CSampleCache::TStats SampleCacheStats;
+			if (m_pSoundFontSynth && m_pSoundFontSynth.load()->GetSampleCacheStats(SampleCacheStats))
+			{
+				LOGNOTE("Sample cache: %d hits, %d misses, %dms paging in (worst %dms), %d unavailable; %ld/%ld MB resident",
+					SampleCacheStats.nHits, SampleCacheStats.nMisses, SampleCacheStats.nTotalStallMillis, SampleCacheStats.nWorstStallMillis,
+					SampleCacheStats.nUnavailable, SampleCacheStats.nResidentBytes / MEGABYTE, SampleCacheStats.nBudgetBytes / MEGABYTE);
+				LOGNOTE("Sample prefetch: %d jobs, %dus average (worst %dus), %d notes before prefetch finished",
+					SampleCacheStats.nPrefetches, SampleCacheStats.nAveragePrefetchMicros, SampleCacheStats.nWorstPrefetchMicros,
+					SampleCacheStats.nLatePrefetches);
+			}
+
+			m_nCoreLoadReportTime = nTicks;
+		}
+
 		CPower::Update();
 
-		// Check for deferred SoundFont switch
-		if (m_bDeferredSoundFontSwitchFlag)
+		// Once the previous synth has faded out, stop it so that it doesn't resume its tails if switched back to
+		if (m_pFadingSynth && m_Crossfader.IsSettled(m_pFadingSynth == m_pMT32Synth ? TSynth::MT32 : TSynth::SoundFont))
+		{
+			m_pFadingSynth->AllSoundOff();
+			m_pFadingSynth = nullptr;
+		}
+
+		// Pass on MIDI held back while samples were paged in; keep going rather than sleep until the page-in has finished
+		CSoundFontSynth* const pSoundFontSynth = m_pSoundFontSynth;
+		const bool bPaging = pSoundFontSynth && pSoundFontSynth->UpdatePaging();
+
+		// Advance any SoundFont switch; the new SoundFont loads in the background, and fades happen on the audio core
+		if (pSoundFontSynth)
+			UpdateSoundFontSwitch(CTimer::GetClockTicks());
+
+		// Check for deferred SoundFont switch; one that's still fading out has to finish first
+		if (m_bDeferredSoundFontSwitchFlag && m_SoundFontSwitchState == TSoundFontSwitchState::Idle)
 		{
 			// Delay switch if scrolling a long SoundFont name
 			if (m_UserInterface.IsScrolling())
@@ -486,12 +808,18 @@ void CMT32Pi::MainTask()
 		UpdateUSB();
 
 		// Allow other tasks to run
+		const unsigned int nTaskSwitches = m_nTaskSwitches;
 		pScheduler->Yield();
+
+		// Sleep until the next interrupt, event from another core, or periodic wake-up. More MIDI may be waiting though,
+		// and if other tasks ran (e.g. network, page-in or WAV writer), they may have more to do; don't hold them up.
+		if (!bMIDIReceived && !bPaging && m_nTaskSwitches == nTaskSwitches)
+			Utility::WaitForCoreEvent();
 	}
 
 
 	// Stop audio
-	m_pSound->Cancel();
+	m_pAudioSink->Cancel();
 
 	// Wait for UI task to finish
 	while (!m_bUITaskDone)
@@ -504,9 +832,10 @@ void CMT32Pi::UITask()
 
 	const bool bMisterEnabled = m_pConfig->ControlMister;
 
-	// Nothing for this core to do; bail out
+	// Nothing else for this core to do; just run jobs
 	if (!(m_pLCD || bMisterEnabled))
 	{
+		m_JobSystem.Run(1, m_bRunning);
 		m_bUITaskDone = true;
 		return;
 	}
@@ -530,20 +859,28 @@ void CMT32Pi::UITask()
 		{
 			TMisterStatus Status{TMisterSynth::Unknown, 0xFF, 0xFF};
 
-			if (m_pCurrentSynth == m_pMT32Synth)
+			// Synths may be published by core 0 at any time
+			CMT32Synth* const pMT32Synth = m_pMT32Synth.load(std::memory_order_acquire);
+			CSoundFontSynth* const pSoundFontSynth = m_pSoundFontSynth.load(std::memory_order_acquire);
+
+			if (m_pCurrentSynth == pMT32Synth)
 				Status.Synth = TMisterSynth::MT32;
-			else if (m_pCurrentSynth == m_pSoundFontSynth)
+			else if (m_pCurrentSynth == pSoundFontSynth)
 				Status.Synth = TMisterSynth::SoundFont;
 
-			if (m_pMT32Synth)
-				Status.MT32ROMSet = static_cast<u8>(m_pMT32Synth->GetROMSet());
+			if (pMT32Synth)
+				Status.MT32ROMSet = static_cast<u8>(pMT32Synth->GetROMSet());
 
-			if (m_pSoundFontSynth)
-				Status.SoundFontIndex = m_pSoundFontSynth->GetSoundFontIndex();
+			if (pSoundFontSynth)
+				Status.SoundFontIndex = pSoundFontSynth->GetSoundFontIndex();
 
 			m_MisterControl.Update(Status);
 			m_nMisterUpdateTime = nTicks;
 		}
+
+		// Use spare time between updates, otherwise sleep until the next periodic wake-up
+		if (!m_JobSystem.RunOne(1))
+			Utility::WaitForCoreEvent();
 	}
 
 	// Clear screen
@@ -553,60 +890,323 @@ void CMT32Pi::UITask()
 	m_bUITaskDone = true;
 }
 
+// Renders a synth at the output rate; may be run on another core
+struct TRenderJob
+{
+	CSynthBase* pSynth;
+	CResampler* pResampler;
+	float* pOutBuffer;
+	size_t nFrames;
+};
+
+static void RenderSynth(void* pParam)
+{
+	const TRenderJob& Job = *static_cast<const TRenderJob*>(pParam);
+
+	if (Job.pResampler->IsBypassed())
+		Job.pSynth->Render(Job.pOutBuffer, Job.nFrames);
+	else
+	{
+		Job.pSynth->Render(Job.pResampler->GetInputBuffer(), Job.pResampler->GetInputFrames(Job.nFrames));
+		Job.pResampler->Process(Job.pOutBuffer, Job.nFrames);
+	}
+}
+
+// Adds the second mt32emu instance to the output, either mixed in or with each instance summed to mono on its own side
+static void MixSecondMT32(const float* pInBuffer, float* pOutBuffer, size_t nFrames, bool bSplit)
+{
+	if (bSplit)
+	{
+		for (size_t i = 0; i < nFrames * 2; i += 2)
+		{
+			pOutBuffer[i] = (pOutBuffer[i] + pOutBuffer[i + 1]) * 0.5f;
+			pOutBuffer[i + 1] = (pInBuffer[i] + pInBuffer[i + 1]) * 0.5f;
+		}
+	}
+	else
+	{
+		for (size_t i = 0; i < nFrames * 2; ++i)
+			pOutBuffer[i] += pInBuffer[i];
+	}
+}
+
 void CMT32Pi::AudioTask()
 {
 	LOGNOTE("Audio task on Core 2 starting up");
 
+	m_AudioTelemetry.EnableCycleCounter();
+
 	constexpr u8 nChannels = 2;
 
-	// Circle's "fast path" for I2S 24-bit really expects 32-bit samples
-	const bool bI2S = m_pConfig->AudioOutputDevice == CConfig::TAudioOutputDevice::I2S;
-	const bool bReversedStereo = m_pConfig->AudioReversedStereo;
-	const u8 nBytesPerSample = bI2S ? sizeof(s32) : (sizeof(s8) * 3);
-	const u8 nBytesPerFrame = 2 * nBytesPerSample;
+	const PCMConverter::TFormat Format = m_pAudioSink->GetFormat();
+	const u8 nBytesPerFrame = nChannels * PCMConverter::GetBytesPerSample(Format);
+
+	// Select conversion routine once, rather than branching on every block
+	const PCMConverter::TConvertFunc ConvertFunc = PCMConverter::GetConvertFunc(Format, m_pConfig->AudioReversedStereo);
 
-	const size_t nQueueSizeFrames = m_pSound->GetQueueSizeFrames();
+	const size_t nQueueSizeFrames = m_pAudioSink->GetQueueSizeFrames();
+	const size_t nChunkFrames = m_pAudioSink->GetChunkFrames();
 
-	// Extra byte so that we can write to the 24-bit buffer with overlapping 32-bit writes (efficiency)
+	// Padding so that the converter can write to the 24-bit buffer with overlapping vector stores (efficiency)
 	float FloatBuffer[nQueueSizeFrames * nChannels];
-	s8 IntBuffer[nQueueSizeFrames * nBytesPerFrame + bI2S ? 0 : 1];
+	float FadeBuffer[nQueueSizeFrames * nChannels];
+	alignas(16) u8 IntBuffer[nQueueSizeFrames * nBytesPerFrame + PCMConverter::OutputPadding];
+
+	// Deadlines are meaningless if the sink doesn't drain in real time (e.g. benchmarking)
+	const bool bRealTime = m_pAudioSink->IsRealTime();
+
+	// Never aim for less than one DMA chunk in the queue, or every chunk would underrun
+	const bool bAdaptiveLatency = m_pConfig->AudioAdaptiveLatency && bRealTime;
+	const size_t nMinFrames = Utility::Max<size_t>(m_pConfig->AudioLatencyMin, nChunkFrames);
+	const size_t nMaxFrames = Utility::Min<size_t>(m_pConfig->AudioLatencyMax, nQueueSizeFrames);
+	CLatencyController LatencyController(m_pAudioSink->GetSampleRate(), nMinFrames, nMaxFrames, m_pConfig->AudioLatencyMargin);
+
+	if (bAdaptiveLatency)
+		LOGNOTE("Adaptive latency enabled (%ld-%ld frames)", nMinFrames, Utility::Max(nMinFrames, nMaxFrames));
+
+	// Optional master bus limiter
+	CLimiter Limiter(m_pAudioSink->GetSampleRate(), m_pConfig->AudioLimiterThreshold);
+	const bool bLimiter = m_pConfig->AudioLimiter && Limiter.Initialize(nQueueSizeFrames);
+	if (bLimiter)
+		LOGNOTE("Limiter enabled (threshold %.1fdB, %ld frames look-ahead)", m_pConfig->AudioLimiterThreshold, Limiter.GetLatencyFrames());
+
+	// Synths may render at a different rate to the output (e.g. to save CPU time at high output rates)
+	const unsigned int nOutputRate = m_pAudioSink->GetSampleRate();
+	CResampler* Resamplers[] = { nullptr, nullptr };
+	bool bRenderedLastBlock[] = { false, false };
+
+	// Synths can be created after this point (deferred at boot, or once ROMs/SoundFonts appear on USB), so a resampler is
+	// rebuilt whenever a synth's render rate doesn't match the one it was built for
+	auto UpdateResampler = [&](TSynth Synth, const CSynthBase* pSynth)
+	{
+		CResampler*& pResampler = Resamplers[static_cast<size_t>(Synth)];
+		const unsigned int nInputRate = pSynth ? pSynth->m_nSampleRate : nOutputRate;
+		if (pResampler && pResampler->GetInputRate() == nInputRate)
+			return;
+
+		delete pResampler;
+		pResampler = new CResampler(nInputRate, nOutputRate);
+		if (!pResampler->Initialize(nQueueSizeFrames))
+			LOGPANIC("Failed to initialize resampler");
+	};
+
+	const bool bSecondMT32Split = m_pConfig->MT32EmuSecondOutput == CConfig::TMT32EmuSecondOutput::Split;
+
+	// Render in whole FluidSynth-sized blocks if they tile the DMA chunk exactly, otherwise in whole chunks
+	const size_t nBlockFrames = nChunkFrames % RenderBlockFrames == 0 ? RenderBlockFrames : nChunkFrames;
+
+	// The queue starts out empty; don't count that as an underrun
+	bool bPrimed = false;
 
 	while (m_bRunning)
 	{
-		const size_t nFrames = nQueueSizeFrames - m_pSound->GetQueueFramesAvail();
-		const size_t nWriteBytes = nFrames * nBytesPerFrame;
+		const size_t nQueuedFrames = nQueueSizeFrames - m_pAudioSink->GetQueueFramesAvail();
+		const size_t nTargetFrames = bAdaptiveLatency ? LatencyController.GetTargetFrames() : nQueueSizeFrames;
+		const size_t nFreeFrames = nQueuedFrames < nTargetFrames ? nTargetFrames - nQueuedFrames : 0;
+		const size_t nFrames = nFreeFrames / nBlockFrames * nBlockFrames;
 
-		m_pCurrentSynth->Render(FloatBuffer, nFrames);
+		if (nFrames == 0)
+		{
+			m_pAudioSink->WaitForSpace();
+			continue;
+		}
+
+		// Synths may be published by core 0 at any time (deferred boot, USB disk inserted)
+		CMT32Synth* const pMT32Synth = m_pMT32Synth.load(std::memory_order_acquire);
+		CSoundFontSynth* const pSoundFontSynth = m_pSoundFontSynth.load(std::memory_order_acquire);
+
+		// In layered mode, mt32emu always renders here while FluidSynth renders the same block on core 3
+		CSynthBase* const pSynth = m_bLayered ? pMT32Synth : m_pCurrentSynth;
+		const TSynth Synth = pSynth == pMT32Synth ? TSynth::MT32 : TSynth::SoundFont;
+		const u32 nRenderStart = CAudioTelemetry::GetCycleCount();
 
-		if (bReversedStereo)
+		// After a switch, the previous synth keeps rendering its release tails until it has faded out
+		const TSynth FadingSynth = Synth == TSynth::MT32 ? TSynth::SoundFont : TSynth::MT32;
+		CSynthBase* const pFadingSynth = FadingSynth == TSynth::MT32 ? static_cast<CSynthBase*>(pMT32Synth) : pSoundFontSynth;
+		const bool bFading = !m_bLayered && pFadingSynth && m_Crossfader.IsAudible(FadingSynth);
+
+		UpdateResampler(TSynth::MT32, pMT32Synth);
+		UpdateResampler(TSynth::SoundFont, pSoundFontSynth);
+
+		// Don't filter against stale history from before a synth switch
+		bool bRendered[] = { false, false };
+		bRendered[static_cast<size_t>(Synth)] = true;
+		bRendered[static_cast<size_t>(FadingSynth)] = bFading;
+		for (size_t i = 0; i < Utility::ArraySize(Resamplers); ++i)
 		{
-			// Convert to signed 24-bit integers with channel swap
-			for (size_t i = 0; i < nFrames * nChannels; i += nChannels)
-			{
-				s32* const pLeftSample = reinterpret_cast<s32*>(IntBuffer + i * nBytesPerSample);
-				s32* const pRightSample = reinterpret_cast<s32*>(IntBuffer + (i + 1) * nBytesPerSample);
-				*pLeftSample = FloatBuffer[i + 1] * Sample24BitMax;
-				*pRightSample = FloatBuffer[i] * Sample24BitMax;
-			}
+			if (bRendered[i] && !bRenderedLastBlock[i])
+				Resamplers[i]->Reset();
+			bRenderedLastBlock[i] = bRendered[i];
 		}
-		else
+
+		if (m_bLayered)
+			m_pLayerWorker->Start(nFrames);
+		else if (m_pSecondMT32Worker)
+			m_pSecondMT32Worker->Start(nFrames);
+
+		// Render the outgoing synth in parallel on core 3 if FluidSynth or the second mt32emu instance isn't already using it
+		TRenderJob FadeJob{pFadingSynth, Resamplers[static_cast<size_t>(FadingSynth)], FadeBuffer, nFrames};
+		const bool bFadeOnAuxCore = bFading && !m_bSoundFontOnAuxCore && !m_pSecondMT32Worker && m_AuxCore.Launch(RenderSynth, &FadeJob);
+
+		TRenderJob Job{pSynth, Resamplers[static_cast<size_t>(Synth)], FloatBuffer, nFrames};
+		RenderSynth(&Job);
+		m_Crossfader.Apply(Synth, FloatBuffer, nFrames);
+
+		if (bFading)
 		{
-			// Convert to signed 24-bit integers
-			for (size_t i = 0; i < nFrames * nChannels; ++i)
-			{
-				s32* const pSample = reinterpret_cast<s32*>(IntBuffer + i * nBytesPerSample);
-				*pSample = FloatBuffer[i] * Sample24BitMax;
-			}
+			if (bFadeOnAuxCore)
+				m_AuxCore.Join();
+			else
+				RenderSynth(&FadeJob);
+
+			m_Crossfader.Mix(FadingSynth, FadeBuffer, FloatBuffer, nFrames);
+		}
+
+		if (m_bLayered)
+			m_Crossfader.Mix(TSynth::SoundFont, m_pLayerWorker->Wait(), FloatBuffer, nFrames);
+		else if (m_pSecondMT32Worker)
+			MixSecondMT32(m_pSecondMT32Worker->Wait(), FloatBuffer, nFrames, bSecondMT32Split);
+
+		u32 nLimiterCycles = 0;
+		if (bLimiter)
+		{
+			const u32 nLimiterStart = CAudioTelemetry::GetCycleCount();
+			Limiter.Process(FloatBuffer, nFrames);
+			nLimiterCycles = CAudioTelemetry::GetCycleCount() - nLimiterStart;
 		}
 
-		const int nResult = m_pSound->Write(IntBuffer, nWriteBytes);
-		if (nResult != static_cast<int>(nWriteBytes))
+		// Convert to signed 24-bit integers with saturation
+		ConvertFunc(FloatBuffer, IntBuffer, nFrames);
+
+		const u32 nRenderCycles = CAudioTelemetry::GetCycleCount() - nRenderStart;
+
+		const bool bShortWrite = m_pAudioSink->Write(IntBuffer, nFrames) != nFrames;
+		if (bShortWrite)
 			LOGERR("Sound data dropped");
+
+		// The queue having already run dry means the sound device has been outputting silence
+		const unsigned int nDeadlineMicros = bRealTime ? static_cast<u64>(nQueuedFrames) * 1000000 / m_pAudioSink->GetSampleRate() : CAudioTelemetry::NoDeadline;
+		const bool bUnderrun = bRealTime && bPrimed && nQueuedFrames == 0;
+		const u32 nRenderMicros = m_AudioTelemetry.RecordBlock(Synth, nRenderCycles, nLimiterCycles, nDeadlineMicros, bUnderrun, bShortWrite);
+		bPrimed = true;
+
+		if (bAdaptiveLatency)
+			LatencyController.Update(nQueuedFrames, nFrames, nRenderMicros);
+
+		// Load is only meaningful when paced by a real-time sink
+		if (bRealTime && (Synth == TSynth::SoundFont || m_bLayered))
+		{
+			const u32 nBlockMicros = static_cast<u64>(nFrames) * 1000000 / nOutputRate;
+			const u32 nSoundFontMicros = m_bLayered ? m_pLayerWorker->GetRenderMicros() : nRenderMicros;
+			pSoundFontSynth->SetRenderLoad(static_cast<float>(nSoundFontMicros) / nBlockMicros);
+		}
 	}
+
+	for (CResampler* pResampler : Resamplers)
+		delete pResampler;
+}
+
+void CMT32Pi::AuxRenderTask()
+{
+	if (m_bLayered)
+	{
+		LOGNOTE("Layer task on Core 3 starting up");
+		m_pLayerWorker->Run(m_bRunning);
+		return;
+	}
+
+	if (m_pSecondMT32Worker)
+	{
+		LOGNOTE("Second mt32emu task on Core 3 starting up");
+		m_pSecondMT32Worker->Run(m_bRunning);
+		return;
+	}
+
+	// Services FluidSynth (if configured to use this core) and the outgoing synth during crossfades, plus jobs in between
+	// Keep servicing even if FluidSynth isn't available yet; it may be initialized later (e.g. from USB storage)
+	LOGNOTE("Auxiliary render task on Core 3 starting up");
+
+	while (m_bRunning)
+	{
+		// Background jobs could hold up FluidSynth's per-block work
+		const CJobSystem::TPriority LowestPriority = m_bSoundFontOnAuxCore ? CJobSystem::TPriority::Critical : CJobSystem::TPriority::Background;
+
+		if (m_AuxCore.RunPending())
+			continue;
+
+		// Launches fail while a job runs here, so the audio core renders a fade itself rather than waiting behind the job
+		bool bRanJob = false;
+		if (m_AuxCore.BeginOtherWork())
+		{
+			bRanJob = m_JobSystem.RunOne(3, LowestPriority);
+			m_AuxCore.EndOtherWork();
+		}
+
+		if (!bRanJob)
+			Utility::WaitForCoreEvent();
+	}
+}
+
+void CMT32Pi::UpdateAudioStats()
+{
+	CSoundFontSynth* const pSoundFontSynth = m_pSoundFontSynth;
+	if (pSoundFontSynth)
+	{
+		const CPolyphonyGovernor& Governor = pSoundFontSynth->GetPolyphonyGovernor();
+		const size_t nVoiceCap = Governor.GetVoiceCap();
+
+		if (nVoiceCap != m_nPolyphonyCap)
+		{
+			if (nVoiceCap < Governor.GetMaxPolyphony())
+				LOGWARN("Polyphony limited to %ld voices (%d steals/s)", nVoiceCap, Governor.GetStealsPerSecond());
+			else if (m_nPolyphonyCap)
+				LOGNOTE("Polyphony restored to %ld voices", nVoiceCap);
+
+			m_nPolyphonyCap = nVoiceCap;
+		}
+
+		if (!m_bEffectsSendsWarned && pSoundFontSynth->AreEffectsSendsSilent())
+		{
+			LOGWARN("FluidSynth isn't producing any effects sends; reverb and chorus won't be heard with effects_core");
+			m_bEffectsSendsWarned = true;
+		}
+	}
+
+	CAudioTelemetry::TStats Stats;
+	m_AudioTelemetry.GetStats(Stats);
+
+	u32 nUnderruns = 0, nShortWrites = 0;
+	for (size_t i = 0; i < CAudioTelemetry::SynthCount; ++i)
+	{
+		nUnderruns += Stats.Underruns[i];
+		nShortWrites += Stats.ShortWrites[i];
+	}
+
+	const u32 nProblemCount = nUnderruns + nShortWrites + Stats.nDeadlineMisses;
+	if (nProblemCount == m_nAudioProblemCount)
+		return;
+
+	LOGWARN("Audio: %d underruns, %d dropped, %d deadline misses; worst render %dus, worst slack %dus", nUnderruns, nShortWrites, Stats.nDeadlineMisses, Stats.nWorstRenderMicros, Stats.nWorstSlackMicros);
+	m_nAudioProblemCount = nProblemCount;
 }
 
 void CMT32Pi::Run(unsigned nCore)
 {
+	// Lets loops that poll timers sleep in between
+	CCoreLoad::EnablePeriodicWakeup(CoreWakeupPeriodMicros);
+
+	// Secondary cores help out with boot, then wait for core 0 to finish initialization; until then, they take jobs
+	// (e.g. decoding the default SoundFont's samples) whenever there's no boot stage for them to run
+	if (nCore != 0)
+	{
+		m_BootGraph.Run(nCore, &m_JobSystem);
+		while (!m_bInitialized)
+		{
+			if (!m_JobSystem.RunOne(nCore))
+				Utility::WaitForCoreEvent();
+		}
+	}
+
 	// Assign tasks to different CPU cores
 	switch (nCore)
 	{
@@ -619,6 +1219,9 @@ void CMT32Pi::Run(unsigned nCore)
 		case 2:
 			return AudioTask();
 
+		case 3:
+			return AuxRenderTask();
+
 		default:
 			break;
 	}
@@ -627,14 +1230,14 @@ void CMT32Pi::Run(unsigned nCore)
 void CMT32Pi::OnEnterPowerSavingMode()
 {
 	CPower::OnEnterPowerSavingMode();
-	m_pSound->Cancel();
+	m_pAudioSink->Cancel();
 	m_UserInterface.EnterPowerSavingMode();
 }
 
 void CMT32Pi::OnExitPowerSavingMode()
 {
 	CPower::OnExitPowerSavingMode();
-	m_pSound->Start();
+	m_pAudioSink->Start();
 	m_UserInterface.ExitPowerSavingMode();
 }
 
@@ -650,8 +1253,9 @@ void CMT32Pi::OnUnderVoltageDetected()
 	LCDLog(TLCDLogType::Warning, "Low voltage! Chk PSU");
 }
 
-void CMT32Pi::OnShortMessage(u32 nMessage)
+void CMT32Pi::OnShortMessage(u32 nMessage, unsigned int nTimestamp)
 {
+	// nTimestamp is when the message's bytes were received, so that the audio core can schedule it sample-accurately
 	// Active sensing
 	if (nMessage == 0xFE)
 	{
@@ -663,25 +1267,77 @@ void CMT32Pi::OnShortMessage(u32 nMessage)
 	if ((nMessage & 0xFF) < 0xF0)
 		LEDOn();
 
-	m_pCurrentSynth->HandleMIDIShortMessage(nMessage);
+	if (m_bLayered)
+	{
+		// System messages go to both synths; channel messages are split according to the channel map
+		const u8 nStatus = nMessage & 0xFF;
+		if (nStatus >= 0xF0)
+		{
+			m_pMT32Synth.load()->HandleMIDIShortMessage(nMessage, nTimestamp);
+			m_pSoundFontSynth.load()->HandleMIDIShortMessage(nMessage, nTimestamp);
+		}
+		else if (m_nLayerMT32Channels & (1 << (nStatus & 0x0F)))
+			m_pMT32Synth.load()->HandleMIDIShortMessage(nMessage, nTimestamp);
+		else
+			m_pSoundFontSynth.load()->HandleMIDIShortMessage(nMessage, nTimestamp);
+	}
+	else
+		m_pCurrentSynth->HandleMIDIShortMessage(nMessage, nTimestamp);
 
 	// Wake from power saving mode if necessary
 	Awaken();
 }
 
-void CMT32Pi::OnSysExMessage(const u8* pData, size_t nSize)
+void CMT32Pi::OnSysExMessage(const u8* pData, size_t nSize, unsigned int nTimestamp)
 {
 	// Flash LED
 	LEDOn();
 
 	// If we don't consume the SysEx message, forward it to the synthesizer
 	if (!ParseCustomSysEx(pData, nSize))
-		m_pCurrentSynth->HandleMIDISysExMessage(pData, nSize);
+	{
+		// Each synth ignores SysEx messages that aren't addressed to it
+		if (m_bLayered)
+		{
+			m_pMT32Synth.load()->HandleMIDISysExMessage(pData, nSize, nTimestamp);
+			m_pSoundFontSynth.load()->HandleMIDISysExMessage(pData, nSize, nTimestamp);
+		}
+		else
+			m_pCurrentSynth->HandleMIDISysExMessage(pData, nSize, nTimestamp);
+	}
 
 	// Wake from power saving mode if necessary
 	Awaken();
 }
 
+void CMT32Pi::CSecondMT32Port::OnShortMessage(u32 nMessage, unsigned int nTimestamp)
+{
+	// Active sensing is only tracked for the main input
+	if (nMessage == 0xFE)
+		return;
+
+	// Flash LED for channel messages
+	if ((nMessage & 0xFF) < 0xF0)
+		m_pMT32Pi->LEDOn();
+
+	m_pMT32Pi->m_pSecondMT32Synth->HandleMIDIShortMessage(nMessage, nTimestamp);
+
+	// Wake from power saving mode if necessary
+	m_pMT32Pi->Awaken();
+}
+
+void CMT32Pi::CSecondMT32Port::OnSysExMessage(const u8* pData, size_t nSize, unsigned int nTimestamp)
+{
+	// Flash LED
+	m_pMT32Pi->LEDOn();
+
+	// Custom SysEx commands are only accepted on the main input
+	m_pMT32Pi->m_pSecondMT32Synth->HandleMIDISysExMessage(pData, nSize, nTimestamp);
+
+	// Wake from power saving mode if necessary
+	m_pMT32Pi->Awaken();
+}
+
 void CMT32Pi::OnUnexpectedStatus()
 {
 	CMIDIParser::OnUnexpectedStatus();
@@ -745,10 +1401,15 @@ bool CMT32Pi::ParseCustomSysEx(const u8* pData, size_t nSize)
 			return true;
 		}
 
-		// Switch SoundFont (F0 7D 02 xx F7)
+		// Switch SoundFont (F0 7D 02 xx F7); replies with the SoundFont cache's status (see SendSoundFontCacheStatus())
 		case TCustomSysExCommand::SwitchSoundFont:
+		{
+			CSoundFontSynth* const pSoundFontSynth = m_pSoundFontSynth;
+			const bool bResident = pSoundFontSynth && pSoundFontSynth->IsSoundFontResident(nParameter);
 			SwitchSoundFont(nParameter);
+			SendSoundFontCacheStatus(nParameter, bResident);
 			return true;
+		}
 
 		// Switch synthesizer (F0 7D 03 xx F7)
 		case TCustomSysExCommand::SwitchSynth:
@@ -761,7 +1422,7 @@ bool CMT32Pi::ParseCustomSysEx(const u8* pData, size_t nSize)
 		case TCustomSysExCommand::SetMT32ReversedStereo:
 		{
 			if (m_pMT32Synth)
-				m_pMT32Synth->SetReversedStereo(nParameter);
+				m_pMT32Synth.load()->SetReversedStereo(nParameter);
 			return true;
 		}
 
@@ -770,6 +1431,44 @@ bool CMT32Pi::ParseCustomSysEx(const u8* pData, size_t nSize)
 	}
 }
 
+void CMT32Pi::SendSoundFontCacheStatus(size_t nIndex, bool bResident)
+{
+	CSoundFontSynth* const pSoundFontSynth = m_pSoundFontSynth;
+	if (!pSoundFontSynth)
+		return;
+
+	// F0 7D 02 xx rr nn mm mm bb bb F7: whether SoundFont xx was resident (a cache hit), followed by the number of other
+	// SoundFonts now resident and the cache's memory use and budget in megabytes (14-bit, MSB first)
+	const CSoundFontCache& SoundFontCache = pSoundFontSynth->GetSoundFontCache();
+	const size_t nResidentMB = Utility::Min<size_t>(SoundFontCache.GetResidentBytes() / MEGABYTE, 0x3FFF);
+	const size_t nBudgetMB = Utility::Min<size_t>(SoundFontCache.GetBudget() / MEGABYTE, 0x3FFF);
+
+	const u8 Reply[] =
+	{
+		0xF0, 0x7D, static_cast<u8>(TCustomSysExCommand::SwitchSoundFont), static_cast<u8>(nIndex & 0x7F),
+		static_cast<u8>(bResident),
+		static_cast<u8>(SoundFontCache.GetCount()),
+		static_cast<u8>(nResidentMB >> 7), static_cast<u8>(nResidentMB & 0x7F),
+		static_cast<u8>(nBudgetMB >> 7), static_cast<u8>(nBudgetMB & 0x7F),
+		0xF7
+	};
+
+	SendMIDI(Reply, sizeof(Reply));
+}
+
+void CMT32Pi::SendMIDI(const u8* pData, size_t nSize)
+{
+	// Out of every port that MIDI may have been received from; the USB devices may be removed at any time
+	if (m_bSerialMIDIEnabled)
+		m_pSerial->Write(pData, nSize);
+
+	if (CUSBMIDIDevice* const pUSBMIDIDevice = m_pUSBMIDIDevice)
+		pUSBMIDIDevice->SendPlainMIDI(0, pData, nSize);
+
+	if (CUSBSerialDevice* const pUSBSerialDevice = m_pUSBSerialDevice)
+		pUSBSerialDevice->Write(pData, nSize);
+}
+
 void CMT32Pi::UpdateUSB(bool bStartup)
 {
 	if (!m_bUSBAvailable || !m_pUSBHCI->UpdatePlugAndPlay())
@@ -792,18 +1491,21 @@ void CMT32Pi::UpdateUSB(bool bStartup)
 			{
 				LCDLog(TLCDLogType::Spinner, "MT-32 ROM rescan");
 				if (m_pMT32Synth)
-					m_pMT32Synth->GetROMManager().ScanROMs();
-				else
+					m_pMT32Synth.load()->GetROMManager().ScanROMs();
+				else if (m_bBootComplete)
 					InitMT32Synth();
+				if (m_pSecondMT32Synth)
+					m_pSecondMT32Synth->GetROMManager().ScanROMs();
 
+				// Missing synths are still being brought up by the deferred boot stages otherwise
 				LCDLog(TLCDLogType::Spinner, "SoundFont rescan");
 				if (m_pSoundFontSynth)
-					m_pSoundFontSynth->GetSoundFontManager().ScanSoundFonts();
-				else
+					m_pSoundFontSynth.load()->GetSoundFontManager().ScanSoundFonts();
+				else if (m_bBootComplete)
 					InitSoundFontSynth();
 
 				if (m_pSoundFontSynth)
-					LCDLog(TLCDLogType::Notice, "%d SoundFonts avail", m_pSoundFontSynth->GetSoundFontManager().GetSoundFontCount());
+					LCDLog(TLCDLogType::Notice, "%d SoundFonts avail", m_pSoundFontSynth.load()->GetSoundFontManager().GetSoundFontCount());
 			}
 		}
 	}
@@ -818,8 +1520,8 @@ void CMT32Pi::UpdateUSB(bool bStartup)
 		if (m_pSoundFontSynth)
 		{
 			LCDLog(TLCDLogType::Spinner, "SoundFont rescan");
-			m_pSoundFontSynth->GetSoundFontManager().ScanSoundFonts();
-			LCDLog(TLCDLogType::Notice, "%d SoundFonts avail", m_pSoundFontSynth->GetSoundFontManager().GetSoundFontCount());
+			m_pSoundFontSynth.load()->GetSoundFontManager().ScanSoundFonts();
+			LCDLog(TLCDLogType::Notice, "%d SoundFonts avail", m_pSoundFontSynth.load()->GetSoundFontManager().GetSoundFontCount());
 		}
 	}
 	m_pUSBMassStorageDevice = pUSBMassStorageDevice;
@@ -888,6 +1590,20 @@ void CMT32Pi::UpdateNetwork()
 				LOGNOTE("UDP MIDI receiver initialized");
 		}
 
+		// The second mt32emu instance listens on the next port up
+		if (m_pSecondMT32Synth && m_pConfig->MT32EmuSecondInput == CConfig::TMT32EmuSecondInput::UDP && !m_pSecondMT32UDPReceiver)
+		{
+			m_pSecondMT32UDPReceiver = new CUDPMIDIReceiver(&m_SecondMT32Port, CUDPMIDIReceiver::DefaultPort + 1);
+			if (!m_pSecondMT32UDPReceiver->Initialize())
+			{
+				LOGERR("Failed to init second UDP MIDI receiver");
+				delete m_pSecondMT32UDPReceiver;
+				m_pSecondMT32UDPReceiver = nullptr;
+			}
+			else
+				LOGNOTE("Second UDP MIDI receiver initialized on port %d", CUDPMIDIReceiver::DefaultPort + 1);
+		}
+
 		if (m_pConfig->NetworkFTPServer && !m_pFTPDaemon)
 		{
 			m_pFTPDaemon = new CFTPDaemon(m_pConfig->NetworkFTPUsername, m_pConfig->NetworkFTPPassword);
@@ -910,46 +1626,149 @@ void CMT32Pi::UpdateNetwork()
 	}
 }
 
-void CMT32Pi::UpdateMIDI()
+bool CMT32Pi::UpdateMIDI()
 {
-	size_t nBytes;
-	u8 Buffer[MIDIRxBufferSize];
+	size_t nBytes = 0;
 
 	// Read MIDI messages from serial device or ring buffer
-	if (m_bSerialMIDIEnabled)
-		nBytes = ReceiveSerialMIDI(Buffer, sizeof(Buffer));
-	else if (m_pUSBSerialDevice)
+	if (m_bSerialMIDIEnabled || m_pUSBSerialDevice)
 	{
-		const int nResult = m_pUSBSerialDevice->Read(Buffer, sizeof(Buffer));
-		nBytes = nResult > 0 ? static_cast<size_t>(nResult) : 0;
+		u8 Buffer[MIDIRxBufferSize];
+
+		if (m_bSerialMIDIEnabled)
+			nBytes = ReceiveSerialMIDI(Buffer, sizeof(Buffer));
+		else
+		{
+			const int nResult = m_pUSBSerialDevice->Read(Buffer, sizeof(Buffer));
+			nBytes = nResult > 0 ? static_cast<size_t>(nResult) : 0;
+		}
+
+		if (nBytes == 0)
+			return false;
+
+		// Process MIDI messages
+		if (m_bSerialMIDIEnabled)
+			ParseSerialMIDI(*this, Buffer, nBytes, m_pConfig->MIDIGPIOBaudRate, m_nSerialMIDIReadTime);
+		else
+			ParseSerialMIDI(*this, Buffer, nBytes, m_pConfig->MIDIUSBSerialBaudRate, m_nUSBSerialMIDIReadTime);
 	}
 	else
-		nBytes = m_MIDIRxBuffer.Dequeue(Buffer, sizeof(Buffer));
-
-	if (nBytes == 0)
-		return;
+	{
+		// Drain everything the interrupt handlers have stamped and queued
+		TMIDIRxByte Bytes[MIDIRxBatchSize];
+		size_t nCount;
+		while ((nCount = m_MIDIRxBuffer.Dequeue(Bytes, MIDIRxBatchSize)) > 0)
+		{
+			ParseMIDIRxBytes(*this, Bytes, nCount);
+			nBytes += nCount;
+		}
 
-	// Process MIDI messages
-	ParseMIDIBytes(Buffer, nBytes);
+		if (nBytes == 0)
+			return false;
+	}
 
 	// Reset the Active Sense timer
 	s_pThis->m_nActiveSenseTime = s_pThis->m_pTimer->GetTicks();
+
+	return true;
+}
+
+bool CMT32Pi::UpdateSecondMT32MIDI()
+{
+	size_t nBytes = 0;
+
+	// UDP is received by its own task
+	if (m_bSecondMT32Serial)
+	{
+		u8 Buffer[MIDIRxBufferSize];
+		nBytes = ReceiveSerialMIDI(Buffer, sizeof(Buffer));
+		if (nBytes)
+			ParseSerialMIDI(m_SecondMT32Port, Buffer, nBytes, m_pConfig->MIDIGPIOBaudRate, m_nSerialMIDIReadTime);
+	}
+	else
+	{
+		TMIDIRxByte Bytes[MIDIRxBatchSize];
+		size_t nCount;
+		while ((nCount = m_SecondMT32RxBuffer.Dequeue(Bytes, MIDIRxBatchSize)) > 0)
+		{
+			ParseMIDIRxBytes(m_SecondMT32Port, Bytes, nCount);
+			nBytes += nCount;
+		}
+	}
+
+	return nBytes > 0;
 }
 
 void CMT32Pi::PurgeMIDIBuffers()
 {
 	size_t nBytes;
 	u8 Buffer[MIDIRxBufferSize];
+	TMIDIRxByte Bytes[MIDIRxBatchSize];
 
 	// Process MIDI messages from all devices/ring buffers, but ignore note-ons
 	while (m_bSerialMIDIEnabled && (nBytes = ReceiveSerialMIDI(Buffer, sizeof(Buffer))) > 0)
-		ParseMIDIBytes(Buffer, nBytes, true);
+		ParseSerialMIDI(*this, Buffer, nBytes, m_pConfig->MIDIGPIOBaudRate, m_nSerialMIDIReadTime, true);
+
+	int nResult;
+	while (m_pUSBSerialDevice && (nResult = m_pUSBSerialDevice->Read(Buffer, sizeof(Buffer))) > 0)
+		ParseSerialMIDI(*this, Buffer, nResult, m_pConfig->MIDIUSBSerialBaudRate, m_nUSBSerialMIDIReadTime, true);
+
+	while ((nBytes = m_MIDIRxBuffer.Dequeue(Bytes, MIDIRxBatchSize)) > 0)
+		ParseMIDIRxBytes(*this, Bytes, nBytes, true);
+}
+
+void CMT32Pi::ParseSerialMIDI(CMIDIParser& Parser, const u8* pData, size_t nSize, unsigned int nBaudRate, unsigned int& nLastReadTime, bool bIgnoreNoteOns)
+{
+	// Circle's serial drivers don't tell us when each byte arrived, so work backwards from the wire time of a byte
+	// (start + 8 data + stop bits) to spread a backlog that built up while we were busy, but no earlier than the last read
+	const unsigned int nNow = CTimer::GetClockTicks();
+	const unsigned int nByteTime = nBaudRate ? 10000000 / nBaudRate : 0;
+
+	for (size_t i = 0; i < nSize; ++i)
+	{
+		unsigned int nTimestamp = nNow - static_cast<unsigned int>(nSize - 1 - i) * nByteTime;
+		if (static_cast<int>(nTimestamp - nLastReadTime) < 0)
+			nTimestamp = nLastReadTime;
 
-	while (m_pUSBSerialDevice && (nBytes = m_pUSBSerialDevice->Read(Buffer, sizeof(Buffer))) > 0)
-		ParseMIDIBytes(Buffer, nBytes, true);
+		Parser.ParseMIDIBytes(&pData[i], 1, nTimestamp, bIgnoreNoteOns);
+	}
 
-	while ((nBytes = m_MIDIRxBuffer.Dequeue(Buffer, sizeof(Buffer))) > 0)
-		ParseMIDIBytes(Buffer, nBytes, true);
+	nLastReadTime = nNow;
+}
+
+void CMT32Pi::ParseMIDIRxBytes(CMIDIParser& Parser, const TMIDIRxByte* pBytes, size_t nCount, bool bIgnoreNoteOns)
+{
+	// Hand each run of bytes that arrived together to the parser in one go
+	u8 Run[MIDIRxBatchSize];
+	size_t nStart = 0;
+
+	while (nStart < nCount)
+	{
+		const unsigned int nTimestamp = pBytes[nStart].nTimestamp;
+		size_t nRunSize = 0;
+
+		while (nStart + nRunSize < nCount && nRunSize < MIDIRxBatchSize && pBytes[nStart + nRunSize].nTimestamp == nTimestamp)
+		{
+			Run[nRunSize] = pBytes[nStart + nRunSize].nData;
+			++nRunSize;
+		}
+
+		Parser.ParseMIDIBytes(Run, nRunSize, nTimestamp, bIgnoreNoteOns);
+		nStart += nRunSize;
+	}
+}
+
+bool CMT32Pi::EnqueueMIDIRxBytes(TMIDIRxBuffer& Buffer, const u8* pData, size_t nSize)
+{
+	// Stamp with receive time so that the audio core can schedule each message sample-accurately,
+	// however long the main loop takes to get around to parsing it
+	const unsigned int nTimestamp = CTimer::GetClockTicks();
+	size_t nEnqueued = 0;
+
+	for (size_t i = 0; i < nSize; ++i)
+		nEnqueued += Buffer.Enqueue(TMIDIRxByte{nTimestamp, pData[i]});
+
+	return nEnqueued == nSize;
 }
 
 size_t CMT32Pi::ReceiveSerialMIDI(u8* pOutData, size_t nSize)
@@ -1040,9 +1859,11 @@ void CMT32Pi::ProcessEventQueue()
 
 			case TEventType::AllSoundOff:
 				if (m_pMT32Synth)
-					m_pMT32Synth->AllSoundOff();
+					m_pMT32Synth.load()->AllSoundOff();
+				if (m_pSecondMT32Synth)
+					m_pSecondMT32Synth->AllSoundOff();
 				if (m_pSoundFontSynth)
-					m_pSoundFontSynth->AllSoundOff();
+					m_pSoundFontSynth.load()->AllSoundOff();
 				break;
 
 			case TEventType::DisplayImage:
@@ -1082,7 +1903,7 @@ void CMT32Pi::ProcessButtonEvent(const TButtonEvent& Event)
 		else
 		{
 			// Next SoundFont
-			const size_t nSoundFonts = m_pSoundFontSynth->GetSoundFontManager().GetSoundFontCount();
+			const size_t nSoundFonts = m_pSoundFontSynth.load()->GetSoundFontManager().GetSoundFontCount();
 
 			if (!nSoundFonts)
 				LCDLog(TLCDLogType::Error, "No SoundFonts!");
@@ -1094,7 +1915,7 @@ void CMT32Pi::ProcessButtonEvent(const TButtonEvent& Event)
 				else
 				{
 					// Current SoundFont was probably on a USB stick that has since been removed
-					const size_t nCurrentSoundFont = m_pSoundFontSynth->GetSoundFontIndex();
+					const size_t nCurrentSoundFont = m_pSoundFontSynth.load()->GetSoundFontIndex();
 					if (nCurrentSoundFont > nSoundFonts)
 						nNextSoundFont = 0;
 					else
@@ -1136,57 +1957,164 @@ void CMT32Pi::SwitchSynth(TSynth NewSynth)
 		return;
 	}
 
-	m_pCurrentSynth->AllSoundOff();
+	// Both synths keep playing in layered mode; only the LCD changes
+	if (!m_bLayered)
+	{
+		// Let the outgoing synth's notes release naturally while crossfading to the new one
+		const TSynth OldSynth = NewSynth == TSynth::MT32 ? TSynth::SoundFont : TSynth::MT32;
+		ReleaseNotes(m_pCurrentSynth);
+		m_Crossfader.SetAudible(NewSynth, true);
+		m_Crossfader.SetAudible(OldSynth, false);
+		m_pFadingSynth = m_pCurrentSynth;
+	}
+
 	m_pCurrentSynth = pNewSynth;
 	const char* pMode = NewSynth == TSynth::MT32 ? "MT-32 mode" : "SoundFont mode";
 	LOGNOTE("Switching to %s", pMode);
 	LCDLog(TLCDLogType::Notice, pMode);
 }
 
+void CMT32Pi::AllSoundOff()
+{
+	if (m_bLayered)
+	{
+		m_pMT32Synth.load()->AllSoundOff();
+		m_pSoundFontSynth.load()->AllSoundOff();
+	}
+	else
+		m_pCurrentSynth->AllSoundOff();
+}
+
+void CMT32Pi::ReleaseNotes(CSynthBase* pSynth)
+{
+	const unsigned int nTimestamp = CTimer::GetClockTicks();
+
+	// Sustain pedal off, then All Notes Off; sounding notes enter their release phase rather than being cut off
+	for (u8 nChannel = 0; nChannel < 16; ++nChannel)
+	{
+		pSynth->HandleMIDIShortMessage(0x0040B0 | nChannel, nTimestamp);
+		pSynth->HandleMIDIShortMessage(0x007BB0 | nChannel, nTimestamp);
+	}
+}
+
 void CMT32Pi::SwitchMT32ROMSet(TMT32ROMSet ROMSet)
 {
-	if (m_pMT32Synth == nullptr)
+	CMT32Synth* const pMT32Synth = m_pMT32Synth;
+	if (pMT32Synth == nullptr)
 		return;
 
 	LOGNOTE("Switching to ROM set %d", static_cast<u8>(ROMSet));
-	if (m_pMT32Synth->SwitchROMSet(ROMSet) && m_pCurrentSynth == m_pMT32Synth)
-		m_pMT32Synth->ReportStatus();
+	if (pMT32Synth->SwitchROMSet(ROMSet) && m_pCurrentSynth == pMT32Synth)
+		pMT32Synth->ReportStatus();
 }
 
 void CMT32Pi::NextMT32ROMSet()
 {
-	if (m_pMT32Synth == nullptr)
+	CMT32Synth* const pMT32Synth = m_pMT32Synth;
+	if (pMT32Synth == nullptr)
 		return;
 
 	LOGNOTE("Switching to next ROM set");
 
-	if (m_pMT32Synth->NextROMSet() && m_pCurrentSynth == m_pMT32Synth)
-		m_pMT32Synth->ReportStatus();
+	if (pMT32Synth->NextROMSet() && m_pCurrentSynth == pMT32Synth)
+		pMT32Synth->ReportStatus();
 }
 
 void CMT32Pi::SwitchSoundFont(size_t nIndex)
 {
-	if (m_pSoundFontSynth == nullptr)
+	CSoundFontSynth* const pSoundFontSynth = m_pSoundFontSynth;
+	if (pSoundFontSynth == nullptr)
 		return;
 
-	LOGNOTE("Switching to SoundFont %d", nIndex);
-	if (m_pSoundFontSynth->SwitchSoundFont(nIndex))
+	const CSoundFontCache& SoundFontCache = pSoundFontSynth->GetSoundFontCache();
+	if (SoundFontCache.IsEnabled())
 	{
-		// Handle any MIDI data that has been queued up while busy
-		PurgeMIDIBuffers();
+		LOGNOTE("Switching to SoundFont %d (%s; %d resident, %d/%d MB)", nIndex, pSoundFontSynth->IsSoundFontResident(nIndex) ? "resident" : "not resident",
+			SoundFontCache.GetCount(), SoundFontCache.GetResidentBytes() / MEGABYTE, SoundFontCache.GetBudget() / MEGABYTE);
+	}
+	else
+		LOGNOTE("Switching to SoundFont %d", nIndex);
+
+	// The previous switch is still fading out
+	if (m_SoundFontSwitchState != TSoundFontSwitchState::Idle)
+	{
+		LCDLog(TLCDLogType::Warning, "Still loading!");
+		return;
+	}
 
-		if (m_pCurrentSynth == m_pSoundFontSynth)
-			m_pSoundFontSynth->ReportStatus();
+	// The new SoundFont loads in the background; the current one keeps playing unless it has to make way first, in which
+	// case the switch carries on once it has faded out (see UpdateSoundFontSwitch())
+	const bool bAudible = m_bLayered || m_pCurrentSynth == pSoundFontSynth;
+	const bool bFade = bAudible && !pSoundFontSynth->IsSwitchSeamless() &&
+	                   nIndex != pSoundFontSynth->GetSoundFontIndex() &&
+	                   pSoundFontSynth->GetSoundFontLoadState() == CSoundFontLoader::TState::Idle &&
+	                   pSoundFontSynth->GetSoundFontManager().GetSoundFontPath(nIndex);
+	if (bFade)
+	{
+		ReleaseNotes(pSoundFontSynth);
+		m_Crossfader.SetAudible(TSynth::SoundFont, false);
+		m_SoundFontSwitchState = TSoundFontSwitchState::FadingOutToLoad;
+		m_nSoundFontSwitchIndex = nIndex;
+		m_nSoundFontSwitchFadeTime = CTimer::GetClockTicks();
+		return;
 	}
+
+	pSoundFontSynth->SwitchSoundFont(nIndex);
+}
+
+void CMT32Pi::CompleteSoundFontSwitch()
+{
+	CSoundFontSynth* const pSoundFontSynth = m_pSoundFontSynth;
+	const bool bAudible = m_bLayered || m_pCurrentSynth == pSoundFontSynth;
+
+	// The old SoundFont's notes ring out while it crossfades to the new one; MIDI goes to the new one straight away
+	if (pSoundFontSynth->CompleteSoundFontSwitch(bAudible) && m_pCurrentSynth == pSoundFontSynth)
+		pSoundFontSynth->ReportStatus();
+
+	// Faded back in if the old SoundFont had to make way first
+	if (bAudible)
+		m_Crossfader.SetAudible(TSynth::SoundFont, true);
+}
+
+void CMT32Pi::UpdateSoundFontSwitch(unsigned int nTicks)
+{
+	CSoundFontSynth* const pSoundFontSynth = m_pSoundFontSynth;
+
+	// Retire the previous engine once it has faded out
+	pSoundFontSynth->UpdateCrossfade();
+
+	if (m_SoundFontSwitchState == TSoundFontSwitchState::Idle)
+	{
+		// Finish once the new SoundFont has loaded in the background
+		const CSoundFontLoader::TState LoadState = pSoundFontSynth->GetSoundFontLoadState();
+		if (LoadState == CSoundFontLoader::TState::Loaded || LoadState == CSoundFontLoader::TState::Failed)
+			CompleteSoundFontSwitch();
+
+		return;
+	}
+
+	// Carry on regardless if the audio core isn't rendering (e.g. the sound device has failed)
+	const unsigned int nTimeout = Utility::MillisToTicks(m_Crossfader.GetFadeMillis() * 2 + 100);
+	if (!m_Crossfader.IsSettled(TSynth::SoundFont) && nTicks - m_nSoundFontSwitchFadeTime < nTimeout)
+		return;
+
+	m_SoundFontSwitchState = TSoundFontSwitchState::Idle;
+
+	// Faded back in once the switch completes
+	if (!pSoundFontSynth->SwitchSoundFont(m_nSoundFontSwitchIndex))
+		m_Crossfader.SetAudible(TSynth::SoundFont, true);
 }
 
 void CMT32Pi::DeferSwitchSoundFont(size_t nIndex)
 {
-	if (m_pSoundFontSynth == nullptr)
+	CSoundFontSynth* const pSoundFontSynth = m_pSoundFontSynth;
+	if (pSoundFontSynth == nullptr)
 		return;
 
-	const char* pName = m_pSoundFontSynth->GetSoundFontManager().GetSoundFontName(nIndex);
-	LCDLog(TLCDLogType::Notice, "SF %ld: %s", nIndex, pName ? pName : "- N/A -");
+	// Resident SoundFonts are marked; switching to one is instant
+	const char* pName = pSoundFontSynth->GetSoundFontManager().GetSoundFontName(nIndex);
+	const char* pResident = pSoundFontSynth->IsSoundFontResident(nIndex) ? "*" : "";
+	LCDLog(TLCDLogType::Notice, "SF %ld%s: %s", nIndex, pResident, pName ? pName : "- N/A -");
 	m_nDeferredSoundFontSwitchIndex = nIndex;
 	m_nDeferredSoundFontSwitchTime  = CTimer::Get()->GetTicks();
 	m_bDeferredSoundFontSwitchFlag  = true;
@@ -1197,9 +2125,11 @@ void CMT32Pi::SetMasterVolume(s32 nVolume)
 	m_nMasterVolume = Utility::Clamp(nVolume, 0, 100);
 
 	if (m_pMT32Synth)
-		m_pMT32Synth->SetMasterVolume(m_nMasterVolume);
+		m_pMT32Synth.load()->SetMasterVolume(m_nMasterVolume);
+	if (m_pSecondMT32Synth)
+		m_pSecondMT32Synth->SetMasterVolume(m_nMasterVolume);
 	if (m_pSoundFontSynth)
-		m_pSoundFontSynth->SetMasterVolume(m_nMasterVolume);
+		m_pSoundFontSynth.load()->SetMasterVolume(m_nMasterVolume);
 
 	if (m_pCurrentSynth == m_pSoundFontSynth)
 		LCDLog(TLCDLogType::Notice, "Volume: %d", m_nMasterVolume);
@@ -1275,6 +2205,20 @@ void CMT32Pi::USBMIDIDeviceRemovedHandler(CDevice* pDevice, void* pContext)
 // The following handlers are called from interrupt context, enqueue into ring buffer for main thread
 void CMT32Pi::USBMIDIPacketHandler(unsigned nCable, u8* pPacket, unsigned nLength)
 {
+	assert(s_pThis != nullptr);
+
+	// Cables other than the first can feed the second mt32emu instance
+	if (nCable != 0 && s_pThis->m_pSecondMT32Synth && s_pThis->m_pConfig->MT32EmuSecondInput == CConfig::TMT32EmuSecondInput::USBCable)
+	{
+		if (!EnqueueMIDIRxBytes(s_pThis->m_SecondMT32RxBuffer, pPacket, nLength))
+		{
+			static const char* pErrorString = "MIDI overrun error!";
+			LOGWARN(pErrorString);
+			s_pThis->LCDLog(TLCDLogType::Error, pErrorString);
+		}
+		return;
+	}
+
 	IRQMIDIReceiveHandler(pPacket, nLength);
 }
 
@@ -1282,8 +2226,8 @@ void CMT32Pi::IRQMIDIReceiveHandler(const u8* pData, size_t nSize)
 {
 	assert(s_pThis != nullptr);
 
-	// Enqueue data into ring buffer
-	if (s_pThis->m_MIDIRxBuffer.Enqueue(pData, nSize) != nSize)
+	// Enqueue timestamped data into ring buffer
+	if (!EnqueueMIDIRxBytes(s_pThis->m_MIDIRxBuffer, pData, nSize))
 	{
 		static const char* pErrorString = "MIDI overrun error!";
 		LOGWARN(pErrorString);
@@ -1291,6 +2235,11 @@ void CMT32Pi::IRQMIDIReceiveHandler(const u8* pData, size_t nSize)
 	}
 }
 
+void CMT32Pi::TaskSwitchHandler(CTask* pTask)
+{
+	++s_pThis->m_nTaskSwitches;
+}
+
 void CMT32Pi::PanicHandler()
 {
 	if (!s_pThis || !s_pThis->m_pLCD)
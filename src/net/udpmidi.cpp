@@ -29,10 +29,9 @@
 
 LOGMODULE("udpmidi");
 
-constexpr u16 MIDIPort = 1999;
-
-CUDPMIDIReceiver::CUDPMIDIReceiver(CUDPMIDIHandler* pHandler)
+CUDPMIDIReceiver::CUDPMIDIReceiver(CUDPMIDIHandler* pHandler, u16 nPort)
 	: CTask(TASK_STACK_SIZE, true),
+	  m_nPort(nPort),
 	  m_pMIDISocket(nullptr),
 	  m_MIDIBuffer{0},
 	  m_pHandler(pHandler)
@@ -54,9 +53,9 @@ bool CUDPMIDIReceiver::Initialize()
 	if ((m_pMIDISocket = new CSocket(pNet, IPPROTO_UDP)) == nullptr)
 		return false;
 
-	if (m_pMIDISocket->Bind(MIDIPort) != 0)
+	if (m_pMIDISocket->Bind(m_nPort) != 0)
 	{
-		LOGERR("Couldn't bind to port %d", MIDIPort);
+		LOGERR("Couldn't bind to port %d", m_nPort);
 		return false;
 	}
 
@@ -0,0 +1,135 @@
+//
+// pcmconverter.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <circle/util.h>
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+#include "pcmconverter.h"
+#include "utility.h"
+
+using namespace PCMConverter;
+
+namespace
+{
+	constexpr u8 nChannels = 2;
+	constexpr float Sample24BitScale = 1 << 23;
+	constexpr float Sample24BitMax = (1 << 23) - 1;
+	constexpr float Sample24BitMin = -(1 << 23);
+
+	// Same scaling and saturation as the vector path
+	inline s32 ConvertSample(float nSample)
+	{
+		return static_cast<s32>(Utility::Clamp(nSample * Sample24BitScale, Sample24BitMin, Sample24BitMax));
+	}
+
+	inline void WriteSample(u8* pOut, s32 nSample)
+	{
+		pOut[0] = nSample;
+		pOut[1] = nSample >> 8;
+		pOut[2] = nSample >> 16;
+	}
+
+#ifdef __ARM_NEON
+	// Converts 4 samples to signed 24-bit integers in the low bits of each lane
+	inline int32x4_t ConvertSamples(float32x4_t Samples)
+	{
+		// Convert to Q31 with saturation, then shift down to 24-bit; clipping is free
+		return vshrq_n_s32(vcvtq_n_s32_f32(Samples, 31), 8);
+	}
+
+	// Packs the low 3 bytes of each lane into the first 12 bytes of the result
+	inline uint8x16_t PackSamples(int32x4_t Samples)
+	{
+		const uint8x16_t Bytes = vreinterpretq_u8_s32(Samples);
+#if AARCH == 64
+		static const u8 Indices[16] = { 0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, 0, 0, 0, 0 };
+		return vqtbl1q_u8(Bytes, vld1q_u8(Indices));
+#else
+		static const u8 IndicesLow[8]  = { 0, 1, 2, 4, 5, 6, 8, 9 };
+		static const u8 IndicesHigh[8] = { 10, 12, 13, 14, 0, 0, 0, 0 };
+		const uint8x8x2_t Table = { { vget_low_u8(Bytes), vget_high_u8(Bytes) } };
+		return vcombine_u8(vtbl2_u8(Table, vld1_u8(IndicesLow)), vtbl2_u8(Table, vld1_u8(IndicesHigh)));
+#endif
+	}
+#endif
+
+	template <TFormat Format, bool bReversedStereo>
+	void Convert(const float* pInBuffer, void* pOutBuffer, size_t nFrames)
+	{
+		constexpr size_t nBytesPerSample = GetBytesPerSample(Format);
+
+		const size_t nSamples = nFrames * nChannels;
+		u8* pOut = static_cast<u8*>(pOutBuffer);
+		size_t i = 0;
+
+#ifdef __ARM_NEON
+		// 2 frames per iteration
+		for (; i + 4 <= nSamples; i += 4)
+		{
+			float32x4_t Samples = vld1q_f32(pInBuffer + i);
+			if (bReversedStereo)
+				Samples = vrev64q_f32(Samples);
+
+			const int32x4_t IntSamples = ConvertSamples(Samples);
+
+			// Packed output overruns by 4 bytes; the next iteration (or the caller's padding) absorbs it
+			if (Format == TFormat::S24_32)
+				vst1q_s32(reinterpret_cast<int32_t*>(pOut), IntSamples);
+			else
+				vst1q_u8(pOut, PackSamples(IntSamples));
+
+			pOut += 4 * nBytesPerSample;
+		}
+#endif
+
+		// Remaining frames
+		for (; i < nSamples; i += nChannels)
+		{
+			const s32 nLeft = ConvertSample(pInBuffer[bReversedStereo ? i + 1 : i]);
+			const s32 nRight = ConvertSample(pInBuffer[bReversedStereo ? i : i + 1]);
+
+			if (Format == TFormat::S24_32)
+			{
+				reinterpret_cast<s32*>(pOut)[0] = nLeft;
+				reinterpret_cast<s32*>(pOut)[1] = nRight;
+			}
+			else
+			{
+				WriteSample(pOut, nLeft);
+				WriteSample(pOut + nBytesPerSample, nRight);
+			}
+
+			pOut += nChannels * nBytesPerSample;
+		}
+	}
+}
+
+TConvertFunc PCMConverter::GetConvertFunc(TFormat Format, bool bReversedStereo)
+{
+	if (Format == TFormat::S24_32)
+		return bReversedStereo ? Convert<TFormat::S24_32, true> : Convert<TFormat::S24_32, false>;
+
+	return bReversedStereo ? Convert<TFormat::S24_Packed, true> : Convert<TFormat::S24_Packed, false>;
+}
@@ -0,0 +1,106 @@
+//
+// renderworker.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <circle/timer.h>
+
+#include "renderworker.h"
+#include "utility.h"
+
+constexpr u8 nChannels = 2;
+
+CRenderWorker::CRenderWorker(CSynthBase* pSynth, unsigned int nOutputRate)
+	: m_pSynth(pSynth),
+	  m_Resampler(pSynth->m_nSampleRate, nOutputRate),
+	  m_pBuffer(nullptr),
+
+	  m_nFrames(0),
+	  m_nRenderMicros(0),
+
+	  m_nRequested(0),
+	  m_nCompleted(0),
+	  m_bStopped(false)
+{
+}
+
+CRenderWorker::~CRenderWorker()
+{
+	delete[] m_pBuffer;
+}
+
+bool CRenderWorker::Initialize(size_t nMaxFrames)
+{
+	m_pBuffer = new float[nMaxFrames * nChannels];
+	return m_pBuffer && m_Resampler.Initialize(nMaxFrames);
+}
+
+void CRenderWorker::Start(size_t nFrames)
+{
+	m_nFrames = nFrames;
+	m_nRequested.fetch_add(1, std::memory_order_release);
+	Utility::SignalCoreEvent();
+}
+
+const float* CRenderWorker::Wait()
+{
+	const u32 nRequested = m_nRequested.load(std::memory_order_relaxed);
+
+	// Give up if the worker has exited, rather than deadlocking during shutdown
+	while (m_nCompleted.load(std::memory_order_acquire) != nRequested && !m_bStopped.load(std::memory_order_acquire))
+		Utility::WaitForCoreEvent();
+
+	return m_pBuffer;
+}
+
+void CRenderWorker::Run(const volatile bool& bRunning)
+{
+	u32 nCompleted = m_nCompleted.load(std::memory_order_relaxed);
+
+	while (bRunning)
+	{
+		const u32 nRequested = m_nRequested.load(std::memory_order_acquire);
+		if (nRequested == nCompleted)
+		{
+			// A request made since the load above will have set the event register, so this returns immediately
+			Utility::WaitForCoreEvent();
+			continue;
+		}
+
+		const unsigned int nStartTicks = CTimer::GetClockTicks();
+
+		if (m_Resampler.IsBypassed())
+			m_pSynth->Render(m_pBuffer, m_nFrames);
+		else
+		{
+			m_pSynth->Render(m_Resampler.GetInputBuffer(), m_Resampler.GetInputFrames(m_nFrames));
+			m_Resampler.Process(m_pBuffer, m_nFrames);
+		}
+
+		m_nRenderMicros = CTimer::GetClockTicks() - nStartTicks;
+
+		nCompleted = nRequested;
+		m_nCompleted.store(nCompleted, std::memory_order_release);
+		Utility::SignalCoreEvent();
+	}
+
+	m_bStopped.store(true, std::memory_order_release);
+	Utility::SignalCoreEvent();
+}
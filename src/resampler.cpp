@@ -0,0 +1,189 @@
+//
+// resampler.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <circle/logger.h>
+#include <circle/util.h>
+
+#include <assert.h>
+#include <cmath>
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+#include "resampler.h"
+#include "utility.h"
+
+LOGMODULE("resampler");
+
+namespace
+{
+	unsigned int GCD(unsigned int nA, unsigned int nB)
+	{
+		while (nB)
+		{
+			const unsigned int nTemp = nA % nB;
+			nA = nB;
+			nB = nTemp;
+		}
+
+		return nA;
+	}
+}
+
+CResampler::CResampler(unsigned int nInputRate, unsigned int nOutputRate)
+	: m_nInputRate(nInputRate),
+	  m_nOutputRate(nOutputRate),
+	  m_nInterpolation(nOutputRate / GCD(nInputRate, nOutputRate)),
+	  m_nDecimation(nInputRate / GCD(nInputRate, nOutputRate)),
+	  m_nTime(0),
+	  m_pCoefficients(nullptr),
+	  m_pBuffer(nullptr),
+	  m_nMaxInputFrames(0)
+{
+}
+
+CResampler::~CResampler()
+{
+	delete[] m_pCoefficients;
+	delete[] m_pBuffer;
+}
+
+bool CResampler::Initialize(size_t nMaxOutputFrames)
+{
+	if (IsBypassed())
+		return true;
+
+	if (!IsRatioSupported(m_nInputRate, m_nOutputRate))
+	{
+		LOGERR("Unsupported ratio %d:%d", m_nInputRate, m_nOutputRate);
+		return false;
+	}
+
+	const size_t nPhases = m_nInterpolation;
+	const size_t nLength = nPhases * Taps;
+
+	// Windowed-sinc prototype at the upsampled rate, cut off just below the lower of the two Nyquist frequencies
+	const float nCutoff = 0.45f / Utility::Max(m_nInterpolation, m_nDecimation);
+	const float nCenter = (nLength - 1) / 2.0f;
+
+	m_pCoefficients = new float[nLength * nChannels];
+	m_nMaxInputFrames = nMaxOutputFrames * m_nDecimation / m_nInterpolation + 2;
+	m_pBuffer = new float[(HistoryFrames + m_nMaxInputFrames) * nChannels];
+
+	if (!m_pCoefficients || !m_pBuffer)
+		return false;
+
+	for (size_t nPhase = 0; nPhase < nPhases; ++nPhase)
+	{
+		float* const pPhase = m_pCoefficients + nPhase * Taps * nChannels;
+		float nSum = 0.0f;
+
+		for (size_t nTap = 0; nTap < Taps; ++nTap)
+		{
+			// Tap N multiplies input frame (i - N); store in reverse so that it lines up with ascending memory
+			const float nX = nPhase + nTap * nPhases - nCenter;
+			const float nSinc = nX == 0.0f ? 2.0f * nCutoff : sinf(2.0f * M_PI * nCutoff * nX) / (M_PI * nX);
+			const float nWindowPos = (nPhase + nTap * nPhases) / static_cast<float>(nLength - 1);
+			const float nWindow = 0.42f - 0.5f * cosf(2.0f * M_PI * nWindowPos) + 0.08f * cosf(4.0f * M_PI * nWindowPos);
+			const float nCoefficient = nSinc * nWindow;
+
+			const size_t nIndex = (Taps - 1 - nTap) * nChannels;
+			pPhase[nIndex] = pPhase[nIndex + 1] = nCoefficient;
+			nSum += nCoefficient;
+		}
+
+		// Normalize each phase to unity gain at DC to avoid ripple from phase-to-phase gain variation
+		for (size_t i = 0; i < Taps * nChannels; ++i)
+			pPhase[i] /= nSum;
+	}
+
+	Reset();
+
+	return true;
+}
+
+bool CResampler::IsRatioSupported(unsigned int nInputRate, unsigned int nOutputRate)
+{
+	return nInputRate && nOutputRate && nOutputRate / GCD(nInputRate, nOutputRate) <= MaxPhases;
+}
+
+void CResampler::Reset()
+{
+	m_nTime = 0;
+	if (m_pBuffer)
+		memset(m_pBuffer, 0, HistoryFrames * nChannels * sizeof(float));
+}
+
+size_t CResampler::GetInputFrames(size_t nOutputFrames) const
+{
+	if (!nOutputFrames)
+		return 0;
+
+	// Input frame used by the last output frame, plus one
+	const int nLastIndex = Utility::Max(m_nTime + static_cast<int>((nOutputFrames - 1) * m_nDecimation), 0) / static_cast<int>(m_nInterpolation);
+	return Utility::Min<size_t>(nLastIndex + 1, m_nMaxInputFrames);
+}
+
+void CResampler::Process(float* pOutBuffer, size_t nOutputFrames)
+{
+	const size_t nInputFrames = GetInputFrames(nOutputFrames);
+	const int nInterpolation = m_nInterpolation;
+	const int nDecimation = m_nDecimation;
+
+	// Frame 0 of the new input; history is available at negative indices
+	const float* const pInput = GetInputBuffer();
+
+	int nTime = m_nTime;
+	for (size_t i = 0; i < nOutputFrames; ++i, nTime += nDecimation)
+	{
+		// Floor division; time can be slightly negative at the start of a block
+		const int nIndex = nTime >= 0 ? nTime / nInterpolation : -((-nTime + nInterpolation - 1) / nInterpolation);
+		const int nPhase = nTime - nIndex * nInterpolation;
+
+		const float* pFrames = pInput + (nIndex - static_cast<int>(Taps) + 1) * nChannels;
+		const float* pCoefficients = m_pCoefficients + nPhase * Taps * nChannels;
+
+#ifdef __ARM_NEON
+		// Two frames (L, R, L, R) per multiply-accumulate
+		float32x4_t Sum = vdupq_n_f32(0.0f);
+		for (size_t nTap = 0; nTap < Taps; nTap += 2)
+			Sum = vmlaq_f32(Sum, vld1q_f32(pFrames + nTap * nChannels), vld1q_f32(pCoefficients + nTap * nChannels));
+
+		vst1_f32(pOutBuffer + i * nChannels, vadd_f32(vget_low_f32(Sum), vget_high_f32(Sum)));
+#else
+		float nLeft = 0.0f, nRight = 0.0f;
+		for (size_t nTap = 0; nTap < Taps; ++nTap)
+		{
+			nLeft += pFrames[nTap * nChannels] * pCoefficients[nTap * nChannels];
+			nRight += pFrames[nTap * nChannels + 1] * pCoefficients[nTap * nChannels + 1];
+		}
+
+		pOutBuffer[i * nChannels] = nLeft;
+		pOutBuffer[i * nChannels + 1] = nRight;
+#endif
+	}
+
+	// Retain the most recent input frames as history for the next block
+	m_nTime = nTime - static_cast<int>(nInputFrames) * nInterpolation;
+	memmove(m_pBuffer, m_pBuffer + nInputFrames * nChannels, HistoryFrames * nChannels * sizeof(float));
+}
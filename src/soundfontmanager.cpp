@@ -40,6 +40,7 @@ constexpr u32 FourCC(const char pFourCC[4])
 	return pFourCC[3] << 24 | pFourCC[2] << 16 | pFourCC[1] << 8 | pFourCC[0];
 }
 
+constexpr u32 FourCCIFIL = FourCC("ifil");
 constexpr u32 FourCCINAM = FourCC("INAM");
 constexpr u32 FourCCINFO = FourCC("INFO");
 constexpr u32 FourCCLIST = FourCC("LIST");
@@ -101,7 +102,7 @@ bool CSoundFontManager::ScanSoundFonts()
 
 		LOGNOTE("%d SoundFonts found:", m_nSoundFonts);
 		for (size_t i = 0; i < m_nSoundFonts; ++i)
-			LOGNOTE("%d: %s (%s)", i, static_cast<const char*>(m_SoundFontList[i].Path), static_cast<const char*>(m_SoundFontList[i].Name));
+			LOGNOTE("%d: %s (%s)%s", i, static_cast<const char*>(m_SoundFontList[i].Path), static_cast<const char*>(m_SoundFontList[i].Name), m_SoundFontList[i].bCompressed ? " [SF3]" : "");
 
 		return true;
 	}
@@ -188,6 +189,7 @@ void CSoundFontManager::CheckSoundFont(const char* pFullPath, const char* pFileN
 	u32 nFourCC;
 	u32 nInfoListChunkSize;
 	char Name[MaxSoundFontNameLength];
+	u16 Version[2] = {2, 0};
 
 	// Init with null terminator
 	Name[0] = '\0';
@@ -235,6 +237,10 @@ void CSoundFontManager::CheckSoundFont(const char* pFullPath, const char* pFileN
 			break;
 		}
 
+		// Extract version; it comes before the name, and SF3s (with compressed samples) are version 3
+		else if (Chunk.FourCC == FourCCIFIL && Chunk.Size == sizeof(Version))
+			f_read(&File, Version, sizeof(Version), &nBytesRead);
+
 		// Skip to start of next chunk
 		else
 			f_lseek(&File, f_tell(&File) + Chunk.Size);
@@ -247,6 +253,7 @@ void CSoundFontManager::CheckSoundFont(const char* pFullPath, const char* pFileN
 
 	TSoundFontListEntry& Entry = m_SoundFontList[m_nSoundFonts++];
 	Entry.Path = pFullPath;
+	Entry.bCompressed = Version[0] == 3;
 
 	// If we got a name, use it, otherwise fall back on filename
 	if (Name[0] != '\0')
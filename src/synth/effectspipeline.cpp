@@ -0,0 +1,173 @@
+//
+// effectspipeline.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <circle/util.h>
+
+#include "synth/effectspipeline.h"
+#include "utility.h"
+
+constexpr u8 nChannels = 2;
+
+// A few seconds of dry output with no signal on the sends means the synth isn't mixing into them
+constexpr u32 SilentSendBlocksThreshold = 4096;
+
+namespace
+{
+	bool IsSilent(const float* pBuffer, size_t nFrames)
+	{
+		for (size_t i = 0; i < nFrames; ++i)
+		{
+			if (pBuffer[i] != 0.0f)
+				return false;
+		}
+
+		return true;
+	}
+}
+
+CEffectsPipeline::CEffectsPipeline(unsigned int nSampleRate, CCoreExecutor* pEffectsCore)
+	: m_pEffectsCore(pEffectsCore),
+	  m_EffectsUnit(nSampleRate),
+
+	  m_nSlot(0),
+	  m_bInFlight(false),
+
+	  m_nCarryFrames(0),
+
+	  m_nSilentSendBlocks(0),
+	  m_bSendsVerified(false)
+{
+}
+
+bool CEffectsPipeline::Initialize()
+{
+	return m_EffectsUnit.Initialize();
+}
+
+void CEffectsPipeline::SetParameters(const CEffectsUnit::TParameters& Parameters)
+{
+	m_EffectsUnit.SetParameters(Parameters);
+}
+
+void CEffectsPipeline::Reset()
+{
+	m_EffectsUnit.Reset();
+	m_bInFlight = false;
+	m_nCarryFrames = 0;
+
+	m_nSilentSendBlocks.store(0, std::memory_order_relaxed);
+	m_bSendsVerified.store(false, std::memory_order_relaxed);
+}
+
+void CEffectsPipeline::Render(fluid_synth_t* pSynth, float* pOutBuffer, size_t nFrames)
+{
+	// Leftovers from the previous call come first
+	const size_t nCarriedFrames = Utility::Min(m_nCarryFrames, nFrames);
+	memcpy(pOutBuffer, m_CarryBuffer, nCarriedFrames * nChannels * sizeof(float));
+	m_nCarryFrames -= nCarriedFrames;
+	memmove(m_CarryBuffer, m_CarryBuffer + nCarriedFrames * nChannels, m_nCarryFrames * nChannels * sizeof(float));
+
+	size_t nWrittenFrames = nCarriedFrames;
+	while (nWrittenFrames < nFrames)
+	{
+		// Each block completes the previous one, so output is produced in whole blocks
+		const size_t nSlot = RenderBlock(pSynth);
+
+		const size_t nBlockFrames = Utility::Min(BlockFrames, nFrames - nWrittenFrames);
+		float* const pOut = pOutBuffer + nWrittenFrames * nChannels;
+
+		for (size_t i = 0; i < BlockFrames; ++i)
+		{
+			float* const pFrame = i < nBlockFrames ? pOut + i * nChannels : m_CarryBuffer + (i - nBlockFrames) * nChannels;
+			pFrame[0] = m_DryBuffers[nSlot][0][i] + m_EffectsBuffer[0][i];
+			pFrame[1] = m_DryBuffers[nSlot][1][i] + m_EffectsBuffer[1][i];
+		}
+
+		m_nCarryFrames = BlockFrames - nBlockFrames;
+		nWrittenFrames += nBlockFrames;
+	}
+}
+
+size_t CEffectsPipeline::RenderBlock(fluid_synth_t* pSynth)
+{
+	const size_t nPreviousSlot = m_nSlot ^ 1;
+
+	// Hand the previous block's sends to the effects core while this block's voices render here
+	bool bLaunched = false;
+	if (m_bInFlight && m_EffectsUnit.IsActive())
+	{
+		// The sends are mono, on the left of each pair; the right is only written by FluidSynth's own effects
+		memcpy(m_ReverbSend, m_SendBuffers[nPreviousSlot][ReverbLeft], sizeof(m_ReverbSend));
+		memcpy(m_ChorusSend, m_SendBuffers[nPreviousSlot][ChorusLeft], sizeof(m_ChorusSend));
+
+		bLaunched = m_pEffectsCore->Launch(EffectsJob, this);
+
+		// Process inline rather than drop the effects
+		if (!bLaunched)
+			EffectsJob(this);
+	}
+	else
+		memset(m_EffectsBuffer, 0, sizeof(m_EffectsBuffer));
+
+	// The very first block has nothing before it; its output is silence
+	if (!m_bInFlight)
+		memset(m_DryBuffers[nPreviousSlot], 0, sizeof(m_DryBuffers[nPreviousSlot]));
+
+	// FluidSynth mixes into the buffers rather than overwriting them
+	float (&DryBuffers)[2][BlockFrames] = m_DryBuffers[m_nSlot];
+	float (&SendBuffers)[SendCount][BlockFrames] = m_SendBuffers[m_nSlot];
+	memset(DryBuffers, 0, sizeof(DryBuffers));
+	memset(SendBuffers, 0, sizeof(SendBuffers));
+
+	float* pDry[] = { DryBuffers[0], DryBuffers[1] };
+	float* pSends[] = { SendBuffers[ReverbLeft], SendBuffers[ReverbRight], SendBuffers[ChorusLeft], SendBuffers[ChorusRight] };
+	fluid_synth_process(pSynth, BlockFrames, SendCount, pSends, 2, pDry);
+
+	// Check that the synth really is mixing into the sends; a synth that isn't would silently give dry output
+	if (!m_bSendsVerified.load(std::memory_order_relaxed) && m_EffectsUnit.IsActive())
+	{
+		if (!IsSilent(SendBuffers[ReverbLeft], BlockFrames) || !IsSilent(SendBuffers[ChorusLeft], BlockFrames))
+			m_bSendsVerified.store(true, std::memory_order_relaxed);
+		else if (!IsSilent(DryBuffers[0], BlockFrames) || !IsSilent(DryBuffers[1], BlockFrames))
+			m_nSilentSendBlocks.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	if (bLaunched)
+		m_pEffectsCore->Join();
+
+	// This block is now in flight, and the previous one is complete
+	m_nSlot = nPreviousSlot;
+	m_bInFlight = true;
+
+	return nPreviousSlot;
+}
+
+void CEffectsPipeline::EffectsJob(void* pParam)
+{
+	CEffectsPipeline* const pThis = static_cast<CEffectsPipeline*>(pParam);
+	pThis->m_EffectsUnit.Process(pThis->m_ReverbSend, pThis->m_ChorusSend, pThis->m_EffectsBuffer[0], pThis->m_EffectsBuffer[1]);
+}
+
+bool CEffectsPipeline::AreSendsSilent() const
+{
+	return !m_bSendsVerified.load(std::memory_order_relaxed) && m_nSilentSendBlocks.load(std::memory_order_relaxed) >= SilentSendBlocksThreshold;
+}
@@ -0,0 +1,105 @@
+//
+// effectsunit.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <circle/util.h>
+
+#include "synth/effectsunit.h"
+#include "utility.h"
+
+// Added to FluidSynth by our patch
+extern "C"
+{
+	_fluid_revmodel_t* fluid_fx_reverb_new(float sample_rate);
+	void fluid_fx_reverb_delete(_fluid_revmodel_t* rev);
+	void fluid_fx_reverb_set(_fluid_revmodel_t* rev, float roomsize, float damping, float width, float level);
+	void fluid_fx_reverb_reset(_fluid_revmodel_t* rev);
+	void fluid_fx_reverb_process(_fluid_revmodel_t* rev, const float* in, float* left_out, float* right_out);
+
+	_fluid_chorus_t* fluid_fx_chorus_new(float sample_rate);
+	void fluid_fx_chorus_delete(_fluid_chorus_t* chorus);
+	void fluid_fx_chorus_set(_fluid_chorus_t* chorus, int nr, float level, float speed, float depth_ms);
+	void fluid_fx_chorus_reset(_fluid_chorus_t* chorus);
+	void fluid_fx_chorus_process(_fluid_chorus_t* chorus, const float* in, float* left_out, float* right_out);
+}
+
+CEffectsUnit::CEffectsUnit(unsigned int nSampleRate)
+	: m_nSampleRate(nSampleRate),
+	  m_Parameters{},
+
+	  m_pReverb(nullptr),
+	  m_pChorus(nullptr)
+{
+}
+
+CEffectsUnit::~CEffectsUnit()
+{
+	if (m_pReverb)
+		fluid_fx_reverb_delete(m_pReverb);
+
+	if (m_pChorus)
+		fluid_fx_chorus_delete(m_pChorus);
+}
+
+bool CEffectsUnit::Initialize()
+{
+	m_pReverb = fluid_fx_reverb_new(m_nSampleRate);
+	m_pChorus = fluid_fx_chorus_new(m_nSampleRate);
+
+	return m_pReverb && m_pChorus;
+}
+
+void CEffectsUnit::SetParameters(const TParameters& Parameters)
+{
+	m_Parameters = Parameters;
+
+	// The ranges of FluidSynth's synth.reverb.* and synth.chorus.* settings
+	fluid_fx_reverb_set(m_pReverb,
+		Utility::Clamp(Parameters.nReverbRoomSize, 0.0f, 1.0f),
+		Utility::Clamp(Parameters.nReverbDamping, 0.0f, 1.0f),
+		Utility::Clamp(Parameters.nReverbWidth, 0.0f, 100.0f),
+		Utility::Clamp(Parameters.nReverbLevel, 0.0f, 1.0f));
+
+	fluid_fx_chorus_set(m_pChorus,
+		Utility::Clamp(Parameters.nChorusVoices, 0, 99),
+		Utility::Clamp(Parameters.nChorusLevel, 0.0f, 10.0f),
+		Utility::Clamp(Parameters.nChorusSpeed, 0.1f, 5.0f),
+		Utility::Clamp(Parameters.nChorusDepth, 0.0f, 256.0f));
+}
+
+void CEffectsUnit::Reset()
+{
+	fluid_fx_reverb_reset(m_pReverb);
+	fluid_fx_chorus_reset(m_pChorus);
+}
+
+void CEffectsUnit::Process(const float* pReverbSend, const float* pChorusSend, float* pOutLeft, float* pOutRight)
+{
+	// FluidSynth's units mix into their output
+	memset(pOutLeft, 0, BlockFrames * sizeof(float));
+	memset(pOutRight, 0, BlockFrames * sizeof(float));
+
+	if (m_Parameters.bReverbActive)
+		fluid_fx_reverb_process(m_pReverb, pReverbSend, pOutLeft, pOutRight);
+
+	if (m_Parameters.bChorusActive)
+		fluid_fx_chorus_process(m_pChorus, pChorusSend, pOutLeft, pOutRight);
+}
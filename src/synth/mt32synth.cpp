@@ -69,18 +69,25 @@ CMT32Synth::~CMT32Synth()
 }
 
 bool CMT32Synth::Initialize()
+{
+	return LoadROMs(CConfig::Get()->MT32EmuROMSet) && Open();
+}
+
+bool CMT32Synth::LoadROMs(TMT32ROMSet PreferredROMSet)
 {
 	if (!m_ROMManager.ScanROMs())
 		return false;
 
 	// Try to load user's preferred initial ROM set, otherwise fall back on first available
-	TMT32ROMSet InitialROMSet = CConfig::Get()->MT32EmuROMSet;
+	TMT32ROMSet InitialROMSet = PreferredROMSet;
 	if (!m_ROMManager.HaveROMSet(InitialROMSet))
 		InitialROMSet = TMT32ROMSet::Any;
 
-	if (!m_ROMManager.GetROMSet(InitialROMSet, m_CurrentROMSet, m_pControlROMImage, m_pPCMROMImage))
-		return false;
+	return m_ROMManager.GetROMSet(InitialROMSet, m_CurrentROMSet, m_pControlROMImage, m_pPCMROMImage);
+}
 
+bool CMT32Synth::Open()
+{
 	m_pSynth = new MT32Emu::Synth(this);
 
 	if (!m_pSynth->open(*m_pControlROMImage, *m_pPCMROMImage))
@@ -120,55 +127,35 @@ bool CMT32Synth::Initialize()
 	return true;
 }
 
-void CMT32Synth::HandleMIDIShortMessage(u32 nMessage)
+size_t CMT32Synth::Render(s16* pOutBuffer, size_t nFrames)
 {
-	m_pSynth->playMsg(nMessage);
-
-	// Update MIDI monitor
-	CSynthBase::HandleMIDIShortMessage(nMessage);
+	return RenderSamples(pOutBuffer, nFrames);
 }
 
-void CMT32Synth::HandleMIDISysExMessage(const u8* pData, size_t nSize)
+size_t CMT32Synth::Render(float* pOutBuffer, size_t nFrames)
 {
-	m_pSynth->playSysex(pData, nSize);
+	return RenderSamples(pOutBuffer, nFrames);
 }
 
-void CMT32Synth::AllSoundOff()
+template <class T>
+size_t CMT32Synth::RenderSamples(T* pOutBuffer, size_t nFrames)
 {
-	// Stop all sound immediately; mt32emu treats CC 0x7C like "All Sound Off", ignoring pedal
-	for (uint8_t i = 0; i < 8; ++i)
-		m_pSynth->playMsgOnPart(i, 0x0B, 0x7C, 0);
-
-	// Reset MIDI monitor
-	CSynthBase::AllSoundOff();
-}
+	// Synth is being reconfigured by the main core; output silence
+	if (!BeginRender())
+	{
+		memset(pOutBuffer, 0, nFrames * 2 * sizeof(T));
+		return nFrames;
+	}
 
-void CMT32Synth::SetMasterVolume(u8 nVolume)
-{
-	const u8 SetVolumeSysEx[] = { 0x10, 0x00, 0x16, nVolume };
-	m_pSynth->writeSysex(0x10, SetVolumeSysEx, sizeof(SetVolumeSysEx));
-}
+	ApplyControls();
+	ProcessCommands(nFrames);
 
-size_t CMT32Synth::Render(s16* pOutBuffer, size_t nFrames)
-{
-	m_Lock.Acquire();
 	if (m_pSampleRateConverter)
 		m_pSampleRateConverter->getOutputSamples(pOutBuffer, nFrames);
 	else
 		m_pSynth->render(pOutBuffer, nFrames);
-	m_Lock.Release();
-
-	return nFrames;
-}
 
-size_t CMT32Synth::Render(float* pOutBuffer, size_t nFrames)
-{
-	m_Lock.Acquire();
-	if (m_pSampleRateConverter)
-		m_pSampleRateConverter->getOutputSamples(pOutBuffer, nFrames);
-	else
-		m_pSynth->render(pOutBuffer, nFrames);
-	m_Lock.Release();
+	EndRender(m_pSynth->isActive());
 
 	return nFrames;
 }
@@ -218,10 +205,7 @@ void CMT32Synth::UpdateLCD(CLCD& LCD, unsigned int nTicks)
 
 void CMT32Synth::SetMIDIChannels(TMIDIChannels Channels)
 {
-	if (Channels == TMIDIChannels::Standard)
-		m_pSynth->writeSysex(0x10, StandardMIDIChannelsSysEx, sizeof(StandardMIDIChannelsSysEx));
-	else
-		m_pSynth->writeSysex(0x10, AlternateMIDIChannelsSysEx, sizeof(AlternateMIDIChannelsSysEx));
+	SetControl(TControl::MIDIChannels, static_cast<u8>(Channels));
 }
 
 bool CMT32Synth::SwitchROMSet(TMT32ROMSet ROMSet)
@@ -246,12 +230,12 @@ bool CMT32Synth::SwitchROMSet(TMT32ROMSet ROMSet)
 	}
 
 	// Reopen synth with new ROMs
-	m_Lock.Acquire();
+	SuspendRendering();
 	m_pSynth->close();
 	assert(m_pSynth->open(*pControlROMImage, *pPCMROMImage));
 	m_pSynth->setOutputGain(m_nGain);
 	m_pSynth->setReverbOutputGain(m_nReverbGain);
-	m_Lock.Release();
+	ResumeRendering();
 
 	m_pControlROMImage = pControlROMImage;
 	m_pPCMROMImage     = pPCMROMImage;
@@ -329,6 +313,64 @@ void CMT32Synth::GetPartLevels(unsigned int nTicks, float PartLevels[9], float P
 	}
 }
 
+void CMT32Synth::ProcessCommands(size_t nFrames)
+{
+	// mt32emu timestamps are in samples at its internal sample rate, relative to the start of rendering
+	const MT32Emu::Bit32u nRenderedSamples = m_pSynth->getInternalRenderedSampleCount();
+
+	TCommand Command;
+	while (DequeueCommand(Command))
+	{
+		const double nFrameOffset = GetFrameOffset(Command.nTimestamp, nFrames);
+		const double nSynthOffset = m_pSampleRateConverter ? m_pSampleRateConverter->convertOutputToSynthTimestamp(nFrameOffset) : nFrameOffset;
+		const MT32Emu::Bit32u nSynthTimestamp = nRenderedSamples + static_cast<MT32Emu::Bit32u>(nSynthOffset);
+
+		switch (Command.Type)
+		{
+			case TCommandType::ShortMessage:
+				m_pSynth->playMsg(Command.nMessage, nSynthTimestamp);
+				break;
+
+			case TCommandType::SysExMessage:
+				m_pSynth->playSysex(Command.SysEx.pData, Command.SysEx.nSize, nSynthTimestamp);
+				break;
+
+			case TCommandType::AllSoundOff:
+				// Stop all sound immediately; mt32emu treats CC 0x7C like "All Sound Off", ignoring pedal
+				for (uint8_t i = 0; i < 8; ++i)
+					m_pSynth->playMsgOnPart(i, 0x0B, 0x7C, 0);
+				break;
+		}
+	}
+}
+
+void CMT32Synth::ApplyControl(TControl Control, u8 nValue)
+{
+	switch (Control)
+	{
+		case TControl::MasterVolume:
+		{
+			const u8 SetVolumeSysEx[] = { 0x10, 0x00, 0x16, nValue };
+			m_pSynth->writeSysex(0x10, SetVolumeSysEx, sizeof(SetVolumeSysEx));
+			break;
+		}
+
+		case TControl::ReversedStereo:
+			m_pSynth->setReversedStereoEnabled(nValue);
+			break;
+
+		case TControl::MIDIChannels:
+			if (static_cast<TMIDIChannels>(nValue) == TMIDIChannels::Standard)
+				m_pSynth->writeSysex(0x10, StandardMIDIChannelsSysEx, sizeof(StandardMIDIChannelsSysEx));
+			else
+				m_pSynth->writeSysex(0x10, AlternateMIDIChannelsSysEx, sizeof(AlternateMIDIChannelsSysEx));
+			break;
+
+		default:
+			break;
+	}
+}
+
 bool CMT32Synth::onMIDIQueueOverflow()
 {
 	LOGERR("MIDI queue overflow");
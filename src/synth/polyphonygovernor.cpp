@@ -0,0 +1,85 @@
+//
+// polyphonygovernor.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "synth/polyphonygovernor.h"
+#include "utility.h"
+
+CPolyphonyGovernor::CPolyphonyGovernor()
+	: m_nMaxPolyphony(0),
+	  m_nVoiceCap(0),
+	  m_nStealsPerSecond(0),
+
+	  m_nRecoveryFrames(0),
+	  m_nSteals(0),
+	  m_nStealWindowFrames(0)
+{
+}
+
+void CPolyphonyGovernor::Reset(size_t nMaxPolyphony)
+{
+	m_nMaxPolyphony.store(nMaxPolyphony, std::memory_order_relaxed);
+	m_nVoiceCap.store(nMaxPolyphony, std::memory_order_relaxed);
+	m_nStealsPerSecond.store(0, std::memory_order_relaxed);
+
+	m_nRecoveryFrames = 0;
+	m_nSteals = 0;
+	m_nStealWindowFrames = 0;
+}
+
+size_t CPolyphonyGovernor::Update(float nLoad, size_t nActiveVoices, size_t nFrames, unsigned int nSampleRate)
+{
+	const size_t nMaxPolyphony = GetMaxPolyphony();
+	const size_t nMinPolyphony = Utility::Min(MinPolyphony, nMaxPolyphony);
+	size_t nVoiceCap = GetVoiceCap();
+
+	if (nLoad > HighLoad)
+	{
+		// Cut back from whichever is lower so that the reduction takes effect immediately
+		const size_t nCurrent = Utility::Min(nVoiceCap, nActiveVoices);
+		nVoiceCap = Utility::Max(nCurrent - nCurrent / 8, nMinPolyphony);
+		m_nRecoveryFrames = 0;
+	}
+	else if (nLoad < LowLoad && nVoiceCap < nMaxPolyphony)
+	{
+		m_nRecoveryFrames += nFrames;
+		if (m_nRecoveryFrames * 1000 >= static_cast<size_t>(nSampleRate) * RecoveryMillis)
+		{
+			nVoiceCap = Utility::Min(nVoiceCap + Utility::Max<size_t>(nVoiceCap / 8, 1), nMaxPolyphony);
+			m_nRecoveryFrames = 0;
+		}
+	}
+	else
+		m_nRecoveryFrames = 0;
+
+	m_nVoiceCap.store(nVoiceCap, std::memory_order_relaxed);
+
+	// Publish steal rate once per second
+	m_nStealWindowFrames += nFrames;
+	if (m_nStealWindowFrames >= nSampleRate)
+	{
+		m_nStealsPerSecond.store(m_nSteals, std::memory_order_relaxed);
+		m_nSteals = 0;
+		m_nStealWindowFrames = 0;
+	}
+
+	return nVoiceCap;
+}
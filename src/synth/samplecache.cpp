@@ -0,0 +1,512 @@
+//
+// samplecache.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <circle/logger.h>
+#include <circle/multicore.h>
+#include <circle/sched/scheduler.h>
+#include <circle/timer.h>
+
+#include <assert.h>
+
+#include "synth/samplecache.h"
+#include "utility.h"
+#include "zoneallocator.h"
+
+LOGMODULE("samplecache");
+
+CSampleCache* CSampleCache::s_pPagingCache = nullptr;
+CTask* CSampleCache::s_pPagingTask = nullptr;
+std::atomic<u32> CSampleCache::s_nRefusedLoads{0};
+
+CSampleCache::CSampleCache(size_t nBudgetBytes)
+	: CTask(TASK_STACK_SIZE, true),
+	  m_nBudgetBytes(nBudgetBytes),
+
+	  m_pSynth(nullptr),
+	  m_pSoundFont(nullptr),
+	  m_nSoundFontID(0),
+
+	  m_BankSelect{0},
+	  m_Selected{},
+
+	  m_Entries{},
+	  m_nUseCounter(0),
+
+	  m_bPagingIn(false),
+	  m_PendingPreset{},
+
+	  m_Ranges{},
+	  m_nNextRange(0),
+	  m_Prefetches{},
+
+	  m_nHits(0),
+	  m_nMisses(0),
+	  m_nTotalStallMillis(0),
+	  m_nWorstStallMillis(0),
+
+	  m_nPrefetches(0),
+	  m_nTotalPrefetchMicros(0),
+	  m_nWorstPrefetchMicros(0),
+	  m_nLatePrefetches(0)
+{
+	for (TPrefetch& Prefetch : m_Prefetches)
+	{
+		Prefetch.pCache = this;
+		Prefetch.Job = CJobSystem::TJob{PrefetchJob, &Prefetch, &Prefetch.Counter};
+	}
+}
+
+CSampleCache::~CSampleCache()
+{
+	WaitForPageIn();
+}
+
+void CSampleCache::Initialize()
+{
+	// We started as a suspended task; run now that the owner is fully initialized
+	Start();
+}
+
+void CSampleCache::Reset(fluid_synth_t* pSynth)
+{
+	// The old engine is about to be deleted or kept resident for later; either way, release what it had pinned
+	for (TEntry& Entry : m_Entries)
+	{
+		if (Entry.bUsed)
+			Unpin(Entry);
+	}
+
+	m_pSynth = pSynth;
+	m_pSoundFont = pSynth ? fluid_synth_get_sfont(pSynth, 0) : nullptr;
+	if (!m_pSoundFont)
+	{
+		m_pSynth = nullptr;
+		return;
+	}
+
+	m_nSoundFontID = fluid_sfont_get_id(m_pSoundFont);
+	ResetPrograms();
+
+	// A reset can select these on the audio core at any time, so they must never be released; they were already loaded
+	// along with the SoundFont
+	TPreset Preset;
+	if (ResolvePreset(0, 0, false, Preset))
+		Pin(Preset, true);
+	if (ResolvePreset(9, 0, true, Preset))
+		Pin(Preset, true);
+}
+
+CSampleCache::TCheckResult CSampleCache::CheckMessage(u32 nMessage, u16 nPercussionMask)
+{
+	if (!m_pSynth)
+		return TCheckResult::Ready;
+
+	const u8 nStatus  = nMessage & 0xFF;
+	const u8 nChannel = nMessage & 0x0F;
+	const u8 nData1   = (nMessage >> 8) & 0xFF;
+	const u8 nData2   = (nMessage >> 16) & 0xFF;
+
+	// The caller must let a page-in finish first, as this may change which presets are selected
+	if (nStatus == 0xFF)
+	{
+		assert(!m_bPagingIn);
+		ResetPrograms();
+		return TCheckResult::Ready;
+	}
+
+	// Bank select MSB (FluidSynth's default GS bank select style ignores the LSB)
+	if ((nStatus & 0xF0) == 0xB0 && nData1 == 0x00)
+	{
+		m_BankSelect[nChannel] = nData2;
+		return TCheckResult::Ready;
+	}
+
+	// A note arriving before the prefetch for its channel has finished may have to wait on memory
+	if ((nStatus & 0xF0) == 0x90 && nData2 > 0)
+	{
+		if (!m_Prefetches[nChannel].Counter.IsDone())
+			++m_nLatePrefetches;
+		return TCheckResult::Ready;
+	}
+
+	if ((nStatus & 0xF0) != 0xC0)
+		return TCheckResult::Ready;
+
+	TPreset Preset;
+	if (!ResolvePreset(nChannel, nData1, nPercussionMask & (1 << nChannel), Preset))
+		return TCheckResult::Ready;
+
+	TEntry* const pEntry = FindEntry(Preset);
+	if (!pEntry && m_bPagingIn)
+		return TCheckResult::Busy;
+
+	m_Selected[nChannel] = Preset;
+
+	if (pEntry)
+	{
+		pEntry->nLastUsed = ++m_nUseCounter;
+		++m_nHits;
+		Prefetch(nChannel, *pEntry);
+		return TCheckResult::Ready;
+	}
+
+	++m_nMisses;
+	m_PendingPreset = Preset;
+	m_bPagingIn = true;
+	m_Event.Set();
+
+	return TCheckResult::PagingIn;
+}
+
+void CSampleCache::WaitForPageIn()
+{
+	while (m_bPagingIn)
+		CScheduler::Get()->Yield();
+
+	// Reset() may free what they read
+	WaitForPrefetches();
+}
+
+void CSampleCache::ResetPrograms()
+{
+	for (u8 nChannel = 0; nChannel < 16; ++nChannel)
+	{
+		m_BankSelect[nChannel] = 0;
+		m_Selected[nChannel] = TPreset{nChannel == 9 ? DrumBank : static_cast<u16>(0), 0};
+	}
+}
+
+void CSampleCache::GetStats(TStats& OutStats) const
+{
+	OutStats.nHits = m_nHits;
+	OutStats.nMisses = m_nMisses;
+	OutStats.nTotalStallMillis = m_nTotalStallMillis;
+	OutStats.nWorstStallMillis = m_nWorstStallMillis;
+	OutStats.nUnavailable = s_nRefusedLoads.load(std::memory_order_relaxed);
+	OutStats.nResidentBytes = CZoneAllocator::Get()->GetTagBytes(TZoneTag::FluidSynthSamples);
+	OutStats.nBudgetBytes = m_nBudgetBytes;
+
+	const u32 nPrefetches = m_nPrefetches.load(std::memory_order_relaxed);
+	OutStats.nPrefetches = nPrefetches;
+	OutStats.nAveragePrefetchMicros = nPrefetches ? m_nTotalPrefetchMicros.load(std::memory_order_relaxed) / nPrefetches : 0;
+	OutStats.nWorstPrefetchMicros = m_nWorstPrefetchMicros.load(std::memory_order_relaxed);
+	OutStats.nLatePrefetches = m_nLatePrefetches;
+}
+
+void CSampleCache::LockEngine()
+{
+	while (m_bEngineLocked.test_and_set(std::memory_order_acquire))
+		;
+}
+
+bool CSampleCache::IsPaging()
+{
+	// FluidSynth allocates on other cores while rendering, and a SoundFont may be loading in another task meanwhile
+	return s_pPagingCache && CMultiCoreSupport::ThisCore() == 0 && CScheduler::Get()->GetCurrentTask() == s_pPagingTask;
+}
+
+void CSampleCache::BeginStorageAccess()
+{
+	// Nothing FluidSynth has changed so far refers to the data being read, so the audio core can render meanwhile
+	if (IsPagingInBackground())
+		s_pPagingCache->UnlockEngine();
+}
+
+void CSampleCache::EndStorageAccess()
+{
+	if (!IsPagingInBackground())
+		return;
+
+	// Let the main task process MIDI between chunks
+	CScheduler::Get()->Yield();
+	s_pPagingCache->LockEngineFromTask();
+}
+
+void CSampleCache::Run()
+{
+	while (true)
+	{
+		m_Event.Wait();
+		m_Event.Clear();
+
+		if (!m_bPagingIn)
+			continue;
+
+		// The preset's channel is held back meanwhile; the others carry on
+		const unsigned int nStartTicks = CTimer::GetClockTicks();
+
+		// Unpinning may free what they read. Waiting runs other jobs on this core, so it mustn't happen with the engine
+		// locked, as the audio core would spin meanwhile; none are started until the page-in has finished.
+		WaitForPrefetches();
+
+		LockEngineFromTask();
+		const bool bPinned = Pin(m_PendingPreset, false);
+		UnlockEngine();
+
+		const u32 nStallMillis = Utility::TicksToMillis(CTimer::GetClockTicks() - nStartTicks);
+		m_nTotalStallMillis += nStallMillis;
+		m_nWorstStallMillis = Utility::Max(m_nWorstStallMillis, nStallMillis);
+
+		if (!bPinned)
+			LOGWARN("Couldn't load samples for preset %d:%d", m_PendingPreset.nBank, m_PendingPreset.nProgram);
+
+		m_bPagingIn = false;
+	}
+}
+
+void CSampleCache::OnSampleAlloc(void* pData, size_t nSize)
+{
+	if (!IsPaging() || !pData || nSize < MinSampleBytes)
+		return;
+
+	// Owned by the entry being paged in once it has been pinned; if there's no room, it just won't be prefetched
+	CSampleCache* const pCache = s_pPagingCache;
+	for (size_t i = 0; i < MaxRanges; ++i)
+	{
+		TRange& Range = pCache->m_Ranges[pCache->m_nNextRange];
+		pCache->m_nNextRange = (pCache->m_nNextRange + 1) % MaxRanges;
+
+		if (Range.nSize == 0)
+		{
+			Range = TRange{static_cast<const u8*>(pData), nSize, PendingEntry};
+			return;
+		}
+	}
+}
+
+bool CSampleCache::IsPagingInBackground()
+{
+	return IsPaging() && s_pPagingTask == s_pPagingCache;
+}
+
+void CSampleCache::LockEngineFromTask()
+{
+	// The audio core only holds it while rendering a block; let the main task run meanwhile
+	while (m_bEngineLocked.test_and_set(std::memory_order_acquire))
+		CScheduler::Get()->Yield();
+}
+
+bool CSampleCache::FindPreset(u16 nBank, u8 nProgram) const
+{
+	return fluid_sfont_get_preset(m_pSoundFont, nBank, nProgram) != nullptr;
+}
+
+bool CSampleCache::ResolvePreset(u8 nChannel, u8 nProgram, bool bDrum, TPreset& OutPreset) const
+{
+	// Same fallbacks as fluid_synth_program_change()
+	if (bDrum)
+	{
+		OutPreset = TPreset{DrumBank, nProgram};
+		if (!FindPreset(OutPreset.nBank, OutPreset.nProgram))
+			OutPreset.nProgram = 0;
+	}
+	else
+	{
+		OutPreset = TPreset{m_BankSelect[nChannel], nProgram};
+		if (!FindPreset(OutPreset.nBank, OutPreset.nProgram))
+		{
+			OutPreset.nBank = 0;
+			if (!FindPreset(OutPreset.nBank, OutPreset.nProgram))
+				OutPreset.nProgram = 0;
+		}
+	}
+
+	return FindPreset(OutPreset.nBank, OutPreset.nProgram);
+}
+
+CSampleCache::TEntry* CSampleCache::FindEntry(const TPreset& Preset)
+{
+	for (TEntry& Entry : m_Entries)
+	{
+		if (Entry.bUsed && Entry.Preset.nBank == Preset.nBank && Entry.Preset.nProgram == Preset.nProgram)
+			return &Entry;
+	}
+
+	return nullptr;
+}
+
+bool CSampleCache::Pin(const TPreset& Preset, bool bPermanent)
+{
+	// Sample data is read by this cache's task while rendering carries on, or by the main task while resetting with
+	// rendering suspended (see BeginStorageAccess())
+	s_pPagingCache = this;
+	s_pPagingTask = CScheduler::Get()->GetCurrentTask();
+	const bool bPinned = fluid_synth_pin_preset(m_pSynth, m_nSoundFontID, Preset.nBank, Preset.nProgram) == FLUID_OK;
+	s_pPagingCache = nullptr;
+	s_pPagingTask = nullptr;
+
+	if (!bPinned)
+	{
+		FreeRanges(PendingEntry);
+		return false;
+	}
+
+	// Use a free entry, otherwise give up the least recently used one
+	TEntry* pEntry = nullptr;
+	for (TEntry& Entry : m_Entries)
+	{
+		if (!Entry.bUsed)
+		{
+			pEntry = &Entry;
+			break;
+		}
+
+		if (!Entry.bPermanent && (!pEntry || Entry.nLastUsed < pEntry->nLastUsed))
+			pEntry = &Entry;
+	}
+
+	if (pEntry->bUsed)
+		Unpin(*pEntry);
+
+	*pEntry = TEntry{Preset, true, bPermanent, ++m_nUseCounter};
+	AssignRanges(pEntry - m_Entries);
+
+	EvictToBudget(pEntry);
+
+	return true;
+}
+
+void CSampleCache::Unpin(TEntry& Entry)
+{
+	// Samples still sounding in a voice are freed by FluidSynth once the voice has finished
+	fluid_synth_unpin_preset(m_pSynth, m_nSoundFontID, Entry.Preset.nBank, Entry.Preset.nProgram);
+	Entry.bUsed = false;
+
+	FreeRanges(&Entry - m_Entries);
+}
+
+bool CSampleCache::IsSelected(const TPreset& Preset) const
+{
+	for (const TPreset& Selected : m_Selected)
+	{
+		if (Selected.nBank == Preset.nBank && Selected.nProgram == Preset.nProgram)
+			return true;
+	}
+
+	return false;
+}
+
+void CSampleCache::EvictToBudget(const TEntry* pKeep)
+{
+	CZoneAllocator* const pAllocator = CZoneAllocator::Get();
+
+	while (pAllocator->GetTagBytes(TZoneTag::FluidSynthSamples) > m_nBudgetBytes)
+	{
+		// Presets selected on a channel stay loaded even when unpinned, so releasing them wouldn't help
+		TEntry* pVictim = nullptr;
+		for (TEntry& Entry : m_Entries)
+		{
+			if (!Entry.bUsed || Entry.bPermanent || &Entry == pKeep || IsSelected(Entry.Preset))
+				continue;
+
+			if (!pVictim || Entry.nLastUsed < pVictim->nLastUsed)
+				pVictim = &Entry;
+		}
+
+		if (!pVictim)
+			break;
+
+		Unpin(*pVictim);
+	}
+}
+
+void CSampleCache::AssignRanges(u16 nEntry)
+{
+	for (TRange& Range : m_Ranges)
+	{
+		if (Range.nSize && Range.nEntry == PendingEntry)
+			Range.nEntry = nEntry;
+	}
+}
+
+void CSampleCache::FreeRanges(u16 nEntry)
+{
+	for (TRange& Range : m_Ranges)
+	{
+		if (Range.nSize && Range.nEntry == nEntry)
+			Range.nSize = 0;
+	}
+}
+
+void CSampleCache::Prefetch(u8 nChannel, const TEntry& Entry)
+{
+	// The page-in task may unpin presets, freeing their samples, once it has waited for prefetches in flight
+	if (m_bPagingIn)
+		return;
+
+	TPrefetch& Prefetch = m_Prefetches[nChannel];
+
+	// Still warming up this channel's previous preset; let it finish rather than pile up jobs
+	if (!Prefetch.Counter.IsDone())
+		return;
+
+	// Samples shared with presets that were paged in earlier belong to those presets' entries, and aren't prefetched
+	const u16 nEntry = &Entry - m_Entries;
+	Prefetch.nRanges = 0;
+	for (const TRange& Range : m_Ranges)
+	{
+		if (Range.nSize && Range.nEntry == nEntry)
+		{
+			Prefetch.Ranges[Prefetch.nRanges++] = Range;
+			if (Prefetch.nRanges == Utility::ArraySize(Prefetch.Ranges))
+				break;
+		}
+	}
+
+	if (!Prefetch.nRanges)
+		return;
+
+	Prefetch.nSubmitTicks = CTimer::GetClockTicks();
+	CJobSystem::Get()->Submit(0, Prefetch.Job);
+}
+
+void CSampleCache::WaitForPrefetches()
+{
+	for (TPrefetch& Prefetch : m_Prefetches)
+		CJobSystem::Get()->Wait(0, Prefetch.Counter);
+}
+
+void CSampleCache::PrefetchJob(void* pParam)
+{
+	TPrefetch* const pPrefetch = static_cast<TPrefetch*>(pParam);
+	CSampleCache* const pCache = pPrefetch->pCache;
+
+	// Touch one word per cache line; the L2 cache is shared, so the audio core will find them there
+	u32 nSum = 0;
+	for (size_t i = 0; i < pPrefetch->nRanges; ++i)
+	{
+		const TRange& Range = pPrefetch->Ranges[i];
+		const size_t nSize = Utility::Min(Range.nSize, PrefetchBytesPerSample);
+
+		for (size_t nOffset = 0; nOffset < nSize; nOffset += CacheLineSize)
+			nSum += *reinterpret_cast<const volatile u8*>(Range.pData + nOffset);
+	}
+	static_cast<void>(nSum);
+
+	const u32 nMicros = CTimer::GetClockTicks() - pPrefetch->nSubmitTicks;
+	pCache->m_nPrefetches.fetch_add(1, std::memory_order_relaxed);
+	pCache->m_nTotalPrefetchMicros.fetch_add(nMicros, std::memory_order_relaxed);
+
+	u32 nWorst = pCache->m_nWorstPrefetchMicros.load(std::memory_order_relaxed);
+	while (nMicros > nWorst && !pCache->m_nWorstPrefetchMicros.compare_exchange_weak(nWorst, nMicros, std::memory_order_relaxed))
+		;
+}
@@ -0,0 +1,189 @@
+//
+// sampledecoder.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include <circle/logger.h>
+#include <circle/multicore.h>
+#include <circle/timer.h>
+
+#include <string.h>
+
+#define STB_VORBIS_HEADER_ONLY
+#define STB_VORBIS_NO_PUSHDATA_API
+#define STB_VORBIS_NO_STDIO
+#include <stb_vorbis.c>
+
+#include "synth/sampledecoder.h"
+#include "synth/soundfontloader.h"
+
+LOGMODULE("sampledecoder");
+
+extern "C" void* fluid_alloc(size_t len);
+
+// Enough for the decoder state and codebooks of any stream an SF3 encoder is likely to produce
+constexpr size_t ScratchSize = 512 * 1024;
+
+// Keeps the job queues from filling up; the rest are submitted as jobs finish
+constexpr u32 MaxPendingJobs = 32;
+
+// If no other core has started a job by then, they're all busy (e.g. core 3 rendering FluidSynth's voices)
+constexpr unsigned HelperTimeoutMillis = 50;
+
+CSampleDecoder::CSampleDecoder()
+	: m_pScratch{nullptr},
+	  m_CoreStats{},
+
+	  m_nStarted(0),
+	  m_nFinished(0),
+	  m_nFailed(0)
+{
+}
+
+CSampleDecoder::~CSampleDecoder()
+{
+	for (u8* pScratch : m_pScratch)
+	{
+		if (pScratch)
+			fluid_free(pScratch);
+	}
+}
+
+bool CSampleDecoder::Initialize()
+{
+	for (u8*& pScratch : m_pScratch)
+	{
+		pScratch = static_cast<u8*>(fluid_alloc(ScratchSize));
+		if (!pScratch)
+			return false;
+	}
+
+	return true;
+}
+
+u32 CSampleDecoder::Decode(const CSoundFontCompiler& Compiler, u8* pImage)
+{
+	CJobSystem* const pJobSystem = CJobSystem::Get();
+	const u32 nSamples = Compiler.GetSampleCount();
+
+	TSampleJob* const pJobs = new TSampleJob[Compiler.GetCompressedSampleCount()];
+	u32 nJobs = 0;
+
+	for (u32 i = 0; i < nSamples; ++i)
+	{
+		TSampleJob& SampleJob = pJobs[nJobs];
+		if (!Compiler.GetCompressedSample(pImage, i, SampleJob.Sample))
+			continue;
+
+		SampleJob.pDecoder = this;
+		SampleJob.Job = CJobSystem::TJob{DecodeJob, &SampleJob, &m_Counter};
+		++nJobs;
+	}
+
+	m_nStarted = 0;
+	m_nFinished = 0;
+	m_nFailed = 0;
+
+	const unsigned nStartTicks = CTimer::GetClockTicks();
+	bool bHelpersAvailable = true;
+	u32 nSubmitted = 0;
+
+	while (nSubmitted < nJobs || !m_Counter.IsDone())
+	{
+		const u32 nFinished = m_nFinished.load(std::memory_order_acquire);
+		while (nSubmitted < nJobs && nSubmitted - nFinished < MaxPendingJobs)
+			pJobSystem->Submit(0, pJobs[nSubmitted++].Job);
+
+		if (bHelpersAvailable && m_nStarted.load(std::memory_order_relaxed) == 0 &&
+		    CTimer::GetClockTicks() - nStartTicks >= HelperTimeoutMillis * 1000)
+		{
+			LOGWARN("No other cores are taking jobs; decoding on the main core");
+			bHelpersAvailable = false;
+		}
+
+		// Otherwise, let the main task carry on while the other cores work
+		if (!bHelpersAvailable)
+			pJobSystem->RunOne(0);
+
+		CSoundFontLoader::OnDecode(m_nFinished.load(std::memory_order_relaxed), nJobs);
+	}
+
+	delete[] pJobs;
+
+	return m_nFailed;
+}
+
+void CSampleDecoder::DecodeJob(void* pParam)
+{
+	TSampleJob* const pSampleJob = static_cast<TSampleJob*>(pParam);
+	CSampleDecoder* const pDecoder = pSampleJob->pDecoder;
+	const CSoundFontCompiler::TCompressedSample& Sample = pSampleJob->Sample;
+	const unsigned nCore = CMultiCoreSupport::ThisCore();
+
+	pDecoder->m_nStarted.fetch_add(1, std::memory_order_relaxed);
+
+	const unsigned nStartTicks = CTimer::GetClockTicks();
+	const bool bDecoded = pDecoder->DecodeSample(Sample, nCore);
+
+	// Only ever written by the core that owns them
+	TCoreStats& Stats = pDecoder->m_CoreStats[nCore];
+	++Stats.nSamples;
+	Stats.nFrames += Sample.nFrames;
+	Stats.nMicros += CTimer::GetClockTicks() - nStartTicks;
+
+	if (!bDecoded)
+	{
+		// Unusable; FluidSynth will skip zones that refer to it
+		memset(Sample.pFrames, 0, Sample.nFrames * sizeof(s16));
+		Sample.pSample->nFlags &= ~SoundFontImageSampleValid;
+		pDecoder->m_nFailed.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	pDecoder->m_nFinished.fetch_add(1, std::memory_order_release);
+}
+
+bool CSampleDecoder::DecodeSample(const CSoundFontCompiler::TCompressedSample& Sample, unsigned nCore)
+{
+	const stb_vorbis_alloc Alloc{reinterpret_cast<char*>(m_pScratch[nCore]), static_cast<int>(ScratchSize)};
+
+	int nError;
+	stb_vorbis* const pVorbis = stb_vorbis_open_memory(Sample.pData, static_cast<int>(Sample.nSize), &nError, &Alloc);
+	if (!pVorbis)
+		return false;
+
+	// Samples are mono; stereo pairs are separate samples
+	u32 nFrames = 0;
+	while (nFrames < Sample.nFrames)
+	{
+		const int nDecoded = stb_vorbis_get_samples_short_interleaved(pVorbis, 1, Sample.pFrames + nFrames, Sample.nFrames - nFrames);
+		if (nDecoded <= 0)
+			break;
+		nFrames += nDecoded;
+	}
+
+	stb_vorbis_close(pVorbis);
+
+	// A stream that ends early leaves silence rather than garbage
+	if (nFrames < Sample.nFrames)
+		memset(Sample.pFrames + nFrames, 0, (Sample.nFrames - nFrames) * sizeof(s16));
+
+	return nFrames > 0;
+}
@@ -0,0 +1,129 @@
+//
+// soundfontcache.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include <circle/logger.h>
+
+#include "synth/soundfontcache.h"
+
+LOGMODULE("soundfontcache");
+
+CSoundFontCache::CSoundFontCache()
+	: m_nBudgetBytes(0),
+	  m_nResidentBytes(0),
+	  m_nUseCounter(0),
+
+	  m_nCount(0),
+	  m_Entries{}
+{
+}
+
+CSoundFontCache::~CSoundFontCache()
+{
+	Clear();
+}
+
+void CSoundFontCache::SetBudget(size_t nBudgetBytes)
+{
+	m_nBudgetBytes = nBudgetBytes;
+
+	while (m_nCount && m_nResidentBytes > m_nBudgetBytes)
+		EvictLeastRecentlyUsed();
+}
+
+void CSoundFontCache::Add(fluid_synth_t* pSynth, const char* pSoundFontPath, size_t nBytes)
+{
+	if (nBytes > m_nBudgetBytes)
+	{
+		delete_fluid_synth(pSynth);
+		return;
+	}
+
+	while (m_nCount == MaxEntries || m_nResidentBytes + nBytes > m_nBudgetBytes)
+		EvictLeastRecentlyUsed();
+
+	m_Entries[m_nCount++] = TEntry{pSynth, pSoundFontPath, nBytes, ++m_nUseCounter};
+	m_nResidentBytes += nBytes;
+}
+
+fluid_synth_t* CSoundFontCache::Take(const char* pSoundFontPath, size_t& nOutBytes)
+{
+	const int nEntry = Find(pSoundFontPath);
+	if (nEntry < 0)
+		return nullptr;
+
+	fluid_synth_t* const pSynth = m_Entries[nEntry].pSynth;
+	nOutBytes = m_Entries[nEntry].nBytes;
+	Remove(nEntry);
+
+	return pSynth;
+}
+
+bool CSoundFontCache::Contains(const char* pSoundFontPath) const
+{
+	return Find(pSoundFontPath) >= 0;
+}
+
+void CSoundFontCache::Clear()
+{
+	while (m_nCount)
+	{
+		delete_fluid_synth(m_Entries[m_nCount - 1].pSynth);
+		Remove(m_nCount - 1);
+	}
+}
+
+int CSoundFontCache::Find(const char* pSoundFontPath) const
+{
+	// Keyed by path rather than index, as indices change when the SoundFonts are rescanned
+	for (size_t i = 0; i < m_nCount; ++i)
+	{
+		if (m_Entries[i].Path.Compare(pSoundFontPath) == 0)
+			return i;
+	}
+
+	return -1;
+}
+
+void CSoundFontCache::Remove(size_t nEntry)
+{
+	m_nResidentBytes -= m_Entries[nEntry].nBytes;
+
+	// Keep the entries contiguous
+	if (nEntry != --m_nCount)
+		m_Entries[nEntry] = m_Entries[m_nCount];
+	m_Entries[m_nCount] = TEntry{};
+}
+
+void CSoundFontCache::EvictLeastRecentlyUsed()
+{
+	size_t nVictim = 0;
+	for (size_t i = 1; i < m_nCount; ++i)
+	{
+		if (m_Entries[i].nLastUsed < m_Entries[nVictim].nLastUsed)
+			nVictim = i;
+	}
+
+	LOGNOTE("Unloading \"%s\"", static_cast<const char*>(m_Entries[nVictim].Path));
+	delete_fluid_synth(m_Entries[nVictim].pSynth);
+	Remove(nVictim);
+}
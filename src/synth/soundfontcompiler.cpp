@@ -0,0 +1,692 @@
+//
+// soundfontcompiler.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <string.h>
+
+#include "synth/soundfontcompiler.h"
+
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "SoundFonts and images are little-endian; big-endian hosts aren't supported"
+#endif
+
+namespace
+{
+	constexpr uint32_t FourCC(const char* pID)
+	{
+		return pID[0] | pID[1] << 8 | pID[2] << 16 | static_cast<uint32_t>(pID[3]) << 24;
+	}
+
+	// SF2 generators with special meaning (SF 2.04 section 8.1.2)
+	enum TGeneratorType : uint16_t
+	{
+		Instrument = 41,
+		KeyRange   = 43,
+		VelRange   = 44,
+		SampleID   = 53,
+		EndOper    = 60,
+	};
+
+	// Maximum modulators per zone, as in FluidSynth (FLUID_NUM_MOD)
+	constexpr uint32_t MaxZoneModulators = 64;
+
+	constexpr size_t Align(size_t nOffset)
+	{
+		return (nOffset + SoundFontImageAlignment - 1) & ~(SoundFontImageAlignment - 1);
+	}
+
+	void CopyName(char* pDest, size_t nDestSize, const char* pSource, size_t nSourceSize)
+	{
+		size_t i = 0;
+		for (; i < nDestSize - 1 && i < nSourceSize && pSource[i]; ++i)
+			pDest[i] = pSource[i];
+		pDest[i] = '\0';
+	}
+
+	bool IsUnusedGenerator(uint16_t nType)
+	{
+		return nType == 14 || nType == 18 || nType == 19 || nType == 20 || nType == 42 || nType == 49 || nType == 55 || nType >= 59;
+	}
+
+	// Sample offsets, keynum/velocity overrides, sample modes, exclusive class and root key are instrument-only (SF 2.04
+	// section 8.5)
+	bool IsInstrumentOnlyGenerator(uint16_t nType)
+	{
+		return nType <= 4 || nType == 12 || nType == 45 || nType == 46 || nType == 47 || nType == 50 || nType == 54 || nType == 57 || nType == 58;
+	}
+
+	// Same rules as FluidSynth's fluid_mod_check_sources()
+	bool IsValidModulatorSource(uint16_t nSource, bool bPrimary)
+	{
+		const uint8_t nIndex = nSource & 0x7F;
+
+		if (nSource & 0x80)
+			return !(nIndex == 0 || nIndex == 6 || nIndex == 32 || nIndex == 38 || (nIndex >= 98 && nIndex <= 101) || nIndex >= 120);
+
+		// A primary source of 'none' would always output 0
+		if (nIndex == 0)
+			return !bPrimary;
+
+		return nIndex == 2 || nIndex == 3 || nIndex == 10 || nIndex == 13 || nIndex == 14 || nIndex == 16 || nIndex == 127;
+	}
+}
+
+CSoundFontCompiler::CSoundFontCompiler()
+	: m_pError(nullptr),
+
+	  m_nSourceSize(0),
+	  m_PDTA{nullptr, 0},
+	  m_Samples{nullptr, 0},
+	  m_Samples24{nullptr, 0},
+	  m_Name{nullptr, 0},
+	  m_bPacked(false),
+
+	  m_PresetHeaders{nullptr, 0},
+	  m_PresetBags{nullptr, 0},
+	  m_PresetModulators{nullptr, 0},
+	  m_PresetGenerators{nullptr, 0},
+	  m_InstrumentHeaders{nullptr, 0},
+	  m_InstrumentBags{nullptr, 0},
+	  m_InstrumentModulators{nullptr, 0},
+	  m_InstrumentGenerators{nullptr, 0},
+	  m_SampleHeaders{nullptr, 0},
+
+	  m_nPresets(0),
+	  m_nInstruments(0),
+	  m_nSamples(0),
+	  m_nCompressedSamples(0),
+	  m_nCompressedBytes(0),
+	  m_Counts{},
+	  m_nSampleDataSize(0),
+	  m_nSampleData24Size(0),
+	  m_nImageSize(0)
+{
+}
+
+bool CSoundFontCompiler::Parse(const uint8_t* pSoundFont, size_t nSize)
+{
+	m_nSourceSize = nSize;
+
+	uint32_t nID, nRIFFSize, nForm;
+	if (nSize < 12)
+		return Error("not a SoundFont");
+
+	memcpy(&nID, pSoundFont, 4);
+	memcpy(&nRIFFSize, pSoundFont + 4, 4);
+	memcpy(&nForm, pSoundFont + 8, 4);
+
+	if (nID != FourCC("RIFF") || nForm != FourCC("sfbk") || nRIFFSize > nSize - 8)
+		return Error("not a SoundFont");
+
+	const TChunk RIFF{pSoundFont + 8, nRIFFSize};
+	TChunk INFO;
+
+	if (!FindList(RIFF, FourCC("sdta"), m_SDTA) || !FindList(RIFF, FourCC("pdta"), m_PDTA) || !FindChunk(m_SDTA, FourCC("smpl"), m_Samples))
+		return Error("missing sample data or hydra");
+
+	if (FindList(RIFF, FourCC("INFO"), INFO))
+		FindChunk(INFO, FourCC("INAM"), m_Name);
+
+	if (!ReadHydraTable("phdr", m_PresetHeaders) || !ReadHydraTable("pbag", m_PresetBags) ||
+	    !ReadHydraTable("pmod", m_PresetModulators) || !ReadHydraTable("pgen", m_PresetGenerators) ||
+	    !ReadHydraTable("inst", m_InstrumentHeaders) || !ReadHydraTable("ibag", m_InstrumentBags) ||
+	    !ReadHydraTable("imod", m_InstrumentModulators) || !ReadHydraTable("igen", m_InstrumentGenerators) ||
+	    !ReadHydraTable("shdr", m_SampleHeaders))
+		return Error("corrupt hydra");
+
+	if (!CheckBags(m_PresetHeaders, m_PresetBags, m_PresetGenerators.nCount, m_PresetModulators.nCount) ||
+	    !CheckBags(m_InstrumentHeaders, m_InstrumentBags, m_InstrumentGenerators.nCount, m_InstrumentModulators.nCount))
+		return Error("corrupt preset/instrument zones");
+
+	m_nPresets = m_PresetHeaders.nCount - 1;
+	m_nInstruments = m_InstrumentHeaders.nCount - 1;
+	m_nSamples = m_SampleHeaders.nCount - 1;
+
+	// SF3s may mix compressed and uncompressed samples; either way, every sample is given its own place
+	for (uint32_t i = 0; i < m_nSamples && !m_bPacked; ++i)
+		m_bPacked = m_SampleHeaders.pRecords[i].nSampleType & SampleTypeVorbis;
+
+	if (m_bPacked)
+	{
+		uint64_t nFrames = 0;
+
+		for (uint32_t i = 0; i < m_nSamples; ++i)
+		{
+			TSampleLayout Layout;
+			if (!GetSampleLayout(i, Layout))
+				continue;
+
+			nFrames += Layout.nFrames + SamplePaddingFrames;
+
+			if (Layout.bCompressed)
+			{
+				++m_nCompressedSamples;
+				m_nCompressedBytes += Layout.nSize;
+			}
+		}
+
+		if (nFrames > UINT32_MAX / sizeof(int16_t))
+			return Error("too large");
+
+		m_nSampleDataSize = nFrames * sizeof(int16_t);
+	}
+	else
+	{
+		// 24-bit samples are only used if the low bytes cover every frame, as in FluidSynth
+		const uint32_t nSampleFrames = m_Samples.nSize / 2;
+		if (FindChunk(m_SDTA, FourCC("sm24"), m_Samples24) && m_Samples24.nSize != nSampleFrames + (nSampleFrames & 1))
+			m_Samples24 = TChunk{nullptr, 0};
+
+		m_nSampleDataSize = nSampleFrames * sizeof(int16_t);
+		m_nSampleData24Size = m_Samples24.nSize;
+	}
+
+	m_Counts = TOutput{};
+	AddPresetsAndInstruments(m_Counts);
+
+	uint64_t nImageSize = sizeof(TSoundFontImageHeader);
+	const size_t TableSizes[] =
+	{
+		m_nPresets * sizeof(TSoundFontImagePreset),
+		m_Counts.nPresetZones * sizeof(TSoundFontImageZone),
+		m_nInstruments * sizeof(TSoundFontImageInstrument),
+		m_Counts.nInstrumentZones * sizeof(TSoundFontImageZone),
+		m_Counts.nGenerators * sizeof(TSoundFontImageGenerator),
+		m_Counts.nModulators * sizeof(TSoundFontImageModulator),
+		m_nSamples * sizeof(TSoundFontImageSample),
+		m_nSampleDataSize,
+		m_nSampleData24Size,
+	};
+
+	for (size_t nTableSize : TableSizes)
+		nImageSize = Align(nImageSize) + nTableSize;
+
+	if (nImageSize > UINT32_MAX)
+		return Error("too large");
+
+	m_nImageSize = nImageSize;
+	return true;
+}
+
+void CSoundFontCompiler::Build(uint8_t* pImage, const char* pFallbackName) const
+{
+	TSoundFontImageHeader Header{};
+	Header.nMagic = SoundFontImageMagic;
+	Header.nVersion = SoundFontImageVersion;
+	Header.nImageSize = m_nImageSize;
+	Header.nSourceSize = m_nSourceSize;
+	Header.nSourceHydraCRC = SoundFontImageCRC(m_PDTA.pData, m_PDTA.nSize);
+	Header.nSourceSampleCRC = SoundFontImageCRC(m_SDTA.pData, m_SDTA.nSize);
+
+	if (m_Name.nSize)
+		CopyName(Header.Name, sizeof(Header.Name), reinterpret_cast<const char*>(m_Name.pData), m_Name.nSize);
+	else
+		CopyName(Header.Name, sizeof(Header.Name), pFallbackName, strlen(pFallbackName));
+
+	size_t nOffset = sizeof(Header);
+	auto AddTable = [&](size_t nCount, size_t nBytes)
+	{
+		nOffset = Align(nOffset);
+		const TSoundFontImageTable Table{static_cast<uint32_t>(nOffset), static_cast<uint32_t>(nCount)};
+		nOffset += nBytes;
+		return Table;
+	};
+
+	Header.Presets = AddTable(m_nPresets, m_nPresets * sizeof(TSoundFontImagePreset));
+	Header.PresetZones = AddTable(m_Counts.nPresetZones, m_Counts.nPresetZones * sizeof(TSoundFontImageZone));
+	Header.Instruments = AddTable(m_nInstruments, m_nInstruments * sizeof(TSoundFontImageInstrument));
+	Header.InstrumentZones = AddTable(m_Counts.nInstrumentZones, m_Counts.nInstrumentZones * sizeof(TSoundFontImageZone));
+	Header.Generators = AddTable(m_Counts.nGenerators, m_Counts.nGenerators * sizeof(TSoundFontImageGenerator));
+	Header.Modulators = AddTable(m_Counts.nModulators, m_Counts.nModulators * sizeof(TSoundFontImageModulator));
+	Header.Samples = AddTable(m_nSamples, m_nSamples * sizeof(TSoundFontImageSample));
+	Header.SampleData = AddTable(m_nSampleDataSize, m_nSampleDataSize);
+	Header.SampleData24 = AddTable(m_nSampleData24Size, m_nSampleData24Size);
+
+	// Everything up to the sample data, including padding
+	memset(pImage, 0, Header.SampleData.nOffset);
+	memcpy(pImage, &Header, sizeof(Header));
+
+	TOutput Output{};
+	Output.pPresets = reinterpret_cast<TSoundFontImagePreset*>(pImage + Header.Presets.nOffset);
+	Output.pPresetZones = reinterpret_cast<TSoundFontImageZone*>(pImage + Header.PresetZones.nOffset);
+	Output.pInstruments = reinterpret_cast<TSoundFontImageInstrument*>(pImage + Header.Instruments.nOffset);
+	Output.pInstrumentZones = reinterpret_cast<TSoundFontImageZone*>(pImage + Header.InstrumentZones.nOffset);
+	Output.pGenerators = reinterpret_cast<TSoundFontImageGenerator*>(pImage + Header.Generators.nOffset);
+	Output.pModulators = reinterpret_cast<TSoundFontImageModulator*>(pImage + Header.Modulators.nOffset);
+	AddPresetsAndInstruments(Output);
+
+	// Looked up by binary search; the first of any duplicates wins, as in FluidSynth, so the sort must be stable (and
+	// presets are usually in order already)
+	TSoundFontImagePreset* const pPresets = Output.pPresets;
+	for (uint32_t i = 1; i < m_nPresets; ++i)
+	{
+		const TSoundFontImagePreset Preset = pPresets[i];
+		uint32_t j = i;
+
+		for (; j > 0 && (pPresets[j - 1].nBank > Preset.nBank || (pPresets[j - 1].nBank == Preset.nBank && pPresets[j - 1].nProgram > Preset.nProgram)); --j)
+			pPresets[j] = pPresets[j - 1];
+
+		pPresets[j] = Preset;
+	}
+
+	TSoundFontImageSample* const pSamples = reinterpret_cast<TSoundFontImageSample*>(pImage + Header.Samples.nOffset);
+	int16_t* const pSampleData = reinterpret_cast<int16_t*>(pImage + Header.SampleData.nOffset);
+	uint32_t nPosition = 0;
+
+	for (uint32_t i = 0; i < m_nSamples; ++i)
+	{
+		const TSampleHeader& SampleHeader = m_SampleHeaders.pRecords[i];
+		TSoundFontImageSample& Sample = pSamples[i];
+
+		memcpy(Sample.Name, SampleHeader.Name, sizeof(Sample.Name));
+		Sample.nSampleRate = SampleHeader.nSampleRate;
+		Sample.nOriginalPitch = SampleHeader.nOriginalPitch <= 127 ? SampleHeader.nOriginalPitch : 60;
+		Sample.nPitchCorrection = SampleHeader.nPitchCorrection;
+
+		// ROM samples aren't available, and broken ones are skipped like FluidSynth does
+		TSampleLayout Layout;
+		const bool bValid = GetSampleLayout(i, Layout);
+
+		// Loop points of compressed samples are relative to the start of the sample (as in FluidSynth)
+		const int64_t nSampleStart = Layout.bCompressed ? 0 : SampleHeader.nStart;
+		int64_t nLoopStart = SampleHeader.nLoopStart - nSampleStart;
+		int64_t nLoopEnd = SampleHeader.nLoopEnd - nSampleStart;
+
+		if (m_bPacked)
+		{
+			if (!bValid)
+				continue;
+
+			Sample.nStart = nPosition;
+			if (!Layout.bCompressed)
+				memcpy(pSampleData + nPosition, Layout.pData, Layout.nSize);
+
+			nPosition += Layout.nFrames;
+			memset(pSampleData + nPosition, 0, SamplePaddingFrames * sizeof(int16_t));
+			nPosition += SamplePaddingFrames;
+		}
+		else
+		{
+			Sample.nStart = SampleHeader.nStart;
+			Sample.nLoopStart = SampleHeader.nLoopStart;
+			Sample.nLoopEnd = SampleHeader.nLoopEnd;
+			Sample.nEnd = SampleHeader.nEnd;
+
+			if (!bValid)
+				continue;
+		}
+
+		Sample.nEnd = Sample.nStart + Layout.nFrames;
+		if (nLoopStart < 0 || nLoopEnd > Layout.nFrames || nLoopStart >= nLoopEnd)
+		{
+			nLoopStart = 0;
+			nLoopEnd = Layout.nFrames;
+		}
+
+		Sample.nLoopStart = Sample.nStart + nLoopStart;
+		Sample.nLoopEnd = Sample.nStart + nLoopEnd;
+		Sample.nFlags |= SoundFontImageSampleValid;
+	}
+
+	if (!m_bPacked)
+	{
+		memcpy(pSampleData, m_Samples.pData, m_nSampleDataSize);
+		if (m_nSampleData24Size)
+			memcpy(pImage + Header.SampleData24.nOffset, m_Samples24.pData, m_nSampleData24Size);
+	}
+}
+
+bool CSoundFontCompiler::GetCompressedSample(uint8_t* pImage, uint32_t nSample, TCompressedSample& OutSample) const
+{
+	if (nSample >= m_nSamples)
+		return false;
+
+	const TSampleHeader& SampleHeader = m_SampleHeaders.pRecords[nSample];
+	if (!(SampleHeader.nSampleType & SampleTypeVorbis))
+		return false;
+
+	const TSoundFontImageHeader* pHeader = reinterpret_cast<const TSoundFontImageHeader*>(pImage);
+	TSoundFontImageSample& Sample = reinterpret_cast<TSoundFontImageSample*>(pImage + pHeader->Samples.nOffset)[nSample];
+	if (!(Sample.nFlags & SoundFontImageSampleValid))
+		return false;
+
+	OutSample.pData = m_Samples.pData + SampleHeader.nStart;
+	OutSample.nSize = SampleHeader.nEnd - SampleHeader.nStart;
+	OutSample.pFrames = reinterpret_cast<int16_t*>(pImage + pHeader->SampleData.nOffset) + Sample.nStart;
+	OutSample.nFrames = Sample.nEnd - Sample.nStart;
+	OutSample.pSample = &Sample;
+
+	return true;
+}
+
+uint32_t CSoundFontCompiler::GetVorbisFrameCount(const uint8_t* pData, size_t nSize)
+{
+	// Ogg page header (RFC 3533 section 6)
+	constexpr size_t PageHeaderSize = 27;
+
+	// The last complete page with a granule position; scan backwards for its capture pattern
+	for (size_t nOffset = nSize >= PageHeaderSize ? nSize - PageHeaderSize + 1 : 0; nOffset-- > 0;)
+	{
+		if (memcmp(pData + nOffset, "OggS", 4) || pData[nOffset + 4] != 0)
+			continue;
+
+		const uint8_t nSegments = pData[nOffset + 26];
+		if (nOffset + PageHeaderSize + nSegments > nSize)
+			continue;
+
+		size_t nPageSize = PageHeaderSize + nSegments;
+		for (uint8_t i = 0; i < nSegments; ++i)
+			nPageSize += pData[nOffset + PageHeaderSize + i];
+
+		int64_t nGranule;
+		memcpy(&nGranule, pData + nOffset + 6, sizeof(nGranule));
+
+		if (nOffset + nPageSize > nSize || nGranule < 0)
+			continue;
+
+		return nGranule <= UINT32_MAX ? nGranule : 0;
+	}
+
+	return 0;
+}
+
+bool CSoundFontCompiler::Error(const char* pMessage)
+{
+	m_pError = pMessage;
+	return false;
+}
+
+// Finds a chunk within a list's payload; pads to even sizes as per RIFF
+bool CSoundFontCompiler::FindChunk(const TChunk& List, uint32_t nID, TChunk& OutChunk)
+{
+	for (uint32_t nOffset = 4; nOffset + 8 <= List.nSize;)
+	{
+		uint32_t nChunkID, nChunkSize;
+		memcpy(&nChunkID, List.pData + nOffset, 4);
+		memcpy(&nChunkSize, List.pData + nOffset + 4, 4);
+
+		if (nChunkSize > List.nSize - nOffset - 8)
+			return false;
+
+		if (nChunkID == nID)
+		{
+			OutChunk = TChunk{List.pData + nOffset + 8, nChunkSize};
+			return true;
+		}
+
+		nOffset += 8 + nChunkSize + (nChunkSize & 1);
+	}
+
+	return false;
+}
+
+// Finds a LIST chunk of the given type at the top level
+bool CSoundFontCompiler::FindList(const TChunk& RIFF, uint32_t nType, TChunk& OutList)
+{
+	for (uint32_t nOffset = 4; nOffset + 12 <= RIFF.nSize;)
+	{
+		uint32_t nChunkID, nChunkSize, nListType;
+		memcpy(&nChunkID, RIFF.pData + nOffset, 4);
+		memcpy(&nChunkSize, RIFF.pData + nOffset + 4, 4);
+		memcpy(&nListType, RIFF.pData + nOffset + 8, 4);
+
+		if (nChunkSize > RIFF.nSize - nOffset - 8)
+			return false;
+
+		if (nChunkID == FourCC("LIST") && nListType == nType)
+		{
+			OutList = TChunk{RIFF.pData + nOffset + 8, nChunkSize};
+			return true;
+		}
+
+		nOffset += 8 + nChunkSize + (nChunkSize & 1);
+	}
+
+	return false;
+}
+
+template <class T>
+bool CSoundFontCompiler::ReadHydraTable(const char* pID, THydraTable<T>& OutTable) const
+{
+	TChunk Chunk;
+	if (!FindChunk(m_PDTA, FourCC(pID), Chunk) || Chunk.nSize % sizeof(T) || Chunk.nSize < sizeof(T))
+		return false;
+
+	// Records are packed, so they can be used in place
+	OutTable = THydraTable<T>{reinterpret_cast<const T*>(Chunk.pData), static_cast<uint32_t>(Chunk.nSize / sizeof(T))};
+	return true;
+}
+
+template <class T>
+bool CSoundFontCompiler::CheckBags(const THydraTable<T>& Headers, const THydraTable<TBag>& Bags, uint32_t nGenerators, uint32_t nModulators)
+{
+	for (uint32_t i = 0; i + 1 < Headers.nCount; ++i)
+	{
+		if (Headers.pRecords[i].nBagIndex > Headers.pRecords[i + 1].nBagIndex || Headers.pRecords[i + 1].nBagIndex >= Bags.nCount)
+			return false;
+	}
+
+	for (uint32_t i = 0; i + 1 < Bags.nCount; ++i)
+	{
+		const TBag& Bag = Bags.pRecords[i];
+		const TBag& NextBag = Bags.pRecords[i + 1];
+
+		if (Bag.nGeneratorIndex > NextBag.nGeneratorIndex || NextBag.nGeneratorIndex > nGenerators)
+			return false;
+		if (Bag.nModulatorIndex > NextBag.nModulatorIndex || NextBag.nModulatorIndex > nModulators)
+			return false;
+	}
+
+	return true;
+}
+
+bool CSoundFontCompiler::GetSampleLayout(uint32_t nSample, TSampleLayout& OutLayout) const
+{
+	const TSampleHeader& Header = m_SampleHeaders.pRecords[nSample];
+	OutLayout = TSampleLayout{nullptr, 0, 0, false};
+
+	if (Header.nSampleType & SampleTypeROM || !Header.nSampleRate || Header.nStart >= Header.nEnd)
+		return false;
+
+	// Compressed samples are located by byte offsets
+	if (Header.nSampleType & SampleTypeVorbis)
+	{
+		if (Header.nEnd > m_Samples.nSize)
+			return false;
+
+		OutLayout.pData = m_Samples.pData + Header.nStart;
+		OutLayout.nSize = Header.nEnd - Header.nStart;
+		OutLayout.nFrames = GetVorbisFrameCount(OutLayout.pData, OutLayout.nSize);
+		OutLayout.bCompressed = true;
+
+		return OutLayout.nFrames > 0;
+	}
+
+	if (Header.nEnd > m_Samples.nSize / 2)
+		return false;
+
+	OutLayout.pData = m_Samples.pData + Header.nStart * sizeof(int16_t);
+	OutLayout.nSize = (Header.nEnd - Header.nStart) * sizeof(int16_t);
+	OutLayout.nFrames = Header.nEnd - Header.nStart;
+
+	return true;
+}
+
+void CSoundFontCompiler::AddModulators(const THydraTable<TModulator>& Modulators, uint32_t nFirst, uint32_t nEnd, TSoundFontImageZone& Zone, TOutput& Output) const
+{
+	const TModulator* Added[MaxZoneModulators];
+
+	Zone.nFirstModulator = Output.nModulators;
+	Zone.nModulators = 0;
+
+	for (uint32_t i = nFirst; i < nEnd; ++i)
+	{
+		const TModulator& Modulator = Modulators.pRecords[i];
+
+		// Linked modulators aren't supported
+		if (Modulator.nDestination & 0x8000 || Modulator.nDestination >= EndOper)
+			continue;
+
+		if (!IsValidModulatorSource(Modulator.nSource, true) || !IsValidModulatorSource(Modulator.nAmountSource, false))
+			continue;
+
+		// Identical modulators after the first are ignored (SF 2.04 section 9.5.1)
+		bool bDuplicate = false;
+		for (uint32_t j = 0; j < Zone.nModulators && !bDuplicate; ++j)
+			bDuplicate = Added[j]->nSource == Modulator.nSource && Added[j]->nDestination == Modulator.nDestination && Added[j]->nAmountSource == Modulator.nAmountSource;
+
+		if (bDuplicate || Zone.nModulators == MaxZoneModulators)
+			continue;
+
+		// Unknown source curve types and non-linear transforms disable the modulator, as in FluidSynth
+		const bool bSupported = (Modulator.nSource >> 10) <= 3 && (Modulator.nAmountSource >> 10) <= 3 && Modulator.nTransform == 0;
+
+		if (Output.pModulators)
+			Output.pModulators[Output.nModulators] = TSoundFontImageModulator{Modulator.nSource, Modulator.nDestination, bSupported ? Modulator.nAmount : static_cast<int16_t>(0), Modulator.nAmountSource};
+
+		Added[Zone.nModulators++] = &Modulator;
+		++Output.nModulators;
+	}
+}
+
+// Converts the bags of a preset or instrument into zones; returns the number of zones added
+uint32_t CSoundFontCompiler::AddZones(const THydraTable<TBag>& Bags, const THydraTable<TGenerator>& Generators, const THydraTable<TModulator>& Modulators,
+                                      uint32_t nFirstBag, uint32_t nEndBag, bool bPresetLevel, uint32_t nTargets, TSoundFontImageZone* pZones,
+                                      uint32_t& nZones, TOutput& Output) const
+{
+	const uint16_t nTargetType = bPresetLevel ? Instrument : SampleID;
+	uint32_t nAdded = 0;
+
+	for (uint32_t nBag = nFirstBag; nBag < nEndBag; ++nBag)
+	{
+		TSoundFontImageZone Zone{-1, 0, 127, 0, 127, Output.nGenerators, 0, 0, 0};
+
+		// Later occurrences of a generator override earlier ones
+		int16_t Values[EndOper] = {0};
+		bool bSet[EndOper] = {false};
+
+		for (uint32_t i = Bags.pRecords[nBag].nGeneratorIndex; i < Bags.pRecords[nBag + 1].nGeneratorIndex; ++i)
+		{
+			const TGenerator& Generator = Generators.pRecords[i];
+
+			// The target is always the last generator in a zone
+			if (Generator.nType == nTargetType)
+			{
+				Zone.nTarget = static_cast<uint16_t>(Generator.nAmount);
+				break;
+			}
+
+			if (Generator.nType == KeyRange || Generator.nType == VelRange)
+			{
+				const uint8_t nLow = Generator.nAmount & 0xFF;
+				const uint8_t nHigh = static_cast<uint16_t>(Generator.nAmount) >> 8;
+
+				if (Generator.nType == KeyRange)
+				{
+					Zone.nKeyLow = nLow;
+					Zone.nKeyHigh = nHigh;
+				}
+				else
+				{
+					Zone.nVelocityLow = nLow;
+					Zone.nVelocityHigh = nHigh;
+				}
+
+				continue;
+			}
+
+			if (IsUnusedGenerator(Generator.nType) || Generator.nType == Instrument || Generator.nType == SampleID)
+				continue;
+
+			if (bPresetLevel && IsInstrumentOnlyGenerator(Generator.nType))
+				continue;
+
+			Values[Generator.nType] = Generator.nAmount;
+			bSet[Generator.nType] = true;
+		}
+
+		// Only the first zone may be global; other zones without a target are ignored
+		if (Zone.nTarget < 0 && nBag != nFirstBag)
+			continue;
+
+		if (Zone.nTarget >= static_cast<int32_t>(nTargets))
+			continue;
+
+		for (uint16_t nType = 0; nType < EndOper; ++nType)
+		{
+			if (!bSet[nType])
+				continue;
+
+			if (Output.pGenerators)
+				Output.pGenerators[Output.nGenerators] = TSoundFontImageGenerator{nType, Values[nType]};
+			++Output.nGenerators;
+		}
+		Zone.nGenerators = Output.nGenerators - Zone.nFirstGenerator;
+
+		AddModulators(Modulators, Bags.pRecords[nBag].nModulatorIndex, Bags.pRecords[nBag + 1].nModulatorIndex, Zone, Output);
+
+		if (pZones)
+			pZones[nZones] = Zone;
+		++nZones;
+		++nAdded;
+	}
+
+	return nAdded;
+}
+
+void CSoundFontCompiler::AddPresetsAndInstruments(TOutput& Output) const
+{
+	for (uint32_t i = 0; i < m_nInstruments; ++i)
+	{
+		const TInstrumentHeader& Header = m_InstrumentHeaders.pRecords[i];
+		const uint32_t nFirstZone = Output.nInstrumentZones;
+		const uint32_t nZones = AddZones(m_InstrumentBags, m_InstrumentGenerators, m_InstrumentModulators, Header.nBagIndex,
+		                                 m_InstrumentHeaders.pRecords[i + 1].nBagIndex, false, m_nSamples,
+		                                 Output.pInstrumentZones, Output.nInstrumentZones, Output);
+
+		if (Output.pInstruments)
+		{
+			TSoundFontImageInstrument& Instrument = Output.pInstruments[i];
+			memcpy(Instrument.Name, Header.Name, sizeof(Instrument.Name));
+			Instrument.nFirstZone = nFirstZone;
+			Instrument.nZones = nZones;
+		}
+	}
+
+	for (uint32_t i = 0; i < m_nPresets; ++i)
+	{
+		const TPresetHeader& Header = m_PresetHeaders.pRecords[i];
+		const uint32_t nFirstZone = Output.nPresetZones;
+		const uint32_t nZones = AddZones(m_PresetBags, m_PresetGenerators, m_PresetModulators, Header.nBagIndex,
+		                                 m_PresetHeaders.pRecords[i + 1].nBagIndex, true, m_nInstruments,
+		                                 Output.pPresetZones, Output.nPresetZones, Output);
+
+		if (Output.pPresets)
+		{
+			TSoundFontImagePreset& Preset = Output.pPresets[i];
+			memcpy(Preset.Name, Header.Name, sizeof(Preset.Name));
+			Preset.nBank = Header.nBank;
+			Preset.nProgram = Header.nProgram;
+			Preset.nFirstZone = nFirstZone;
+			Preset.nZones = nZones;
+		}
+	}
+}
@@ -0,0 +1,863 @@
+//
+// soundfontimage.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include <circle/logger.h>
+#include <circle/sched/scheduler.h>
+#include <circle/string.h>
+#include <circle/timer.h>
+
+#include <stddef.h>
+#include <string.h>
+#include <type_traits>
+
+#include "synth/sampledecoder.h"
+#include "synth/soundfontcompiler.h"
+#include "synth/soundfontimage.h"
+#include "synth/soundfontloader.h"
+#include "utility.h"
+#include "zoneallocator.h"
+
+LOGMODULE("soundfontimage");
+
+// Largest single read from an image or SoundFont, or write to an image; the loader task yields in between
+constexpr UINT ReadChunkSize = 256 * 1024;
+
+// Memory comes from the same heap as FluidSynth's (see soundfontsynth.cpp)
+extern "C" void* fluid_alloc(size_t len);
+
+fluid_sfloader_t* CSoundFontImage::CreateLoader(bool bCompressedOnly, bool bSaveDecodedImages)
+{
+	fluid_sfloader_t* pLoader = new_fluid_sfloader(LoaderLoad, LoaderFree);
+	if (pLoader)
+		fluid_sfloader_set_data(pLoader, new TLoaderOptions{bCompressedOnly, bSaveDecodedImages});
+
+	return pLoader;
+}
+
+bool CSoundFontImage::IsCompressed(const char* pSoundFontPath)
+{
+	FIL File;
+	if (f_open(&File, pSoundFontPath, FA_READ) != FR_OK)
+		return false;
+
+	// 'RIFF' <size> 'sfbk' 'LIST' <size> 'INFO' 'ifil' <size> <major> <minor>; the version always comes first
+	u32 Header[9];
+	UINT nRead;
+	const bool bRead = f_read(&File, Header, sizeof(Header), &nRead) == FR_OK && nRead == sizeof(Header);
+	f_close(&File);
+
+	// SF3 is version 3.x
+	return bRead && Header[0] == 0x46464952 && Header[2] == 0x6B626673 && Header[3] == 0x5453494C &&
+	       Header[5] == 0x4F464E49 && Header[6] == 0x6C696669 && Header[7] == sizeof(u32) && (Header[8] & 0xFFFF) == 3;
+}
+
+CSoundFontImage::CSoundFontImage()
+	: m_pImage(nullptr),
+	  m_pHeader(nullptr),
+
+	  m_pPresets(nullptr),
+	  m_pPresetZones(nullptr),
+	  m_pInstruments(nullptr),
+	  m_pInstrumentZones(nullptr),
+	  m_pGenerators(nullptr),
+	  m_pModulators(nullptr),
+	  m_pSamples(nullptr),
+	  m_pSampleData(nullptr),
+	  m_pSampleData24(nullptr),
+
+	  m_pSampleObjects(nullptr),
+	  m_nSampleObjectSize(fluid_sample_sizeof()),
+	  m_pModulatorObjects(nullptr),
+	  m_nModulatorObjectSize(fluid_mod_sizeof()),
+	  m_pPresetRefs(nullptr),
+	  m_pPresetObjects(nullptr),
+	  m_nIterationIndex(0)
+{
+}
+
+CSoundFontImage::~CSoundFontImage()
+{
+	if (m_pPresetObjects)
+	{
+		for (size_t i = 0; i < m_pHeader->Presets.nCount; ++i)
+		{
+			if (m_pPresetObjects[i])
+				delete_fluid_preset(m_pPresetObjects[i]);
+		}
+
+		fluid_free(m_pPresetObjects);
+	}
+
+	if (m_pPresetRefs)
+		fluid_free(m_pPresetRefs);
+
+	if (m_pModulatorObjects)
+		fluid_free(m_pModulatorObjects);
+
+	if (m_pSampleObjects)
+		fluid_free(m_pSampleObjects);
+
+	if (m_pImage)
+		fluid_free(m_pImage);
+}
+
+bool CSoundFontImage::Load(const char* pImagePath, const char* pSoundFontPath)
+{
+	FIL File;
+	if (f_open(&File, pImagePath, FA_READ) != FR_OK)
+		return false;
+
+	TSoundFontImageHeader Header;
+	UINT nRead;
+	if (f_read(&File, &Header, sizeof(Header), &nRead) != FR_OK || nRead != sizeof(Header) ||
+	    Header.nMagic != SoundFontImageMagic || Header.nVersion != SoundFontImageVersion ||
+	    Header.nImageSize < sizeof(Header) || Header.nImageSize != f_size(&File))
+	{
+		LOGWARN("\"%s\" isn't a valid image; recompile it", pImagePath);
+		f_close(&File);
+		return false;
+	}
+
+	// Checked before reading the rest of the image, as it's much smaller (unless the sample data has to be checked)
+	const u32 nSourceTimestamp = Header.nSourceTimestamp;
+	if (!IsSourceCurrent(pSoundFontPath, Header))
+	{
+		LOGWARN("\"%s\" has changed since its image was compiled; recompile it", pSoundFontPath);
+		f_close(&File);
+		return false;
+	}
+
+	m_pImage = static_cast<u8*>(fluid_alloc(Header.nImageSize));
+	if (!m_pImage)
+	{
+		LOGERR("Not enough memory for \"%s\"", pImagePath);
+		f_close(&File);
+		return false;
+	}
+
+	memcpy(m_pImage, &Header, sizeof(Header));
+
+	const bool bRead = ReadChunks(File, m_pImage + sizeof(Header), Header.nImageSize - sizeof(Header));
+	f_close(&File);
+
+	if (!bRead)
+	{
+		LOGERR("Couldn't read \"%s\"", pImagePath);
+		return false;
+	}
+
+	if (!Relocate())
+	{
+		LOGWARN("\"%s\" is corrupt; recompile it", pImagePath);
+		return false;
+	}
+
+	// Record the SoundFont's timestamp so that its sample data needn't be checked again next time
+	if (Header.nSourceTimestamp != nSourceTimestamp)
+		SaveSourceTimestamp(pImagePath, Header.nSourceTimestamp);
+
+	return true;
+}
+
+bool CSoundFontImage::Decode(const char* pSoundFontPath)
+{
+	FIL File;
+	if (f_open(&File, pSoundFontPath, FA_READ) != FR_OK)
+		return false;
+
+	const unsigned int nStartTicks = CTimer::GetClockTicks();
+	const size_t nStartBytes = CZoneAllocator::Get()->GetTagBytes(TZoneTag::FluidSynth);
+
+	// The whole SoundFont is needed in memory while its samples are decoded
+	const size_t nSourceSize = f_size(&File);
+	u8* pSource = static_cast<u8*>(fluid_alloc(nSourceSize));
+	if (!pSource)
+	{
+		LOGERR("Not enough memory to decode \"%s\"", pSoundFontPath);
+		f_close(&File);
+		return false;
+	}
+
+	const bool bRead = ReadChunks(File, pSource, nSourceSize);
+	f_close(&File);
+
+	CSoundFontCompiler Compiler;
+	if (!bRead || !Compiler.Parse(pSource, nSourceSize))
+	{
+		if (bRead)
+			LOGERR("\"%s\": %s", pSoundFontPath, Compiler.GetError());
+		else
+			LOGERR("Couldn't read \"%s\"", pSoundFontPath);
+		fluid_free(pSource);
+		return false;
+	}
+
+	CSampleDecoder Decoder;
+	m_pImage = static_cast<u8*>(fluid_alloc(Compiler.GetImageSize()));
+	if (!m_pImage || !Decoder.Initialize())
+	{
+		LOGERR("Not enough memory to decode \"%s\"", pSoundFontPath);
+		fluid_free(pSource);
+		return false;
+	}
+
+	const char* pFileName = strrchr(pSoundFontPath, '/');
+	Compiler.Build(m_pImage, pFileName ? pFileName + 1 : pSoundFontPath);
+
+	// The sample data was checked as it was compiled
+	reinterpret_cast<TSoundFontImageHeader*>(m_pImage)->nSourceTimestamp = GetSourceTimestamp(pSoundFontPath);
+
+	const unsigned int nDecodeStartTicks = CTimer::GetClockTicks();
+	const u32 nFailed = Decoder.Decode(Compiler, m_pImage);
+	const unsigned int nDecodeEndTicks = CTimer::GetClockTicks();
+
+	// The source, image and decoders' scratch memory are all allocated at this point
+	const size_t nPeakBytes = CZoneAllocator::Get()->GetTagBytes(TZoneTag::FluidSynth) - nStartBytes;
+	fluid_free(pSource);
+
+	const u32 nCompressedSamples = Compiler.GetCompressedSampleCount();
+	LOGNOTE("Decoded %d SF3 samples (%d MB compressed) in %dms, after reading for %dms; peak memory %d MB", nCompressedSamples - nFailed,
+		Compiler.GetCompressedBytes() / MEGABYTE, Utility::TicksToMillis(nDecodeEndTicks - nDecodeStartTicks),
+		Utility::TicksToMillis(nDecodeStartTicks - nStartTicks), nPeakBytes / MEGABYTE);
+
+	for (unsigned int nCore = 0; nCore < CJobSystem::MaxCores; ++nCore)
+	{
+		const CSampleDecoder::TCoreStats& Stats = Decoder.GetCoreStats(nCore);
+		if (!Stats.nSamples)
+			continue;
+
+		// Decoded bytes per microsecond is MB/s
+		const float nRate = Stats.nMicros ? static_cast<float>(Stats.nFrames * sizeof(s16)) / Stats.nMicros : 0.0f;
+		LOGNOTE("Core %d: %d samples, %0.1f MB/s", nCore, Stats.nSamples, nRate);
+	}
+
+	if (nFailed)
+		LOGWARN("%d samples of \"%s\" couldn't be decoded and will be silent", nFailed, pSoundFontPath);
+
+	if (!Relocate())
+	{
+		LOGERR("\"%s\" couldn't be converted", pSoundFontPath);
+		return false;
+	}
+
+	return true;
+}
+
+bool CSoundFontImage::Save(const char* pImagePath) const
+{
+	FIL File;
+	if (f_open(&File, pImagePath, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK)
+	{
+		LOGWARN("Couldn't create \"%s\"", pImagePath);
+		return false;
+	}
+
+	const u8* pBuffer = m_pImage;
+	size_t nRemaining = m_pHeader->nImageSize;
+	bool bWritten = true;
+	while (nRemaining)
+	{
+		const UINT nChunkSize = Utility::Min<size_t>(nRemaining, ReadChunkSize);
+		UINT nWritten;
+		if (f_write(&File, pBuffer, nChunkSize, &nWritten) != FR_OK || nWritten != nChunkSize)
+		{
+			bWritten = false;
+			break;
+		}
+
+		CScheduler::Get()->Yield();
+		pBuffer += nWritten;
+		nRemaining -= nWritten;
+	}
+
+	bWritten = f_close(&File) == FR_OK && bWritten;
+
+	// Don't leave a partial image behind (e.g. if the card is full)
+	if (!bWritten)
+	{
+		LOGWARN("Couldn't write \"%s\"", pImagePath);
+		f_unlink(pImagePath);
+	}
+
+	return bWritten;
+}
+
+template <class T>
+bool CSoundFontImage::GetTable(const TSoundFontImageTable& Table, T*& pOutTable) const
+{
+	// Sample data counts are in bytes
+	constexpr size_t nEntrySize = std::is_same<T, s16>::value ? 1 : sizeof(T);
+
+	if (Table.nOffset % SoundFontImageAlignment || Table.nOffset > m_pHeader->nImageSize ||
+	    Table.nCount > (m_pHeader->nImageSize - Table.nOffset) / nEntrySize)
+		return false;
+
+	pOutTable = reinterpret_cast<T*>(m_pImage + Table.nOffset);
+	return true;
+}
+
+bool CSoundFontImage::CheckZones(const TSoundFontImageZone* pZones, u32 nFirst, u32 nCount, u32 nTargets) const
+{
+	for (u32 i = nFirst; i < nFirst + nCount; ++i)
+	{
+		const TSoundFontImageZone& Zone = pZones[i];
+
+		// Only the first zone may be global
+		if ((Zone.nTarget < 0 && i != nFirst) || Zone.nTarget >= static_cast<s32>(nTargets))
+			return false;
+
+		if (!CheckRange(Zone.nFirstGenerator, Zone.nGenerators, m_pHeader->Generators.nCount) ||
+		    !CheckRange(Zone.nFirstModulator, Zone.nModulators, m_pHeader->Modulators.nCount))
+			return false;
+	}
+
+	return true;
+}
+
+bool CSoundFontImage::Relocate()
+{
+	m_pHeader = reinterpret_cast<TSoundFontImageHeader*>(m_pImage);
+	m_pHeader->Name[sizeof(m_pHeader->Name) - 1] = '\0';
+
+	const TSoundFontImageHeader& Header = *m_pHeader;
+
+	if (!GetTable(Header.Presets, m_pPresets) || !GetTable(Header.PresetZones, m_pPresetZones) ||
+	    !GetTable(Header.Instruments, m_pInstruments) || !GetTable(Header.InstrumentZones, m_pInstrumentZones) ||
+	    !GetTable(Header.Generators, m_pGenerators) || !GetTable(Header.Modulators, m_pModulators) ||
+	    !GetTable(Header.Samples, m_pSamples) || !GetTable(Header.SampleData, m_pSampleData) ||
+	    !GetTable(Header.SampleData24, m_pSampleData24))
+		return false;
+
+	// Everything referred to must be within the image, so that nothing needs checking while playing
+	for (u32 i = 0; i < Header.Presets.nCount; ++i)
+	{
+		const TSoundFontImagePreset& Preset = m_pPresets[i];
+		if (!CheckRange(Preset.nFirstZone, Preset.nZones, Header.PresetZones.nCount) ||
+		    !CheckZones(m_pPresetZones, Preset.nFirstZone, Preset.nZones, Header.Instruments.nCount))
+			return false;
+	}
+
+	for (u32 i = 0; i < Header.Instruments.nCount; ++i)
+	{
+		const TSoundFontImageInstrument& Instrument = m_pInstruments[i];
+		if (!CheckRange(Instrument.nFirstZone, Instrument.nZones, Header.InstrumentZones.nCount) ||
+		    !CheckZones(m_pInstrumentZones, Instrument.nFirstZone, Instrument.nZones, Header.Samples.nCount))
+			return false;
+	}
+
+	for (u32 i = 0; i < Header.Generators.nCount; ++i)
+	{
+		if (m_pGenerators[i].nType >= GEN_LAST)
+			return false;
+	}
+
+	for (u32 i = 0; i < Header.Modulators.nCount; ++i)
+	{
+		if (m_pModulators[i].nDestination >= GEN_LAST)
+			return false;
+	}
+
+	const u32 nFrames = Header.SampleData.nCount / sizeof(s16);
+	if (Header.SampleData24.nCount && Header.SampleData24.nCount < nFrames)
+		return false;
+
+	for (u32 i = 0; i < Header.Samples.nCount; ++i)
+	{
+		const TSoundFontImageSample& Sample = m_pSamples[i];
+		if (!(Sample.nFlags & SoundFontImageSampleValid))
+			continue;
+
+		if (Sample.nStart >= Sample.nEnd || Sample.nEnd > nFrames || Sample.nLoopStart < Sample.nStart ||
+		    Sample.nLoopEnd > Sample.nEnd || Sample.nLoopStart > Sample.nLoopEnd)
+			return false;
+	}
+
+	if (!Header.SampleData24.nCount)
+		m_pSampleData24 = nullptr;
+
+	return true;
+}
+
+bool CSoundFontImage::CreateObjects(fluid_sfont_t* pSoundFont)
+{
+	const TSoundFontImageHeader& Header = *m_pHeader;
+
+	// Pools of zero-initialized objects, as recommended by FluidSynth; the samples play straight from the image
+	const size_t nSampleObjectsSize = Header.Samples.nCount * m_nSampleObjectSize;
+	const size_t nModulatorObjectsSize = Header.Modulators.nCount * m_nModulatorObjectSize;
+	m_pSampleObjects = static_cast<u8*>(fluid_alloc(Utility::Max<size_t>(nSampleObjectsSize, 1)));
+	m_pModulatorObjects = static_cast<u8*>(fluid_alloc(Utility::Max<size_t>(nModulatorObjectsSize, 1)));
+	m_pPresetRefs = static_cast<TPresetRef*>(fluid_alloc(Utility::Max<size_t>(Header.Presets.nCount * sizeof(TPresetRef), 1)));
+	m_pPresetObjects = static_cast<fluid_preset_t**>(fluid_alloc(Utility::Max<size_t>(Header.Presets.nCount * sizeof(fluid_preset_t*), 1)));
+
+	if (!m_pSampleObjects || !m_pModulatorObjects || !m_pPresetRefs || !m_pPresetObjects)
+		return false;
+
+	memset(m_pSampleObjects, 0, nSampleObjectsSize);
+	memset(m_pModulatorObjects, 0, nModulatorObjectsSize);
+	memset(m_pPresetObjects, 0, Header.Presets.nCount * sizeof(fluid_preset_t*));
+
+	for (u32 i = 0; i < Header.Samples.nCount; ++i)
+	{
+		const TSoundFontImageSample& Sample = m_pSamples[i];
+		if (!(Sample.nFlags & SoundFontImageSampleValid))
+			continue;
+
+		char Name[sizeof(Sample.Name) + 1] = {0};
+		memcpy(Name, Sample.Name, sizeof(Sample.Name));
+
+		fluid_sample_t* const pSample = GetSample(i);
+		fluid_sample_set_name(pSample, Name);
+		fluid_sample_set_sound_data(pSample, m_pSampleData + Sample.nStart, m_pSampleData24 ? m_pSampleData24 + Sample.nStart : nullptr,
+		                            Sample.nEnd - Sample.nStart, Sample.nSampleRate, false);
+		fluid_sample_set_loop(pSample, Sample.nLoopStart - Sample.nStart, Sample.nLoopEnd - Sample.nStart);
+		fluid_sample_set_pitch(pSample, Sample.nOriginalPitch, Sample.nPitchCorrection);
+	}
+
+	// SF2 modulator sources (SF 2.04 section 8.2): index, CC flag, direction, polarity and curve type
+	auto GetSourceFlags = [](u16 nSource)
+	{
+		static const int CurveFlags[] = { FLUID_MOD_LINEAR, FLUID_MOD_CONCAVE, FLUID_MOD_CONVEX, FLUID_MOD_SWITCH };
+		const u8 nCurve = nSource >> 10;
+
+		return (nSource & 0x80 ? FLUID_MOD_CC : FLUID_MOD_GC) |
+		       (nSource & 0x100 ? FLUID_MOD_NEGATIVE : FLUID_MOD_POSITIVE) |
+		       (nSource & 0x200 ? FLUID_MOD_BIPOLAR : FLUID_MOD_UNIPOLAR) |
+		       (nCurve < Utility::ArraySize(CurveFlags) ? CurveFlags[nCurve] : FLUID_MOD_LINEAR);
+	};
+
+	for (u32 i = 0; i < Header.Modulators.nCount; ++i)
+	{
+		const TSoundFontImageModulator& Modulator = m_pModulators[i];
+		fluid_mod_t* const pModulator = GetModulator(i);
+
+		fluid_mod_set_source1(pModulator, Modulator.nSource & 0x7F, GetSourceFlags(Modulator.nSource));
+		fluid_mod_set_source2(pModulator, Modulator.nAmountSource & 0x7F, GetSourceFlags(Modulator.nAmountSource));
+		fluid_mod_set_dest(pModulator, Modulator.nDestination);
+		fluid_mod_set_amount(pModulator, Modulator.nAmount);
+	}
+
+	for (u32 i = 0; i < Header.Presets.nCount; ++i)
+	{
+		TPresetRef& Ref = m_pPresetRefs[i];
+		Ref.pImage = this;
+		Ref.pPreset = &m_pPresets[i];
+		memcpy(Ref.Name, Ref.pPreset->Name, sizeof(Ref.pPreset->Name));
+		Ref.Name[sizeof(Ref.Name) - 1] = '\0';
+
+		m_pPresetObjects[i] = new_fluid_preset(pSoundFont, PresetGetName, PresetGetBank, PresetGetNumber, PresetNoteOn, PresetFree);
+		if (!m_pPresetObjects[i])
+			return false;
+
+		fluid_preset_set_data(m_pPresetObjects[i], &Ref);
+	}
+
+	return true;
+}
+
+fluid_sample_t* CSoundFontImage::GetSample(u32 nIndex) const
+{
+	return reinterpret_cast<fluid_sample_t*>(m_pSampleObjects + nIndex * m_nSampleObjectSize);
+}
+
+fluid_mod_t* CSoundFontImage::GetModulator(u32 nIndex) const
+{
+	return reinterpret_cast<fluid_mod_t*>(m_pModulatorObjects + nIndex * m_nModulatorObjectSize);
+}
+
+int CSoundFontImage::NoteOn(const TSoundFontImagePreset& Preset, fluid_synth_t* pSynth, int nChannel, int nKey, int nVelocity) const
+{
+	auto IsInRange = [nKey, nVelocity](const TSoundFontImageZone& Zone)
+	{
+		return nKey >= Zone.nKeyLow && nKey <= Zone.nKeyHigh && nVelocity >= Zone.nVelocityLow && nVelocity <= Zone.nVelocityHigh;
+	};
+
+	const TSoundFontImageZone* const pPresetZones = m_pPresetZones + Preset.nFirstZone;
+	const TSoundFontImageZone* const pGlobalPresetZone = Preset.nZones && pPresetZones[0].nTarget < 0 ? pPresetZones : nullptr;
+
+	for (u32 i = pGlobalPresetZone ? 1 : 0; i < Preset.nZones; ++i)
+	{
+		const TSoundFontImageZone& PresetZone = pPresetZones[i];
+		if (!IsInRange(PresetZone))
+			continue;
+
+		const TSoundFontImageInstrument& Instrument = m_pInstruments[PresetZone.nTarget];
+		const TSoundFontImageZone* const pInstrumentZones = m_pInstrumentZones + Instrument.nFirstZone;
+		const TSoundFontImageZone* const pGlobalInstrumentZone = Instrument.nZones && pInstrumentZones[0].nTarget < 0 ? pInstrumentZones : nullptr;
+
+		for (u32 j = pGlobalInstrumentZone ? 1 : 0; j < Instrument.nZones; ++j)
+		{
+			const TSoundFontImageZone& InstrumentZone = pInstrumentZones[j];
+			if (!IsInRange(InstrumentZone) || !(m_pSamples[InstrumentZone.nTarget].nFlags & SoundFontImageSampleValid))
+				continue;
+
+			fluid_voice_t* const pVoice = fluid_synth_alloc_voice(pSynth, GetSample(InstrumentZone.nTarget), nChannel, nKey, nVelocity);
+			if (!pVoice)
+				return FLUID_FAILED;
+
+			// Instrument generators replace the defaults; local ones take precedence over global ones
+			if (pGlobalInstrumentZone)
+			{
+				for (u32 k = 0; k < pGlobalInstrumentZone->nGenerators; ++k)
+				{
+					const TSoundFontImageGenerator& Generator = m_pGenerators[pGlobalInstrumentZone->nFirstGenerator + k];
+					fluid_voice_gen_set(pVoice, Generator.nType, Generator.nAmount);
+				}
+			}
+
+			for (u32 k = 0; k < InstrumentZone.nGenerators; ++k)
+			{
+				const TSoundFontImageGenerator& Generator = m_pGenerators[InstrumentZone.nFirstGenerator + k];
+				fluid_voice_gen_set(pVoice, Generator.nType, Generator.nAmount);
+			}
+
+			AddModulators(pVoice, pGlobalInstrumentZone, InstrumentZone, FLUID_VOICE_OVERWRITE);
+
+			// Preset generators are added to those; again, local ones take precedence over global ones
+			const TSoundFontImageGenerator* const pLocalGenerators = m_pGenerators + PresetZone.nFirstGenerator;
+			for (u32 k = 0; k < PresetZone.nGenerators; ++k)
+				fluid_voice_gen_incr(pVoice, pLocalGenerators[k].nType, pLocalGenerators[k].nAmount);
+
+			if (pGlobalPresetZone)
+			{
+				for (u32 k = 0; k < pGlobalPresetZone->nGenerators; ++k)
+				{
+					const TSoundFontImageGenerator& Generator = m_pGenerators[pGlobalPresetZone->nFirstGenerator + k];
+
+					bool bOverridden = false;
+					for (u32 l = 0; l < PresetZone.nGenerators && !bOverridden; ++l)
+						bOverridden = pLocalGenerators[l].nType == Generator.nType;
+
+					if (!bOverridden)
+						fluid_voice_gen_incr(pVoice, Generator.nType, Generator.nAmount);
+				}
+			}
+
+			AddModulators(pVoice, pGlobalPresetZone, PresetZone, FLUID_VOICE_ADD);
+
+			fluid_synth_start_voice(pSynth, pVoice);
+		}
+	}
+
+	return FLUID_OK;
+}
+
+void CSoundFontImage::AddModulators(fluid_voice_t* pVoice, const TSoundFontImageZone* pGlobalZone, const TSoundFontImageZone& Zone, int nMode) const
+{
+	auto AddModulator = [&](u32 nIndex)
+	{
+		// Modulators with no effect aren't worth adding to a preset's; at instrument level they still replace defaults
+		if (nMode == FLUID_VOICE_ADD && m_pModulators[nIndex].nAmount == 0)
+			return;
+
+		fluid_voice_add_mod(pVoice, GetModulator(nIndex), nMode);
+	};
+
+	// Global modulators are overridden by identical local ones
+	if (pGlobalZone)
+	{
+		for (u32 i = pGlobalZone->nFirstModulator; i < pGlobalZone->nFirstModulator + pGlobalZone->nModulators; ++i)
+		{
+			const TSoundFontImageModulator& Global = m_pModulators[i];
+
+			bool bOverridden = false;
+			for (u32 j = Zone.nFirstModulator; j < Zone.nFirstModulator + Zone.nModulators && !bOverridden; ++j)
+			{
+				const TSoundFontImageModulator& Local = m_pModulators[j];
+				bOverridden = Local.nSource == Global.nSource && Local.nDestination == Global.nDestination && Local.nAmountSource == Global.nAmountSource;
+			}
+
+			if (!bOverridden)
+				AddModulator(i);
+		}
+	}
+
+	for (u32 i = Zone.nFirstModulator; i < Zone.nFirstModulator + Zone.nModulators; ++i)
+		AddModulator(i);
+}
+
+bool CSoundFontImage::IsSourceCurrent(const char* pSoundFontPath, TSoundFontImageHeader& Header)
+{
+	// The sample data is only checked if the SoundFont's timestamp has changed since it last was
+	const u32 nTimestamp = GetSourceTimestamp(pSoundFontPath);
+	const bool bCheckSamples = !nTimestamp || nTimestamp != Header.nSourceTimestamp;
+
+	FIL File;
+	if (f_open(&File, pSoundFontPath, FA_READ) != FR_OK)
+		return false;
+
+	bool bHydraCurrent = false;
+	bool bSamplesCurrent = !bCheckSamples;
+	bool bFailed = false;
+	UINT nRead;
+	u32 RIFFHeader[3];
+
+	// Walk the top-level chunks to the sample data and hydra; the CRCs cover each list's type and contents
+	if (f_size(&File) == Header.nSourceSize && f_read(&File, RIFFHeader, sizeof(RIFFHeader), &nRead) == FR_OK && nRead == sizeof(RIFFHeader))
+	{
+		u32 ChunkHeader[3];
+		while (!bFailed && f_read(&File, ChunkHeader, sizeof(ChunkHeader), &nRead) == FR_OK && nRead == sizeof(ChunkHeader))
+		{
+			const u32 nChunkSize = ChunkHeader[1];
+			if (nChunkSize < sizeof(u32) || nChunkSize > Header.nSourceSize)
+				break;
+
+			// 'LIST' 'sdta'; too large to read at once
+			if (bCheckSamples && ChunkHeader[0] == 0x5453494C && ChunkHeader[2] == 0x61746473)
+			{
+				u8* pBuffer = static_cast<u8*>(fluid_alloc(ReadChunkSize));
+				if (!pBuffer)
+					break;
+
+				u32 nCRC = SoundFontImageCRC(&ChunkHeader[2], sizeof(u32));
+				size_t nRemaining = nChunkSize - sizeof(u32);
+				while (nRemaining)
+				{
+					const UINT nReadSize = Utility::Min<size_t>(nRemaining, ReadChunkSize);
+					if (f_read(&File, pBuffer, nReadSize, &nRead) != FR_OK || nRead != nReadSize)
+						break;
+
+					// Not counted towards the loading progress, which is for the image
+					CScheduler::Get()->Yield();
+					nCRC = SoundFontImageCRC(pBuffer, nRead, nCRC);
+					nRemaining -= nRead;
+				}
+
+				fluid_free(pBuffer);
+				bSamplesCurrent = !nRemaining && nCRC == Header.nSourceSampleCRC;
+				bFailed = !bSamplesCurrent || ((nChunkSize & 1) && f_lseek(&File, f_tell(&File) + 1) != FR_OK);
+				continue;
+			}
+
+			// 'LIST' 'pdta'
+			if (ChunkHeader[0] == 0x5453494C && ChunkHeader[2] == 0x61746470)
+			{
+				u8* pHydra = static_cast<u8*>(fluid_alloc(nChunkSize));
+				if (!pHydra)
+					break;
+
+				memcpy(pHydra, &ChunkHeader[2], sizeof(u32));
+				if (f_read(&File, pHydra + sizeof(u32), nChunkSize - sizeof(u32), &nRead) == FR_OK && nRead == nChunkSize - sizeof(u32))
+					bHydraCurrent = SoundFontImageCRC(pHydra, nChunkSize) == Header.nSourceHydraCRC;
+
+				fluid_free(pHydra);
+
+				// The hydra follows the sample data
+				break;
+			}
+
+			if (f_lseek(&File, f_tell(&File) + nChunkSize - sizeof(u32) + (nChunkSize & 1)) != FR_OK)
+				break;
+		}
+	}
+
+	f_close(&File);
+
+	if (!bHydraCurrent || !bSamplesCurrent)
+		return false;
+
+	Header.nSourceTimestamp = nTimestamp;
+
+	return true;
+}
+
+u32 CSoundFontImage::GetSourceTimestamp(const char* pSoundFontPath)
+{
+	FILINFO FileInfo;
+	if (f_stat(pSoundFontPath, &FileInfo) != FR_OK)
+		return 0;
+
+	return static_cast<u32>(FileInfo.fdate) << 16 | FileInfo.ftime;
+}
+
+void CSoundFontImage::SaveSourceTimestamp(const char* pImagePath, u32 nTimestamp)
+{
+	// Not worth failing the load over; the sample data will just be checked again next time
+	FIL File;
+	if (f_open(&File, pImagePath, FA_WRITE | FA_OPEN_EXISTING) != FR_OK)
+		return;
+
+	UINT nWritten;
+	if (f_lseek(&File, offsetof(TSoundFontImageHeader, nSourceTimestamp)) != FR_OK ||
+	    f_write(&File, &nTimestamp, sizeof(nTimestamp), &nWritten) != FR_OK || nWritten != sizeof(nTimestamp))
+		LOGWARN("Couldn't update \"%s\"", pImagePath);
+
+	f_close(&File);
+}
+
+bool CSoundFontImage::ReadChunks(FIL& File, u8* pBuffer, size_t nSize)
+{
+	// Large sequential reads; let the main task run in between, as when loading a SoundFont
+	while (nSize)
+	{
+		const UINT nChunkSize = Utility::Min<size_t>(nSize, ReadChunkSize);
+		UINT nRead;
+		if (f_read(&File, pBuffer, nChunkSize, &nRead) != FR_OK || nRead != nChunkSize)
+			return false;
+
+		CSoundFontLoader::OnRead(nRead);
+		pBuffer += nRead;
+		nSize -= nRead;
+	}
+
+	return true;
+}
+
+fluid_sfont_t* CSoundFontImage::LoaderLoad(fluid_sfloader_t* pLoader, const char* pFileName)
+{
+	const TLoaderOptions* pOptions = static_cast<TLoaderOptions*>(fluid_sfloader_get_data(pLoader));
+	const bool bCompressed = IsCompressed(pFileName);
+
+	// Leave SF2s to FluidSynth's loader (e.g. with dynamic sample loading)
+	if (!bCompressed && pOptions->bCompressedOnly)
+		return nullptr;
+
+	CString ImagePath = pFileName;
+	ImagePath.Append(SoundFontImageExtension);
+
+	const unsigned int nStartTicks = CTimer::GetClockTicks();
+
+	CSoundFontImage* pImage = new CSoundFontImage();
+	FILINFO FileInfo;
+	const bool bHaveImage = f_stat(ImagePath, &FileInfo) == FR_OK && pImage->Load(ImagePath, pFileName);
+	if (!bHaveImage)
+	{
+		delete pImage;
+
+		// No usable image; leave it to FluidSynth's loader
+		if (!bCompressed)
+			return nullptr;
+
+		pImage = new CSoundFontImage();
+		if (!pImage->Decode(pFileName))
+		{
+			delete pImage;
+			return nullptr;
+		}
+	}
+
+	const unsigned int nReadTicks = CTimer::GetClockTicks();
+
+	fluid_sfont_t* pSoundFont = new_fluid_sfont(SoundFontGetName, SoundFontGetPreset, SoundFontIterationStart, SoundFontIterationNext, SoundFontFree);
+	if (!pSoundFont || !pImage->CreateObjects(pSoundFont))
+	{
+		LOGERR("Couldn't set up \"%s\"", static_cast<const char*>(ImagePath));
+		delete pImage;
+		if (pSoundFont)
+			delete_fluid_sfont(pSoundFont);
+		return nullptr;
+	}
+
+	fluid_sfont_set_data(pSoundFont, pImage);
+
+	const unsigned int nEndTicks = CTimer::GetClockTicks();
+	if (bHaveImage)
+		LOGNOTE("Loaded precompiled image of \"%s\": %d MB read in %dms, set up in %dms", pFileName, pImage->m_pHeader->nImageSize / MEGABYTE,
+			Utility::TicksToMillis(nReadTicks - nStartTicks), Utility::TicksToMillis(nEndTicks - nReadTicks));
+	else if (pOptions->bSaveDecodedImages && pImage->Save(ImagePath))
+		LOGNOTE("Saved decoded image of \"%s\" (%d MB)", pFileName, pImage->m_pHeader->nImageSize / MEGABYTE);
+
+	return pSoundFont;
+}
+
+void CSoundFontImage::LoaderFree(fluid_sfloader_t* pLoader)
+{
+	delete static_cast<TLoaderOptions*>(fluid_sfloader_get_data(pLoader));
+	delete_fluid_sfloader(pLoader);
+}
+
+const char* CSoundFontImage::SoundFontGetName(fluid_sfont_t* pSoundFont)
+{
+	return static_cast<CSoundFontImage*>(fluid_sfont_get_data(pSoundFont))->m_pHeader->Name;
+}
+
+fluid_preset_t* CSoundFontImage::SoundFontGetPreset(fluid_sfont_t* pSoundFont, int nBank, int nProgram)
+{
+	const CSoundFontImage* pImage = static_cast<CSoundFontImage*>(fluid_sfont_get_data(pSoundFont));
+
+	// Presets are sorted by bank, then program
+	size_t nLow = 0, nHigh = pImage->m_pHeader->Presets.nCount;
+	while (nLow < nHigh)
+	{
+		const size_t nMiddle = (nLow + nHigh) / 2;
+		const TSoundFontImagePreset& Preset = pImage->m_pPresets[nMiddle];
+
+		if (Preset.nBank < nBank || (Preset.nBank == nBank && Preset.nProgram < nProgram))
+			nLow = nMiddle + 1;
+		else
+			nHigh = nMiddle;
+	}
+
+	if (nLow < pImage->m_pHeader->Presets.nCount && pImage->m_pPresets[nLow].nBank == nBank && pImage->m_pPresets[nLow].nProgram == nProgram)
+		return pImage->m_pPresetObjects[nLow];
+
+	return nullptr;
+}
+
+void CSoundFontImage::SoundFontIterationStart(fluid_sfont_t* pSoundFont)
+{
+	static_cast<CSoundFontImage*>(fluid_sfont_get_data(pSoundFont))->m_nIterationIndex = 0;
+}
+
+fluid_preset_t* CSoundFontImage::SoundFontIterationNext(fluid_sfont_t* pSoundFont)
+{
+	CSoundFontImage* pImage = static_cast<CSoundFontImage*>(fluid_sfont_get_data(pSoundFont));
+	if (pImage->m_nIterationIndex >= pImage->m_pHeader->Presets.nCount)
+		return nullptr;
+
+	return pImage->m_pPresetObjects[pImage->m_nIterationIndex++];
+}
+
+int CSoundFontImage::SoundFontFree(fluid_sfont_t* pSoundFont)
+{
+	// Only called when the synth is deleted, by which time no voices are playing our samples
+	delete static_cast<CSoundFontImage*>(fluid_sfont_get_data(pSoundFont));
+	delete_fluid_sfont(pSoundFont);
+	return FLUID_OK;
+}
+
+const char* CSoundFontImage::PresetGetName(fluid_preset_t* pPreset)
+{
+	return static_cast<TPresetRef*>(fluid_preset_get_data(pPreset))->Name;
+}
+
+int CSoundFontImage::PresetGetBank(fluid_preset_t* pPreset)
+{
+	return static_cast<TPresetRef*>(fluid_preset_get_data(pPreset))->pPreset->nBank;
+}
+
+int CSoundFontImage::PresetGetNumber(fluid_preset_t* pPreset)
+{
+	return static_cast<TPresetRef*>(fluid_preset_get_data(pPreset))->pPreset->nProgram;
+}
+
+int CSoundFontImage::PresetNoteOn(fluid_preset_t* pPreset, fluid_synth_t* pSynth, int nChannel, int nKey, int nVelocity)
+{
+	const TPresetRef* pRef = static_cast<TPresetRef*>(fluid_preset_get_data(pPreset));
+	return pRef->pImage->NoteOn(*pRef->pPreset, pSynth, nChannel, nKey, nVelocity);
+}
+
+void CSoundFontImage::PresetFree(fluid_preset_t* pPreset)
+{
+	// Presets are owned by the image, and deleted along with it
+}
@@ -0,0 +1,178 @@
+//
+// soundfontloader.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <circle/logger.h>
+#include <circle/sched/scheduler.h>
+#include <circle/timer.h>
+#include <fatfs/ff.h>
+
+#include <assert.h>
+#include <stdio.h>
+
+#include "synth/soundfontloader.h"
+
+LOGMODULE("soundfontloader");
+
+// Granularity of LCD progress updates
+constexpr u8 ProgressStepPercent = 5;
+
+CSoundFontLoader* CSoundFontLoader::s_pActiveLoader = nullptr;
+
+CSoundFontLoader::CSoundFontLoader()
+	: CTask(TASK_STACK_SIZE, true),
+	  m_State(TState::Idle),
+
+	  m_pSynth(nullptr),
+	  m_pUI(nullptr),
+
+	  m_nFileSize(0),
+	  m_nBytesRead(0),
+	  m_nProgress(0),
+	  m_nDecodeProgress(0)
+{
+}
+
+void CSoundFontLoader::Initialize()
+{
+	// We started as a suspended task; run now that the owner is fully initialized
+	Start();
+}
+
+bool CSoundFontLoader::Load(fluid_synth_t* pSynth, const char* pSoundFontPath, CUserInterface* pUI)
+{
+	if (m_State != TState::Idle)
+		return false;
+
+	FILINFO FileInfo;
+	if (f_stat(pSoundFontPath, &FileInfo) != FR_OK)
+	{
+		LOGERR("Couldn't stat \"%s\"", pSoundFontPath);
+		return false;
+	}
+
+	m_pSynth = pSynth;
+	m_SoundFontPath = pSoundFontPath;
+	m_pUI = pUI;
+
+	m_nFileSize = FileInfo.fsize;
+	m_nBytesRead = 0;
+	m_nProgress = 0;
+	m_nDecodeProgress = 0;
+
+	m_State = TState::Loading;
+	m_Event.Set();
+
+	return true;
+}
+
+fluid_synth_t* CSoundFontLoader::Finish()
+{
+	assert(m_State == TState::Loaded || m_State == TState::Failed);
+
+	fluid_synth_t* const pSynth = m_pSynth;
+	m_pSynth = nullptr;
+	m_State = TState::Idle;
+
+	return pSynth;
+}
+
+void CSoundFontLoader::OnRead(size_t nBytes)
+{
+	if (s_pActiveLoader)
+		s_pActiveLoader->UpdateProgress(nBytes);
+
+	// Let the main task process MIDI, network packets, etc. (also when loading in a deferred boot stage)
+	CScheduler::Get()->Yield();
+}
+
+void CSoundFontLoader::OnDecode(size_t nDone, size_t nTotal)
+{
+	if (s_pActiveLoader)
+		s_pActiveLoader->UpdateDecodeProgress(nDone, nTotal);
+
+	CScheduler::Get()->Yield();
+}
+
+void CSoundFontLoader::Run()
+{
+	while (true)
+	{
+		m_Event.Wait();
+		m_Event.Clear();
+
+		if (m_State != TState::Loading)
+			continue;
+
+		if (m_pUI)
+			m_pUI->ShowSystemMessage("Loading SoundFont", true);
+
+		const unsigned int nLoadStart = CTimer::GetClockTicks();
+
+		s_pActiveLoader = this;
+		const bool bLoaded = fluid_synth_sfload(m_pSynth, m_SoundFontPath, true) != FLUID_FAILED;
+		s_pActiveLoader = nullptr;
+
+		if (bLoaded)
+		{
+			const float nLoadTime = (CTimer::GetClockTicks() - nLoadStart) / 1000000.0f;
+			LOGNOTE("\"%s\" loaded in the background in %0.2f seconds", static_cast<const char*>(m_SoundFontPath), nLoadTime);
+		}
+		else
+			LOGERR("Failed to load SoundFont");
+
+		m_State = bLoaded ? TState::Loaded : TState::Failed;
+	}
+}
+
+void CSoundFontLoader::UpdateProgress(size_t nBytes)
+{
+	m_nBytesRead += nBytes;
+
+	if (!m_pUI || !m_nFileSize)
+		return;
+
+	const u8 nProgress = static_cast<u64>(m_nBytesRead) * 100 / m_nFileSize;
+	if (nProgress < m_nProgress + ProgressStepPercent)
+		return;
+
+	m_nProgress = nProgress;
+
+	char Buffer[32];
+	snprintf(Buffer, sizeof(Buffer), "Loading SF %d%%", nProgress);
+	m_pUI->ShowSystemMessage(Buffer, true);
+}
+
+void CSoundFontLoader::UpdateDecodeProgress(size_t nDone, size_t nTotal)
+{
+	if (!m_pUI || !nTotal)
+		return;
+
+	const u8 nProgress = static_cast<u64>(nDone) * 100 / nTotal;
+	if (nProgress < m_nDecodeProgress + ProgressStepPercent)
+		return;
+
+	m_nDecodeProgress = nProgress;
+
+	char Buffer[32];
+	snprintf(Buffer, sizeof(Buffer), "Decoding SF %d%%", nProgress);
+	m_pUI->ShowSystemMessage(Buffer, true);
+}
@@ -22,12 +22,18 @@
 
 #include <fatfs/ff.h>
 #include <circle/logger.h>
+#include <circle/multicore.h>
+#include <circle/sysconfig.h>
 #include <circle/timer.h>
 
+#include <atomic>
+#include <type_traits>
+
 #include "config.h"
 #include "lcd/ui.h"
 #include "synth/gmsysex.h"
 #include "synth/rolandsysex.h"
+#include "synth/soundfontimage.h"
 #include "synth/soundfontsynth.h"
 #include "synth/yamahasysex.h"
 #include "utility.h"
@@ -36,22 +42,134 @@
 LOGMODULE("soundfontsynth");
 const char SoundFontPath[] = "soundfonts";
 
+// Largest single read from a SoundFont file
+constexpr UINT ReadChunkSize = 256 * 1024;
+
+// Smaller while paging in samples, so that MIDI for other channels isn't held up for long between chunks
+constexpr UINT PagingReadChunkSize = 32 * 1024;
+
+// Core that runs FluidSynth's extra mixer thread, if any
+static CCoreExecutor* pMixerThreadCore = nullptr;
+
+// A SoundFont may be loading on core 0 while the current synth renders on another core, so heap access is serialized.
+// Core 0 makes thousands of allocations while parsing a SoundFont, so each of the other cores has a small zone of its
+// own for small allocations (which is all FluidSynth makes while rendering), and never has to wait for it.
+constexpr size_t CoreZoneSize     = 1 * MEGABYTE;
+constexpr size_t CoreZoneMaxAlloc = 16 * 1024;
+
+struct THeap
+{
+	CZoneAllocator* pZone = nullptr;
+	std::atomic_flag bLocked = ATOMIC_FLAG_INIT;
+
+	void Lock()
+	{
+		while (bLocked.test_and_set(std::memory_order_acquire))
+			;
+	}
+
+	void Unlock() { bLocked.clear(std::memory_order_release); }
+};
+
+static THeap SharedHeap;
+static THeap CoreHeaps[CORES];
+
+static void InitializeHeaps()
+{
+	SharedHeap.pZone = CZoneAllocator::Get();
+
+	for (unsigned nCore = 1; nCore < CORES; ++nCore)
+	{
+		if (CoreHeaps[nCore].pZone)
+			continue;
+
+		void* const pCoreZone = SharedHeap.pZone->Alloc(CoreZoneSize, TZoneTag::Uncategorized);
+		if (pCoreZone)
+			CoreHeaps[nCore].pZone = new CZoneAllocator(pCoreZone, CoreZoneSize);
+	}
+}
+
+static THeap& FindHeap(const void* pPtr)
+{
+	for (THeap& Heap : CoreHeaps)
+	{
+		if (Heap.pZone && Heap.pZone->Contains(pPtr))
+			return Heap;
+	}
+
+	return SharedHeap;
+}
+
+static void* HeapAlloc(THeap& Heap, size_t nSize, TZoneTag Tag)
+{
+	Heap.Lock();
+	void* const pPtr = Heap.pZone->Alloc(nSize, Tag);
+	Heap.Unlock();
+	return pPtr;
+}
+
 extern "C"
 {
 	// Replacements for fluid_sys.c functions
+
+	// Sample data is tagged separately so that the sample cache can keep track of how much is resident
+	static TZoneTag GetAllocTag() { return CSampleCache::IsPaging() ? TZoneTag::FluidSynthSamples : TZoneTag::FluidSynth; }
+
+	// Added by our FluidSynth patch for the polyphony governor and effects pipeline
+	float fluid_voice_get_amplitude(const fluid_voice_t* voice);
+	int fluid_synth_get_voice_high_water(const fluid_synth_t* synth);
+	void fluid_synth_set_fx_bypass(fluid_synth_t* synth, int bypass);
+
 	void* fluid_alloc(size_t len)
 	{
-		return CZoneAllocator::Get()->Alloc(len, TZoneTag::FluidSynth);
+		const TZoneTag Tag = GetAllocTag();
+		THeap& CoreHeap = CoreHeaps[CMultiCoreSupport::ThisCore()];
+		void* pPtr = nullptr;
+
+		if (CoreHeap.pZone && len <= CoreZoneMaxAlloc)
+			pPtr = HeapAlloc(CoreHeap, len, Tag);
+
+		// Large, from core 0, or the core's own zone is full
+		if (!pPtr)
+			pPtr = HeapAlloc(SharedHeap, len, Tag);
+
+		CSampleCache::OnSampleAlloc(pPtr, len);
+		return pPtr;
 	}
 
 	void* fluid_realloc(void* ptr, size_t len)
 	{
-		return CZoneAllocator::Get()->Realloc(ptr, len, TZoneTag::FluidSynth);
+		if (!ptr)
+			return fluid_alloc(len);
+
+		THeap& Heap = FindHeap(ptr);
+		Heap.Lock();
+		void* pPtr = Heap.pZone->Realloc(ptr, len, GetAllocTag());
+		const size_t nOldSize = Heap.pZone->GetAllocSize(ptr);
+		Heap.Unlock();
+
+		if (pPtr || !len || &Heap == &SharedHeap)
+			return pPtr;
+
+		// Outgrew a core's zone; move it to the shared heap
+		if ((pPtr = HeapAlloc(SharedHeap, len, GetAllocTag())))
+		{
+			memcpy(pPtr, ptr, Utility::Min(nOldSize, len));
+			fluid_free(ptr);
+		}
+
+		return pPtr;
 	}
 
 	void fluid_free(void* ptr)
 	{
-		CZoneAllocator::Get()->Free(ptr);
+		if (!ptr)
+			return;
+
+		THeap& Heap = FindHeap(ptr);
+		Heap.Lock();
+		Heap.pZone->Free(ptr);
+		Heap.Unlock();
 	}
 
 	FILE* fluid_file_open(const char* path, const char** errMsg)
@@ -71,8 +189,21 @@ extern "C"
 	// These were found to be much faster than FluidSynth's default approach of going through libc
 	void* default_fopen(const char* path)
 	{
+		// Storage is only accessible from core 0; the audio core would get here if it selected a preset whose samples
+		// hadn't been paged in by the sample cache
+		if (CMultiCoreSupport::ThisCore() != 0)
+		{
+			CSampleCache::OnLoadRefused();
+			return nullptr;
+		}
+
 		FIL* pFile = new FIL;
-		if (f_open(pFile, path, FA_READ) != FR_OK)
+
+		CSampleCache::BeginStorageAccess();
+		const FRESULT Result = f_open(pFile, path, FA_READ);
+		CSampleCache::EndStorageAccess();
+
+		if (Result != FR_OK)
 		{
 			delete pFile;
 			pFile = nullptr;
@@ -85,7 +216,11 @@ extern "C"
 	{
 		FIL* pFile = static_cast<FIL*>(handle);
 
-		if (f_close(pFile) == FR_OK)
+		CSampleCache::BeginStorageAccess();
+		const FRESULT Result = f_close(pFile);
+		CSampleCache::EndStorageAccess();
+
+		if (Result == FR_OK)
 		{
 			delete pFile;
 			return FLUID_OK;
@@ -103,8 +238,37 @@ extern "C"
 	int safe_fread(void* buf, fluid_long_long_t count, void* fd)
 	{
 		FIL* pFile = static_cast<FIL*>(fd);
-		UINT nRead;
-		return f_read(pFile, buf, count, &nRead) == FR_OK ? FLUID_OK : FLUID_FAILED;
+		u8* pBuffer = static_cast<u8*>(buf);
+
+		// Read large blocks (i.e. sample data) in chunks so that a background load can yield to other tasks
+		const bool bPaging = CSampleCache::IsPaging();
+		const UINT nMaxChunkSize = bPaging ? PagingReadChunkSize : ReadChunkSize;
+
+		while (count > 0)
+		{
+			const UINT nChunkSize = Utility::Min<fluid_long_long_t>(count, nMaxChunkSize);
+			UINT nRead;
+
+			CSampleCache::BeginStorageAccess();
+			const FRESULT Result = f_read(pFile, pBuffer, nChunkSize, &nRead);
+			CSampleCache::EndStorageAccess();
+
+			if (Result != FR_OK)
+				return FLUID_FAILED;
+
+			// Page-ins yield in EndStorageAccess()
+			if (!bPaging)
+				CSoundFontLoader::OnRead(nRead);
+
+			// End of file
+			if (nRead < nChunkSize)
+				break;
+
+			pBuffer += nRead;
+			count -= nRead;
+		}
+
+		return FLUID_OK;
 	}
 
 	int safe_fseek(void* fd, fluid_long_long_t ofs, int whence)
@@ -125,31 +289,186 @@ extern "C"
 			break;
 		}
 
-		return f_lseek(pFile, ofs) == FR_OK ? FLUID_OK : FLUID_FAILED;
+		// Following the cluster chain to a sample far into a large file can take a while
+		CSampleCache::BeginStorageAccess();
+		const FRESULT Result = f_lseek(pFile, ofs);
+		CSampleCache::EndStorageAccess();
+
+		return Result == FR_OK ? FLUID_OK : FLUID_FAILED;
+	}
+
+	// Replacements for fluid_sys.h threading primitives
+	// Only FluidSynth's mixer uses these; its extra thread renders a share of the voices on another core
+	typedef struct _fluid_cond_mutex_t fluid_cond_mutex_t;
+	typedef struct _fluid_cond_t fluid_cond_t;
+	typedef struct _fluid_thread_t fluid_thread_t;
+	typedef void* (*fluid_thread_func_t)(void* data);
+
+	struct _fluid_cond_mutex_t
+	{
+		std::atomic_flag bLocked = ATOMIC_FLAG_INIT;
+	};
+
+	struct _fluid_cond_t
+	{
+		std::atomic<u32> nSequence{0};
+	};
+
+	struct _fluid_thread_t
+	{
+		fluid_thread_func_t pFunc;
+		void* pData;
+	};
+
+	fluid_cond_mutex_t* new_fluid_cond_mutex() { return new fluid_cond_mutex_t; }
+	void delete_fluid_cond_mutex(fluid_cond_mutex_t* m) { delete m; }
+
+	void fluid_cond_mutex_lock(fluid_cond_mutex_t* m)
+	{
+		while (m->bLocked.test_and_set(std::memory_order_acquire))
+			Utility::WaitForCoreEvent();
+	}
+
+	void fluid_cond_mutex_unlock(fluid_cond_mutex_t* m)
+	{
+		m->bLocked.clear(std::memory_order_release);
+		Utility::SignalCoreEvent();
+	}
+
+	fluid_cond_t* new_fluid_cond() { return new fluid_cond_t; }
+	void delete_fluid_cond(fluid_cond_t* cond) { delete cond; }
+
+	void fluid_cond_broadcast(fluid_cond_t* cond)
+	{
+		cond->nSequence.fetch_add(1, std::memory_order_release);
+		Utility::SignalCoreEvent();
+	}
+
+	// There is never more than one waiter per condition
+	void fluid_cond_signal(fluid_cond_t* cond) { fluid_cond_broadcast(cond); }
+
+	void fluid_cond_wait(fluid_cond_t* cond, fluid_cond_mutex_t* m)
+	{
+		// Sample the sequence while still holding the mutex so that a signal sent straight after unlocking isn't missed
+		const u32 nSequence = cond->nSequence.load(std::memory_order_acquire);
+		fluid_cond_mutex_unlock(m);
+
+		while (cond->nSequence.load(std::memory_order_acquire) == nSequence)
+			Utility::WaitForCoreEvent();
+
+		fluid_cond_mutex_lock(m);
+	}
+
+	static void FluidThreadEntry(void* pParam)
+	{
+		fluid_thread_t* const pThread = static_cast<fluid_thread_t*>(pParam);
+		pThread->pFunc(pThread->pData);
+	}
+
+	fluid_thread_t* new_fluid_thread(const char* name, fluid_thread_func_t func, void* data, int prio_level, int detach)
+	{
+		if (!pMixerThreadCore)
+			return nullptr;
+
+		// The core may be finishing a job; the thread then keeps it for as long as the synth exists
+		fluid_thread_t* pThread = new fluid_thread_t{func, data};
+		if (!pMixerThreadCore->Launch(FluidThreadEntry, pThread, true))
+		{
+			LOGERR("No free core for thread '%s'", name);
+			delete pThread;
+			return nullptr;
+		}
+
+		return pThread;
+	}
+
+	void delete_fluid_thread(fluid_thread_t* thread) { delete thread; }
+	void fluid_thread_self_set_prio(int prio_level) {}
+
+	int fluid_thread_join(fluid_thread_t* thread)
+	{
+		pMixerThreadCore->Join();
+		return FLUID_OK;
 	}
 }
 
-CSoundFontSynth::CSoundFontSynth(unsigned nSampleRate)
+CSoundFontSynth::CSoundFontSynth(unsigned nSampleRate, CCoreExecutor* pMixerThreadCore, CCoreExecutor* pEffectsCore)
 	: CSynthBase(nSampleRate),
 
+	  m_pMixerThreadCore(pMixerThreadCore),
+	  m_pEffectsCore(pEffectsCore),
+
 	  m_pSettings(nullptr),
 	  m_pSynth(nullptr),
 
+	  m_pEffectsPipeline(nullptr),
+	  m_pSampleCache(nullptr),
+	  m_pLoader(nullptr),
+	  m_nLoadingSoundFontIndex(0),
+	  m_nLoadingSoundFontBytes(0),
+
+	  m_pResidentSynth(nullptr),
+
+	  m_pOutgoingSynth(nullptr),
+	  m_nOutgoingSoundFontIndex(0),
+	  m_nOutgoingSoundFontBytes(0),
+	  m_nOutgoingDelayFrames(0),
+	  m_nOutgoingFadeStartTime(0),
+
+	  m_pDeletingSynth(nullptr),
+	  m_DeleteJob{DeleteSynthJob, this, &m_DeleteCounter},
+
 	  m_nVolume(100),
 	  m_nInitialGain(0.2f),
 
+	  m_nHeldMessages(0),
+	  m_nHeldChannels(0),
+	  m_bHoldingAll(false),
+	  m_nHeldSysExBytes(0),
+
 	  m_nPercussionMask(1 << 9),
-	  m_nCurrentSoundFontIndex(0)
+	  m_nCurrentSoundFontIndex(0),
+	  m_nCurrentSoundFontBytes(0),
+
+	  m_bPolyphonyGovernorEnabled(false),
+	  m_nRenderLoad(-1.0f),
+	  m_nEnginePolyphony(0),
+	  m_pVoiceList(nullptr),
+	  m_nVoiceListSize(0)
 {
 }
 
 CSoundFontSynth::~CSoundFontSynth()
 {
+	if (CJobSystem* pJobSystem = CJobSystem::Get())
+		pJobSystem->Wait(CMultiCoreSupport::ThisCore(), m_DeleteCounter);
+
 	if (m_pSynth)
 		delete_fluid_synth(m_pSynth);
 
+	if (m_pOutgoingSynth)
+		delete_fluid_synth(m_pOutgoingSynth);
+
+	if (m_pResidentSynth)
+		delete_fluid_synth(m_pResidentSynth);
+
+	// Resident SoundFonts must go before the settings they were created with
+	m_SoundFontCache.Clear();
+
 	if (m_pSettings)
 		delete_fluid_settings(m_pSettings);
+
+	if (m_pVoiceList)
+		delete[] m_pVoiceList;
+
+	if (m_pEffectsPipeline)
+		delete m_pEffectsPipeline;
+
+	if (m_pSampleCache)
+		delete m_pSampleCache;
+
+	if (m_pLoader)
+		delete m_pLoader;
 }
 
 void CSoundFontSynth::FluidSynthLogCallback(int nLevel, const char* pMessage, void* pUser)
@@ -161,6 +480,8 @@ bool CSoundFontSynth::Initialize()
 {
 	const CConfig* const pConfig = CConfig::Get();
 
+	InitializeHeaps();
+
 	if (!m_SoundFontManager.ScanSoundFonts())
 		return false;
 
@@ -200,131 +521,303 @@ bool CSoundFontSynth::Initialize()
 	fluid_settings_setnum(m_pSettings, "synth.sample-rate", static_cast<double>(m_nSampleRate));
 	fluid_settings_setint(m_pSettings, "synth.threadsafe-api", false);
 
-	return Reinitialize(pSoundFontPath, &FXProfile);
-}
-
-void CSoundFontSynth::HandleMIDIShortMessage(u32 nMessage)
-{
-	const u8 nStatus  = nMessage & 0xFF;
-	const u8 nChannel = nMessage & 0x0F;
-	const u8 nData1   = (nMessage >> 8) & 0xFF;
-	const u8 nData2   = (nMessage >> 16) & 0xFF;
+	// The mixer splits the active voices between the audio core and an extra thread on each render. Voices are claimed
+	// dynamically so that both cores finish together; each core's sum depends on which voices it took, so the output isn't
+	// bit-identical between runs (differences are at the level of float rounding)
+	if (m_pMixerThreadCore)
+	{
+		pMixerThreadCore = m_pMixerThreadCore;
+		fluid_settings_setint(m_pSettings, "synth.cpu-cores", 2);
+		LOGNOTE("Rendering voices on 2 cores");
+	}
 
-	// Handle system real-time messages
-	if (nStatus == 0xFF)
+	if (m_pEffectsCore)
 	{
-		m_Lock.Acquire();
-		fluid_synth_system_reset(m_pSynth);
-		m_Lock.Release();
-		return;
+		m_pEffectsPipeline = new CEffectsPipeline(m_nSampleRate, m_pEffectsCore);
+		if (m_pEffectsPipeline->Initialize())
+			LOGNOTE("Rendering effects on a separate core");
+		else
+		{
+			LOGERR("Failed to initialize effects pipeline");
+			delete m_pEffectsPipeline;
+			m_pEffectsPipeline = nullptr;
+		}
 	}
 
-	m_Lock.Acquire();
+	// Only the samples of presets in use are loaded; SoundFonts load quickly and can be larger than memory
+	if (pConfig->FluidSynthDynamicSampleLoading)
+	{
+		fluid_settings_setint(m_pSettings, "synth.dynamic-sample-loading", true);
+		m_pSampleCache = new CSampleCache(static_cast<size_t>(Utility::Max(pConfig->FluidSynthSampleCacheSize, 1)) * MEGABYTE);
+		m_pSampleCache->Initialize();
+		LOGNOTE("Loading samples on demand (%d MB cache)", Utility::Max(pConfig->FluidSynthSampleCacheSize, 1));
+	}
 
-	// Handle channel messages
-	switch (nStatus & 0xF0)
+	// Each instance's mixer thread occupies the extra core for its whole lifetime, so only one can exist at a time
+	if (pConfig->FluidSynthSoundFontCacheSize > 0)
 	{
-		// Note off
-		case 0x80:
-			fluid_synth_noteoff(m_pSynth, nChannel, nData1);
-			break;
+		if (m_pMixerThreadCore)
+			LOGWARN("SoundFont cache not available when rendering voices on 2 cores");
+		else
+		{
+			m_SoundFontCache.SetBudget(static_cast<size_t>(pConfig->FluidSynthSoundFontCacheSize) * MEGABYTE);
+			LOGNOTE("Keeping up to %d MB of SoundFonts loaded", pConfig->FluidSynthSoundFontCacheSize);
+		}
+	}
 
-		// Note on
-		case 0x90:
-			fluid_synth_noteon(m_pSynth, nChannel, nData1, nData2);
-			break;
+	m_bPolyphonyGovernorEnabled = pConfig->FluidSynthPolyphonyGovernor;
+	if (m_bPolyphonyGovernorEnabled)
+	{
+		// Extra entry for the null terminator
+		m_nVoiceListSize = pConfig->FluidSynthPolyphony + 1;
+		m_pVoiceList = new fluid_voice_t*[m_nVoiceListSize];
+	}
 
-		// Polyphonic key pressure/aftertouch
-		case 0xA0:
-			fluid_synth_key_pressure(m_pSynth, nChannel, nData1, nData2);
-			break;
+	if (!Reinitialize(pSoundFontPath, &FXProfile))
+		return false;
 
-		// Control change
-		case 0xB0:
-			fluid_synth_cc(m_pSynth, nChannel, nData1, nData2);
-			break;
+	// Subsequent SoundFont switches load in the background, and crossfade between engines
+	m_pLoader = new CSoundFontLoader();
+	m_pLoader->Initialize();
+	m_EngineCrossfader.Initialize(m_nSampleRate, Utility::Max(pConfig->SystemCrossfadeTime, 0));
 
-		// Program change
-		case 0xC0:
-			fluid_synth_program_change(m_pSynth, nChannel, nData1);
-			break;
+	return true;
+}
 
-		// Channel pressure/aftertouch
-		case 0xD0:
-			fluid_synth_channel_pressure(m_pSynth, nChannel, nData1);
-			break;
+void CSoundFontSynth::HandleMIDIShortMessage(u32 nMessage, unsigned int nTimestamp)
+{
+	// Samples for a newly selected preset must be resident before the audio core selects it
+	if (m_pSampleCache && !CheckPaging(nMessage, nTimestamp, false))
+		return;
 
-		// Pitch bend
-		case 0xE0:
-			fluid_synth_pitch_bend(m_pSynth, nChannel, (nData2 << 7) | nData1);
-			break;
-	}
+	CSynthBase::HandleMIDIShortMessage(nMessage, nTimestamp);
+}
 
-	m_Lock.Release();
+void CSoundFontSynth::HandleMIDISysExMessage(const u8* pData, size_t nSize, unsigned int nTimestamp)
+{
+	// Mustn't overtake held messages (e.g. a GM reset after a program change)
+	if (m_pSampleCache && !CheckPagingSysEx(pData, nSize, nTimestamp))
+		return;
 
-	// Update MIDI monitor
-	CSynthBase::HandleMIDIShortMessage(nMessage);
+	ForwardMIDISysExMessage(pData, nSize, nTimestamp);
 }
 
-void CSoundFontSynth::HandleMIDISysExMessage(const u8* pData, size_t nSize)
+void CSoundFontSynth::ForwardMIDISysExMessage(const u8* pData, size_t nSize, unsigned int nTimestamp)
 {
 	// Return early if it wasn't a GM Mode On/Off message and was consumed as a text/display dots message
 	if (!ParseGMSysEx(pData, nSize) && (ParseRolandSysEx(pData, nSize) || ParseYamahaSysEx(pData, nSize)))
 		return;
 
-	// No special handling; forward to FluidSynth SysEx parser, excluding leading 0xF0 and trailing 0xF7
-	m_Lock.Acquire();
-	fluid_synth_sysex(m_pSynth, reinterpret_cast<const char*>(pData + 1), nSize - 2, nullptr, nullptr, nullptr, false);
-	m_Lock.Release();
+	// No special handling; forward to audio core for FluidSynth's SysEx parser
+	CSynthBase::HandleMIDISysExMessage(pData, nSize, nTimestamp);
+}
+
+void CSoundFontSynth::SetMasterVolume(u8 nVolume)
+{
+	m_nVolume = nVolume;
+	CSynthBase::SetMasterVolume(nVolume);
 }
 
-bool CSoundFontSynth::IsActive()
+size_t CSoundFontSynth::Render(float* pOutBuffer, size_t nFrames)
 {
-	m_Lock.Acquire();
-	int nVoices = fluid_synth_get_active_voice_count(m_pSynth);
-	m_Lock.Release();
+	return RenderWithCommands<float, fluid_synth_write_float>(pOutBuffer, nFrames);
+}
 
-	return nVoices > 0;
+size_t CSoundFontSynth::Render(s16* pOutBuffer, size_t nFrames)
+{
+	return RenderWithCommands<s16, fluid_synth_write_s16>(pOutBuffer, nFrames);
 }
 
-void CSoundFontSynth::AllSoundOff()
+template <class T, int (*WriteFunc)(fluid_synth_t*, int, void*, int, int, void*, int, int)>
+size_t CSoundFontSynth::RenderWithCommands(T* pOutBuffer, size_t nFrames)
 {
-	m_Lock.Acquire();
-	fluid_synth_all_sounds_off(m_pSynth, -1);
-	m_Lock.Release();
+	// Synth is being reconfigured by the main core; output silence
+	if (!BeginRender())
+	{
+		memset(pOutBuffer, 0, nFrames * 2 * sizeof(T));
+		return nFrames;
+	}
+
+	// No engine while its replacement loads (see SwitchSoundFont()); discard commands meant for the old one
+	if (!m_pSynth)
+	{
+		TCommand Command;
+		while (DequeueCommand(Command))
+			;
+
+		memset(pOutBuffer, 0, nFrames * 2 * sizeof(T));
+		EndRender(false);
+		return nFrames;
+	}
+
+	// A page-in only changes FluidSynth's state between blocks
+	if (m_pSampleCache)
+		m_pSampleCache->LockEngine();
+
+	ApplyControls();
+
+	if (m_bPolyphonyGovernorEnabled)
+		GovernPolyphony(nFrames);
 
-	// Reset MIDI monitor
-	CSynthBase::AllSoundOff();
+	auto WriteSegment = [this](T* pSegment, size_t nSegmentFrames)
+	{
+		// Effects are processed on another core, one FluidSynth block behind the voices
+		if constexpr (std::is_same<T, float>::value)
+		{
+			if (m_pEffectsPipeline)
+			{
+				m_pEffectsPipeline->Render(m_pSynth, pSegment, nSegmentFrames);
+				return;
+			}
+		}
+
+		assert(WriteFunc(m_pSynth, nSegmentFrames, pSegment, 0, 2, pSegment, 1, 2) == FLUID_OK);
+	};
+
+	// Split the block at each command boundary so that events take effect at the correct frame
+	size_t nRenderedFrames = 0;
+	TCommand Command;
+	while (DequeueCommand(Command))
+	{
+		const size_t nFrameOffset = GetFrameOffset(Command.nTimestamp, nFrames);
+		if (nFrameOffset > nRenderedFrames)
+		{
+			WriteSegment(pOutBuffer + nRenderedFrames * 2, nFrameOffset - nRenderedFrames);
+			nRenderedFrames = nFrameOffset;
+		}
+
+		ProcessCommand(Command);
+	}
+
+	if (nRenderedFrames < nFrames)
+		WriteSegment(pOutBuffer + nRenderedFrames * 2, nFrames - nRenderedFrames);
+
+	bool bActive = fluid_synth_get_active_voice_count(m_pSynth) > 0;
+
+	if (m_pSampleCache)
+		m_pSampleCache->UnlockEngine();
+
+	// The outgoing engine isn't paged by the sample cache, so it doesn't need the lock
+	if (m_pOutgoingSynth)
+	{
+		if constexpr (std::is_same<T, float>::value)
+			MixOutgoingSynth(pOutBuffer, nFrames);
+		else
+			m_EngineCrossfader.Reset(OutgoingSlot, false);
+
+		bActive = true;
+	}
+
+	EndRender(bActive);
+
+	return nFrames;
 }
 
-void CSoundFontSynth::SetMasterVolume(u8 nVolume)
+void CSoundFontSynth::GovernPolyphony(size_t nFrames)
 {
-	m_nVolume = nVolume;
-	m_Lock.Acquire();
-	fluid_synth_set_gain(m_pSynth, m_nVolume / 100.0f * m_nInitialGain);
-	m_Lock.Release();
+	// No measurement yet (e.g. first block, or last block was from the other synth)
+	if (m_nRenderLoad < 0.0f)
+		return;
+
+	const size_t nActiveVoices = fluid_synth_get_active_voice_count(m_pSynth);
+	const size_t nVoiceCap = m_PolyphonyGovernor.Update(m_nRenderLoad, nActiveVoices, nFrames, m_nSampleRate);
+	m_nRenderLoad = -1.0f;
+
+	ShedVoices(nVoiceCap);
+	ApplyVoiceCap(nVoiceCap);
 }
 
-size_t CSoundFontSynth::Render(float* pOutBuffer, size_t nFrames)
+void CSoundFontSynth::ShedVoices(size_t nVoiceCap)
 {
-	m_Lock.Acquire();
-	assert(fluid_synth_write_float(m_pSynth, nFrames, pOutBuffer, 0, 2, pOutBuffer, 1, 2) == FLUID_OK);
-	m_Lock.Release();
-	return nFrames;
+	// Fast release time in timecents (~16ms); short enough to free the voice quickly, long enough to avoid a click
+	constexpr float FastReleaseTimecents = -7200.0f;
+
+	fluid_synth_get_voicelist(m_pSynth, m_pVoiceList, m_nVoiceListSize, -1);
+
+	// Voices that have already been released (including ones shed earlier) are on their way out; only held ones count
+	size_t nCount = 0;
+	for (size_t i = 0; i < m_nVoiceListSize && m_pVoiceList[i]; ++i)
+	{
+		fluid_voice_t* const pVoice = m_pVoiceList[i];
+		if (fluid_voice_is_on(pVoice) || fluid_voice_is_sustained(pVoice) || fluid_voice_is_sostenuto(pVoice))
+			m_pVoiceList[nCount++] = pVoice;
+	}
+
+	if (nCount <= nVoiceCap)
+		return;
+
+	// Quietest first (by current output level, not velocity), then oldest
+	auto Comparator = [](fluid_voice_t* const& pVoiceA, fluid_voice_t* const& pVoiceB)
+	{
+		const float nAmplitudeA = fluid_voice_get_amplitude(pVoiceA);
+		const float nAmplitudeB = fluid_voice_get_amplitude(pVoiceB);
+		if (nAmplitudeA != nAmplitudeB)
+			return nAmplitudeA < nAmplitudeB;
+
+		return fluid_voice_get_id(pVoiceA) < fluid_voice_get_id(pVoiceB);
+	};
+
+	Utility::QSort<fluid_voice_t*>(m_pVoiceList, Comparator, 0, nCount - 1);
+
+	const size_t nExcess = nCount - nVoiceCap;
+	size_t nShed = 0;
+	for (size_t i = 0; i < nCount && nShed < nExcess; ++i)
+	{
+		fluid_voice_t* const pVoice = m_pVoiceList[i];
+
+		// Already released along with another voice of the same note, or held by a pedal
+		if (!fluid_voice_is_on(pVoice))
+			continue;
+
+		// A note-off would only move the voice to the sustain/sostenuto pedal, so it can't be released individually
+		const int nChannel = fluid_voice_get_channel(pVoice);
+		int nSustain = 0, nSostenuto = 0;
+		fluid_synth_get_cc(m_pSynth, nChannel, 64, &nSustain);
+		fluid_synth_get_cc(m_pSynth, nChannel, 66, &nSostenuto);
+		if (nSustain >= 64 || nSostenuto >= 64)
+			continue;
+
+		// Release every voice started by the same note (e.g. layered samples) together
+		const unsigned int nID = fluid_voice_get_id(pVoice);
+		for (size_t j = i; j < nCount; ++j)
+		{
+			fluid_voice_t* const pNoteVoice = m_pVoiceList[j];
+			if (fluid_voice_get_id(pNoteVoice) != nID || !fluid_voice_is_on(pNoteVoice))
+				continue;
+
+			fluid_voice_gen_set(pNoteVoice, GEN_VOLENVRELEASE, FastReleaseTimecents);
+			fluid_voice_update_param(pNoteVoice, GEN_VOLENVRELEASE);
+			++nShed;
+		}
+
+		fluid_synth_stop(m_pSynth, nID);
+	}
+
+	m_PolyphonyGovernor.AddSteals(nShed);
 }
 
-size_t CSoundFontSynth::Render(s16* pOutBuffer, size_t nFrames)
+void CSoundFontSynth::ApplyVoiceCap(size_t nVoiceCap)
 {
-	m_Lock.Acquire();
-	assert(fluid_synth_write_s16(m_pSynth, nFrames, pOutBuffer, 0, 2, pOutBuffer, 1, 2) == FLUID_OK);
-	m_Lock.Release();
-	return nFrames;
+	// With the cap applied to FluidSynth itself, notes played over it steal a voice when they start rather than being shed
+	// a block later; FluidSynth kills any voice in a slot above its polyphony though, so the limit can only come down as far
+	// as the highest slot still in use, and follows the cap down as those voices finish
+	const size_t nHighWater = fluid_synth_get_voice_high_water(m_pSynth);
+	const size_t nPolyphony = Utility::Max(nVoiceCap, nHighWater);
+
+	if (nPolyphony == m_nEnginePolyphony)
+		return;
+
+	fluid_synth_set_polyphony(m_pSynth, nPolyphony);
+	m_nEnginePolyphony = nPolyphony;
 }
 
 void CSoundFontSynth::ReportStatus() const
 {
-	if (m_pUI)
-		m_pUI->ShowSystemMessage(m_SoundFontManager.GetSoundFontName(m_nCurrentSoundFontIndex));
+	if (!m_pUI)
+		return;
+
+	const char* pSoundFontName = m_SoundFontManager.GetSoundFontName(m_nCurrentSoundFontIndex);
+	m_pUI->ShowSystemMessage(pSoundFontName ? pSoundFontName : "No SoundFont!");
 }
 
 void CSoundFontSynth::UpdateLCD(CLCD& LCD, unsigned int nTicks)
@@ -354,23 +847,317 @@ bool CSoundFontSynth::SwitchSoundFont(size_t nIndex)
 		return false;
 	}
 
-	if (m_pUI)
-		m_pUI->ShowSystemMessage("Loading SoundFont", true);
+	if (GetSoundFontLoadState() != CSoundFontLoader::TState::Idle)
+	{
+		if (m_pUI)
+			m_pUI->ShowSystemMessage("Still loading!");
+		return false;
+	}
 
-	TFXProfile FXProfile = m_SoundFontManager.GetSoundFontFXProfile(nIndex);
+	m_LoadingFXProfile = m_SoundFontManager.GetSoundFontFXProfile(nIndex);
+	m_nLoadingSoundFontIndex = nIndex;
 
-	// We can't use fluid_synth_sfunload() as we don't support the lazy SoundFont unload timer, so trash the entire synth and create a new one
-	if (!Reinitialize(pSoundFontPath, &FXProfile))
+	// The previous switch is still fading out; finish it so that the engine can be kept resident or deleted
+	if (m_pOutgoingSynth)
+		RetireOutgoingSynth();
+
+	// Still loaded from earlier; the engines are swapped once CompleteSoundFontSwitch() is called
+	if ((m_pResidentSynth = m_SoundFontCache.Take(pSoundFontPath, m_nLoadingSoundFontBytes)))
+		return true;
+
+	// Each instance's mixer thread occupies the extra core for its whole lifetime, so the current one has to go first
+	if (m_pMixerThreadCore)
+		InstallSynth(nullptr, &m_LoadingFXProfile);
+
+	if (!LoadInBackground(pSoundFontPath))
 	{
 		if (m_pUI)
 			m_pUI->ShowSystemMessage("SF switch failed!");
 
+		if (!m_pSynth)
+			RestoreSoundFont();
+
 		return false;
 	}
 
-	m_nCurrentSoundFontIndex = nIndex;
-
-	LOGNOTE("Loaded \"%s\"", m_SoundFontManager.GetSoundFontName(nIndex));
+	return true;
+}
+
+bool CSoundFontSynth::LoadInBackground(const char* pSoundFontPath)
+{
+	// Whatever FluidSynth allocates from here until the load completes belongs to the new SoundFont, so an engine that's
+	// still being deleted must be gone first
+	CJobSystem::Get()->Wait(0, m_DeleteCounter);
+	m_nLoadingSoundFontBytes = CZoneAllocator::Get()->GetTagBytes(TZoneTag::FluidSynth);
+
+	// We can't use fluid_synth_sfunload() as we don't support the lazy SoundFont unload timer, so load into a new synth
+	fluid_synth_t* const pSynth = CreateSynth(&m_LoadingFXProfile);
+	if (!pSynth || !m_pLoader->Load(pSynth, pSoundFontPath, m_pUI))
+	{
+		if (pSynth)
+			delete_fluid_synth(pSynth);
+
+		return false;
+	}
+
+	return true;
+}
+
+void CSoundFontSynth::RestoreSoundFont()
+{
+	// The current engine made way for a SoundFont that failed to load (see SwitchSoundFont()); load the previous
+	// SoundFont back in its place, unless that's what just failed
+	const char* pSoundFontPath = m_SoundFontManager.GetSoundFontPath(m_nCurrentSoundFontIndex);
+	if (pSoundFontPath && m_nLoadingSoundFontIndex != m_nCurrentSoundFontIndex)
+	{
+		LOGNOTE("Reloading \"%s\"", m_SoundFontManager.GetSoundFontName(m_nCurrentSoundFontIndex));
+		m_LoadingFXProfile = m_SoundFontManager.GetSoundFontFXProfile(m_nCurrentSoundFontIndex);
+		m_nLoadingSoundFontIndex = m_nCurrentSoundFontIndex;
+
+		if (LoadInBackground(pSoundFontPath))
+			return;
+	}
+
+	// Nothing is loaded; forget the previous SoundFont so that selecting it again isn't refused
+	LOGERR("No SoundFont loaded");
+	m_nCurrentSoundFontIndex = NoSoundFontIndex;
+}
+
+bool CSoundFontSynth::UpdatePaging()
+{
+	if (!m_pSampleCache)
+		return false;
+
+	if (m_nHeldMessages && !m_pSampleCache->IsPagingIn())
+		ReleaseHeldMessages();
+
+	return m_pSampleCache->IsPagingIn();
+}
+
+bool CSoundFontSynth::CheckPaging(u32 nMessage, unsigned int nTimestamp, bool bChecked)
+{
+	const u8 nStatus  = nMessage & 0xFF;
+	const u8 nChannel = nMessage & 0x0F;
+
+	MakeRoomForHeldMessage(0);
+
+	// Messages that follow a held one on the same channel are held too, so that they stay in order. A reset selects
+	// presets on every channel, so it waits for the page-in, and everything after it waits in turn.
+	const bool bReset = nStatus == 0xFF && (m_nHeldMessages || m_pSampleCache->IsPagingIn());
+	if (m_bHoldingAll || bReset || (nStatus < 0xF0 && (m_nHeldChannels & (1 << nChannel))))
+	{
+		m_bHoldingAll |= bReset;
+		HoldMessage(nMessage, nTimestamp, bChecked);
+		return false;
+	}
+
+	if (bChecked)
+		return true;
+
+	switch (m_pSampleCache->CheckMessage(nMessage, m_nPercussionMask))
+	{
+		case CSampleCache::TCheckResult::PagingIn:
+			HoldMessage(nMessage, nTimestamp, true);
+			return false;
+
+		case CSampleCache::TCheckResult::Busy:
+			HoldMessage(nMessage, nTimestamp, false);
+			return false;
+
+		case CSampleCache::TCheckResult::Ready:
+			break;
+	}
+
+	return true;
+}
+
+bool CSoundFontSynth::CheckPagingSysEx(const u8* pData, size_t nSize, unsigned int nTimestamp)
+{
+	MakeRoomForHeldMessage(nSize);
+
+	// Any SysEx message may select presets (e.g. a GM reset), so it's held back like a reset
+	if (!m_nHeldMessages && !m_pSampleCache->IsPagingIn())
+		return true;
+
+	m_bHoldingAll = true;
+	HoldMessage(0, nTimestamp, true, pData, nSize);
+	return false;
+}
+
+void CSoundFontSynth::MakeRoomForHeldMessage(size_t nSysExSize)
+{
+	const auto IsFull = [&]()
+	{
+		return m_nHeldMessages == MaxHeldMessages || m_nHeldSysExBytes + nSysExSize > MaxHeldSysExBytes;
+	};
+
+	if (!IsFull())
+		return;
+
+	if (!m_pSampleCache->IsPagingIn())
+		ReleaseHeldMessages();
+
+	// Still full; a page-in is in progress
+	if (IsFull())
+		FlushHeldMessages();
+}
+
+void CSoundFontSynth::HoldMessage(u32 nMessage, unsigned int nTimestamp, bool bChecked, const u8* pSysExData, size_t nSysExSize)
+{
+	m_HeldMessages[m_nHeldMessages++] = THeldMessage{nMessage, nTimestamp, bChecked, nSysExSize};
+
+	if (nSysExSize)
+	{
+		// Payloads being held again while replaying only ever move towards the start of the buffer
+		memmove(m_HeldSysEx + m_nHeldSysExBytes, pSysExData, nSysExSize);
+		m_nHeldSysExBytes += nSysExSize;
+	}
+	else
+		m_nHeldChannels |= 1 << (nMessage & 0x0F);
+}
+
+void CSoundFontSynth::ReleaseHeldMessages()
+{
+	// Replayed in order; a program change may start another page-in and hold its channel again. Each message is held
+	// again at most once, in place of an earlier one, so the array is compacted as it goes.
+	const size_t nMessages = m_nHeldMessages;
+	m_nHeldMessages = 0;
+	m_nHeldChannels = 0;
+	m_bHoldingAll = false;
+	m_nHeldSysExBytes = 0;
+
+	const u8* pSysExData = m_HeldSysEx;
+	for (size_t i = 0; i < nMessages; ++i)
+	{
+		const THeldMessage Message = m_HeldMessages[i];
+		if (Message.nSysExSize)
+		{
+			if (CheckPagingSysEx(pSysExData, Message.nSysExSize, Message.nTimestamp))
+				ForwardMIDISysExMessage(pSysExData, Message.nSysExSize, Message.nTimestamp);
+			pSysExData += Message.nSysExSize;
+		}
+		else if (CheckPaging(Message.nMessage, Message.nTimestamp, Message.bChecked))
+			CSynthBase::HandleMIDIShortMessage(Message.nMessage, Message.nTimestamp);
+	}
+}
+
+void CSoundFontSynth::FlushHeldMessages()
+{
+	// Out of room while a page-in is in progress; pass everything on in order rather than block the main task until
+	// it has finished. Notes using the preset being paged in may be silent until then.
+	LOGWARN("Too much MIDI held back while paging in samples");
+
+	const size_t nMessages = m_nHeldMessages;
+	m_nHeldMessages = 0;
+	m_nHeldChannels = 0;
+	m_bHoldingAll = false;
+	m_nHeldSysExBytes = 0;
+
+	const u8* pSysExData = m_HeldSysEx;
+	for (size_t i = 0; i < nMessages; ++i)
+	{
+		const THeldMessage& Message = m_HeldMessages[i];
+		if (Message.nSysExSize)
+		{
+			ForwardMIDISysExMessage(pSysExData, Message.nSysExSize, Message.nTimestamp);
+			pSysExData += Message.nSysExSize;
+			continue;
+		}
+
+		// Keep the cache's bank/program state up to date; nothing else starts paging in until this page-in has finished
+		if (!Message.bChecked)
+		{
+			if ((Message.nMessage & 0xFF) == 0xFF)
+				m_pSampleCache->ResetPrograms();
+			else
+				m_pSampleCache->CheckMessage(Message.nMessage, m_nPercussionMask);
+		}
+
+		CSynthBase::HandleMIDIShortMessage(Message.nMessage, Message.nTimestamp);
+	}
+}
+
+bool CSoundFontSynth::GetSampleCacheStats(CSampleCache::TStats& OutStats) const
+{
+	if (!m_pSampleCache)
+		return false;
+
+	m_pSampleCache->GetStats(OutStats);
+	return true;
+}
+
+bool CSoundFontSynth::AreEffectsSendsSilent() const
+{
+	return m_pEffectsPipeline && m_pEffectsPipeline->AreSendsSilent();
+}
+
+bool CSoundFontSynth::IsSoundFontResident(size_t nIndex) const
+{
+	const char* pSoundFontPath = m_SoundFontManager.GetSoundFontPath(nIndex);
+	return pSoundFontPath && m_SoundFontCache.Contains(pSoundFontPath);
+}
+
+CSoundFontLoader::TState CSoundFontSynth::GetSoundFontLoadState() const
+{
+	if (m_pResidentSynth)
+		return CSoundFontLoader::TState::Loaded;
+
+	return m_pLoader ? m_pLoader->GetState() : CSoundFontLoader::TState::Idle;
+}
+
+bool CSoundFontSynth::CompleteSoundFontSwitch(bool bCrossfade)
+{
+	const CSoundFontLoader::TState State = GetSoundFontLoadState();
+	assert(State == CSoundFontLoader::TState::Loaded || State == CSoundFontLoader::TState::Failed);
+
+	const bool bLoaded = State == CSoundFontLoader::TState::Loaded;
+	const bool bResident = m_pResidentSynth != nullptr;
+	fluid_synth_t* pSynth;
+
+	if (bResident)
+	{
+		pSynth = m_pResidentSynth;
+		m_pResidentSynth = nullptr;
+	}
+	else
+	{
+		pSynth = m_pLoader->Finish();
+		m_nLoadingSoundFontBytes = CZoneAllocator::Get()->GetTagBytes(TZoneTag::FluidSynth) - m_nLoadingSoundFontBytes;
+	}
+
+	if (!bLoaded)
+	{
+		delete_fluid_synth(pSynth);
+
+		// Most likely out of memory; give it all back so that trying again has a chance
+		if (m_SoundFontCache.GetCount())
+		{
+			LOGWARN("Unloading all resident SoundFonts");
+			m_SoundFontCache.Clear();
+		}
+
+		if (m_pUI)
+			m_pUI->ShowSystemMessage("SF switch failed!");
+
+		if (!m_pSynth)
+			RestoreSoundFont();
+
+		return false;
+	}
+
+	const unsigned int nSwapStart = CTimer::GetClockTicks();
+	InstallSynth(pSynth, &m_LoadingFXProfile, bCrossfade);
+	m_nCurrentSoundFontIndex = m_nLoadingSoundFontIndex;
+	m_nCurrentSoundFontBytes = m_nLoadingSoundFontBytes;
+
+	if (bResident)
+		LOGNOTE("Switched to resident \"%s\" in %dus", m_SoundFontManager.GetSoundFontName(m_nCurrentSoundFontIndex), CTimer::GetClockTicks() - nSwapStart);
+	else
+		LOGNOTE("Loaded \"%s\"", m_SoundFontManager.GetSoundFontName(m_nCurrentSoundFontIndex));
+
+	if (m_SoundFontCache.IsEnabled())
+		LOGNOTE("%d other SoundFont(s) resident; %d/%d MB", m_SoundFontCache.GetCount(), m_SoundFontCache.GetResidentBytes() / MEGABYTE, m_SoundFontCache.GetBudget() / MEGABYTE);
+
 	if (m_pUI)
 		m_pUI->ClearSpinnerMessage();
 
@@ -379,60 +1166,344 @@ bool CSoundFontSynth::SwitchSoundFont(size_t nIndex)
 
 bool CSoundFontSynth::Reinitialize(const char* pSoundFontPath, const TFXProfile* pFXProfile)
 {
-	const CConfig* const pConfig = CConfig::Get();
+	const size_t nBytesBefore = CZoneAllocator::Get()->GetTagBytes(TZoneTag::FluidSynth);
 
-	m_Lock.Acquire();
+	fluid_synth_t* const pSynth = CreateSynth(pFXProfile);
+	if (!pSynth)
+		return false;
 
-	if (m_pSynth)
-		delete_fluid_synth(m_pSynth);
+	const unsigned int nLoadStart = CTimer::GetClockTicks();
 
-	m_pSynth = new_fluid_synth(m_pSettings);
+	if (fluid_synth_sfload(pSynth, pSoundFontPath, true) == FLUID_FAILED)
+	{
+		LOGERR("Failed to load SoundFont");
+		delete_fluid_synth(pSynth);
+		return false;
+	}
 
-	if (!m_pSynth)
+	const float nLoadTime = (CTimer::GetClockTicks() - nLoadStart) / 1000000.0f;
+	LOGNOTE("\"%s\" loaded in %0.2f seconds", pSoundFontPath, nLoadTime);
+
+	InstallSynth(pSynth, pFXProfile);
+	m_nCurrentSoundFontBytes = CZoneAllocator::Get()->GetTagBytes(TZoneTag::FluidSynth) - nBytesBefore;
+
+	return true;
+}
+
+fluid_synth_t* CSoundFontSynth::CreateSynth(const TFXProfile* pFXProfile) const
+{
+	const CConfig* const pConfig = CConfig::Get();
+
+	fluid_synth_t* const pSynth = new_fluid_synth(m_pSettings);
+	if (!pSynth)
 	{
-		m_Lock.Release();
 		LOGERR("Failed to create synth");
-		return false;
+		return nullptr;
 	}
 
-	fluid_synth_set_polyphony(m_pSynth, pConfig->FluidSynthPolyphony);
+	// Precompiled images are tried first; they hold all of their sample data, so they're skipped with dynamic sample loading,
+	// except for SF3s, which are always decoded into one
+	fluid_synth_add_sfloader(pSynth, CSoundFontImage::CreateLoader(m_pSampleCache != nullptr, pConfig->FluidSynthSF3DecodeCache));
 
-	m_nInitialGain = pFXProfile->nGain.ValueOr(pConfig->FluidSynthDefaultGain);
-	fluid_synth_set_gain(m_pSynth, m_nVolume / 100.0f * m_nInitialGain);
+	fluid_synth_set_polyphony(pSynth, pConfig->FluidSynthPolyphony);
+
+	const float nInitialGain = pFXProfile->nGain.ValueOr(pConfig->FluidSynthDefaultGain);
+	fluid_synth_set_gain(pSynth, m_nVolume / 100.0f * nInitialGain);
 
 	// Use values from effects profile if set, otherwise use defaults
-	fluid_synth_reverb_on(m_pSynth, -1, pFXProfile->bReverbActive.ValueOr(pConfig->FluidSynthDefaultReverbActive));
-	fluid_synth_set_reverb_group_damp(m_pSynth, -1, pFXProfile->nReverbDamping.ValueOr(pConfig->FluidSynthDefaultReverbDamping));
-	fluid_synth_set_reverb_group_level(m_pSynth, -1, pFXProfile->nReverbLevel.ValueOr(pConfig->FluidSynthDefaultReverbLevel));
-	fluid_synth_set_reverb_group_roomsize(m_pSynth, -1, pFXProfile->nReverbRoomSize.ValueOr(pConfig->FluidSynthDefaultReverbRoomSize));
-	fluid_synth_set_reverb_group_width(m_pSynth, -1, pFXProfile->nReverbWidth.ValueOr(pConfig->FluidSynthDefaultReverbWidth));
-
-	fluid_synth_chorus_on(m_pSynth, -1, pFXProfile->bChorusActive.ValueOr(pConfig->FluidSynthDefaultChorusActive));
-	fluid_synth_set_chorus_group_depth(m_pSynth, -1, pFXProfile->nChorusDepth.ValueOr(pConfig->FluidSynthDefaultChorusDepth));
-	fluid_synth_set_chorus_group_level(m_pSynth, -1, pFXProfile->nChorusLevel.ValueOr(pConfig->FluidSynthDefaultChorusLevel));
-	fluid_synth_set_chorus_group_nr(m_pSynth, -1, pFXProfile->nChorusVoices.ValueOr(pConfig->FluidSynthDefaultChorusVoices));
-	fluid_synth_set_chorus_group_speed(m_pSynth, -1, pFXProfile->nChorusSpeed.ValueOr(pConfig->FluidSynthDefaultChorusSpeed));
+	fluid_synth_reverb_on(pSynth, -1, pFXProfile->bReverbActive.ValueOr(pConfig->FluidSynthDefaultReverbActive));
+	fluid_synth_set_reverb_group_damp(pSynth, -1, pFXProfile->nReverbDamping.ValueOr(pConfig->FluidSynthDefaultReverbDamping));
+	fluid_synth_set_reverb_group_level(pSynth, -1, pFXProfile->nReverbLevel.ValueOr(pConfig->FluidSynthDefaultReverbLevel));
+	fluid_synth_set_reverb_group_roomsize(pSynth, -1, pFXProfile->nReverbRoomSize.ValueOr(pConfig->FluidSynthDefaultReverbRoomSize));
+	fluid_synth_set_reverb_group_width(pSynth, -1, pFXProfile->nReverbWidth.ValueOr(pConfig->FluidSynthDefaultReverbWidth));
+
+	fluid_synth_chorus_on(pSynth, -1, pFXProfile->bChorusActive.ValueOr(pConfig->FluidSynthDefaultChorusActive));
+	fluid_synth_set_chorus_group_depth(pSynth, -1, pFXProfile->nChorusDepth.ValueOr(pConfig->FluidSynthDefaultChorusDepth));
+	fluid_synth_set_chorus_group_level(pSynth, -1, pFXProfile->nChorusLevel.ValueOr(pConfig->FluidSynthDefaultChorusLevel));
+	fluid_synth_set_chorus_group_nr(pSynth, -1, pFXProfile->nChorusVoices.ValueOr(pConfig->FluidSynthDefaultChorusVoices));
+	fluid_synth_set_chorus_group_speed(pSynth, -1, pFXProfile->nChorusSpeed.ValueOr(pConfig->FluidSynthDefaultChorusSpeed));
+
+	// FluidSynth only mixes the effects sends; the pipeline takes over the effects themselves. Reverb and chorus stay
+	// enabled, as FluidSynth doesn't mix into the sends of disabled effects
+	if (m_pEffectsPipeline)
+		fluid_synth_set_fx_bypass(pSynth, true);
+
+	return pSynth;
+}
+
+void CSoundFontSynth::InstallSynth(fluid_synth_t* pSynth, const TFXProfile* pFXProfile, bool bCrossfade)
+{
+	const CConfig* const pConfig = CConfig::Get();
+
+	// A page-in in progress belongs to the outgoing engine
+	if (m_pSampleCache)
+		m_pSampleCache->WaitForPageIn();
+
+	// Swap engines between blocks; any block in progress finishes with the old one
+	SuspendRendering();
+
+	fluid_synth_t* const pOldSynth = m_pSynth;
+	m_pSynth = pSynth;
+
+	// An earlier switch that's still fading out is cut short
+	fluid_synth_t* const pCutSynth = m_pOutgoingSynth;
+	const size_t nCutSoundFontIndex = m_nOutgoingSoundFontIndex;
+	const size_t nCutSoundFontBytes = m_nOutgoingSoundFontBytes;
+	m_pOutgoingSynth = nullptr;
+
+	// The outgoing engine's notes are released, and it renders alongside the new one until it has faded out
+	bCrossfade = bCrossfade && pOldSynth && pSynth;
+	if (bCrossfade)
+	{
+		for (int nChannel = 0; nChannel < 16; ++nChannel)
+		{
+			fluid_synth_cc(pOldSynth, nChannel, 64, 0);
+			fluid_synth_all_notes_off(pOldSynth, nChannel);
+		}
+
+		// The pipeline's output is a block behind, and its last block still belongs to the outgoing engine; holding the
+		// outgoing engine back by the same amount keeps it continuous. It processes its own effects from here on.
+		m_nOutgoingDelayFrames = 0;
+		if (m_pEffectsPipeline)
+		{
+			fluid_synth_set_fx_bypass(pOldSynth, false);
+			m_nOutgoingDelayFrames = CEffectsPipeline::BlockFrames;
+		}
+
+		m_pOutgoingSynth = pOldSynth;
+		m_nOutgoingSoundFontIndex = m_nCurrentSoundFontIndex;
+		m_nOutgoingSoundFontBytes = m_nCurrentSoundFontBytes;
+		m_nOutgoingFadeStartTime = CTimer::GetClockTicks();
+		m_EngineCrossfader.Reset(OutgoingSlot, true);
+		m_EngineCrossfader.SetAudible(OutgoingSlot, false);
+	}
+
+	m_PolyphonyGovernor.Reset(pConfig->FluidSynthPolyphony);
+	m_nRenderLoad = -1.0f;
+	m_nEnginePolyphony = pConfig->FluidSynthPolyphony;
+
+	m_nInitialGain = pFXProfile->nGain.ValueOr(pConfig->FluidSynthDefaultGain);
+
+	// The volume may have changed while the new synth was loading
+	if (m_pSynth)
+		fluid_synth_set_gain(m_pSynth, m_nVolume / 100.0f * m_nInitialGain);
+
+	if (m_pEffectsPipeline)
+	{
+		const CEffectsUnit::TParameters Parameters =
+		{
+			pFXProfile->bReverbActive.ValueOr(pConfig->FluidSynthDefaultReverbActive),
+			pFXProfile->nReverbRoomSize.ValueOr(pConfig->FluidSynthDefaultReverbRoomSize),
+			pFXProfile->nReverbDamping.ValueOr(pConfig->FluidSynthDefaultReverbDamping),
+			pFXProfile->nReverbWidth.ValueOr(pConfig->FluidSynthDefaultReverbWidth),
+			pFXProfile->nReverbLevel.ValueOr(pConfig->FluidSynthDefaultReverbLevel),
+
+			pFXProfile->bChorusActive.ValueOr(pConfig->FluidSynthDefaultChorusActive),
+			pFXProfile->nChorusVoices.ValueOr(pConfig->FluidSynthDefaultChorusVoices),
+			pFXProfile->nChorusLevel.ValueOr(pConfig->FluidSynthDefaultChorusLevel),
+			pFXProfile->nChorusSpeed.ValueOr(pConfig->FluidSynthDefaultChorusSpeed),
+			pFXProfile->nChorusDepth.ValueOr(pConfig->FluidSynthDefaultChorusDepth),
+		};
+
+		m_pEffectsPipeline->SetParameters(Parameters);
+
+		// When crossfading, the outgoing engine's effects tails carry on through the pipeline
+		if (!bCrossfade)
+			m_pEffectsPipeline->Reset();
+
+		// A resident engine may have faded out processing its own effects
+		if (m_pSynth)
+			fluid_synth_set_fx_bypass(m_pSynth, true);
+	}
 
 #ifndef NDEBUG
-	DumpFXSettings();
+	if (m_pSynth)
+		DumpFXSettings();
 #endif
 
+	// Pins the presets that a reset can select; these were loaded along with the SoundFont. Samples still sounding in the
+	// outgoing engine's voices stay loaded until those voices have finished.
+	if (m_pSampleCache)
+		m_pSampleCache->Reset(m_pSynth);
+
 	ResetMIDIMonitor();
 
-	m_Lock.Release();
+	ResumeRendering();
 
-	const unsigned int nLoadStart = CTimer::GetClockTicks();
+	// Anything still held back was checked against the outgoing engine's presets
+	if (m_nHeldMessages)
+	{
+		for (size_t i = 0; i < m_nHeldMessages; ++i)
+			m_HeldMessages[i].bChecked = false;
+
+		ReleaseHeldMessages();
+	}
+
+	if (pCutSynth)
+		RetireSynth(pCutSynth, nCutSoundFontIndex, nCutSoundFontBytes);
 
-	if (fluid_synth_sfload(m_pSynth, pSoundFontPath, true) == FLUID_FAILED)
+	if (pOldSynth && !bCrossfade)
+		RetireSynth(pOldSynth, m_nCurrentSoundFontIndex, m_nCurrentSoundFontBytes);
+}
+
+void CSoundFontSynth::MixOutgoingSynth(float* pOutBuffer, size_t nFrames)
+{
+	// Audio core; silent until retired by the main core
+	if (!m_EngineCrossfader.IsAudible(OutgoingSlot))
+		return;
+
+	size_t nDoneFrames = 0;
+
+	// Leave room for the last block coming out of the effects pipeline
+	if (m_nOutgoingDelayFrames)
 	{
-		LOGERR("Failed to load SoundFont");
-		return false;
+		nDoneFrames = Utility::Min(m_nOutgoingDelayFrames, nFrames);
+		m_nOutgoingDelayFrames -= nDoneFrames;
 	}
 
-	const float nLoadTime = (CTimer::GetClockTicks() - nLoadStart) / 1000000.0f;
-	LOGNOTE("\"%s\" loaded in %0.2f seconds", pSoundFontPath, nLoadTime);
+	while (nDoneFrames < nFrames)
+	{
+		const size_t nBlockFrames = Utility::Min(OutgoingBlockFrames, nFrames - nDoneFrames);
+		fluid_synth_write_float(m_pOutgoingSynth, nBlockFrames, m_OutgoingBuffer, 0, 2, m_OutgoingBuffer, 1, 2);
+		m_EngineCrossfader.Mix(OutgoingSlot, m_OutgoingBuffer, pOutBuffer + nDoneFrames * 2, nBlockFrames);
+		nDoneFrames += nBlockFrames;
+	}
+}
 
-	return true;
+void CSoundFontSynth::UpdateCrossfade()
+{
+	if (!m_pOutgoingSynth)
+		return;
+
+	// Carry on regardless if the audio core isn't rendering this synth (e.g. switched away from it meanwhile)
+	const unsigned int nTimeout = Utility::MillisToTicks(m_EngineCrossfader.GetFadeMillis() * 2 + 100);
+	if (m_EngineCrossfader.IsSettled(OutgoingSlot) || CTimer::GetClockTicks() - m_nOutgoingFadeStartTime >= nTimeout)
+		RetireOutgoingSynth();
+}
+
+void CSoundFontSynth::RetireOutgoingSynth()
+{
+	SuspendRendering();
+	fluid_synth_t* const pSynth = m_pOutgoingSynth;
+	m_pOutgoingSynth = nullptr;
+	ResumeRendering();
+
+	RetireSynth(pSynth, m_nOutgoingSoundFontIndex, m_nOutgoingSoundFontBytes);
+}
+
+void CSoundFontSynth::RetireSynth(fluid_synth_t* pSynth, size_t nSoundFontIndex, size_t nBytes)
+{
+	// Keep the outgoing SoundFont loaded so that switching back to it is instant; it's reset so that it comes back in
+	// its initial state, and so that any samples loaded on demand for it are released
+	const char* pSoundFontPath = m_SoundFontManager.GetSoundFontPath(nSoundFontIndex);
+	if (m_SoundFontCache.IsEnabled() && pSoundFontPath)
+	{
+		fluid_synth_system_reset(pSynth);
+		m_SoundFontCache.Add(pSynth, pSoundFontPath, nBytes);
+		return;
+	}
+
+	// Its mixer thread is joined through the core executor, which is only driven from here
+	if (m_pMixerThreadCore)
+	{
+		delete_fluid_synth(pSynth);
+		return;
+	}
+
+	// Freeing a whole SoundFont takes a while; do it on whichever core has time
+	CJobSystem* const pJobSystem = CJobSystem::Get();
+	pJobSystem->Wait(0, m_DeleteCounter);
+	m_pDeletingSynth = pSynth;
+	pJobSystem->Submit(0, m_DeleteJob);
+}
+
+void CSoundFontSynth::DeleteSynthJob(void* pParam)
+{
+	CSoundFontSynth* const pThis = static_cast<CSoundFontSynth*>(pParam);
+	delete_fluid_synth(pThis->m_pDeletingSynth);
+	pThis->m_pDeletingSynth = nullptr;
+}
+
+void CSoundFontSynth::ProcessCommand(const TCommand& Command)
+{
+	switch (Command.Type)
+	{
+		case TCommandType::ShortMessage:
+			PlayMIDIShortMessage(Command.nMessage);
+			break;
+
+		case TCommandType::SysExMessage:
+			// Exclude leading 0xF0 and trailing 0xF7
+			fluid_synth_sysex(m_pSynth, reinterpret_cast<const char*>(Command.SysEx.pData + 1), Command.SysEx.nSize - 2, nullptr, nullptr, nullptr, false);
+			break;
+
+		case TCommandType::AllSoundOff:
+			fluid_synth_all_sounds_off(m_pSynth, -1);
+			break;
+
+		default:
+			break;
+	}
+}
+
+void CSoundFontSynth::ApplyControl(TControl Control, u8 nValue)
+{
+	if (Control == TControl::MasterVolume)
+		fluid_synth_set_gain(m_pSynth, nValue / 100.0f * m_nInitialGain);
+}
+
+void CSoundFontSynth::PlayMIDIShortMessage(u32 nMessage)
+{
+	const u8 nStatus  = nMessage & 0xFF;
+	const u8 nChannel = nMessage & 0x0F;
+	const u8 nData1   = (nMessage >> 8) & 0xFF;
+	const u8 nData2   = (nMessage >> 16) & 0xFF;
+
+	// Handle system real-time messages
+	if (nStatus == 0xFF)
+	{
+		fluid_synth_system_reset(m_pSynth);
+		return;
+	}
+
+	// Handle channel messages
+	switch (nStatus & 0xF0)
+	{
+		// Note off
+		case 0x80:
+			fluid_synth_noteoff(m_pSynth, nChannel, nData1);
+			break;
+
+		// Note on
+		case 0x90:
+			fluid_synth_noteon(m_pSynth, nChannel, nData1, nData2);
+			break;
+
+		// Polyphonic key pressure/aftertouch
+		case 0xA0:
+			fluid_synth_key_pressure(m_pSynth, nChannel, nData1, nData2);
+			break;
+
+		// Control change
+		case 0xB0:
+			fluid_synth_cc(m_pSynth, nChannel, nData1, nData2);
+			break;
+
+		// Program change
+		case 0xC0:
+			fluid_synth_program_change(m_pSynth, nChannel, nData1);
+			break;
+
+		// Channel pressure/aftertouch
+		case 0xD0:
+			fluid_synth_channel_pressure(m_pSynth, nChannel, nData1);
+			break;
+
+		// Pitch bend
+		case 0xE0:
+			fluid_synth_pitch_bend(m_pSynth, nChannel, (nData2 << 7) | nData1);
+			break;
+	}
 }
 
 void CSoundFontSynth::ResetMIDIMonitor()
@@ -440,6 +1511,9 @@ void CSoundFontSynth::ResetMIDIMonitor()
 	m_MIDIMonitor.AllNotesOff();
 	m_MIDIMonitor.ResetControllers(false);
 	m_nPercussionMask = 1 << 9;
+
+	if (m_pSampleCache)
+		m_pSampleCache->ResetPrograms();
 }
 
 #ifndef NDEBUG
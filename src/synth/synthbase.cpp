@@ -0,0 +1,210 @@
+//
+// synthbase.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <circle/logger.h>
+#include <circle/timer.h>
+
+#include "synth/synthbase.h"
+
+LOGMODULE("synthbase");
+
+void CSynthBase::HandleMIDIShortMessage(u32 nMessage, unsigned int nTimestamp)
+{
+	TCommand Command;
+	Command.Type = TCommandType::ShortMessage;
+	Command.nTimestamp = nTimestamp;
+	Command.nMessage = nMessage;
+
+	// Defer to the audio core so that the message can be placed at the correct frame within the next block
+	Enqueue(Command);
+
+	// Update MIDI monitor
+	m_MIDIMonitor.OnShortMessage(nMessage);
+}
+
+void CSynthBase::HandleMIDISysExMessage(const u8* pData, size_t nSize, unsigned int nTimestamp)
+{
+	const size_t nUsed = m_nSysExBytesWritten - m_nSysExBytesReleased.load(std::memory_order_acquire);
+	const size_t nWritePos = m_nSysExBytesWritten % SysExBufferSize;
+
+	// Payloads are stored contiguously; skip the tail of the buffer if there isn't enough room
+	const size_t nPadding = nSize > SysExBufferSize - nWritePos ? SysExBufferSize - nWritePos : 0;
+	const size_t nBufferSize = nPadding + nSize;
+
+	if (nUsed + nBufferSize > SysExBufferSize)
+	{
+		LOGERR("SysEx buffer overflow");
+		return;
+	}
+
+	u8* const pBufferData = m_SysExBuffer + (nWritePos + nPadding) % SysExBufferSize;
+	memcpy(pBufferData, pData, nSize);
+
+	TCommand Command;
+	Command.Type = TCommandType::SysExMessage;
+	Command.nTimestamp = nTimestamp;
+	Command.SysEx.pData = pBufferData;
+	Command.SysEx.nSize = nSize;
+	Command.SysEx.nBufferSize = nBufferSize;
+
+	if (!Enqueue(Command))
+		return;
+
+	m_nSysExBytesWritten += nBufferSize;
+}
+
+void CSynthBase::AllSoundOff()
+{
+	// Synths that aren't being rendered get one after every fade; don't let them fill up the queue
+	const bool bRedundant = m_bAllSoundOffPending.load(std::memory_order_acquire) && m_nEnqueuedCommands == m_nAllSoundOffCommand;
+	if (!bRedundant && EnqueueCommand(TCommandType::AllSoundOff))
+	{
+		m_bAllSoundOffPending.store(true, std::memory_order_relaxed);
+		m_nAllSoundOffCommand = m_nEnqueuedCommands;
+	}
+
+	// Reset MIDI monitor
+	m_MIDIMonitor.AllNotesOff();
+}
+
+void CSynthBase::SetMasterVolume(u8 nVolume)
+{
+	SetControl(TControl::MasterVolume, nVolume);
+}
+
+bool CSynthBase::EnqueueCommand(TCommandType Type)
+{
+	TCommand Command;
+	Command.Type = Type;
+	Command.nTimestamp = CTimer::GetClockTicks();
+
+	return Enqueue(Command);
+}
+
+void CSynthBase::SetControl(TControl Control, u8 nValue)
+{
+	// Replaces any value the audio core hasn't picked up yet
+	m_PendingControls[static_cast<size_t>(Control)].store(nValue, std::memory_order_release);
+}
+
+bool CSynthBase::Enqueue(const TCommand& Command)
+{
+	if (!m_CommandQueue.Enqueue(Command))
+	{
+		LOGERR("Command queue overflow");
+		return false;
+	}
+
+	++m_nEnqueuedCommands;
+	return true;
+}
+
+void CSynthBase::SuspendRendering()
+{
+	// Wait for any block in progress to finish; subsequent blocks will be silent until resumed
+	m_bSuspended.store(true);
+	while (m_bRendering.load())
+		;
+}
+
+void CSynthBase::ResumeRendering()
+{
+	m_bSuspended.store(false);
+}
+
+bool CSynthBase::BeginRender()
+{
+	m_bRendering.store(true);
+	if (m_bSuspended.load())
+	{
+		m_bRendering.store(false, std::memory_order_release);
+		return false;
+	}
+
+	m_nLastRenderTime = m_nRenderTime;
+	m_nRenderTime = CTimer::GetClockTicks();
+	return true;
+}
+
+void CSynthBase::EndRender(bool bActive)
+{
+	m_bActive.store(bActive, std::memory_order_relaxed);
+
+	// Release the last SysEx payload so that the producer doesn't have to wait for the next block
+	if (m_nSysExBytesToRelease)
+	{
+		m_nSysExBytesReleased.fetch_add(m_nSysExBytesToRelease, std::memory_order_release);
+		m_nSysExBytesToRelease = 0;
+	}
+
+	m_bRendering.store(false, std::memory_order_release);
+}
+
+void CSynthBase::ApplyControls()
+{
+	for (size_t i = 0; i < static_cast<size_t>(TControl::Count); ++i)
+	{
+		// Plain load first; most blocks have nothing to apply
+		if (m_PendingControls[i].load(std::memory_order_relaxed) == NoControlValue)
+			continue;
+
+		const s16 nValue = m_PendingControls[i].exchange(NoControlValue, std::memory_order_acquire);
+		if (nValue != NoControlValue)
+			ApplyControl(static_cast<TControl>(i), nValue);
+	}
+}
+
+bool CSynthBase::DequeueCommand(TCommand& OutCommand)
+{
+	// SysEx data from the previously dequeued command is no longer referenced
+	if (m_nSysExBytesToRelease)
+	{
+		m_nSysExBytesReleased.fetch_add(m_nSysExBytesToRelease, std::memory_order_release);
+		m_nSysExBytesToRelease = 0;
+	}
+
+	if (!m_CommandQueue.Dequeue(OutCommand))
+		return false;
+
+	if (OutCommand.Type == TCommandType::SysExMessage)
+		m_nSysExBytesToRelease = OutCommand.SysEx.nBufferSize;
+	else if (OutCommand.Type == TCommandType::AllSoundOff)
+		m_bAllSoundOffPending.store(false, std::memory_order_release);
+
+	return true;
+}
+
+size_t CSynthBase::GetFrameOffset(unsigned int nTimestamp, size_t nFrames) const
+{
+	// Events received during the previous render period are played back with the same relative timing within
+	// this block; this adds a constant latency of one block, but removes the jitter of quantizing to block boundaries
+	const unsigned int nPeriod = m_nRenderTime - m_nLastRenderTime;
+	const int nDelta = static_cast<int>(nTimestamp - m_nLastRenderTime);
+
+	if (nDelta <= 0 || nPeriod == 0)
+		return 0;
+
+	if (static_cast<unsigned int>(nDelta) >= nPeriod)
+		return nFrames;
+
+	return static_cast<u64>(nDelta) * nFrames / nPeriod;
+}
@@ -39,17 +39,32 @@ CZoneAllocator* CZoneAllocator::s_pThis = nullptr;
 CZoneAllocator::CZoneAllocator()
 	: m_pHeap(nullptr),
 	  m_nHeapSize(0),
+	  m_bSubZone(false),
 	  m_pCurrentBlock(nullptr),
-	  m_nAllocCount(0)
+	  m_nAllocCount(0),
+	  m_nTagBytes{0}
 {
 	assert(s_pThis == nullptr);
 	s_pThis = this;
 }
 
+CZoneAllocator::CZoneAllocator(void* pHeap, size_t nHeapSize)
+	: m_pHeap(pHeap),
+	  m_nHeapSize(nHeapSize & ~0xF),
+	  m_bSubZone(true),
+	  m_pCurrentBlock(nullptr),
+	  m_nAllocCount(0),
+	  m_nTagBytes{0}
+{
+	assert((reinterpret_cast<uintptr>(pHeap) & 0xF) == 0);
+	Clear();
+}
+
 CZoneAllocator::~CZoneAllocator()
 {
 	// Release the entire heap
-	CMemorySystem::Get()->HeapFree(m_pHeap);
+	if (!m_bSubZone)
+		CMemorySystem::Get()->HeapFree(m_pHeap);
 }
 
 bool CZoneAllocator::Initialize()
@@ -108,9 +123,9 @@ void* CZoneAllocator::Alloc(size_t nSize, TZoneTag Tag)
 	if (!nSize)
 		return nullptr;
 
-	if (Tag == TZoneTag::Free)
+	if (Tag == TZoneTag::Free || Tag >= TZoneTag::TagCount)
 	{
-		LOGERR("Zone allocation failed: tag value of 0 was used");
+		LOGERR("Zone allocation failed: invalid tag value %d", Tag);
 		return nullptr;
 	}
 
@@ -126,7 +141,9 @@ void* CZoneAllocator::Alloc(size_t nSize, TZoneTag Tag)
 		// We've been through the whole linked list and couldn't find a free block
 		if (pNextBlock == pStartBlock)
 		{
-			LOGERR("Zone allocation failed: couldn't allocate %d bytes", nSize);
+			// Users of a sub-zone fall back to the main zone once it fills up
+			if (!m_bSubZone)
+				LOGERR("Zone allocation failed: couldn't allocate %d bytes", nSize);
 			return nullptr;
 		}
 
@@ -160,6 +177,7 @@ void* CZoneAllocator::Alloc(size_t nSize, TZoneTag Tag)
 	// Mark block used
 	pCandidateBlock->Tag    = Tag;
 	pCandidateBlock->nMagic = BlockMagic;
+	m_nTagBytes[Tag] += pCandidateBlock->nSize;
 
 	// Mark end of memory with magic number
 	GetEndMagic(pCandidateBlock) = BlockMagic;
@@ -190,9 +208,9 @@ void* CZoneAllocator::Realloc(void* pPtr, size_t nSize, TZoneTag Tag)
 	const size_t nNewSize = (nSize + sizeof(TBlock) + sizeof(BlockMagic) + 0xF) & ~0xF;
 	TBlock* pBlock        = reinterpret_cast<TBlock*>(pPtr) - 1;
 
-	if (Tag == TZoneTag::Free)
+	if (Tag == TZoneTag::Free || Tag >= TZoneTag::TagCount)
 	{
-		LOGERR("Zone reallocation failed: tag value of 0 was used");
+		LOGERR("Zone reallocation failed: invalid tag value %d", Tag);
 		return nullptr;
 	}
 
@@ -227,6 +245,9 @@ void* CZoneAllocator::Realloc(void* pPtr, size_t nSize, TZoneTag Tag)
 			if (pBlock->pNext == m_pCurrentBlock)
 				m_pCurrentBlock = pNewBlock;
 
+			m_nTagBytes[pBlock->Tag] -= pBlock->nSize;
+			m_nTagBytes[Tag] += nNewSize;
+
 			pBlock->nSize       = nNewSize;
 			pBlock->pNext       = pNewBlock;
 			pBlock->Tag         = Tag;
@@ -247,7 +268,8 @@ void* CZoneAllocator::Realloc(void* pPtr, size_t nSize, TZoneTag Tag)
 
 			if (!pDest)
 			{
-				LOGERR("Zone reallocation failed");
+				if (!m_bSubZone)
+					LOGERR("Zone reallocation failed");
 				return nullptr;
 			}
 
@@ -265,6 +287,8 @@ void* CZoneAllocator::Realloc(void* pPtr, size_t nSize, TZoneTag Tag)
 	// Shrink in-place
 	if (nNewSize < pBlock->nSize)
 	{
+		m_nTagBytes[pBlock->Tag] -= pBlock->nSize;
+
 		const size_t nRemain = pBlock->nSize - nNewSize;
 		if (nRemain > MinFragmentSize)
 		{
@@ -308,6 +332,7 @@ void* CZoneAllocator::Realloc(void* pPtr, size_t nSize, TZoneTag Tag)
 
 		pBlock->nSize = nNewSize;
 		pBlock->Tag   = Tag;
+		m_nTagBytes[Tag] += pBlock->nSize;
 
 		// Mark end of memory with magic number
 		GetEndMagic(pBlock) = BlockMagic;
@@ -316,6 +341,8 @@ void* CZoneAllocator::Realloc(void* pPtr, size_t nSize, TZoneTag Tag)
 	}
 
 	// Size is the same, just update tag
+	m_nTagBytes[pBlock->Tag] -= pBlock->nSize;
+	m_nTagBytes[Tag] += pBlock->nSize;
 	pBlock->Tag = Tag;
 	return pPtr;
 }
@@ -340,6 +367,7 @@ void CZoneAllocator::Free(void* pPtr)
 	}
 
 	// Mark this block as free
+	m_nTagBytes[pBlock->Tag] -= pBlock->nSize;
 	pBlock->Tag = TZoneTag::Free;
 
 	// Join with previous block if previous block is also free
@@ -376,6 +404,15 @@ void CZoneAllocator::Free(void* pPtr)
 	--m_nAllocCount;
 }
 
+size_t CZoneAllocator::GetAllocSize(const void* pPtr) const
+{
+	if (!pPtr)
+		return 0;
+
+	const TBlock* pBlock = reinterpret_cast<const TBlock*>(pPtr) - 1;
+	return pBlock->nSize - sizeof(TBlock) - sizeof(BlockMagic);
+}
+
 void CZoneAllocator::Clear()
 {
 	TBlock* pFirstBlock = static_cast<TBlock*>(m_pHeap);
@@ -401,6 +438,9 @@ void CZoneAllocator::Clear()
 #endif
 
 	m_pCurrentBlock = pFirstBlock;
+
+	for (size_t& nTagBytes : m_nTagBytes)
+		nTagBytes = 0;
 }
 
 void CZoneAllocator::FreeTag(u32 Tag)
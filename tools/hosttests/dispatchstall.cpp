@@ -0,0 +1,215 @@
+//
+// dispatchstall.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+// Host benchmark for MIDI dispatch stalls between the main core and the audio core. A producer thread stands in for
+// core 0, dispatching MIDI messages at a steady rate, while a consumer thread stands in for the audio core, rendering
+// blocks that take a varying (and occasionally very long) time. Each dispatch is timed:
+//
+//  - before: a spin lock shared with the renderer, which holds it for the whole block (the old CSynthBase::m_Lock)
+//  - after:  CSPSCQueue, drained by the renderer at the start of each block (CSynthBase's command queue)
+//
+// Usage: dispatchstall [seconds per run]
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "spscqueue.h"
+
+namespace
+{
+	using TClock = std::chrono::steady_clock;
+
+	// 256 frames at 48kHz; most blocks take a fraction of that, but a heavy one can take several times as long
+	constexpr auto BlockPeriod = std::chrono::microseconds(5333);
+	constexpr auto MessagePeriod = std::chrono::microseconds(320);
+
+	struct TCommand
+	{
+		uint32_t nMessage;
+		uint32_t nTimestamp;
+	};
+
+	struct TResult
+	{
+		double nMeanMicros;
+		double nP999Micros;
+		double nWorstMicros;
+		size_t nMessages;
+	};
+
+	void BusyWait(std::chrono::nanoseconds Duration)
+	{
+		const auto End = TClock::now() + Duration;
+		while (TClock::now() < End)
+			;
+	}
+
+	// Render times: mostly 0.5-3ms, with one block in 50 taking 8-20ms (e.g. a SoundFont with many voices starting)
+	std::chrono::nanoseconds RenderTime(std::mt19937& Random)
+	{
+		std::uniform_int_distribution<int> Heavy(0, 49);
+		if (Heavy(Random) == 0)
+			return std::chrono::microseconds(std::uniform_int_distribution<int>(8000, 20000)(Random));
+
+		return std::chrono::microseconds(std::uniform_int_distribution<int>(500, 3000)(Random));
+	}
+
+	class CSpinLock
+	{
+	public:
+		void Acquire()
+		{
+			while (m_bLocked.test_and_set(std::memory_order_acquire))
+				;
+		}
+
+		void Release() { m_bLocked.clear(std::memory_order_release); }
+
+	private:
+		std::atomic_flag m_bLocked = ATOMIC_FLAG_INIT;
+	};
+
+	template <class TDispatch, class TRender>
+	TResult Run(std::chrono::seconds Duration, TDispatch Dispatch, TRender Render)
+	{
+		std::atomic<bool> bRunning{true};
+
+		std::thread AudioThread([&]()
+		{
+			std::mt19937 Random(1234);
+			auto NextBlock = TClock::now();
+			while (bRunning.load(std::memory_order_relaxed))
+			{
+				Render(RenderTime(Random));
+
+				// Wait for the next DMA period, as the audio core would
+				NextBlock += BlockPeriod;
+				while (TClock::now() < NextBlock && bRunning.load(std::memory_order_relaxed))
+					;
+				NextBlock = std::max(NextBlock, TClock::now());
+			}
+		});
+
+		std::vector<double> Stalls;
+		const auto End = TClock::now() + Duration;
+		auto NextMessage = TClock::now();
+		uint32_t nMessage = 0;
+
+		while (TClock::now() < End)
+		{
+			const auto Start = TClock::now();
+			// Alternating Note On/Note Off
+			Dispatch(TCommand{(nMessage & 1) ? 0x7F3C80u : 0x7F3C90u, nMessage});
+			++nMessage;
+			Stalls.push_back(std::chrono::duration<double, std::micro>(TClock::now() - Start).count());
+
+			NextMessage += MessagePeriod;
+			while (TClock::now() < NextMessage)
+				;
+		}
+
+		bRunning = false;
+		AudioThread.join();
+
+		std::sort(Stalls.begin(), Stalls.end());
+
+		TResult Result;
+		Result.nMessages = Stalls.size();
+		Result.nMeanMicros = 0;
+		for (double nStall : Stalls)
+			Result.nMeanMicros += nStall;
+		Result.nMeanMicros /= Stalls.size();
+		Result.nP999Micros = Stalls[Stalls.size() * 999 / 1000];
+		Result.nWorstMicros = Stalls.back();
+
+		return Result;
+	}
+
+	void Print(const char* pName, const TResult& Result)
+	{
+		printf("%-8s %8zu messages   mean %9.2f us   99.9%% %9.2f us   worst %9.2f us\n", pName, Result.nMessages,
+		       Result.nMeanMicros, Result.nP999Micros, Result.nWorstMicros);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	const std::chrono::seconds Duration(argc > 1 ? atoi(argv[1]) : 5);
+
+	if (std::thread::hardware_concurrency() < 2)
+		fprintf(stderr, "Warning: fewer than 2 hardware threads; results won't be representative\n");
+
+	// Before: the renderer holds the lock for the whole block, and each dispatch needs it
+	CSpinLock Lock;
+	volatile uint32_t nLastMessage = 0;
+	const TResult Before = Run(
+		Duration,
+		[&](const TCommand& Command)
+		{
+			Lock.Acquire();
+			nLastMessage = Command.nMessage;
+			Lock.Release();
+		},
+		[&](std::chrono::nanoseconds RenderTime)
+		{
+			Lock.Acquire();
+			BusyWait(RenderTime);
+			Lock.Release();
+		});
+
+	// After: dispatch only touches the queue; the renderer drains it before rendering without holding anything
+	static CSPSCQueue<TCommand, 512> Queue;
+	size_t nOverflows = 0;
+	const TResult After = Run(
+		Duration,
+		[&](const TCommand& Command)
+		{
+			if (!Queue.Enqueue(Command))
+				++nOverflows;
+		},
+		[&](std::chrono::nanoseconds RenderTime)
+		{
+			TCommand Command;
+			while (Queue.Dequeue(Command))
+				nLastMessage = Command.nMessage;
+			BusyWait(RenderTime);
+		});
+
+	printf("MIDI dispatch stall, one message every %lld us, render period %lld us\n",
+	       static_cast<long long>(MessagePeriod.count()), static_cast<long long>(BlockPeriod.count()));
+	Print("before", Before);
+	Print("after", After);
+
+	if (nOverflows)
+		printf("after: %zu queue overflows\n", nOverflows);
+
+	return 0;
+}
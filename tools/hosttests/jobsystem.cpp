@@ -0,0 +1,336 @@
+//
+// jobsystem.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+// Host tests for the job system (CJobSystem and CWorkStealingDeque), with threads standing in for cores:
+//
+//  - deque:    one owner pushing and popping while thieves steal; every item must be taken exactly once
+//  - last:     the owner and a thief racing for a single item
+//  - priority: a core takes Critical jobs before Background ones
+//  - overflow: jobs submitted to a full queue run inline, and still count towards their counter
+//  - join:     jobs submitted from core 0 and run on all cores, some forking and joining jobs of their own; every job
+//              must have run exactly once by the time Wait() returns
+//
+// Usage: jobsystem [rounds]
+// Returns non-zero if any test fails.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "jobsystem.h"
+#include "workstealingdeque.h"
+
+namespace
+{
+	constexpr unsigned CoreCount = CJobSystem::MaxCores;
+
+	size_t nFailures = 0;
+
+	void Check(bool bCondition, const char* pTest, const char* pMessage, size_t nRound)
+	{
+		if (bCondition)
+			return;
+
+		fprintf(stderr, "%s: round %zu: %s\n", pTest, nRound, pMessage);
+		++nFailures;
+	}
+
+	void TestDeque(size_t nRounds)
+	{
+		constexpr size_t ItemsPerRound = 20000;
+		constexpr unsigned ThiefCount = 3;
+
+		for (size_t nRound = 0; nRound < nRounds; ++nRound)
+		{
+			CWorkStealingDeque<uint32_t, 64> Deque;
+			std::unique_ptr<std::atomic<uint8_t>[]> TakenCounts(new std::atomic<uint8_t>[ItemsPerRound]());
+			std::atomic<bool> bOwnerDone{false};
+
+			auto Take = [&](uint32_t nItem) { TakenCounts[nItem].fetch_add(1, std::memory_order_relaxed); };
+
+			std::vector<std::thread> Thieves;
+			for (unsigned i = 0; i < ThiefCount; ++i)
+			{
+				Thieves.emplace_back([&]()
+				{
+					uint32_t nItem;
+					while (!bOwnerDone.load(std::memory_order_acquire) || !Deque.IsEmpty())
+					{
+						if (Deque.Steal(nItem))
+							Take(nItem);
+						else
+							std::this_thread::yield();
+					}
+				});
+			}
+
+			// Keep the deque shallow most of the time so that the owner and thieves often race for the last item
+			uint32_t nItem;
+			for (uint32_t i = 0; i < ItemsPerRound; ++i)
+			{
+				while (!Deque.Push(i))
+				{
+					if (Deque.Pop(nItem))
+						Take(nItem);
+				}
+
+				if ((i % 3) && Deque.Pop(nItem))
+					Take(nItem);
+
+				// Give the thieves a look in, even without spare hardware threads
+				if (i % 16 == 0)
+					std::this_thread::yield();
+			}
+
+			while (Deque.Pop(nItem))
+				Take(nItem);
+
+			bOwnerDone.store(true, std::memory_order_release);
+			for (std::thread& Thief : Thieves)
+				Thief.join();
+
+			size_t nLost = 0, nDuplicated = 0;
+			for (size_t i = 0; i < ItemsPerRound; ++i)
+			{
+				const uint8_t nCount = TakenCounts[i].load(std::memory_order_relaxed);
+				nLost += nCount == 0;
+				nDuplicated += nCount > 1;
+			}
+
+			Check(nLost == 0, "deque", "items lost", nRound);
+			Check(nDuplicated == 0, "deque", "items taken more than once", nRound);
+		}
+	}
+
+	// The owner pops the only item while a thief steals it; exactly one of them must get it
+	void TestLastItem(size_t nRounds)
+	{
+		constexpr uint32_t RacesPerRound = 2000;
+
+		for (size_t nRound = 0; nRound < nRounds; ++nRound)
+		{
+			CWorkStealingDeque<uint32_t, 64> Deque;
+			std::atomic<uint32_t> nRace{0};
+			std::atomic<uint32_t> nStolen{0};
+			std::atomic<bool> bThiefDone{true};
+
+			std::thread Thief([&]()
+			{
+				uint32_t nItem;
+				for (uint32_t i = 1; i <= RacesPerRound; ++i)
+				{
+					while (nRace.load(std::memory_order_acquire) != i)
+						std::this_thread::yield();
+
+					if (Deque.Steal(nItem))
+						nStolen.fetch_add(1, std::memory_order_relaxed);
+
+					bThiefDone.store(true, std::memory_order_release);
+				}
+			});
+
+			size_t nPopped = 0;
+			uint32_t nItem;
+			for (uint32_t i = 1; i <= RacesPerRound; ++i)
+			{
+				while (!bThiefDone.load(std::memory_order_acquire))
+					std::this_thread::yield();
+
+				bThiefDone.store(false, std::memory_order_relaxed);
+				Deque.Push(i);
+				nRace.store(i, std::memory_order_release);
+
+				if (Deque.Pop(nItem))
+					++nPopped;
+			}
+
+			Thief.join();
+
+			Check(nPopped + nStolen.load() == RacesPerRound, "last item", "item taken by both or neither", nRound);
+			Check(Deque.IsEmpty(), "last item", "deque not empty", nRound);
+		}
+	}
+
+	void TestPriority()
+	{
+		CJobSystem JobSystem;
+		std::vector<int> Order;
+
+		auto Record = [](void* pParam) { static_cast<std::vector<int>*>(pParam)->push_back(0); };
+		auto RecordCritical = [](void* pParam) { static_cast<std::vector<int>*>(pParam)->push_back(1); };
+
+		CJobSystem::TJob BackgroundJob{Record, &Order, nullptr};
+		CJobSystem::TJob CriticalJob{RecordCritical, &Order, nullptr};
+		JobSystem.Submit(0, BackgroundJob, CJobSystem::TPriority::Background);
+		JobSystem.Submit(0, CriticalJob, CJobSystem::TPriority::Critical);
+
+		while (JobSystem.RunOne(0))
+			;
+
+		Check(Order.size() == 2 && Order[0] == 1 && Order[1] == 0, "priority", "Background job ran before Critical job", 0);
+	}
+
+	void TestOverflow()
+	{
+		constexpr size_t JobCount = CJobSystem::QueueSize * 3;
+
+		CJobSystem JobSystem;
+		CJobSystem::CCounter Counter;
+		std::atomic<size_t> nRun{0};
+		std::vector<CJobSystem::TJob> Jobs(JobCount, CJobSystem::TJob{[](void* pParam) { static_cast<std::atomic<size_t>*>(pParam)->fetch_add(1); }, &nRun, &Counter});
+
+		for (CJobSystem::TJob& Job : Jobs)
+			JobSystem.Submit(0, Job);
+
+		Check(nRun.load() == JobCount - CJobSystem::QueueSize, "overflow", "jobs beyond the queue size didn't run inline", 0);
+
+		JobSystem.Wait(0, Counter);
+		Check(nRun.load() == JobCount && Counter.IsDone(), "overflow", "not all jobs ran", 0);
+	}
+
+	// Core that the calling thread is standing in for
+	thread_local unsigned nThisCore = 0;
+
+	struct TJoinTest
+	{
+		CJobSystem* pJobSystem;
+		std::unique_ptr<std::atomic<uint8_t>[]> RunCounts;
+		std::atomic<size_t> nForkedRun{0};
+	};
+
+	struct TJoinParam
+	{
+		TJoinTest* pTest;
+		size_t nIndex;
+	};
+
+	void ForkedJob(void* pParam)
+	{
+		static_cast<TJoinTest*>(pParam)->nForkedRun.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	// Every fourth job forks a few jobs onto the core it's running on and joins them before finishing
+	void JoinJob(void* pParam)
+	{
+		const TJoinParam& Param = *static_cast<TJoinParam*>(pParam);
+		TJoinTest& Test = *Param.pTest;
+
+		if (Param.nIndex % 4 == 0)
+		{
+			constexpr size_t ForkCount = 4;
+			CJobSystem::CCounter Counter;
+			CJobSystem::TJob Jobs[ForkCount];
+
+			for (CJobSystem::TJob& Job : Jobs)
+			{
+				Job = CJobSystem::TJob{ForkedJob, &Test, &Counter};
+				Test.pJobSystem->Submit(nThisCore, Job);
+			}
+
+			Test.pJobSystem->Wait(nThisCore, Counter);
+		}
+
+		Test.RunCounts[Param.nIndex].fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void TestJoin(size_t nRounds)
+	{
+		constexpr size_t JobsPerRound = 48;
+		constexpr size_t BatchesPerRound = 50;
+
+		CJobSystem JobSystem;
+		volatile bool bRunning = true;
+
+		std::vector<std::thread> Workers;
+		for (unsigned nCore = 1; nCore < CoreCount; ++nCore)
+		{
+			Workers.emplace_back([&JobSystem, &bRunning, nCore]()
+			{
+				nThisCore = nCore;
+				JobSystem.Run(nCore, bRunning);
+			});
+		}
+
+		for (size_t nRound = 0; nRound < nRounds; ++nRound)
+		{
+			for (size_t nBatch = 0; nBatch < BatchesPerRound; ++nBatch)
+			{
+				TJoinTest Test;
+				Test.pJobSystem = &JobSystem;
+				Test.RunCounts.reset(new std::atomic<uint8_t>[JobsPerRound]());
+
+				CJobSystem::CCounter Counter;
+				TJoinParam Params[JobsPerRound];
+				CJobSystem::TJob Jobs[JobsPerRound];
+
+				for (size_t i = 0; i < JobsPerRound; ++i)
+				{
+					Params[i] = TJoinParam{&Test, i};
+					Jobs[i] = CJobSystem::TJob{JoinJob, &Params[i], &Counter};
+					JobSystem.Submit(0, Jobs[i]);
+				}
+
+				JobSystem.Wait(0, Counter);
+
+				size_t nWrongCount = 0;
+				for (size_t i = 0; i < JobsPerRound; ++i)
+					nWrongCount += Test.RunCounts[i].load(std::memory_order_relaxed) != 1;
+
+				Check(nWrongCount == 0, "join", "Wait() returned before every job had run exactly once", nRound);
+				Check(Test.nForkedRun.load() == (JobsPerRound + 3) / 4 * 4, "join", "forked jobs missing", nRound);
+			}
+		}
+
+		bRunning = false;
+		for (std::thread& Worker : Workers)
+			Worker.join();
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	const size_t nRounds = argc > 1 ? atoi(argv[1]) : 20;
+
+	if (std::thread::hardware_concurrency() < 2)
+		fprintf(stderr, "Warning: fewer than 2 hardware threads; races will be exercised by preemption only\n");
+
+	TestDeque(nRounds);
+	TestLastItem(nRounds);
+	TestPriority();
+	TestOverflow();
+	TestJoin(nRounds);
+
+	if (nFailures)
+	{
+		printf("jobsystem: %zu failure(s)\n", nFailures);
+		return EXIT_FAILURE;
+	}
+
+	printf("jobsystem: all tests passed (%zu rounds)\n", nRounds);
+	return EXIT_SUCCESS;
+}
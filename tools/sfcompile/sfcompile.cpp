@@ -0,0 +1,140 @@
+//
+// sfcompile.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+// Offline SoundFont compiler; turns an SF2 file into a precompiled image (see soundfontimageformat.h) that mt32-pi can
+// load without parsing it. Copy the image into the same directory as the SF2 on the SD card/USB drive. SF3 SoundFonts
+// are decoded into images by mt32-pi itself (see the sf3_decode_cache option).
+//
+// Usage: sfcompile [-o <image>] <soundfont.sf2>
+
+#include <stdio.h>
+#include <string.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "synth/soundfontcompiler.h"
+
+namespace
+{
+	bool Error(const char* pPath, const char* pMessage)
+	{
+		fprintf(stderr, "%s: %s\n", pPath, pMessage);
+		return false;
+	}
+
+	bool ReadFile(const char* pPath, std::vector<uint8_t>& OutData)
+	{
+		FILE* pFile = fopen(pPath, "rb");
+		if (!pFile)
+			return Error(pPath, "couldn't open file");
+
+		fseek(pFile, 0, SEEK_END);
+		const long nSize = ftell(pFile);
+		fseek(pFile, 0, SEEK_SET);
+
+		OutData.resize(nSize > 0 ? nSize : 0);
+		const bool bRead = nSize > 0 && fread(OutData.data(), 1, OutData.size(), pFile) == OutData.size();
+		fclose(pFile);
+
+		return bRead || Error(pPath, "couldn't read file");
+	}
+
+	bool Compile(const char* pPath, const char* pImagePath)
+	{
+		const auto StartTime = std::chrono::steady_clock::now();
+
+		std::vector<uint8_t> Source;
+		if (!ReadFile(pPath, Source))
+			return false;
+
+		CSoundFontCompiler Compiler;
+		if (!Compiler.Parse(Source.data(), Source.size()))
+			return Error(pPath, Compiler.GetError());
+
+		if (Compiler.GetCompressedSampleCount())
+			return Error(pPath, "compressed (SF3) samples aren't supported; mt32-pi decodes SF3 SoundFonts itself");
+
+		const char* pFileName = strrchr(pPath, '/');
+		std::vector<uint8_t> Output(Compiler.GetImageSize());
+		Compiler.Build(Output.data(), pFileName ? pFileName + 1 : pPath);
+
+		FILE* pFile = fopen(pImagePath, "wb");
+		if (!pFile)
+			return Error(pImagePath, "couldn't create file");
+
+		const bool bWritten = fwrite(Output.data(), 1, Output.size(), pFile) == Output.size();
+		if (fclose(pFile) != 0 || !bWritten)
+		{
+			remove(pImagePath);
+			return Error(pImagePath, "couldn't write file");
+		}
+
+		TSoundFontImageHeader Header;
+		memcpy(&Header, Output.data(), sizeof(Header));
+
+		const double nSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - StartTime).count();
+		printf("%s: %u presets, %u instruments, %u zones, %u generators, %u modulators, %u samples%s\n", pPath,
+		       Header.Presets.nCount, Header.Instruments.nCount, Header.PresetZones.nCount + Header.InstrumentZones.nCount,
+		       Header.Generators.nCount, Header.Modulators.nCount, Header.Samples.nCount, Header.SampleData24.nCount ? " (24-bit)" : "");
+		printf("%s: %.1f MB written in %.2f seconds\n", pImagePath, Output.size() / 1048576.0, nSeconds);
+
+		return true;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	const char* pImagePath = nullptr;
+	std::vector<const char*> Inputs;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		if (!strcmp(argv[i], "-o") && i + 1 < argc)
+			pImagePath = argv[++i];
+		else if (argv[i][0] != '-')
+			Inputs.push_back(argv[i]);
+		else
+		{
+			Inputs.clear();
+			break;
+		}
+	}
+
+	if (Inputs.empty() || (pImagePath && Inputs.size() > 1))
+	{
+		fprintf(stderr, "Usage: %s [-o <image>] <soundfont.sf2> [<soundfont.sf2>...]\n", argv[0]);
+		fprintf(stderr, "Writes a precompiled image next to each SoundFont, named <soundfont.sf2>%s\n", SoundFontImageExtension);
+		return 1;
+	}
+
+	bool bSuccess = true;
+	for (const char* pPath : Inputs)
+	{
+		const std::string ImagePath = pImagePath ? pImagePath : std::string(pPath) + SoundFontImageExtension;
+		bSuccess &= Compile(pPath, ImagePath.c_str());
+	}
+
+	return bSuccess ? 0 : 1;
+}